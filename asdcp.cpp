@@ -9,13 +9,83 @@
 
 namespace ASDCP {
     Result_t MD_to_PCM_ADesc(ASDCP::MXF::WaveAudioDescriptor* ADescObj, ASDCP::PCM::AudioDescriptor& ADesc);
+    Result_t DecryptFrameBuffer(const ASDCP::FrameBuffer&, ASDCP::FrameBuffer&, AESDecContext*);
 }
 
 using namespace ASDCP;
 
 const ui32_t FRAME_BUFFER_SIZE = 4 * Kumu::Megabyte;
 
-Result_t read_PCM_file(asset_t *asset, av_pipeline_context_t *av_context, asdcp_on_pcm_frame_func on_frame, void *user_data) {
+// BER lengths, AssetID, sequence number and HMAC at the end of an encrypted
+// frame, the klv_intpack_size of AS_DCP_internal.h
+const ui32_t INTPACK_SIZE = MXF_BER_LENGTH + UUIDlen + MXF_BER_LENGTH + sizeof(ui64_t) + MXF_BER_LENGTH + HMAC_SIZE;
+
+// what IntegrityPack::TestValues checks, with the public HMACContext only.
+// the class itself lives in AS_DCP_internal.h which doesn't compile outside
+// of asdcplib
+static Result_t test_integrity_pack(const byte_t *buf, ui32_t length, const byte_t *asset_id, ui32_t sequence, HMACContext *HMAC) {
+    if (length < INTPACK_SIZE) {
+        return RESULT_HMACFAIL;
+    }
+    byte_t *p = (byte_t*)buf + (length - INTPACK_SIZE);
+
+    if (!Kumu::read_test_BER(&p, UUIDlen) || memcmp(p, asset_id, UUIDlen) != 0) {
+        return RESULT_HMACFAIL;
+    }
+    p += UUIDlen;
+
+    if (!Kumu::read_test_BER(&p, sizeof(ui64_t))) {
+        return RESULT_HMACFAIL;
+    }
+    ui64_t test_sequence;
+    memcpy(&test_sequence, p, sizeof(ui64_t));
+    if ((ui32_t)KM_i64_BE(test_sequence) != sequence) {
+        return RESULT_HMACFAIL;
+    }
+    p += sizeof(ui64_t);
+
+    if (!Kumu::read_test_BER(&p, HMAC_SIZE)) {
+        return RESULT_HMACFAIL;
+    }
+    HMAC->Reset();
+    HMAC->Update(buf, length - HMAC_SIZE);
+    HMAC->Finalize();
+    return HMAC->TestHMACValue(p);
+}
+
+// key with matching CryptographicKeyID first, otherwise the first key without id
+static asdcp_content_key_t* find_content_key(av_pipeline_context_t *av_context, const WriterInfo &Info) {
+    asdcp_content_key_t *fallback = 0;
+    for (linked_list_t *c = av_context->content_keys; c; c = c->next) {
+        asdcp_content_key_t *key = (asdcp_content_key_t*)c->user_data;
+        if (!key->has_key_id) {
+            if (!fallback) {
+                fallback = key;
+            }
+        } else if (memcmp(key->key_id, Info.CryptographicKeyID, UUIDlen) == 0) {
+            return key;
+        }
+    }
+    return fallback;
+}
+
+// -X copies the essence as it is, the cleartext of an encrypted track file
+// only goes to disk when that was asked for with -D. 1 if it may be decrypted
+static int may_decrypt(av_pipeline_context_t *av_context, const char *mxf_path) {
+    if (!av_context->flatten_dir) {
+        return 1;
+    }
+    if (!av_context->flatten_decrypt) {
+        fprintf(stderr, "%s is encrypted, -X writes it decrypted only with -D\n", mxf_path);
+        return 0;
+    }
+    fprintf(stderr, "warning: writing encrypted track file %s decrypted to %s\n", mxf_path, av_context->flatten_dir);
+    return 1;
+}
+
+// *stopped is set when on_frame asked to stop, the files after this one are
+// not read then
+static Result_t read_PCM_file(asset_t *asset, av_pipeline_context_t *av_context, asdcp_on_pcm_frame_func on_frame, void *user_data, int *stopped) {
     AESDecContext* Context = 0;
     HMACContext* HMAC = 0;
     AS_02::PCM::MXFReader Reader;
@@ -85,30 +155,58 @@ Result_t read_PCM_file(asset_t *asset, av_pipeline_context_t *av_context, asdcp_
     int last_frame = AS_02::MXF::CalcFramesFromDurationInSamples(asset->end_frame, *wave_descriptor, edit_rate);
     int start_frame = AS_02::MXF::CalcFramesFromDurationInSamples(asset->start_frame, *wave_descriptor, edit_rate);
 
-    /*
-    if (ASDCP_SUCCESS(result) && Options.key_flag) {
-        Context = new AESDecContext;
-        result = Context->InitKey(Options.key_value);
+    // audio frames are small, so we decrypt and verify them inline on the reader thread
+    AESDecContext DecContext;
+    HMACContext HMACCtx;
+    WriterInfo Info;
+    Reader.FillWriterInfo(Info);
 
-        if (ASDCP_SUCCESS(result) && Options.read_hmac ) {
-            WriterInfo Info;
-            Reader.FillWriterInfo(Info);
+    if (Info.EncryptedEssence) {
+        if (!may_decrypt(av_context, asset->mxf_path)) {
+            return RESULT_FAIL;
+        }
+        asdcp_content_key_t *key = find_content_key(av_context, Info);
+        if (!key) {
+            fprintf(stderr, "no content key for encrypted track file %s\n", asset->mxf_path);
+            return RESULT_FAIL;
+        }
+        result = DecContext.InitKey(key->key);
+        if (!ASDCP_SUCCESS(result)) {
+            fprintf(stderr, "error initializing content key for %s\n", asset->mxf_path);
+            return result;
+        }
+        Context = &DecContext;
 
+        if (av_context->verify_hmac) {
             if (Info.UsesHMAC) {
-                HMAC = new HMACContext;
-                result = HMAC->InitKey(Options.key_value, Info.LabelSetType);
+                result = HMACCtx.InitKey(key->key, Info.LabelSetType);
+                if (!ASDCP_SUCCESS(result)) {
+                    fprintf(stderr, "error initializing HMAC key for %s\n", asset->mxf_path);
+                    return result;
+                }
+                HMAC = &HMACCtx;
             } else {
-                fputs("File does not contain HMAC values, ignoring -m option.\n", stderr);
+                fprintf(stderr, "%s does not contain HMAC values, not verified\n", asset->mxf_path);
             }
         }
+    } else if (av_context->verify_hmac) {
+        fprintf(stderr, "%s is not encrypted, not verified\n", asset->mxf_path);
     }
-    */
 
     fprintf(stderr, "decode %s [%d, %d[\n", asset->mxf_path, start_frame, last_frame);
 
     for (unsigned int i = start_frame; i < last_frame; i++) {
         result = Reader.ReadFrame(i, FrameBuffer, Context, HMAC);
 
+        if (result == RESULT_HMACFAIL) {
+            // frame is decrypted anyway. keep going, only the first failure gets reported
+            if (!av_context->audio_integrity.failed) {
+                av_context->audio_integrity.failed = 1;
+                av_context->audio_integrity.frame = i;
+                strcpy(av_context->audio_integrity.mxf_path, asset->mxf_path);
+            }
+            result = RESULT_OK;
+        }
         if (!ASDCP_SUCCESS(result)) {
             break;
         }
@@ -120,6 +218,7 @@ Result_t read_PCM_file(asset_t *asset, av_pipeline_context_t *av_context, asdcp_
         memcpy(buf, FrameBuffer.Data(), FrameBuffer.Size());
         int err = on_frame(buf, FrameBuffer.Size(), i, user_data);
         if (err) {
+            *stopped = 1;
             break;
         }
     }
@@ -127,15 +226,21 @@ Result_t read_PCM_file(asset_t *asset, av_pipeline_context_t *av_context, asdcp_
     return result;
 }
 
-Result_t read_JP2K_file(asset_t *asset, asdcp_on_j2k_frame_func on_frame, void *user_data)
+// *stopped as with read_PCM_file
+static Result_t read_JP2K_file(asset_t *asset, av_pipeline_context_t *av_context, asdcp_on_j2k_frame_func on_frame, void *user_data, int *stopped)
 {
+    // no contexts on purpose. encrypted frames are handed out as ciphertext
+    // and decrypted in the pipeline's decrypt stage
     AESDecContext* Context = 0;
     HMACContext* HMAC = 0;
     AS_02::JP2K::MXFReader Reader;
+    asdcp_content_key_t *key = 0;
     JP2K::FrameBuffer FrameBuffer(FRAME_BUFFER_SIZE);
     ui32_t frame_count = 0;
 
-    Result_t result = Reader.OpenRead(asset->mxf_path);
+    // only the index partitions of [start_frame, end_frame[ get read, and
+    // they stay parsed for the next resource of this file, e.g. a repeat
+    Result_t result = Reader.OpenRead(asset->mxf_path, AS_02::IM_ON_DEMAND);
 
     if (ASDCP_SUCCESS(result)) {
         ASDCP::MXF::RGBAEssenceDescriptor *rgba_descriptor = 0;
@@ -170,29 +275,31 @@ Result_t read_JP2K_file(asset_t *asset, asdcp_on_j2k_frame_func on_frame, void *
         }
     }
 
-    /*
-       if (ASDCP_SUCCESS(result) && Options.key_flag)
-       {
-       Context = new AESDecContext;
-       result = Context->InitKey(Options.key_value);
-
-       if ( ASDCP_SUCCESS(result) && Options.read_hmac )
-       {
-       WriterInfo Info;
-       Reader.FillWriterInfo(Info);
-
-       if ( Info.UsesHMAC )
-       {
-       HMAC = new HMACContext;
-       result = HMAC->InitKey(Options.key_value, Info.LabelSetType);
-       }
-       else
-       {
-       fputs("File does not contain HMAC values, ignoring -m option.\n", stderr);
-       }
-       }
-       }
-       */
+    WriterInfo Info;
+    int verify_hmac = 0;
+    if (ASDCP_SUCCESS(result)) {
+        Reader.FillWriterInfo(Info);
+
+        if (Info.EncryptedEssence) {
+            if (!may_decrypt(av_context, asset->mxf_path)) {
+                return RESULT_FAIL;
+            }
+            key = find_content_key(av_context, Info);
+            if (!key) {
+                fprintf(stderr, "no content key for encrypted track file %s\n", asset->mxf_path);
+                return RESULT_FAIL;
+            }
+            if (av_context->verify_hmac) {
+                if (Info.UsesHMAC) {
+                    verify_hmac = 1;
+                } else {
+                    fprintf(stderr, "%s does not contain HMAC values, not verified\n", asset->mxf_path);
+                }
+            }
+        } else if (av_context->verify_hmac) {
+            fprintf(stderr, "%s is not encrypted, not verified\n", asset->mxf_path);
+        }
+    }
 
     unsigned int start_frame = asset->start_frame;
     unsigned int last_frame = asset->end_frame;
@@ -202,10 +309,24 @@ Result_t read_JP2K_file(asset_t *asset, asdcp_on_j2k_frame_func on_frame, void *
         result = Reader.ReadFrame(i, FrameBuffer, Context, HMAC);
 
         if (ASDCP_SUCCESS(result)) {
+            asdcp_encrypted_frame_t *encrypted = NULL;
+            if (key) {
+                encrypted = (asdcp_encrypted_frame_t*)malloc(sizeof(asdcp_encrypted_frame_t));
+                encrypted->source_length = FrameBuffer.SourceLength();
+                encrypted->plaintext_offset = FrameBuffer.PlaintextOffset();
+                memcpy(encrypted->key, key->key, sizeof(encrypted->key));
+                encrypted->verify_hmac = verify_hmac;
+                encrypted->label_set_type = Info.LabelSetType;
+                // same sequence number Read_EKLV_Packet tests against
+                encrypted->sequence_num = i + 1;
+                memcpy(encrypted->asset_uuid, Info.AssetUUID, sizeof(encrypted->asset_uuid));
+                encrypted->mxf_path = asset->mxf_path;
+            }
             unsigned char *buf = (unsigned char*)malloc(FrameBuffer.Size());
             memcpy(buf, FrameBuffer.Data(), FrameBuffer.Size());
-            int err = on_frame(buf, FrameBuffer.Size(), i, user_data);
+            int err = on_frame(buf, FrameBuffer.Size(), i, encrypted, user_data);
             if (err) {
+                *stopped = 1;
                 break;
             }
         } else {
@@ -216,9 +337,11 @@ Result_t read_JP2K_file(asset_t *asset, asdcp_on_j2k_frame_func on_frame, void *
     return result;
 }
 
-int asdcp_read_audio_files(linked_list_t *files, av_pipeline_context_t *av_context, asdcp_on_pcm_frame_func on_frame, void *user_data) { int err = 0;
+int asdcp_read_audio_files(linked_list_t *files, av_pipeline_context_t *av_context, asdcp_on_pcm_frame_func on_frame, void *user_data) {
+    int err = 0;
+    int stopped = 0;
 
-    for (linked_list_t *c = files; !err && c; c = c->next) {
+    for (linked_list_t *c = files; !err && c; c = av_pipeline_next_asset(av_context, c)) {
         EssenceType_t essenceType;
         asset_t *asset = (asset_t*)c->user_data;
         Result_t result = ASDCP::EssenceType(asset->mxf_path, essenceType);
@@ -232,11 +355,14 @@ int asdcp_read_audio_files(linked_list_t *files, av_pipeline_context_t *av_conte
             err = 1;
             break;
         }
-        result = read_PCM_file(asset, av_context, on_frame, user_data);
+        result = read_PCM_file(asset, av_context, on_frame, user_data, &stopped);
         if (!ASDCP_SUCCESS(result)) {
             err = 1;
             break;
         }
+        if (stopped) {
+            break;
+        }
     }
     on_frame(NULL, 0, 0, user_data);
 
@@ -245,8 +371,9 @@ int asdcp_read_audio_files(linked_list_t *files, av_pipeline_context_t *av_conte
 
 int asdcp_read_video_files(linked_list_t *files, av_pipeline_context_t *av_context, asdcp_on_j2k_frame_func on_frame, void *user_data) {
     int err = 0;
+    int stopped = 0;
 
-    for (linked_list_t *c = files; !err && c; c = c->next) {
+    for (linked_list_t *c = files; !err && c; c = av_pipeline_next_asset(av_context, c)) {
         EssenceType_t essenceType;
         asset_t *asset = (asset_t*)c->user_data;
         Result_t result = ASDCP::EssenceType(asset->mxf_path, essenceType);
@@ -260,14 +387,225 @@ int asdcp_read_video_files(linked_list_t *files, av_pipeline_context_t *av_conte
             err = 1;
             break;
         }
-        result = read_JP2K_file(asset, on_frame, user_data);
+        result = read_JP2K_file(asset, av_context, on_frame, user_data, &stopped);
         if (!ASDCP_SUCCESS(result)) {
             err = 1;
             break;
         }
+        if (stopped) {
+            break;
+        }
     }
 
-    on_frame(NULL, 0, 0, user_data);
+    on_frame(NULL, 0, 0, NULL, user_data);
 
     return !err;
 }
+
+int asdcp_decrypt_frame(asdcp_encrypted_frame_t *encrypted, unsigned char *ct_buf, unsigned int ct_length, unsigned char **pt_buf, unsigned int *pt_length) {
+    AESDecContext Context;
+    Result_t result = Context.InitKey(encrypted->key);
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error initializing content key\n");
+        return 1;
+    }
+
+    ASDCP::FrameBuffer CtBuffer;
+    CtBuffer.SetData(ct_buf, ct_length);
+    CtBuffer.Size(ct_length);
+    CtBuffer.SourceLength(encrypted->source_length);
+    CtBuffer.PlaintextOffset(encrypted->plaintext_offset);
+
+    // decrypt straight into the buffer that goes to the decoder
+    unsigned char *buf = (unsigned char*)malloc(encrypted->source_length);
+    ASDCP::FrameBuffer PtBuffer;
+    PtBuffer.SetData(buf, encrypted->source_length);
+
+    result = DecryptFrameBuffer(CtBuffer, PtBuffer, &Context);
+    if (!ASDCP_SUCCESS(result)) {
+        free(buf);
+        return 1;
+    }
+
+    *pt_buf = buf;
+    *pt_length = PtBuffer.Size();
+    return 0;
+}
+
+int asdcp_verify_frame(asdcp_encrypted_frame_t *encrypted, unsigned char *ct_buf, unsigned int ct_length) {
+    HMACContext HMAC;
+    Result_t result = HMAC.InitKey(encrypted->key, (LabelSet_t)encrypted->label_set_type);
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error initializing HMAC key\n");
+        return 1;
+    }
+
+    result = test_integrity_pack(ct_buf, ct_length, encrypted->asset_uuid, encrypted->sequence_num, &HMAC);
+
+    return !ASDCP_SUCCESS(result);
+}
+
+struct asdcp_track_reader_s {
+    enum asset_type asset_type;
+    AS_02::JP2K::MXFReader VideoReader;
+    AS_02::PCM::MXFReader AudioReader;
+    JP2K::FrameBuffer VideoBuffer;
+    PCM::FrameBuffer AudioBuffer;
+    // set for encrypted track files, frames come out decrypted
+    AESDecContext DecContext;
+    HMACContext HMACCtx;
+    AESDecContext *Context;
+    HMACContext *HMAC;
+    av_pipeline_context_t *av_context;
+    std::string mxf_path;
+    // PCM samples in each frame read, 0 for video
+    unsigned int samples_per_frame;
+
+    asdcp_track_reader_s() : VideoBuffer(FRAME_BUFFER_SIZE), Context(0), HMAC(0), av_context(0), samples_per_frame(0) {}
+};
+
+// decryption and HMAC contexts of the reader, as read_PCM_file sets them up
+static Result_t init_track_reader_keys(asdcp_track_reader_t *reader, const WriterInfo &Info) {
+    av_pipeline_context_t *av_context = reader->av_context;
+    const char *mxf_path = reader->mxf_path.c_str();
+
+    if (!Info.EncryptedEssence) {
+        if (av_context->verify_hmac) {
+            fprintf(stderr, "%s is not encrypted, not verified\n", mxf_path);
+        }
+        return RESULT_OK;
+    }
+    asdcp_content_key_t *key = find_content_key(av_context, Info);
+    if (!key) {
+        fprintf(stderr, "no content key for encrypted track file %s\n", mxf_path);
+        return RESULT_FAIL;
+    }
+    Result_t result = reader->DecContext.InitKey(key->key);
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error initializing content key for %s\n", mxf_path);
+        return result;
+    }
+    reader->Context = &reader->DecContext;
+
+    if (av_context->verify_hmac) {
+        if (!Info.UsesHMAC) {
+            fprintf(stderr, "%s does not contain HMAC values, not verified\n", mxf_path);
+            return RESULT_OK;
+        }
+        result = reader->HMACCtx.InitKey(key->key, Info.LabelSetType);
+        if (!ASDCP_SUCCESS(result)) {
+            fprintf(stderr, "error initializing HMAC key for %s\n", mxf_path);
+            return result;
+        }
+        reader->HMAC = &reader->HMACCtx;
+    }
+    return RESULT_OK;
+}
+
+static Result_t open_PCM_track_reader(asdcp_track_reader_t *reader, asset_t *asset, unsigned int *start_frame, unsigned int *end_frame) {
+    Rational edit_rate = Rational(
+            reader->av_context->cpl->edit_rate.num,
+            reader->av_context->cpl->edit_rate.denom);
+
+    Result_t result = reader->AudioReader.OpenRead(asset->mxf_path, edit_rate);
+    if (!KM_SUCCESS(result)) {
+        fprintf(stderr, "error opening %s\n", asset->mxf_path);
+        return result;
+    }
+
+    ASDCP::MXF::InterchangeObject* tmp_obj = 0;
+    result = reader->AudioReader.OP1aHeader().GetMDObjectByType(DefaultCompositeDict().ul(MDD_WaveAudioDescriptor), &tmp_obj);
+    ASDCP::MXF::WaveAudioDescriptor *wave_descriptor = dynamic_cast<ASDCP::MXF::WaveAudioDescriptor*>(tmp_obj);
+    if (!KM_SUCCESS(result) || wave_descriptor == 0) {
+        fprintf(stderr, "File does not contain an essence descriptor.\n");
+        return RESULT_FAIL;
+    }
+
+    reader->AudioBuffer.Capacity(AS_02::MXF::CalcFrameBufferSize(*wave_descriptor, edit_rate));
+    reader->samples_per_frame = AS_02::MXF::CalcSamplesPerFrame(*wave_descriptor, edit_rate);
+    *start_frame = AS_02::MXF::CalcFramesFromDurationInSamples(asset->start_frame, *wave_descriptor, edit_rate);
+    *end_frame = AS_02::MXF::CalcFramesFromDurationInSamples(asset->end_frame, *wave_descriptor, edit_rate);
+    return RESULT_OK;
+}
+
+asdcp_track_reader_t *asdcp_open_track_reader(asset_t *asset, av_pipeline_context_t *av_context, unsigned int *start_frame, unsigned int *end_frame) {
+    asdcp_track_reader_t *reader = new asdcp_track_reader_t;
+    reader->asset_type = asset->asset_type;
+    reader->av_context = av_context;
+    reader->mxf_path = asset->mxf_path;
+
+    Result_t result = RESULT_OK;
+    WriterInfo Info;
+    if (asset->asset_type == ASSET_TYPE_AUDIO) {
+        result = open_PCM_track_reader(reader, asset, start_frame, end_frame);
+        if (ASDCP_SUCCESS(result)) {
+            reader->AudioReader.FillWriterInfo(Info);
+        }
+    } else {
+        // index partitions get read as frames of them are asked for, see
+        // read_JP2K_file
+        result = reader->VideoReader.OpenRead(asset->mxf_path, AS_02::IM_ON_DEMAND);
+        if (ASDCP_SUCCESS(result)) {
+            reader->VideoReader.FillWriterInfo(Info);
+            *start_frame = asset->start_frame;
+            *end_frame = asset->end_frame;
+        } else {
+            fprintf(stderr, "error opening %s\n", asset->mxf_path);
+        }
+    }
+    if (ASDCP_SUCCESS(result)) {
+        result = init_track_reader_keys(reader, Info);
+    }
+
+    if (!ASDCP_SUCCESS(result)) {
+        delete reader;
+        return NULL;
+    }
+    return reader;
+}
+
+int asdcp_read_track_frame(asdcp_track_reader_t *reader, unsigned int frame, unsigned char **buf, unsigned int *length, int *hmac_failed) {
+    ASDCP::FrameBuffer *FrameBuffer;
+    Result_t result = RESULT_OK;
+
+    if (reader->asset_type == ASSET_TYPE_AUDIO) {
+        result = reader->AudioReader.ReadFrame(frame, reader->AudioBuffer, reader->Context, reader->HMAC);
+        FrameBuffer = &reader->AudioBuffer;
+    } else {
+        result = reader->VideoReader.ReadFrame(frame, reader->VideoBuffer, reader->Context, reader->HMAC);
+        FrameBuffer = &reader->VideoBuffer;
+    }
+
+    // the frame is decrypted anyway. the caller keeps the report, readers of
+    // different track files run in parallel
+    *hmac_failed = result == RESULT_HMACFAIL;
+    if (result == RESULT_HMACFAIL) {
+        result = RESULT_OK;
+    }
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error reading frame %d of %s\n", frame, reader->mxf_path.c_str());
+        return 0;
+    }
+    // the whole buffer goes out like in read_PCM_file, what a short frame
+    // at the end leaves of it is silence
+    if (reader->asset_type == ASSET_TYPE_AUDIO && FrameBuffer->Size() != FrameBuffer->Capacity()) {
+        memset(FrameBuffer->Data() + FrameBuffer->Size(), 0, FrameBuffer->Capacity() - FrameBuffer->Size());
+        FrameBuffer->Size(FrameBuffer->Capacity());
+    }
+
+    *buf = (unsigned char*)malloc(FrameBuffer->Size());
+    if (!*buf) {
+        return 0;
+    }
+    memcpy(*buf, FrameBuffer->Data(), FrameBuffer->Size());
+    *length = FrameBuffer->Size();
+    return 1;
+}
+
+unsigned int asdcp_track_samples_per_frame(asdcp_track_reader_t *reader) {
+    return reader->samples_per_frame;
+}
+
+void asdcp_close_track_reader(asdcp_track_reader_t *reader) {
+    delete reader;
+}
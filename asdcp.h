@@ -31,13 +31,64 @@ typedef struct {
     void *essence_descriptor;
 } asset_t;
 
+// content key (16 byte AES) for encrypted track files
+typedef struct {
+    // 1 if key_id is set. keys without id are used for every track file
+    int has_key_id;
+    // CryptographicKeyID of the track files this key belongs to
+    unsigned char key_id[16];
+    unsigned char key[16];
+} asdcp_content_key_t;
+
+// everything needed to decrypt an encrypted frame away from the reader
+typedef struct {
+    unsigned int source_length;
+    unsigned int plaintext_offset;
+    unsigned char key[16];
+
+    // integrity pack, only set if verification was requested and the file carries HMAC values
+    int verify_hmac;
+    int label_set_type;
+    unsigned int sequence_num;
+    unsigned char asset_uuid[16];
+    // track file the frame was read from, for reporting
+    const char *mxf_path;
+} asdcp_encrypted_frame_t;
+
 struct av_pipeline_context_s;
 
 typedef int (*asdcp_on_pcm_frame_func)(unsigned char *data, unsigned int length, unsigned int current_frame, void *user_data);
-typedef int (*asdcp_on_j2k_frame_func)(unsigned char *data, unsigned int length, unsigned int frame_count, void *user_data);
+// if encrypted is not NULL, data holds the ciphertext of the frame and must be decrypted
+// with asdcp_decrypt_frame. Callee owns data and encrypted.
+typedef int (*asdcp_on_j2k_frame_func)(unsigned char *data, unsigned int length, unsigned int frame_count, asdcp_encrypted_frame_t *encrypted, void *user_data);
 
+// on_frame returns nonzero to stop, no frame after that one gets read and it
+// is no error. on_frame gets NULL data at the end either way
 extern int asdcp_read_audio_files(linked_list_t *files, struct av_pipeline_context_s *av_context, asdcp_on_pcm_frame_func on_frame, void *user_data);
 extern int asdcp_read_video_files(linked_list_t *files, struct av_pipeline_context_s *av_context, asdcp_on_j2k_frame_func on_frame, void *user_data);
+// decrypts a frame delivered by asdcp_read_video_files. *pt_buf must be freed by caller
+extern int asdcp_decrypt_frame(asdcp_encrypted_frame_t *encrypted, unsigned char *ct_buf, unsigned int ct_length, unsigned char **pt_buf, unsigned int *pt_length);
+// checks the HMAC of the integrity pack at the end of the ciphertext. returns 0 if it matches
+extern int asdcp_verify_frame(asdcp_encrypted_frame_t *encrypted, unsigned char *ct_buf, unsigned int ct_length);
+
+// random access to the frames of one track file, the file and its index stay
+// open between reads. not thread safe, one reader per thread or a lock
+typedef struct asdcp_track_reader_s asdcp_track_reader_t;
+
+// opens the track file of asset. *start_frame and *end_frame get the frames
+// of the asset in edit units of the CPL, audio assets are counted in samples
+// in the CPL. NULL on error
+extern asdcp_track_reader_t *asdcp_open_track_reader(asset_t *asset, struct av_pipeline_context_s *av_context, unsigned int *start_frame, unsigned int *end_frame);
+// reads frame of the track file, decrypted. for audio that's one edit unit
+// of the CPL worth of PCM samples. *buf must be freed by caller. with
+// verify_hmac, *hmac_failed is set to 1 for a frame whose HMAC values don't
+// match, it is read anyway. returns 1 on success like asdcp_read_video_files
+extern int asdcp_read_track_frame(asdcp_track_reader_t *reader, unsigned int frame, unsigned char **buf, unsigned int *length, int *hmac_failed);
+// PCM samples per channel in each frame asdcp_read_track_frame returns for
+// an audio track file, rounded up at edit rates that don't divide the sample
+// rate as AS-02 does. 0 for video
+extern unsigned int asdcp_track_samples_per_frame(asdcp_track_reader_t *reader);
+extern void asdcp_close_track_reader(asdcp_track_reader_t *reader);
 
 #ifdef __cplusplus
 }
@@ -65,6 +65,15 @@ namespace AS_02
 
   KM_DECLARE_RESULT(AS02_FORMAT,        -116, "The file format is not proper OP-1a/AS-02.");
 
+  // How a reader gets at the index table segments of a file
+  enum IndexMode_t
+  {
+    IM_LOAD_ALL,  // every index partition is read and parsed when the file is opened
+    IM_ON_DEMAND, // only the RIP is used when the file is opened, an index partition is read
+                  // when a frame it covers is first looked up. Parsed partitions are shared
+                  // by all readers of the same file in the process
+  };
+
   namespace MXF {
     //
     // reads distributed index tables and provides a uniform lookup with
@@ -72,9 +81,12 @@ namespace AS_02
     // to the actual file position
     class AS02IndexReader : public ASDCP::MXF::Partition
     {
+      class h__OnDemandIndex;
+
       Kumu::ByteString m_IndexSegmentData;
       ui32_t m_Duration;
       ui32_t m_BytesPerEditUnit;
+      h__OnDemandIndex* m_OnDemand;
 
       Result_t InitFromBuffer(const byte_t* p, ui32_t l, const ui64_t& body_offset, const ui64_t& essence_container_offset);
 
@@ -89,6 +101,10 @@ namespace AS_02
       virtual ~AS02IndexReader();
     
       Result_t InitFromFile(const Kumu::FileReader& reader, const ASDCP::MXF::RIP& rip, const bool has_header_essence);
+      // IM_ON_DEMAND: index partitions are read from filename as they are needed. Falls back
+      // to InitFromFile if the RIP does not list one index partition per body partition
+      Result_t InitOnDemand(const std::string& filename, const Kumu::FileReader& reader,
+			    const ASDCP::MXF::RIP& rip, const bool has_header_essence);
       ui32_t GetDuration() const;
       void     Dump(FILE* = 0);
       Result_t GetMDObjectByID(const Kumu::UUID&, ASDCP::MXF::InterchangeObject** = 0);
@@ -207,8 +223,8 @@ namespace AS_02
       virtual ASDCP::MXF::RIP& RIP();
 
       // Open the file for reading. The file must exist. Returns error if the
-      // operation cannot be completed.
-      Result_t OpenRead(const std::string& filename) const;
+      // operation cannot be completed. See IndexMode_t for index_mode.
+      Result_t OpenRead(const std::string& filename, const IndexMode_t& index_mode = IM_LOAD_ALL) const;
 
       // Returns RESULT_INIT if the file is not open.
       Result_t Close() const;
@@ -60,15 +60,15 @@ public:
 
   virtual ~h__Reader() {}
 
-  Result_t    OpenRead(const std::string&);
+  Result_t    OpenRead(const std::string&, const IndexMode_t&);
   Result_t    ReadFrame(ui32_t, ASDCP::JP2K::FrameBuffer&, AESDecContext*, HMACContext*);
 };
 
 //
 Result_t
-AS_02::JP2K::MXFReader::h__Reader::OpenRead(const std::string& filename)
+AS_02::JP2K::MXFReader::h__Reader::OpenRead(const std::string& filename, const IndexMode_t& index_mode)
 {
-  Result_t result = OpenMXFRead(filename);
+  Result_t result = OpenMXFRead(filename, index_mode);
 
   if( KM_SUCCESS(result) )
     {
@@ -180,9 +180,9 @@ AS_02::JP2K::MXFReader::RIP()
 // Open the file for reading. The file must exist. Returns error if the
 // operation cannot be completed.
 Result_t
-AS_02::JP2K::MXFReader::OpenRead(const std::string& filename) const
+AS_02::JP2K::MXFReader::OpenRead(const std::string& filename, const IndexMode_t& index_mode) const
 {
-  return m_Reader->OpenRead(filename);
+  return m_Reader->OpenRead(filename, index_mode);
 }
 
 //
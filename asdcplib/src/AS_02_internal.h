@@ -63,7 +63,7 @@ namespace AS_02
       h__AS02Reader(const ASDCP::Dictionary&);
       virtual ~h__AS02Reader();
 
-      Result_t OpenMXFRead(const std::string& filename);
+      Result_t OpenMXFRead(const std::string& filename, const IndexMode_t& index_mode = IM_LOAD_ALL);
 
       // USE FRAME WRAPPING...
       Result_t ReadEKLVFrame(ui32_t FrameNum, ASDCP::FrameBuffer& FrameBuf,
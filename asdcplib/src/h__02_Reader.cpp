@@ -33,6 +33,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define DEFAULT_02_MD_DECL
 #include "AS_02_internal.h"
+#include <KM_mutex.h>
 
 using namespace ASDCP;
 using namespace ASDCP::MXF;
@@ -63,11 +64,555 @@ AS_02::default_md_object_init()
 //
 
     
+//---------------------------------------------------------------------------------
+// IM_ON_DEMAND
+
+// The index partitions of one file. A partition is read and parsed the first time
+// a frame it covers is looked up and is kept as long as a reader has the file open,
+// plus a few idle files after that, so that a file opened again (e.g. for every
+// repeat of a resource) finds its index already parsed.
+class AS_02::MXF::AS02IndexReader::h__OnDemandIndex
+{
+  ASDCP_NO_COPY_CONSTRUCT(h__OnDemandIndex);
+  h__OnDemandIndex();
+
+  struct IndexPartition
+  {
+    ui64_t IndexOffset; // the index partition
+    ui64_t BodyOffset;  // the body partition it indexes, 0 if there is none
+    bool   Loaded;
+    ui64_t StartPosition;
+    ui64_t Duration;    // 0 for a partition without index data
+    std::list<IndexTableSegment*> Segments;
+    // the segments point into it
+    Kumu::ByteString* SegmentData;
+
+    IndexPartition() : IndexOffset(0), BodyOffset(0), Loaded(false), StartPosition(0), Duration(0), SegmentData(0) {}
+  };
+
+  // the segments keep a reference to it
+  const ASDCP::Dictionary* m_Dict;
+  std::string        m_Filename;
+  Kumu::fsize_t      m_FileSize;
+  std::vector<RIP::PartitionPair> m_Pairs;
+  bool               m_HasHeaderEssence;
+  ui32_t             m_RefCount;
+
+  // guards everything below
+  Kumu::Mutex        m_Lock;
+  Kumu::FileReader   m_File;
+  std::vector<IndexPartition> m_Partitions;
+
+  // every file with an index in use or idle, idle ones in the order they were released
+  static Kumu::Mutex sm_IndexesLock;
+  static std::list<h__OnDemandIndex*> sm_Indexes;
+  static const ui32_t sm_MaxIdleIndexes = 8;
+
+  h__OnDemandIndex(const ASDCP::Dictionary* d, const std::string& filename, const Kumu::fsize_t& file_size) :
+    m_Dict(d), m_Filename(filename), m_FileSize(file_size), m_HasHeaderEssence(false), m_RefCount(0) {}
+
+  bool     Matches(const std::string& filename, const Kumu::fsize_t& file_size, const ASDCP::MXF::RIP& rip) const;
+  Result_t Init(const ASDCP::MXF::RIP& rip, const bool has_header_essence);
+  Result_t LoadPartition(ui32_t n, ASDCP::IPrimerLookup* lookup);
+  Result_t LoadAll(ASDCP::IPrimerLookup* lookup);
+
+public:
+  ~h__OnDemandIndex();
+
+  // the index of filename, shared with other readers of the file. RESULT_NOTIMPL if the
+  // layout of the RIP is not one index partition per body partition
+  static Result_t Acquire(const ASDCP::Dictionary*& d, const std::string& filename, const ASDCP::MXF::RIP& rip,
+			  const bool has_header_essence, h__OnDemandIndex** index);
+  static void     Release(h__OnDemandIndex* index);
+
+  // lookup is the primer of the reader, used to parse partitions read now
+  Result_t Lookup(ui32_t frame_num, IndexTableSegment::IndexEntry& Entry, ASDCP::IPrimerLookup* lookup);
+  ui32_t   GetDuration(ASDCP::IPrimerLookup* lookup);
+  // reads every partition, the segments belong to the index
+  Result_t GetSegments(std::list<InterchangeObject*>& ObjectList, ASDCP::IPrimerLookup* lookup);
+};
+
+Kumu::Mutex AS_02::MXF::AS02IndexReader::h__OnDemandIndex::sm_IndexesLock;
+std::list<AS_02::MXF::AS02IndexReader::h__OnDemandIndex*> AS_02::MXF::AS02IndexReader::h__OnDemandIndex::sm_Indexes;
+
+//
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::~h__OnDemandIndex()
+{
+  std::vector<IndexPartition>::iterator i;
+  for ( i = m_Partitions.begin(); i != m_Partitions.end(); ++i )
+    {
+      std::list<IndexTableSegment*>::iterator j;
+      for ( j = i->Segments.begin(); j != i->Segments.end(); ++j )
+	delete *j;
+
+      delete i->SegmentData;
+    }
+}
+
+//
+bool
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::Matches(const std::string& filename, const Kumu::fsize_t& file_size,
+						       const ASDCP::MXF::RIP& rip) const
+{
+  if ( filename != m_Filename || file_size != m_FileSize || rip.PairArray.size() != m_Pairs.size() )
+    return false;
+
+  RIP::const_pair_iterator i;
+  std::vector<RIP::PartitionPair>::const_iterator j = m_Pairs.begin();
+
+  for ( i = rip.PairArray.begin(); i != rip.PairArray.end(); ++i, ++j )
+    {
+      if ( i->BodySID != j->BodySID || i->ByteOffset != j->ByteOffset )
+	return false;
+    }
+
+  return true;
+}
+
+// pairs the index partitions with the body partitions the way InitFromFile does, without
+// reading any of them. AS-02 writers follow each body partition with its index partition
+Result_t
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::Init(const ASDCP::MXF::RIP& rip, const bool has_header_essence)
+{
+  std::vector<ui64_t> body_offsets, index_offsets;
+  RIP::const_pair_iterator i;
+  ui32_t first_body_sid = 0;
+
+  for ( i = rip.PairArray.begin(); i != rip.PairArray.end(); ++i )
+    {
+      m_Pairs.push_back(RIP::PartitionPair(i->BodySID, i->ByteOffset));
+
+      if ( i->BodySID == 0 )
+	{
+	  if ( i->ByteOffset != 0 )
+	    index_offsets.push_back(i->ByteOffset);
+	}
+      else
+	{
+	  if ( first_body_sid == 0 )
+	    first_body_sid = i->BodySID;
+
+	  if ( i->BodySID == first_body_sid )
+	    body_offsets.push_back(i->ByteOffset);
+	}
+    }
+
+  if ( body_offsets.empty() )
+    {
+      DefaultLogSink().Error("File has no partitions with essence data.\n");
+      return RESULT_AS02_FORMAT;
+    }
+
+  // the footer, unless it is the only place with index data
+  if ( index_offsets.size() > body_offsets.size() && index_offsets.back() == rip.PairArray.back().ByteOffset )
+    index_offsets.pop_back();
+
+  if ( index_offsets.empty() || index_offsets.size() > body_offsets.size() )
+    return Kumu::RESULT_NOTIMPL;
+
+  m_HasHeaderEssence = has_header_essence;
+  m_Partitions.resize(index_offsets.size());
+
+  for ( ui32_t n = 0; n < index_offsets.size(); ++n )
+    {
+      m_Partitions[n].IndexOffset = index_offsets[n];
+      m_Partitions[n].BodyOffset = body_offsets[n];
+    }
+
+  return RESULT_OK;
+}
+
+//
+Result_t
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::Acquire(const ASDCP::Dictionary*& d, const std::string& filename,
+						       const ASDCP::MXF::RIP& rip, const bool has_header_essence,
+						       h__OnDemandIndex** index)
+{
+  assert(index);
+  Kumu::fsize_t file_size = Kumu::FileSize(filename);
+  Kumu::AutoMutex BlockLock(sm_IndexesLock);
+
+  std::list<h__OnDemandIndex*>::iterator i = sm_Indexes.begin();
+  while ( i != sm_Indexes.end() )
+    {
+      if ( (*i)->Matches(filename, file_size, rip) )
+	{
+	  (*i)->m_RefCount++;
+	  *index = *i;
+	  return RESULT_OK;
+	}
+
+      // the file changed since, nobody gets these segments anymore
+      if ( (*i)->m_Filename == filename && (*i)->m_RefCount == 0 )
+	{
+	  delete *i;
+	  i = sm_Indexes.erase(i);
+	}
+      else
+	{
+	  ++i;
+	}
+    }
+
+  h__OnDemandIndex* tmp_index = new h__OnDemandIndex(d, filename, file_size);
+  Result_t result = tmp_index->Init(rip, has_header_essence);
+
+  if ( KM_FAILURE(result) )
+    {
+      delete tmp_index;
+      return result;
+    }
+
+  tmp_index->m_RefCount = 1;
+  sm_Indexes.push_back(tmp_index);
+  *index = tmp_index;
+  return RESULT_OK;
+}
+
+//
+void
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::Release(h__OnDemandIndex* index)
+{
+  Kumu::AutoMutex BlockLock(sm_IndexesLock);
+  assert(index->m_RefCount > 0);
+
+  if ( --index->m_RefCount > 0 )
+    return;
+
+  {
+    Kumu::AutoMutex IndexLock(index->m_Lock);
+    index->m_File.Close();
+  }
+
+  // most recently released last
+  sm_Indexes.remove(index);
+  sm_Indexes.push_back(index);
+
+  ui32_t idle_count = 0;
+  std::list<h__OnDemandIndex*>::iterator i;
+  for ( i = sm_Indexes.begin(); i != sm_Indexes.end(); ++i )
+    {
+      if ( (*i)->m_RefCount == 0 )
+	++idle_count;
+    }
+
+  for ( i = sm_Indexes.begin(); idle_count > sm_MaxIdleIndexes && i != sm_Indexes.end(); )
+    {
+      if ( (*i)->m_RefCount == 0 )
+	{
+	  delete *i;
+	  i = sm_Indexes.erase(i);
+	  --idle_count;
+	}
+      else
+	{
+	  ++i;
+	}
+    }
+}
+
+// reads partition n and the body partition pack it belongs to, m_Lock must be held
+Result_t
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::LoadPartition(ui32_t n, ASDCP::IPrimerLookup* lookup)
+{
+  assert(n < m_Partitions.size());
+  IndexPartition& this_partition = m_Partitions[n];
+
+  if ( this_partition.Loaded )
+    return RESULT_OK;
+
+  Result_t result = RESULT_OK;
+
+  if ( ! m_File.IsOpen() )
+    result = m_File.OpenRead(m_Filename);
+
+  ASDCP::MXF::Partition index_part(m_Dict);
+
+  if ( KM_SUCCESS(result) )
+    result = m_File.Seek(this_partition.IndexOffset);
+
+  if ( KM_SUCCESS(result) )
+    result = index_part.InitFromFile(m_File);
+
+  if ( KM_FAILURE(result) )
+    {
+      DefaultLogSink().Error("Error reading index partition at %llu.\n", this_partition.IndexOffset);
+      return result;
+    }
+
+  if ( index_part.IndexByteCount == 0 )
+    {
+      this_partition.Loaded = true;
+      return RESULT_OK;
+    }
+
+  assert (index_part.IndexByteCount <= 0xFFFFFFFFL);
+  ui32_t bytes_this_partition = (ui32_t)index_part.IndexByteCount;
+  ui32_t read_count = 0;
+  Kumu::mem_ptr<Kumu::ByteString> segment_data(new Kumu::ByteString);
+
+  result = segment_data->Capacity(bytes_this_partition);
+
+  if ( KM_SUCCESS(result) )
+    result = m_File.Read(segment_data->Data(), bytes_this_partition, &read_count);
+
+  if ( KM_SUCCESS(result) && read_count != bytes_this_partition )
+    {
+      DefaultLogSink().Error("Short read of index partition: got %u, expecting %u\n",
+			     read_count, bytes_this_partition);
+      return RESULT_AS02_FORMAT;
+    }
+
+  segment_data->Length(bytes_this_partition);
+
+  ASDCP::MXF::Partition body_part(m_Dict);
+
+  if ( KM_SUCCESS(result) )
+    result = m_File.Seek(this_partition.BodyOffset);
+
+  if ( KM_SUCCESS(result) )
+    result = body_part.InitFromFile(m_File);
+
+  if ( KM_FAILURE(result) )
+    return result;
+
+  ui64_t body_offset = 0;
+  ui64_t ec_offset = 0;
+
+  if ( m_HasHeaderEssence && body_part.ThisPartition == 0 )
+    {
+      body_offset = 0;
+      ec_offset = body_part.HeaderByteCount + body_part.ArchiveSize();
+    }
+  else
+    {
+      body_offset = body_part.BodyOffset;
+      ec_offset = body_part.ThisPartition + body_part.ArchiveSize();
+    }
+
+  // as AS02IndexReader::InitFromBuffer
+  std::list<IndexTableSegment*> segments;
+  const byte_t* p = segment_data->RoData();
+  const byte_t* end_p = p + bytes_this_partition;
+
+  while ( KM_SUCCESS(result) && p < end_p )
+    {
+      InterchangeObject* object = CreateObject(m_Dict, p);
+      assert(object);
+
+      object->m_Lookup = lookup;
+      result = object->InitFromBuffer(p, end_p - p);
+      // the primer belongs to the reader
+      object->m_Lookup = 0;
+      p += object->PacketLength();
+
+      IndexTableSegment *segment = dynamic_cast<IndexTableSegment*>(object);
+
+      if ( KM_SUCCESS(result) && segment != 0 )
+	{
+	  segment->RtFileOffset = ec_offset;
+	  segment->RtEntryOffset = body_offset;
+	  segments.push_back(segment);
+	}
+      else
+	{
+	  if ( KM_FAILURE(result) )
+	    DefaultLogSink().Error("Error initializing index segment packet.\n");
+
+	  delete object;
+	}
+    }
+
+  if ( KM_FAILURE(result) )
+    {
+      std::list<IndexTableSegment*>::iterator i;
+      for ( i = segments.begin(); i != segments.end(); ++i )
+	delete *i;
+
+      DefaultLogSink().Error("Failed to initialize AS02IndexReader.\n");
+      return result;
+    }
+
+  std::list<IndexTableSegment*>::iterator i;
+  for ( i = segments.begin(); i != segments.end(); ++i )
+    {
+      if ( i == segments.begin() || (ui64_t)(*i)->IndexStartPosition < this_partition.StartPosition )
+	this_partition.StartPosition = (*i)->IndexStartPosition;
+
+      this_partition.Duration += (*i)->IndexDuration;
+    }
+
+  this_partition.Segments.swap(segments);
+  this_partition.SegmentData = segment_data.get();
+  segment_data.release();
+  this_partition.Loaded = true;
+  return RESULT_OK;
+}
+
+// m_Lock must be held
+Result_t
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::LoadAll(ASDCP::IPrimerLookup* lookup)
+{
+  Result_t result = RESULT_OK;
+
+  for ( ui32_t n = 0; KM_SUCCESS(result) && n < m_Partitions.size(); ++n )
+    result = LoadPartition(n, lookup);
+
+  return result;
+}
+
+// the partitions are in edit unit order and usually of the same duration, so the first
+// guess from the duration of partition 0 mostly hits, a binary search otherwise
+Result_t
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::Lookup(ui32_t frame_num, IndexTableSegment::IndexEntry& Entry,
+						      ASDCP::IPrimerLookup* lookup)
+{
+  Kumu::AutoMutex BlockLock(m_Lock);
+  Result_t result = LoadPartition(0, lookup);
+
+  if ( KM_FAILURE(result) )
+    return result;
+
+  const IndexPartition& first = m_Partitions.front();
+
+  if ( ! first.Segments.empty() && first.Segments.front()->EditUnitByteCount > 0 ) // CBR
+    {
+      if ( m_Partitions.size() > 1 || first.Segments.size() > 1 )
+	DefaultLogSink().Error("Unexpected multiple IndexTableSegment in CBR file\n");
+
+      IndexTableSegment *segment = first.Segments.front();
+      Entry.StreamOffset = ((ui64_t)frame_num * segment->EditUnitByteCount) + segment->RtFileOffset;
+      return RESULT_OK;
+    }
+
+  i32_t lo = 0;
+  i32_t hi = (i32_t)m_Partitions.size() - 1;
+  i32_t n = 0;
+
+  if ( first.Duration > 0 && (ui64_t)frame_num >= first.StartPosition )
+    n = (i32_t)Kumu::xmin<ui64_t>((frame_num - first.StartPosition) / first.Duration, hi);
+
+  while ( lo <= hi )
+    {
+      result = LoadPartition(n, lookup);
+
+      if ( KM_FAILURE(result) )
+	return result;
+
+      const IndexPartition& this_partition = m_Partitions[n];
+
+      if ( this_partition.Duration == 0 || (ui64_t)frame_num < this_partition.StartPosition )
+	{
+	  hi = n - 1;
+	}
+      else if ( (ui64_t)frame_num >= this_partition.StartPosition + this_partition.Duration )
+	{
+	  lo = n + 1;
+	}
+      else
+	{
+	  std::list<IndexTableSegment*>::const_iterator i;
+	  for ( i = this_partition.Segments.begin(); i != this_partition.Segments.end(); ++i )
+	    {
+	      ui64_t start_pos = (*i)->IndexStartPosition;
+
+	      if ( (ui64_t)frame_num >= start_pos
+		   && (ui64_t)frame_num < (start_pos + (*i)->IndexDuration) )
+		{
+		  ui64_t tmp = frame_num - start_pos;
+		  assert(tmp <= 0xFFFFFFFFL);
+
+		  if ( tmp < (*i)->IndexEntryArray.size() )
+		    {
+		      Entry = (*i)->IndexEntryArray[(ui32_t) tmp];
+		      Entry.StreamOffset = Entry.StreamOffset - (*i)->RtEntryOffset + (*i)->RtFileOffset;
+		      return RESULT_OK;
+		    }
+		  else
+		    {
+		      DefaultLogSink().Error("Malformed index table segment, IndexDuration does not match entries.\n");
+		    }
+		}
+	    }
+
+	  break;
+	}
+
+      n = lo + (hi - lo) / 2;
+    }
+
+  return RESULT_FAIL;
+}
+
+// end of the last partition with index data
+ui32_t
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::GetDuration(ASDCP::IPrimerLookup* lookup)
+{
+  Kumu::AutoMutex BlockLock(m_Lock);
+
+  for ( i32_t n = (i32_t)m_Partitions.size() - 1; n >= 0; --n )
+    {
+      if ( KM_FAILURE(LoadPartition(n, lookup)) )
+	return 0;
+
+      if ( m_Partitions[n].Duration > 0 )
+	return (ui32_t)(m_Partitions[n].StartPosition + m_Partitions[n].Duration);
+    }
+
+  return 0;
+}
+
+//
+Result_t
+AS_02::MXF::AS02IndexReader::h__OnDemandIndex::GetSegments(std::list<InterchangeObject*>& ObjectList,
+							   ASDCP::IPrimerLookup* lookup)
+{
+  Kumu::AutoMutex BlockLock(m_Lock);
+  Result_t result = LoadAll(lookup);
+
+  std::vector<IndexPartition>::const_iterator i;
+  for ( i = m_Partitions.begin(); i != m_Partitions.end(); ++i )
+    ObjectList.insert(ObjectList.end(), i->Segments.begin(), i->Segments.end());
+
+  return result;
+}
+
+
+//---------------------------------------------------------------------------------
+//
+
 AS_02::MXF::AS02IndexReader::AS02IndexReader(const ASDCP::Dictionary*& d) :
-  m_Duration(0), m_BytesPerEditUnit(0),
+  m_Duration(0), m_BytesPerEditUnit(0), m_OnDemand(0),
   ASDCP::MXF::Partition(d), m_Dict(d) {}
 
-AS_02::MXF::AS02IndexReader::~AS02IndexReader() {}
+AS_02::MXF::AS02IndexReader::~AS02IndexReader()
+{
+  if ( m_OnDemand )
+    h__OnDemandIndex::Release(m_OnDemand);
+}
+
+//
+Result_t
+AS_02::MXF::AS02IndexReader::InitOnDemand(const std::string& filename, const Kumu::FileReader& reader,
+					  const ASDCP::MXF::RIP& rip, const bool has_header_essence)
+{
+  if ( m_OnDemand )
+    {
+      h__OnDemandIndex::Release(m_OnDemand);
+      m_OnDemand = 0;
+    }
+
+  Result_t result = h__OnDemandIndex::Acquire(m_Dict, filename, rip, has_header_essence, &m_OnDemand);
+
+  if ( result == Kumu::RESULT_NOTIMPL )
+    {
+      DefaultLogSink().Debug("Index partitions of %s are not one per body partition, reading them all.\n",
+			     filename.c_str());
+      return InitFromFile(reader, rip, has_header_essence);
+    }
+
+  return result;
+}
 
 //    
 Result_t
@@ -301,8 +846,14 @@ AS_02::MXF::AS02IndexReader::Dump(FILE* stream)
   if ( stream == 0 )
     stream = stderr;
 
-  std::list<InterchangeObject*>::iterator i = m_PacketList->m_List.begin();
-  for ( ; i != m_PacketList->m_List.end(); ++i )
+  std::list<InterchangeObject*> segments;
+  std::list<InterchangeObject*>& objects = m_OnDemand ? segments : m_PacketList->m_List;
+
+  if ( m_OnDemand )
+    m_OnDemand->GetSegments(segments, m_Lookup);
+
+  std::list<InterchangeObject*>::iterator i = objects.begin();
+  for ( ; i != objects.end(); ++i )
     (*i)->Dump(stream);
 }
 
@@ -310,6 +861,26 @@ AS_02::MXF::AS02IndexReader::Dump(FILE* stream)
 Result_t
 AS_02::MXF::AS02IndexReader::GetMDObjectByID(const UUID& object_id, InterchangeObject** Object)
 {
+  if ( m_OnDemand )
+    {
+      std::list<InterchangeObject*> segments;
+      m_OnDemand->GetSegments(segments, m_Lookup);
+
+      std::list<InterchangeObject*>::iterator i;
+      for ( i = segments.begin(); i != segments.end(); ++i )
+	{
+	  if ( (*i)->InstanceUID == object_id )
+	    {
+	      if ( Object != 0 )
+		*Object = *i;
+
+	      return RESULT_OK;
+	    }
+	}
+
+      return RESULT_FAIL;
+    }
+
   return m_PacketList->GetMDObjectByID(object_id, Object);
 }
 
@@ -322,6 +893,18 @@ AS_02::MXF::AS02IndexReader::GetMDObjectByType(const byte_t* type_id, Interchang
   if ( Object == 0 )
     Object = &TmpObject;
 
+  if ( m_OnDemand )
+    {
+      std::list<InterchangeObject*> segments;
+      GetMDObjectsByType(type_id, segments);
+
+      if ( segments.empty() )
+	return RESULT_FAIL;
+
+      *Object = segments.front();
+      return RESULT_OK;
+    }
+
   return m_PacketList->GetMDObjectByType(type_id, Object);
 }
 
@@ -329,6 +912,21 @@ AS_02::MXF::AS02IndexReader::GetMDObjectByType(const byte_t* type_id, Interchang
 Result_t
 AS_02::MXF::AS02IndexReader::GetMDObjectsByType(const byte_t* ObjectID, std::list<ASDCP::MXF::InterchangeObject*>& ObjectList)
 {
+  if ( m_OnDemand )
+    {
+      std::list<InterchangeObject*> segments;
+      m_OnDemand->GetSegments(segments, m_Lookup);
+
+      std::list<InterchangeObject*>::iterator i;
+      for ( i = segments.begin(); i != segments.end(); ++i )
+	{
+	  if ( (*i)->HasUL(ObjectID) )
+	    ObjectList.push_back(*i);
+	}
+
+      return ObjectList.empty() ? RESULT_FAIL : RESULT_OK;
+    }
+
   return m_PacketList->GetMDObjectsByType(ObjectID, ObjectList);
 }
 
@@ -337,6 +935,9 @@ AS_02::MXF::AS02IndexReader::GetMDObjectsByType(const byte_t* ObjectID, std::lis
 ui32_t
 AS_02::MXF::AS02IndexReader::GetDuration() const
 {
+  if ( m_OnDemand )
+    return m_OnDemand->GetDuration(m_Lookup);
+
   return m_Duration;
 }
 
@@ -344,6 +945,15 @@ AS_02::MXF::AS02IndexReader::GetDuration() const
 Result_t
 AS_02::MXF::AS02IndexReader::Lookup(ui32_t frame_num, ASDCP::MXF::IndexTableSegment::IndexEntry& Entry) const
 {
+  if ( m_OnDemand )
+    {
+      if ( KM_SUCCESS(m_OnDemand->Lookup(frame_num, Entry, m_Lookup)) )
+	return RESULT_OK;
+
+      DefaultLogSink().Error("AS_02::MXF::AS02IndexReader::Lookup FAILED: frame_num=%d\n", frame_num);
+      return RESULT_FAIL;
+    }
+
   std::list<InterchangeObject*>::iterator i;
   for ( i = m_PacketList->m_List.begin(); i != m_PacketList->m_List.end(); ++i )
     {
@@ -399,7 +1009,7 @@ AS_02::h__AS02Reader::~h__AS02Reader() {}
 
 // AS-DCP method of opening an MXF file for read
 Result_t
-AS_02::h__AS02Reader::OpenMXFRead(const std::string& filename)
+AS_02::h__AS02Reader::OpenMXFRead(const std::string& filename, const IndexMode_t& index_mode)
 {
   bool has_header_essence = false;
   Result_t result = ASDCP::MXF::TrackFileReader<OP1aHeader, AS_02::MXF::AS02IndexReader>::OpenMXFRead(filename);
@@ -472,7 +1082,11 @@ AS_02::h__AS02Reader::OpenMXFRead(const std::string& filename)
   if ( KM_SUCCESS(result) )
     {
       m_IndexAccess.m_Lookup = &m_HeaderPart.m_Primer;
-      result = m_IndexAccess.InitFromFile(m_File, m_RIP, has_header_essence);
+
+      if ( index_mode == IM_ON_DEMAND )
+	result = m_IndexAccess.InitOnDemand(filename, m_File, m_RIP, has_header_essence);
+      else
+	result = m_IndexAccess.InitFromFile(m_File, m_RIP, has_header_essence);
     }
 
   return result;
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assets.h"
+
+void free_asset(asset_t *asset) {
+    if (asset) {
+        if (asset->essence_descriptor) {
+            free(asset->essence_descriptor);
+        }
+        free(asset);
+    }
+}
+
+int get_audio_assets(imf_doc_t *cpl_doc, imf_doc_t *assetmap_doc, linked_list_t *first, linked_list_t *last, linked_list_t **assets, pthread_mutex_t *m) {
+    int err = 0;
+
+    for (linked_list_t *head = first; head != last && !err; head = head->next) {
+        cpl_resource_t *cpl_res = head->user_data;
+        am_chunk_t *chunk = am_get_chunk_for_resource(assetmap_doc, cpl_res);
+        if (!chunk) {
+            fprintf(stderr, "error resolving asset %s for resource %s\n", cpl_res->track_file_id, cpl_res->id);
+            err = 1;
+        } else {
+
+            cpl_wave_pcm_descriptor *wave_pcm_desc = cpl_get_wave_pcm_descriptor_for_resource(cpl_doc, cpl_res);
+            if (!wave_pcm_desc) {
+                fprintf(stderr, "error resolving essence descriptor [%s] for resource %s [%s]\n", cpl_res->source_encoding, cpl_res->id, chunk->path);
+                err = 1;
+            } else {
+                for (int i = 0; i < cpl_res->repeat_count; ++i) {
+                    asset_t* asset = (asset_t*)malloc(sizeof(asset_t));
+                    memset(asset, 0, sizeof(asset_t));
+                    asset->asset_type = ASSET_TYPE_AUDIO;
+                    // every repetition owns a copy, free_asset frees it
+                    asset->essence_descriptor = malloc(sizeof(cpl_wave_pcm_descriptor));
+                    memcpy(asset->essence_descriptor, wave_pcm_desc, sizeof(cpl_wave_pcm_descriptor));
+                    strcpy(asset->mxf_path, chunk->path);
+                    asset->start_frame = cpl_res->entry_point;
+                    asset->end_frame = cpl_res->source_duration;
+
+                    pthread_mutex_lock(m);
+                    *assets = ll_append(*assets, asset);
+                    pthread_mutex_unlock(m);
+                }
+                free(wave_pcm_desc);
+            }
+        }
+        am_free_chunk(chunk);
+    }
+
+    return err;
+}
+
+int get_video_assets(imf_doc_t *cpl_doc, imf_doc_t *assetmap_doc, linked_list_t *first, linked_list_t *last, linked_list_t **assets, pthread_mutex_t *m) {
+    int err = 0;
+
+    for (linked_list_t *head = first; head != last && !err; head = head->next) {
+        cpl_resource_t *cpl_res = head->user_data;
+        am_chunk_t *chunk = am_get_chunk_for_resource(assetmap_doc, cpl_res);
+        if (!chunk) {
+            fprintf(stderr, "error resolving asset %s for resource %s\n", cpl_res->track_file_id, cpl_res->id);
+            err = 1;
+        } else {
+            cpl_cdci_descriptor *cdci_desc = cpl_get_cdci_descriptor_for_resource(cpl_doc, cpl_res);
+            cpl_rgba_descriptor *rgba_desc = NULL;
+            if (!cdci_desc) {
+                rgba_desc = cpl_get_rgba_descriptor_for_resource(cpl_doc, cpl_res);
+            }
+            if (!cdci_desc && !rgba_desc) {
+                fprintf(stderr, "error resolving essence descriptor [%s] for resource %s [%s]\n", cpl_res->source_encoding, cpl_res->id, chunk->path);
+                err = 1;
+            } else {
+                for (int i = 0; i < cpl_res->repeat_count; ++i) {
+                    asset_t* asset = (asset_t*)malloc(sizeof(asset_t));
+                    memset(asset, 0, sizeof(asset_t));
+                    asset->asset_type = ASSET_TYPE_PICTURE;
+                    // every repetition owns a copy, free_asset frees it
+                    if (cdci_desc) {
+                        asset->picture_type = PICTURE_TYPE_CDCI;
+                        asset->essence_descriptor = malloc(sizeof(cpl_cdci_descriptor));
+                        memcpy(asset->essence_descriptor, cdci_desc, sizeof(cpl_cdci_descriptor));
+                    } else {
+                        asset->picture_type = PICTURE_TYPE_RGBA;
+                        asset->essence_descriptor = malloc(sizeof(cpl_rgba_descriptor));
+                        memcpy(asset->essence_descriptor, rgba_desc, sizeof(cpl_rgba_descriptor));
+                    }
+                    strcpy(asset->mxf_path, chunk->path);
+                    asset->start_frame = cpl_res->entry_point;
+                    asset->end_frame = cpl_res->source_duration;
+
+                    pthread_mutex_lock(m);
+                    *assets = ll_append(*assets, asset);
+                    pthread_mutex_unlock(m);
+                }
+                free(cdci_desc);
+                free(rgba_desc);
+            }
+        }
+        am_free_chunk(chunk);
+    }
+
+    return err;
+}
@@ -0,0 +1,20 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <pthread.h>
+#include "asdcp.h"
+#include "imf.h"
+#include "linked_list.h"
+
+// appends an asset_t per repetition of the audio resources from first up to
+// (excluding) last to *assets. m guards the list, the pipeline might already
+// walk it. returns 0 on success
+extern int get_audio_assets(imf_doc_t *cpl_doc, imf_doc_t *assetmap_doc, linked_list_t *first, linked_list_t *last, linked_list_t **assets, pthread_mutex_t *m);
+
+// same as get_audio_assets for picture resources
+extern int get_video_assets(imf_doc_t *cpl_doc, imf_doc_t *assetmap_doc, linked_list_t *first, linked_list_t *last, linked_list_t **assets, pthread_mutex_t *m);
+
+// free_user_data_func_t for the asset lists
+extern void free_asset(asset_t *asset);
+
+#endif
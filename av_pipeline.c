@@ -4,30 +4,71 @@
 #include <string.h>
 #include <openjpeg-2.3/openjpeg.h>
 #include <libavutil/opt.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <pthread.h>
 #include <time.h>
 #include "asdcp.h"
 #include "color.h"
+#include "pack.h"
 #include "imf.h"
 #include "linked_list.h"
 #include "av_pipeline.h"
+#include "metrics.h"
+#include "trace.h"
+#include "budget.h"
+#include "numa_place.h"
+#include "frame_pool.h"
 
 static volatile int keep_running = 1;
+// a frame could not be decoded or encoded, the output is cut short and the
+// run fails
+static volatile int video_failed = 0;
 
-pthread_mutex_t decoding_mutex;
-pthread_mutex_t vid_packet_mutex;
-pthread_mutex_t aud_packet_mutex;
+static pthread_mutex_t decoding_mutex;
+static pthread_mutex_t vid_packet_mutex;
+static pthread_mutex_t aud_packet_mutex;
+static pthread_mutex_t decrypt_mutex;
 
 typedef struct {
     // need to free later when consumed
     unsigned char *frame_buf;
     unsigned int frame_size;
     unsigned int current_frame;
+    // position in the composition
+    unsigned int timeline_frame;
+    // 0 as long as the decrypt stage didn't fill frame_buf. guarded by decoding_mutex
+    int ready;
 } decoding_queue_context_t;
 
+typedef struct {
+    // ciphertext, freed after decryption
+    unsigned char *ct_buf;
+    unsigned int ct_size;
+    asdcp_encrypted_frame_t *encrypted;
+    // slot in the decoding queue that receives the plaintext
+    decoding_queue_context_t *decoding_queue_context;
+    // position in the composition, for reporting
+    unsigned int timeline_frame;
+} decrypt_queue_context_t;
+
 static linked_list_t *decoding_queue_s = NULL;
+static linked_list_t *decrypt_queue_s = NULL;
+// video frames handed to the decoding queue so far
+static unsigned int video_frames_read = 0;
+// when the readers got control back from the last callback, for metrics
+static uint64_t video_read_resumed_ns = 0;
+static uint64_t audio_read_resumed_ns = 0;
 static linked_list_t *vid_packet_queue_s = NULL;
 static linked_list_t *aud_packet_queue_s = NULL;
+// 1 once the first video frame went to the output
+static volatile int first_frame_out = 0;
+// timeline frame whose packet goes into vid_packet_queue_s next, decode
+// workers finish frames out of order. guarded by vid_packet_mutex
+static unsigned int next_packet_frame = 0;
+// openjpeg threads shared by the decode workers, NULL with -N where every
+// worker has its own on its node
+static opj_shared_thread_pool_t decode_pool = NULL;
 
 
 // 5 MB read buf
@@ -36,30 +77,35 @@ static linked_list_t *aud_packet_queue_s = NULL;
 #define MAX_QUEUE_LEN   25
 #define QUEUE_SLEEP_MS  10
 
-void error_callback(const char *msg, void *client_data)
+static void error_callback(const char *msg, void *client_data)
 {
     (void)client_data;
     fprintf(stderr, "[ERROR] %s", msg);
 }
-void warning_callback(const char *msg, void *client_data)
+static void warning_callback(const char *msg, void *client_data)
 {
     (void)client_data;
     fprintf(stderr, "[WARNING] %s", msg);
 }
 
-void info_callback(const char *msg, void *client_data)
+static void info_callback(const char *msg, void *client_data)
 {
     (void)client_data;
     fprintf(stderr, "[INFO] %s", msg);
 }
 
-void quiet_callback(const char *msg, void *client_data)
+static void quiet_callback(const char *msg, void *client_data)
 {
     (void)msg;
     (void)client_data;
 }
 
-void block_until_queue_has_space(pthread_mutex_t *m, linked_list_t **q, int threshold, int sleep_ms) {
+// start of a measured section for metrics and trace. both use CLOCK_MONOTONIC
+static uint64_t stage_now() {
+    return trace_enabled ? trace_now() : metrics_now();
+}
+
+static void block_until_queue_has_space(pthread_mutex_t *m, linked_list_t **q, int threshold, int sleep_ms) {
     int wait = 1;
     while (keep_running && wait) {
         pthread_mutex_lock(m);
@@ -73,7 +119,7 @@ void block_until_queue_has_space(pthread_mutex_t *m, linked_list_t **q, int thre
     }
 }
 
-void push_to_queue(pthread_mutex_t *m, linked_list_t **q, void *data) {
+static void push_to_queue(pthread_mutex_t *m, linked_list_t **q, void *data) {
     pthread_mutex_lock(m);
     if (!*q) {
         *q = ll_create(data);
@@ -83,7 +129,21 @@ void push_to_queue(pthread_mutex_t *m, linked_list_t **q, void *data) {
     pthread_mutex_unlock(m);
 }
 
-linked_list_t *blocked_pop_queue(pthread_mutex_t *m, linked_list_t **q, int sleep_ms) {
+static unsigned int queue_len(pthread_mutex_t *m, linked_list_t **q) {
+    pthread_mutex_lock(m);
+    unsigned int len = ll_len(*q);
+    pthread_mutex_unlock(m);
+    return len;
+}
+
+static void sample_queue_depths(unsigned int *depths) {
+    depths[METRICS_QUEUE_DECODING] = queue_len(&decoding_mutex, &decoding_queue_s);
+    depths[METRICS_QUEUE_DECRYPT] = queue_len(&decrypt_mutex, &decrypt_queue_s);
+    depths[METRICS_QUEUE_VIDEO_PACKETS] = queue_len(&vid_packet_mutex, &vid_packet_queue_s);
+    depths[METRICS_QUEUE_AUDIO_PACKETS] = queue_len(&aud_packet_mutex, &aud_packet_queue_s);
+}
+
+static linked_list_t *blocked_pop_queue(pthread_mutex_t *m, linked_list_t **q, int sleep_ms) {
     int wait = 1;
     linked_list_t *head = NULL;
     while (keep_running && wait) {
@@ -100,7 +160,142 @@ linked_list_t *blocked_pop_queue(pthread_mutex_t *m, linked_list_t **q, int slee
     return head;
 }
 
-int encode_image_to_r210(opj_image_t *image, av_pipeline_context_t *av_context, AVPacket **pkt_ptr) 
+// takes bytes from the memory budget. only waits while there are frames in
+// the decoding queue, the decoder is what gives budget back
+static void block_until_budget_has_space(uint64_t bytes, int sleep_ms) {
+    int taken = 0;
+    while (keep_running && !(taken = budget_try_take(bytes)) &&
+            queue_len(&decoding_mutex, &decoding_queue_s)) {
+        usleep(sleep_ms);
+    }
+    if (!taken) {
+        budget_take(bytes);
+    }
+}
+
+// bytes of the decoded image, held by the decoder until packed
+static uint64_t image_size(opj_image_t *image) {
+    uint64_t size = 0;
+    for (unsigned int compno = 0; compno < image->numcomps; ++compno) {
+        size += (uint64_t)image->comps[compno].w * image->comps[compno].h * sizeof(OPJ_INT32);
+    }
+    return size;
+}
+
+linked_list_t *av_pipeline_next_asset(av_pipeline_context_t *av_context, linked_list_t *asset) {
+    linked_list_t *next = NULL;
+    int wait = 1;
+    while (keep_running && wait) {
+        pthread_mutex_lock(&av_context->assets_mutex);
+        next = asset->next;
+        wait = !next && !av_context->assets_resolved;
+        pthread_mutex_unlock(&av_context->assets_mutex);
+        if (wait) {
+            usleep(QUEUE_SLEEP_MS);
+        }
+    }
+    return next;
+}
+
+static void free_pooled_buffer(void *opaque, uint8_t *data) {
+    frame_pool_free(data);
+}
+
+// size bytes for the encoder to write to, back to the pool once the muxer
+// is done with it
+static int alloc_pooled_packet(AVPacket *pkt, int size) {
+    uint8_t *data = frame_pool_alloc(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!data) {
+        return 1;
+    }
+    pkt->buf = av_buffer_create(data, size + AV_INPUT_BUFFER_PADDING_SIZE, free_pooled_buffer, NULL, 0);
+    if (!pkt->buf) {
+        frame_pool_free(data);
+        return 1;
+    }
+    pkt->data = data;
+    pkt->size = size;
+    return 0;
+}
+
+// planes for the next frame to encode, in one buffer that goes back to the
+// pool once the encoder let go of the frame
+static int alloc_pooled_frame(AVFrame *frame) {
+    int linesizes[4];
+    int err = av_image_fill_linesizes(linesizes, frame->format, FFALIGN(frame->width, 64));
+    if (err < 0) {
+        return err;
+    }
+    int size = av_image_fill_pointers(frame->data, frame->format, frame->height, NULL, linesizes);
+    if (size < 0) {
+        return size;
+    }
+    uint8_t *data = frame_pool_alloc(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!data) {
+        return AVERROR(ENOMEM);
+    }
+    frame->buf[0] = av_buffer_create(data, size + AV_INPUT_BUFFER_PADDING_SIZE, free_pooled_buffer, NULL, 0);
+    if (!frame->buf[0]) {
+        frame_pool_free(data);
+        return AVERROR(ENOMEM);
+    }
+    av_image_fill_pointers(frame->data, frame->format, frame->height, data, linesizes);
+    memcpy(frame->linesize, linesizes, sizeof(linesizes));
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+// colour conversion and packing of a frame in horizontal strips, run on
+// decode_pool next to the code-block jobs of the frames still decoding
+typedef struct {
+    opj_job_group_t group;
+    int num_strips;
+    // of the strips being run
+    opj_image_t *image;
+    opj_image_t *rgb_image;
+    unsigned char **planes;
+    const int *linesizes;
+    // bits the components are deeper than the planes
+    int shift;
+} strip_jobs_t;
+
+static void color_strip_job(void *data, int strip) {
+    strip_jobs_t *jobs = data;
+    color_sycc_to_rgb_strip(jobs->image, jobs->rgb_image, strip, jobs->num_strips);
+}
+
+static void pack_gbrp16_strip_job(void *data, int strip) {
+    strip_jobs_t *jobs = data;
+    pack_image_gbrp16_strip(jobs->image, jobs->planes, jobs->linesizes, jobs->shift, strip, jobs->num_strips);
+}
+
+static void pack_yuv16_strip_job(void *data, int strip) {
+    strip_jobs_t *jobs = data;
+    pack_image_yuv16_strip(jobs->image, jobs->planes, jobs->linesizes, jobs->shift, strip, jobs->num_strips);
+}
+
+static int run_pack_strips(strip_jobs_t *jobs, void (*pack)(void *, int), opj_image_t *image, AVFrame *frame) {
+    // 12 bit RGB masters into r210's 10 bit planes, by the shallowest
+    // component so that none gets shifted below 0 bits
+    int depth = av_pix_fmt_desc_get(frame->format)->comp[0].depth;
+    int prec = (int)image->comps[0].prec;
+    for (unsigned int compno = 1; compno < image->numcomps && compno < 3; ++compno) {
+        prec = (int)image->comps[compno].prec < prec ? (int)image->comps[compno].prec : prec;
+    }
+    jobs->image = image;
+    jobs->planes = frame->data;
+    jobs->linesizes = frame->linesize;
+    jobs->shift = prec > depth ? prec - depth : 0;
+    if (!opj_job_group_run(jobs->group, pack, jobs, jobs->num_strips)) {
+        fprintf(stderr, "error running pack jobs\n");
+        return 1;
+    }
+    return 0;
+}
+
+// packs image into the output frame and encodes it. decoded is the frame
+// openjpeg already wrote the planes of, NULL to pack image
+static int encode_image_to_r210(opj_image_t *image, AVFrame *decoded, av_pipeline_context_t *av_context, strip_jobs_t *jobs, AVPacket **pkt_ptr) 
 {
     AVPacket *pkt = NULL;
     int err = 0;
@@ -139,52 +334,21 @@ int encode_image_to_r210(opj_image_t *image, av_pipeline_context_t *av_context,
             return 1;
         }
 
-        int comp_table[3];
-        comp_table[0] = 1;   // r->g[1]
-        comp_table[1] = 2;   // g->b[2]
-        comp_table[2] = 0;   // b->r[0]
-
-        int w = (int)image->comps[0].w;
-        int h = (int)image->comps[0].h;
-
-        union {
-            unsigned short val;
-            unsigned char vals[2];
-        } uc16;
-
-        err = 0;
-        err = av_frame_make_writable(av_context->video_stream.frame);
-        if (err) {
-            fprintf(stderr, "error av_frame_make_writeable\n");
-            goto err_and_out;
-        }
-
+        AVFrame *frame = decoded;
+        if (!frame) {
+            err = av_frame_make_writable(av_context->video_stream.frame);
+            if (err) {
+                fprintf(stderr, "error av_frame_make_writeable\n");
+                goto err_and_out;
+            }
 
-        // To-DO: check if we can use this part and directly encode to r210
-        // this way we can skip avcodec_encode_video2 below which does in a way
-        // only another loop through the frame
-        AVFrame *frame = av_context->video_stream.frame;
-        for (int i = 0; i < image->numcomps; i++) {
-            int compno = comp_table[i];
-            int mask = (1 << image->comps[compno].prec) - 1;
-            int *ptr = image->comps[compno].data;
-            for (int y = 0; y < h; y++) { // height, y
-                for (int x = 0; x < w; x++) { // width, x
-                    int curr = *ptr;
-                    if (curr > 65535) {
-                        curr = 65535;
-                    } else if (curr < 0) {
-                        curr = 0;
-                    }
-                    uc16.val = (unsigned short)(curr & mask);
-                    //fprintf(stderr, "[%d] %d", compno, frame->linesize[compno]); 
-                    //linesize = width*2
-                    int offset = 2 * (y * w + x);
-                    frame->data[i][offset] = uc16.vals[0];
-                    frame->data[i][offset + 1] = uc16.vals[1];
-
-                    ptr++;
-                }
+            // To-DO: check if we can use this part and directly encode to r210
+            // this way we can skip avcodec_encode_video2 below which does in a way
+            // only another loop through the frame
+            frame = av_context->video_stream.frame;
+            err = run_pack_strips(jobs, pack_gbrp16_strip_job, image, frame);
+            if (err) {
+                goto err_and_out;
             }
         }
 
@@ -197,6 +361,15 @@ int encode_image_to_r210(opj_image_t *image, av_pipeline_context_t *av_context,
         AVStream *st = av_context->video_stream.stream;
 
         av_init_packet(pkt);
+        if (!av_context->no_frame_pool) {
+            // the encoder fills a packet we hand it as is, otherwise it
+            // encodes into its own buffer and copies that into a new one
+            err = alloc_pooled_packet(pkt, 4 * FFALIGN(c->width, 64) * c->height);
+            if (err) {
+                fprintf(stderr, "error allocating packet\n");
+                goto err_and_out;
+            }
+        }
         int got_packet = 0;
         err = avcodec_encode_video2(c, pkt, frame, &got_packet);
         if (err) {
@@ -208,6 +381,9 @@ int encode_image_to_r210(opj_image_t *image, av_pipeline_context_t *av_context,
             fprintf(stderr, "no packet produced\n");
             goto err_and_out;
         }
+        // one frame, or the last one gets cut off in containers that go by
+        // sample durations
+        pkt->duration = 1;
         av_packet_rescale_ts(pkt, c->time_base, st->time_base);
         pkt->stream_index = st->index;
 
@@ -218,49 +394,297 @@ err_and_out:
     return err;
 }
 
-int on_jpeg2000_frame(unsigned char* frame_buf, unsigned int frame_size, unsigned int current_frame, void *user_data)
+static void queue_video_packet(AVPacket *pkt, unsigned int timeline_frame) {
+    uint64_t wait_start = stage_now();
+    block_until_queue_has_space(
+            &vid_packet_mutex,
+            &vid_packet_queue_s,
+            MAX_QUEUE_LEN,
+            QUEUE_SLEEP_MS);
+    metrics_stage_idle(METRICS_STAGE_PACK, wait_start);
+    trace_span("packet queue wait", timeline_frame, wait_start);
+
+    pthread_mutex_lock(&vid_packet_mutex);
+    if (!vid_packet_queue_s) {
+        vid_packet_queue_s = ll_create(pkt);
+    } else {
+        ll_append(vid_packet_queue_s, pkt);
+    }
+    pthread_mutex_unlock(&vid_packet_mutex);
+}
+
+// sends image to the encoder, NULL to flush it, and queues the packets it
+// has ready. frame threaded encoders hand out packets a few frames later.
+// decoded is the frame openjpeg already wrote the planes of, NULL to pack
+// image
+static int encode_image_send_receive(opj_image_t *image, AVFrame *decoded, av_pipeline_context_t *av_context, strip_jobs_t *jobs, unsigned int timeline_frame) {
+    AVCodecContext *c = av_context->video_stream.codec_context;
+    AVStream *st = av_context->video_stream.stream;
+    AVFrame *frame = NULL;
+    int err = 0;
+
+    if (decoded) {
+        frame = decoded;
+        frame->pts = av_context->video_stream.next_pts++;
+    } else if (image) {
+        frame = av_context->video_stream.frame;
+        int rgb = av_pix_fmt_desc_get(c->pix_fmt)->flags & AV_PIX_FMT_FLAG_RGB;
+        int chroma_w, chroma_h;
+        av_pix_fmt_get_chroma_sub_sample(c->pix_fmt, &chroma_w, &chroma_h);
+        if (image->numcomps < 3
+                || (int)image->comps[0].w != c->width
+                || (int)image->comps[0].h != c->height
+                || image->comps[1].dx != image->comps[0].dx << chroma_w
+                || image->comps[1].dy != image->comps[0].dy << chroma_h) {
+            fprintf(stderr, "decoded image doesn't fit %s %s\n", c->codec->name, av_get_pix_fmt_name(c->pix_fmt));
+            return 1;
+        }
+
+        // the encoder's threads hold on to the frames they were sent. the
+        // next one gets new planes instead of a copy of the old ones
+        if (!av_frame_is_writable(frame)) {
+            av_frame_unref(frame);
+            frame->format = c->pix_fmt;
+            frame->width = c->width;
+            frame->height = c->height;
+            err = av_context->no_frame_pool ? av_frame_get_buffer(frame, 0) : alloc_pooled_frame(frame);
+            if (err) {
+                fprintf(stderr, "error allocating encoding frame: %s\n", av_err2str(err));
+                return 1;
+            }
+        }
+        if (run_pack_strips(jobs, rgb ? pack_gbrp16_strip_job : pack_yuv16_strip_job, image, frame)) {
+            return 1;
+        }
+        frame->pts = av_context->video_stream.next_pts++;
+    }
+
+#if LIBAVCODEC_VERSION_MAJOR < 59
+    // avcodec_send_frame() of libavcodec 58 doesn't drain frame threads of
+    // encoders without AV_CODEC_CAP_DELAY, the frames they hold would be lost
+    int drain_compat = !frame && (c->active_thread_type & FF_THREAD_FRAME);
+#else
+    int drain_compat = 0;
+#endif
+    if (!drain_compat) {
+        err = avcodec_send_frame(c, frame);
+        if (err) {
+            fprintf(stderr, "error avcodec_send_frame: %s\n", av_err2str(err));
+            return 1;
+        }
+    }
+
+    while (keep_running) {
+        AVPacket *pkt = (AVPacket*)malloc(sizeof(AVPacket));
+        memset(pkt, 0, sizeof(AVPacket));
+        av_init_packet(pkt);
+#if LIBAVCODEC_VERSION_MAJOR < 59
+        if (drain_compat) {
+            int got_packet = 0;
+            err = avcodec_encode_video2(c, pkt, NULL, &got_packet);
+            if (!err && !got_packet) {
+                err = AVERROR_EOF;
+            }
+        } else
+#endif
+        err = avcodec_receive_packet(c, pkt);
+        if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+            free(pkt);
+            return 0;
+        }
+        if (err) {
+            fprintf(stderr, "error encoding video: %s\n", av_err2str(err));
+            free(pkt);
+            return 1;
+        }
+        pkt->duration = 1;
+        av_packet_rescale_ts(pkt, c->time_base, st->time_base);
+        pkt->stream_index = st->index;
+        // until the writer muxed it
+        budget_take(pkt->size);
+        queue_video_packet(pkt, timeline_frame);
+    }
+    return 0;
+}
+
+static void block_until_frame_ready(decoding_queue_context_t *decoding_queue_context, int sleep_ms) {
+    int wait = 1;
+    while (keep_running && wait) {
+        pthread_mutex_lock(&decoding_mutex);
+        wait = !decoding_queue_context->ready;
+        pthread_mutex_unlock(&decoding_mutex);
+        if (wait) {
+            usleep(sleep_ms);
+        }
+    }
+}
+
+static int on_jpeg2000_frame(unsigned char* frame_buf, unsigned int frame_size, unsigned int current_frame, asdcp_encrypted_frame_t *encrypted, void *user_data)
 {
     av_pipeline_context_t *av_context = user_data;
+
+    // everything since we last returned was spent in the reader
+    if (frame_buf) {
+        metrics_stage_busy(METRICS_STAGE_READ, video_read_resumed_ns, frame_size);
+        metrics_frame_read(video_frames_read);
+        trace_span("read", video_frames_read, video_read_resumed_ns);
+    }
     
     decoding_queue_context_t *decoding_queue_context = (decoding_queue_context_t *)malloc(sizeof(decoding_queue_context_t));
 
-    decoding_queue_context->frame_buf = frame_buf;
-    decoding_queue_context->frame_size = frame_size;
     decoding_queue_context->current_frame = current_frame;
+    decoding_queue_context->timeline_frame = video_frames_read;
+
+    decrypt_queue_context_t *decrypt_queue_context = NULL;
+    if (encrypted) {
+        // frame keeps its place in the decoding queue, the decrypt stage fills it
+        decoding_queue_context->frame_buf = NULL;
+        decoding_queue_context->frame_size = 0;
+        decoding_queue_context->ready = 0;
+
+        decrypt_queue_context = (decrypt_queue_context_t *)malloc(sizeof(decrypt_queue_context_t));
+        decrypt_queue_context->ct_buf = frame_buf;
+        decrypt_queue_context->ct_size = frame_size;
+        decrypt_queue_context->encrypted = encrypted;
+        decrypt_queue_context->decoding_queue_context = decoding_queue_context;
+        decrypt_queue_context->timeline_frame = video_frames_read;
+    } else {
+        decoding_queue_context->frame_buf = frame_buf;
+        decoding_queue_context->frame_size = frame_size;
+        decoding_queue_context->ready = 1;
+    }
 
+    // with -F a short read ahead until the first frame is out, frames read
+    // ahead and their decryption compete with decoding the first one
+    int read_ahead = av_context->fast_start && !first_frame_out ? MAX_QUEUE_LEN : MAX_QUEUE_LEN*10;
+    uint64_t wait_start = stage_now();
     block_until_queue_has_space(
             &decoding_mutex,
             &decoding_queue_s,
-            MAX_QUEUE_LEN*10,
+            read_ahead,
             QUEUE_SLEEP_MS);
+    if (frame_buf) {
+        block_until_budget_has_space(frame_size, QUEUE_SLEEP_MS);
+    }
+    metrics_stage_idle(METRICS_STAGE_READ, wait_start);
+    trace_span("read queue wait", video_frames_read, wait_start);
 
     push_to_queue(
             &decoding_mutex,
             &decoding_queue_s,
             decoding_queue_context);
 
+    if (frame_buf) {
+        video_frames_read++;
+    }
+
+    // decrypt queue can't outgrow the decoding queue, no need to block here
+    if (decrypt_queue_context) {
+        push_to_queue(
+                &decrypt_mutex,
+                &decrypt_queue_s,
+                decrypt_queue_context);
+    } else if (!frame_buf) {
+        // end of stream. one NULL per decrypt thread
+        for (int i = 0; i < av_context->num_decrypt_threads; ++i) {
+            push_to_queue(
+                    &decrypt_mutex,
+                    &decrypt_queue_s,
+                    NULL);
+        }
+    }
+
+    video_read_resumed_ns = stage_now();
     return 0;
 }
 
-int decode_jpeg2000_frame(unsigned char* frame_buf, unsigned int frame_size, unsigned int current_frame, av_pipeline_context_t *av_context, opj_image_t **image_ptr)
-{
-    int ok = 1;
-    opj_image_t *image = NULL;
-    opj_stream_t *stream = NULL;
-    opj_stream_t *codec = NULL;
+static void report_video_integrity_failure(av_pipeline_context_t *av_context, decrypt_queue_context_t *decrypt_queue_context, unsigned int current_frame) {
+    integrity_report_t *report = &av_context->video_integrity;
+    pthread_mutex_lock(&decrypt_mutex);
+    // frames are verified out of order, keep the earliest
+    if (!report->failed || decrypt_queue_context->timeline_frame < report->timeline_frame) {
+        report->failed = 1;
+        report->timeline_frame = decrypt_queue_context->timeline_frame;
+        report->frame = current_frame;
+        strcpy(report->mxf_path, decrypt_queue_context->encrypted->mxf_path);
+    }
+    pthread_mutex_unlock(&decrypt_mutex);
+}
 
-    opj_buffer_info_t buffer_info;
-    buffer_info.buf = frame_buf;
-    buffer_info.cur = frame_buf;
-    buffer_info.len = frame_size;
+static void *decrypt_frames_thread(void *thread_data) {
+    av_pipeline_context_t *av_context = thread_data;
+    trace_thread_name("decrypt");
+    while (keep_running) {
+        uint64_t wait_start = stage_now();
+        linked_list_t *head = blocked_pop_queue(
+                &decrypt_mutex,
+                &decrypt_queue_s,
+                QUEUE_SLEEP_MS);
+        metrics_stage_idle(METRICS_STAGE_DECRYPT, wait_start);
+        if (!head) {
+            break;
+        }
 
-    stream = opj_stream_create_buffer_stream(&buffer_info, 1);
-    if (!stream) {
-        fprintf(stderr, "error creating stream [frame: %d]\n", current_frame);
-        goto free_and_out;
+        decrypt_queue_context_t *decrypt_queue_context = (decrypt_queue_context_t *)head->user_data;
+        free(head);
+        if (!decrypt_queue_context) {
+            break;
+        }
+
+        decoding_queue_context_t *decoding_queue_context = decrypt_queue_context->decoding_queue_context;
+        unsigned int current_frame = decoding_queue_context->current_frame;
+        unsigned char *pt_buf = NULL;
+        unsigned int pt_size = 0;
+        uint64_t decrypt_start = stage_now();
+
+        int err = asdcp_decrypt_frame(
+                decrypt_queue_context->encrypted,
+                decrypt_queue_context->ct_buf,
+                decrypt_queue_context->ct_size,
+                &pt_buf,
+                &pt_size);
+        if (err) {
+            fprintf(stderr, "error decrypting frame [frame: %d]\n", current_frame);
+            keep_running = 0;
+        } else {
+            budget_take(pt_size);
+            pthread_mutex_lock(&decoding_mutex);
+            decoding_queue_context->frame_buf = pt_buf;
+            decoding_queue_context->frame_size = pt_size;
+            decoding_queue_context->ready = 1;
+            pthread_mutex_unlock(&decoding_mutex);
+            // decoder owns decoding_queue_context from here on
+
+            // verify while the frame is being decoded
+            if (decrypt_queue_context->encrypted->verify_hmac) {
+                err = asdcp_verify_frame(
+                        decrypt_queue_context->encrypted,
+                        decrypt_queue_context->ct_buf,
+                        decrypt_queue_context->ct_size);
+                if (err) {
+                    report_video_integrity_failure(av_context, decrypt_queue_context, current_frame);
+                }
+            }
+            metrics_stage_busy(METRICS_STAGE_DECRYPT, decrypt_start, decrypt_queue_context->ct_size);
+            trace_span("decrypt", decrypt_queue_context->timeline_frame, decrypt_start);
+        }
+
+        free(decrypt_queue_context->ct_buf);
+        budget_give(decrypt_queue_context->ct_size);
+        free(decrypt_queue_context->encrypted);
+        free(decrypt_queue_context);
     }
 
-    codec = opj_create_decompress(OPJ_CODEC_J2K);
+    fprintf(stderr, "exit decrypt thread\n");
+    return NULL;
+}
+
+static opj_codec_t *create_jpeg2000_decoder(av_pipeline_context_t *av_context, int num_threads, unsigned int current_frame) {
+    opj_codec_t *codec = opj_create_decompress(OPJ_CODEC_J2K);
+    if (!codec) {
+        fprintf(stderr, "error creating codec [frame: %d]\n", current_frame);
+        return NULL;
+    }
 
     if (av_context->print_debug) {
         opj_set_info_handler(codec, info_callback, 00);
@@ -274,87 +698,771 @@ int decode_jpeg2000_frame(unsigned char* frame_buf, unsigned int frame_size, uns
 
     opj_dparameters_t *core = av_context->user_data;
 
-    ok = opj_setup_decoder(codec, core);
-    if (!ok) {
+    if (!opj_setup_decoder(codec, core)) {
         fprintf(stderr, "failed to setup decoder [frame: %d]\n", current_frame);
-        goto free_and_out;
+        opj_destroy_codec(codec);
+        return NULL;
     }
 
-    ok = opj_codec_set_threads(codec, av_context->num_threads);
-    if (!ok) {
+    // the band codecs of the tile-parallel path go to the pool too, whatever
+    // their share of the threads
+    if (decode_pool) {
+        if (!opj_codec_set_shared_thread_pool(codec, decode_pool)) {
+            fprintf(stderr, "failed to attach to the decode thread pool [frame: %d]\n", current_frame);
+            opj_destroy_codec(codec);
+            return NULL;
+        }
+    } else if (!opj_codec_set_threads(codec, num_threads)) {
         fprintf(stderr, "failed to setup %d threads [frame: %d]\n",
-                av_context->num_threads,
+                num_threads,
                 current_frame);
-        goto free_and_out;
+        opj_destroy_codec(codec);
+        return NULL;
     }
 
-    ok = opj_read_header(
-            stream,
-            codec,
-            &image);
-    if (!ok) {
+    return codec;
+}
+
+static inline int ceildiv(int a, int b) {
+    return (a + b - 1) / b;
+}
+
+static inline int ceildivpow2(int a, int b) {
+    return (a + (1 << b) - 1) >> b;
+}
+
+// opj_decode_tile_data output is planar, one component after the other,
+// 1, 2 or 4 bytes per sample depending on precision
+static void copy_tile_to_image(const unsigned char *tile_buf, int tx0, int ty0, int tx1, int ty1, int reduce, opj_image_t *image) {
+    for (unsigned int c = 0; c < image->numcomps; c++) {
+        opj_image_comp_t *comp = &image->comps[c];
+        int x0 = ceildivpow2(ceildiv(tx0, comp->dx), reduce);
+        int y0 = ceildivpow2(ceildiv(ty0, comp->dy), reduce);
+        int w = ceildivpow2(ceildiv(tx1, comp->dx), reduce) - x0;
+        int h = ceildivpow2(ceildiv(ty1, comp->dy), reduce) - y0;
+        OPJ_INT32 *dst = comp->data
+            + (y0 - ceildivpow2(comp->y0, reduce)) * comp->w
+            + (x0 - ceildivpow2(comp->x0, reduce));
+
+        if (comp->prec <= 8) {
+            for (int y = 0; y < h; y++, dst += comp->w) {
+                for (int x = 0; x < w; x++) {
+                    dst[x] = comp->sgnd ? ((const signed char *)tile_buf)[x] : tile_buf[x];
+                }
+                tile_buf += w;
+            }
+        } else if (comp->prec <= 16) {
+            const OPJ_INT16 *src = (const OPJ_INT16 *)tile_buf;
+            for (int y = 0; y < h; y++, dst += comp->w, src += w) {
+                for (int x = 0; x < w; x++) {
+                    dst[x] = comp->sgnd ? src[x] : (OPJ_UINT16)src[x];
+                }
+            }
+            tile_buf = (const unsigned char *)src;
+        } else {
+            const OPJ_INT32 *src = (const OPJ_INT32 *)tile_buf;
+            for (int y = 0; y < h; y++, dst += comp->w, src += w) {
+                memcpy(dst, src, w * sizeof(OPJ_INT32));
+            }
+            tile_buf = (const unsigned char *)src;
+        }
+    }
+}
+
+// one band of the tile-parallel path
+typedef struct {
+    opj_codec_t *codec;
+    unsigned char *tile_buf;
+    OPJ_UINT32 tile_buf_size;
+    // kept with the codec, see jpeg2000_decoder_t
+    opj_stream_t *stream;
+    opj_buffer_info_t buffer_info;
+    opj_image_t *header_image;
+} jpeg2000_band_decoder_t;
+
+// tile grid of the main header, what the tile-parallel path needs of
+// opj_get_cstr_info
+typedef struct {
+    OPJ_UINT32 tx0, ty0;
+    OPJ_UINT32 tdx, tdy;
+    OPJ_UINT32 tw, th;
+} tile_grid_t;
+
+// kept by the decode thread between frames. the codecs hold the parsed main
+// header, tile structures and thread pool of the previous frame and are
+// reused as long as the main header stays the same, which is the case for
+// all frames of a track file. the stream and images are recycled too, so
+// that decoding a frame of the same size as the previous one doesn't
+// allocate at all
+typedef struct {
+    opj_codec_t *codec;
+    jpeg2000_band_decoder_t *bands;
+    int num_bands;
+    // openjpeg threads of this decoder
+    int num_threads;
+    // the stream keeps a pointer to buffer_info
+    opj_stream_t *stream;
+    opj_buffer_info_t buffer_info;
+    // from the codec, handed back to it by opj_read_next_header
+    opj_image_t *image;
+    // what the tile-parallel path decodes into
+    opj_image_t *tile_image;
+    // output of the colour conversion
+    opj_image_t *rgb_image;
+    // 16 bit planes of the encoder's pixel format the single tile path
+    // decodes into, see decode_into_frame
+    AVFrame *frame;
+    // colour and pack jobs of the frames of this decoder
+    strip_jobs_t strips;
+    // tile grid of codec, queried once per codec instead of every frame
+    tile_grid_t grid;
+    int has_grid;
+    // a single tile in LRCP order, what -B can cut short (see
+    // decode_jpeg2000_frame)
+    int layer_progressive;
+    // tile-parallel jobs, num_bands of them, run on tile_group. that is on
+    // decode_pool if there is one, otherwise on tile_pool of this decoder
+    struct tile_job *jobs;
+    opj_shared_thread_pool_t tile_pool;
+    opj_job_group_t tile_group;
+} jpeg2000_decoder_t;
+
+static void jpeg2000_free_bands(jpeg2000_decoder_t *decoder) {
+    for (int i = 0; i < decoder->num_bands; i++) {
+        if (decoder->bands[i].codec) {
+            opj_destroy_codec(decoder->bands[i].codec);
+        }
+        if (decoder->bands[i].stream) {
+            opj_stream_destroy(decoder->bands[i].stream);
+        }
+        if (decoder->bands[i].header_image) {
+            opj_image_destroy(decoder->bands[i].header_image);
+        }
+        free(decoder->bands[i].tile_buf);
+    }
+    free(decoder->bands);
+    free(decoder->jobs);
+    decoder->bands = NULL;
+    decoder->jobs = NULL;
+    decoder->num_bands = 0;
+}
+
+static void jpeg2000_decoder_reset(jpeg2000_decoder_t *decoder) {
+    if (decoder->codec) {
+        opj_destroy_codec(decoder->codec);
+        decoder->codec = NULL;
+    }
+    if (decoder->stream) {
+        opj_stream_destroy(decoder->stream);
+        decoder->stream = NULL;
+    }
+    if (decoder->image) {
+        opj_image_destroy(decoder->image);
+        decoder->image = NULL;
+    }
+    if (decoder->tile_image) {
+        opj_image_destroy(decoder->tile_image);
+        decoder->tile_image = NULL;
+    }
+    if (decoder->rgb_image) {
+        opj_image_destroy(decoder->rgb_image);
+        decoder->rgb_image = NULL;
+    }
+    av_frame_free(&decoder->frame);
+    jpeg2000_free_bands(decoder);
+    if (decoder->tile_group) {
+        opj_destroy_job_group(decoder->tile_group);
+        decoder->tile_group = NULL;
+    }
+    if (decoder->tile_pool) {
+        opj_destroy_shared_thread_pool(decoder->tile_pool);
+        decoder->tile_pool = NULL;
+    }
+    decoder->has_grid = 0;
+}
+
+// points *stream, created on first use, at the codestream in buffer_info
+static int open_jpeg2000_stream(unsigned int current_frame, opj_buffer_info_t *buffer_info, opj_stream_t **stream) {
+    if (*stream) {
+        return opj_stream_reset_buffer_stream(*stream, buffer_info);
+    }
+    *stream = opj_stream_create_buffer_stream(buffer_info, 1);
+    if (!*stream) {
+        fprintf(stderr, "error creating stream [frame: %d]\n", current_frame);
+        return 0;
+    }
+    return 1;
+}
+
+// reads the main header with the codec of the previous frame if it has the
+// same one, otherwise *codec gets replaced and *new_codec, if given, set.
+// *image is the image of the previous frame, if any, whose buffers the codec
+// reuses
+static int read_jpeg2000_header(av_pipeline_context_t *av_context, int num_threads, unsigned int current_frame, opj_buffer_info_t *buffer_info, opj_codec_t **codec, opj_stream_t **stream, opj_image_t **image, int *new_codec) {
+    if (new_codec) {
+        *new_codec = 0;
+    }
+    if (*codec) {
+        if (opj_read_next_header(*stream, *codec, image)) {
+            return 1;
+        }
+        if (av_context->print_debug) {
+            fprintf(stderr, "main header changed, new decoder [frame: %d]\n", current_frame);
+        }
+        opj_destroy_codec(*codec);
+        *codec = NULL;
+
+        // the failed attempt left the stream somewhere in the main header
+        buffer_info->cur = buffer_info->buf;
+        if (!open_jpeg2000_stream(current_frame, buffer_info, stream)) {
+            return 0;
+        }
+    }
+    // opj_read_header creates a new one
+    if (*image) {
+        opj_image_destroy(*image);
+        *image = NULL;
+    }
+
+    *codec = create_jpeg2000_decoder(av_context, num_threads, current_frame);
+    if (!*codec) {
+        return 0;
+    }
+    if (new_codec) {
+        *new_codec = 1;
+    }
+
+    if (!opj_read_header(*stream, *codec, image)) {
         fprintf(stderr, "failed to read header [frame: %d]\n", current_frame);
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct tile_job {
+    unsigned char *frame_buf;
+    unsigned int frame_size;
+    unsigned int current_frame;
+    av_pipeline_context_t *av_context;
+    int num_threads;
+    jpeg2000_band_decoder_t *band;
+    // decode area in reference grid coordinates, always whole tiles
+    int x0, y0, x1, y1;
+    // shared output, every job only writes the area of its own tiles
+    opj_image_t *image;
+    int ok;
+} tile_job_t;
+
+// opj_job_group_run function over the tile_job_t of the bands
+static void decode_tiles_job(void *data, int index) {
+    tile_job_t *job = &((tile_job_t *)data)[index];
+    jpeg2000_band_decoder_t *band = job->band;
+    opj_dparameters_t *core = job->av_context->user_data;
+
+    // each band has its own codec and stream over the same codestream
+    band->buffer_info.buf = job->frame_buf;
+    band->buffer_info.cur = job->frame_buf;
+    band->buffer_info.len = job->frame_size;
+
+    job->ok = 0;
+
+    if (!open_jpeg2000_stream(job->current_frame, &band->buffer_info, &band->stream)) {
         goto free_and_out;
     }
 
-    ok = opj_set_decode_area(codec, image, 0, 0, 0, 0);
-    if (!ok) {
-        fprintf(stderr, "failed to set decode area [frame: %d]\n", current_frame);
+    if (!read_jpeg2000_header(job->av_context, job->num_threads, job->current_frame,
+                              &band->buffer_info, &band->codec, &band->stream, &band->header_image, NULL)) {
+        goto free_and_out;
+    }
+
+    // tiles outside of the area are skipped without being decoded
+    if (!opj_set_decode_area(band->codec, band->header_image, job->x0, job->y0, job->x1, job->y1)) {
+        fprintf(stderr, "failed to set decode area [frame: %d]\n", job->current_frame);
         goto free_and_out;
     }
 
-    ok = opj_decode(
-            codec,
-            stream,
-            image);
+    while (1) {
+        OPJ_UINT32 tile_index, data_size, nb_comps;
+        OPJ_INT32 tx0, ty0, tx1, ty1;
+        OPJ_BOOL go_on;
+
+        if (!opj_read_tile_header(band->codec, band->stream, &tile_index, &data_size,
+                                  &tx0, &ty0, &tx1, &ty1, &nb_comps, &go_on)) {
+            fprintf(stderr, "failed to read tile header [frame: %d]\n", job->current_frame);
+            goto free_and_out;
+        }
+        if (!go_on) {
+            break;
+        }
+
+        if (data_size > band->tile_buf_size) {
+            free(band->tile_buf);
+            band->tile_buf_size = 0;
+            band->tile_buf = malloc(data_size);
+            if (!band->tile_buf) {
+                fprintf(stderr, "out of memory for tile %d [frame: %d]\n", tile_index, job->current_frame);
+                goto free_and_out;
+            }
+            band->tile_buf_size = data_size;
+        }
+
+        if (!opj_decode_tile_data(band->codec, tile_index, band->tile_buf, data_size, band->stream)) {
+            fprintf(stderr, "failed on decoding tile %d [frame: %d]\n", tile_index, job->current_frame);
+            goto free_and_out;
+        }
+
+        copy_tile_to_image(band->tile_buf, tx0, ty0, tx1, ty1, core->cp_reduce, job->image);
+    }
+
+    job->ok = opj_end_decompress(band->codec, band->stream);
+    if (!job->ok) {
+        fprintf(stderr, "failed on end decompress [frame: %d]\n", job->current_frame);
+    }
+
+free_and_out:
+    // no telling what state the codec is in after an error, the header
+    // image goes with it
+    if (!job->ok && band->codec) {
+        opj_destroy_codec(band->codec);
+        band->codec = NULL;
+    }
+    if (!job->ok && band->header_image) {
+        opj_image_destroy(band->header_image);
+        band->header_image = NULL;
+    }
+}
+
+// geometry of component c once decoded at the given reduction, what
+// opj_decode would give it
+static void tile_comp_geometry(const opj_image_t *header, unsigned int c, int reduce, opj_image_cmptparm_t *parm) {
+    const opj_image_comp_t *comp = &header->comps[c];
+
+    memset(parm, 0, sizeof(*parm));
+    parm->dx = comp->dx;
+    parm->dy = comp->dy;
+    parm->x0 = ceildiv(header->x0, comp->dx);
+    parm->y0 = ceildiv(header->y0, comp->dy);
+    parm->w = ceildivpow2(ceildiv(header->x1, comp->dx), reduce) - ceildivpow2(parm->x0, reduce);
+    parm->h = ceildivpow2(ceildiv(header->y1, comp->dy), reduce) - ceildivpow2(parm->y0, reduce);
+    parm->prec = comp->prec;
+    parm->sgnd = comp->sgnd;
+}
+
+// splits the tile grid into bands of whole tiles and decodes them at the
+// same time, each band with its own codec. header is the image from
+// opj_read_header, the tiles go to decoder->tile_image which has the
+// geometry of header and keeps its component buffers between frames.
+static int decode_tiles_parallel(unsigned char* frame_buf, unsigned int frame_size, unsigned int current_frame, av_pipeline_context_t *av_context, jpeg2000_decoder_t *decoder, const tile_grid_t *grid, opj_image_t *header) {
+    opj_dparameters_t *core = av_context->user_data;
+    int reduce = core->cp_reduce;
+    int ok = 1;
+    opj_image_t *image = decoder->tile_image;
+    opj_image_cmptparm_t parm;
+
+    for (unsigned int c = 0; image && c < header->numcomps; c++) {
+        tile_comp_geometry(header, c, reduce, &parm);
+        if (image->numcomps != header->numcomps
+            || image->comps[c].w != parm.w || image->comps[c].h != parm.h) {
+            opj_image_destroy(image);
+            image = decoder->tile_image = NULL;
+        }
+    }
+    if (!image) {
+        opj_image_cmptparm_t *parms = calloc(header->numcomps, sizeof(opj_image_cmptparm_t));
+        if (parms) {
+            for (unsigned int c = 0; c < header->numcomps; c++) {
+                tile_comp_geometry(header, c, reduce, &parms[c]);
+            }
+            image = decoder->tile_image = opj_image_create(header->numcomps, parms, header->color_space);
+            free(parms);
+        }
+        if (!image) {
+            fprintf(stderr, "out of memory for tile image [frame: %d]\n", current_frame);
+            return 0;
+        }
+    }
+    image->x0 = header->x0;
+    image->y0 = header->y0;
+    image->x1 = header->x1;
+    image->y1 = header->y1;
+    image->color_space = header->color_space;
+
+    for (unsigned int c = 0; c < image->numcomps; c++) {
+        opj_image_comp_t *comp = &image->comps[c];
+        OPJ_INT32 *data = comp->data;
+
+        tile_comp_geometry(header, c, reduce, &parm);
+        *comp = header->comps[c];
+        comp->data = data;
+        comp->factor = reduce;
+        comp->x0 = parm.x0;
+        comp->y0 = parm.y0;
+        comp->w = parm.w;
+        comp->h = parm.h;
+    }
+
+    // rows of tiles first, columns when there are more threads than rows
+    int bands_y = (int)grid->th < decoder->num_threads ? (int)grid->th : decoder->num_threads;
+    int bands_x = decoder->num_threads / bands_y;
+    if (bands_x > (int)grid->tw) {
+        bands_x = grid->tw;
+    }
+    int num_jobs = bands_x * bands_y;
+    // what is left over goes to the codec of each band
+    int threads_per_job = decoder->num_threads / num_jobs;
+    if (threads_per_job < 2) {
+        threads_per_job = 0;
+    }
+
+    if (decoder->num_bands != num_jobs) {
+        jpeg2000_free_bands(decoder);
+        decoder->bands = calloc(num_jobs, sizeof(jpeg2000_band_decoder_t));
+        decoder->jobs = calloc(num_jobs, sizeof(tile_job_t));
+        if (!decoder->bands || !decoder->jobs) {
+            fprintf(stderr, "out of memory for tile bands [frame: %d]\n", current_frame);
+            jpeg2000_free_bands(decoder);
+            return 0;
+        }
+        decoder->num_bands = num_jobs;
+    }
+
+    // the bands run next to the code-block jobs of the other frames on
+    // decode_pool. without it on threads of this decoder, as many as there
+    // are bands besides the one waiting in opj_job_group_run
+    if (!decoder->tile_group) {
+        if (!decode_pool && !decoder->tile_pool) {
+            decoder->tile_pool = opj_create_shared_thread_pool(decoder->num_threads - 1);
+        }
+        decoder->tile_group = opj_create_job_group(decode_pool ? decode_pool : decoder->tile_pool);
+        if (!decoder->tile_group) {
+            fprintf(stderr, "error creating job group [frame: %d]\n", current_frame);
+            return 0;
+        }
+    }
+
+    tile_job_t *jobs = decoder->jobs;
+
+    for (int by = 0; by < bands_y; by++) {
+        for (int bx = 0; bx < bands_x; bx++) {
+            tile_job_t *job = &jobs[by * bands_x + bx];
+            int first_x = bx * grid->tw / bands_x;
+            int last_x = (bx + 1) * grid->tw / bands_x;
+            int first_y = by * grid->th / bands_y;
+            int last_y = (by + 1) * grid->th / bands_y;
+
+            job->frame_buf = frame_buf;
+            job->frame_size = frame_size;
+            job->current_frame = current_frame;
+            job->av_context = av_context;
+            job->num_threads = threads_per_job;
+            job->band = &decoder->bands[by * bands_x + bx];
+            job->image = image;
+            job->x0 = grid->tx0 + first_x * grid->tdx;
+            job->y0 = grid->ty0 + first_y * grid->tdy;
+            job->x1 = grid->tx0 + last_x * grid->tdx;
+            job->y1 = grid->ty0 + last_y * grid->tdy;
+            // the tile grid may start before and end after the image area
+            job->x0 = job->x0 > (int)image->x0 ? job->x0 : (int)image->x0;
+            job->y0 = job->y0 > (int)image->y0 ? job->y0 : (int)image->y0;
+            job->x1 = job->x1 < (int)image->x1 ? job->x1 : (int)image->x1;
+            job->y1 = job->y1 < (int)image->y1 ? job->y1 : (int)image->y1;
+        }
+    }
+
+    ok = opj_job_group_run(decoder->tile_group, decode_tiles_job, jobs, num_jobs);
+    for (int i = 0; i < num_jobs; i++) {
+        ok = ok && jobs[i].ok;
+    }
+    return ok;
+}
+
+// decoded Y'CbCr goes through color_sycc_to_rgb before it is packed
+static int needs_rgb_conversion(const opj_image_t *image, const av_pipeline_context_t *av_context) {
+    return !av_context->encode_ycbcr
+        && !av_context->rgb_essence
+        && image->color_space != OPJ_CLRSPC_SYCC
+        && image->numcomps == 3
+        && image->comps[0].dx == image->comps[0].dy
+        && image->comps[1].dx != 1;
+}
+
+// points the codec at the planes of decoder->frame when the image would be
+// packed into the encoder's frame as it is, so that openjpeg writes the
+// final samples there instead of into the image. pack_image_gbrp16 and
+// pack_image_yuv16 clamp the same way. returns the frame, or NULL when the
+// image gets decoded and packed as usual
+static AVFrame *decode_into_frame(const opj_image_t *header, av_pipeline_context_t *av_context, jpeg2000_decoder_t *decoder) {
+    // R, G, B to the G, B, R planes of AV_PIX_FMT_GBRP10 / GBRP12
+    static const int gbr_planes[3] = { 2, 0, 1 };
+    AVCodecContext *c = av_context->video_stream.codec_context;
+    // no encoder for the frames of av_pipeline_decode_frame
+    if (!c) {
+        return NULL;
+    }
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(c->pix_fmt);
+    int gbr = desc->flags & AV_PIX_FMT_FLAG_RGB;
+    int chroma_w, chroma_h;
+
+    av_pix_fmt_get_chroma_sub_sample(c->pix_fmt, &chroma_w, &chroma_h);
+    if (needs_rgb_conversion(header, av_context)
+            || header->numcomps != 3
+            || av_pix_fmt_count_planes(c->pix_fmt) != 3
+            || (int)header->comps[0].w != c->width
+            || (int)header->comps[0].h != c->height) {
+        return NULL;
+    }
+    for (unsigned int compno = 0; compno < 3; ++compno) {
+        const opj_image_comp_t *comp = &header->comps[compno];
+        // deeper components get shifted down when they are packed
+        if ((int)comp->prec > desc->comp[0].depth) {
+            return NULL;
+        }
+        // what encode_image_to_r210 and encode_image_send_receive take
+        if (gbr && (comp->dx != header->comps[0].dx || comp->dy != header->comps[0].dy
+                || comp->prec != header->comps[0].prec || comp->sgnd != header->comps[0].sgnd)) {
+            return NULL;
+        }
+    }
+    if (!gbr && (header->comps[1].dx != header->comps[0].dx << chroma_w
+            || header->comps[1].dy != header->comps[0].dy << chroma_h)) {
+        return NULL;
+    }
+
+    if (!decoder->frame) {
+        decoder->frame = av_frame_alloc();
+        if (!decoder->frame) {
+            return NULL;
+        }
+    }
+    // the encoder's threads may still hold the previous frame
+    AVFrame *frame = decoder->frame;
+    if (!av_frame_is_writable(frame)) {
+        av_frame_unref(frame);
+        frame->format = c->pix_fmt;
+        frame->width = c->width;
+        frame->height = c->height;
+        int err = av_context->no_frame_pool ? av_frame_get_buffer(frame, 0) : alloc_pooled_frame(frame);
+        if (err) {
+            fprintf(stderr, "error allocating decoding frame: %s\n", av_err2str(err));
+            return NULL;
+        }
+    }
+
+    opj_output_plane_t planes[3];
+    for (int compno = 0; compno < 3; ++compno) {
+        int plane = gbr ? gbr_planes[compno] : compno;
+        planes[compno].data = (OPJ_UINT16 *)frame->data[plane];
+        planes[compno].stride = frame->linesize[plane];
+        planes[compno].format = OPJ_PLANE_U16;
+    }
+    if (!opj_set_decoded_planes(decoder->codec, planes, 3)) {
+        return NULL;
+    }
+    return frame;
+}
+
+static int decode_jpeg2000_frame(unsigned char* frame_buf, unsigned int frame_size, unsigned int current_frame, unsigned int timeline_frame, av_pipeline_context_t *av_context, jpeg2000_decoder_t *decoder, opj_image_t **image_ptr, AVFrame **frame_ptr)
+{
+    AVFrame *frame = NULL;
+    int ok = 1;
+    opj_image_t *image = NULL;
+    int new_codec = 0;
+    uint64_t decode_start = stage_now();
+
+    // preview byte budget, openjpeg decodes the truncated codestream as far as
+    // it goes (see av_pipeline_run). only for LRCP, checked below
+    if (av_context->max_frame_bytes && frame_size > av_context->max_frame_bytes) {
+        frame_size = av_context->max_frame_bytes;
+    }
+
+    decoder->buffer_info.buf = frame_buf;
+    decoder->buffer_info.cur = frame_buf;
+    decoder->buffer_info.len = frame_size;
+
+    ok = open_jpeg2000_stream(current_frame, &decoder->buffer_info, &decoder->stream);
     if (!ok) {
-        fprintf(stderr, "failed on decoding image [frame: %d]\n", current_frame);
         goto free_and_out;
     }
 
-    ok = opj_end_decompress(codec, stream);
+    // the image of the previous frame goes back to the codec, which decodes
+    // into the same buffers
+    uint64_t header_start = trace_now();
+    ok = read_jpeg2000_header(av_context, decoder->num_threads, current_frame,
+                              &decoder->buffer_info, &decoder->codec, &decoder->stream, &decoder->image, &new_codec);
     if (!ok) {
-        fprintf(stderr, "failedon end decompress [frame: %d]\n", current_frame);
+        goto free_and_out;
+    }
+    trace_span("decode header", timeline_frame, header_start);
+
+    opj_codec_t *codec = decoder->codec;
+    opj_stream_t *stream = decoder->stream;
+    image = decoder->image;
+
+    // the tile grid is part of the main header, it only changes along with
+    // the codec
+    if (new_codec || !decoder->has_grid) {
+        opj_codestream_info_v2_t *cstr_info = opj_get_cstr_info(codec);
+        decoder->has_grid = cstr_info != NULL;
+        if (cstr_info) {
+            decoder->grid.tx0 = cstr_info->tx0;
+            decoder->grid.ty0 = cstr_info->ty0;
+            decoder->grid.tdx = cstr_info->tdx;
+            decoder->grid.tdy = cstr_info->tdy;
+            decoder->grid.tw = cstr_info->tw;
+            decoder->grid.th = cstr_info->th;
+            decoder->layer_progressive = cstr_info->tw * cstr_info->th == 1 &&
+                cstr_info->m_default_tile_info.prg == OPJ_LRCP;
+            opj_destroy_cstr_info(&cstr_info);
+        }
+    }
+
+    // a byte budget only drops whole quality layers if they come first in the
+    // codestream. with CPRL, as in IMF App 2E, the lower part of the frame
+    // would lose its detail, with tiles the tiles past the budget would be
+    // missing
+    if (av_context->max_frame_bytes && !(decoder->has_grid && decoder->layer_progressive)) {
+        fprintf(stderr, "-B needs single tile codestreams in layer progressive (LRCP) order [frame: %d]\n", current_frame);
+        ok = 0;
         goto free_and_out;
     }
 
-    if (image->comps[0].data == NULL) {
+    // multi tile codestreams get their tiles decoded side by side, opj_decode
+    // would go through them one after another
+    if (decoder->has_grid && decoder->grid.tw * decoder->grid.th > 1 && decoder->num_threads > 1) {
+        uint64_t tiles_start = trace_now();
+        ok = decode_tiles_parallel(frame_buf, frame_size, current_frame, av_context, decoder, &decoder->grid, image);
+        if (!ok) {
+            fprintf(stderr, "failed on decoding tiles [frame: %d]\n", current_frame);
+            goto free_and_out;
+        }
+        image = decoder->tile_image;
+        trace_span("decode tiles", timeline_frame, tiles_start);
+    } else {
+        ok = opj_set_decode_area(codec, image, 0, 0, 0, 0);
+        if (!ok) {
+            fprintf(stderr, "failed to set decode area [frame: %d]\n", current_frame);
+            goto free_and_out;
+        }
+
+        // the planes stay set for the following frames until replaced
+        frame = decode_into_frame(image, av_context, decoder);
+        if (!frame && !opj_set_decoded_planes(codec, NULL, 0)) {
+            ok = 0;
+            goto free_and_out;
+        }
+
+        // T1 and DWT both happen in here
+        uint64_t t1_dwt_start = trace_now();
+        ok = opj_decode(
+                codec,
+                stream,
+                image);
+        if (!ok) {
+            fprintf(stderr, "failed on decoding image [frame: %d]\n", current_frame);
+            goto free_and_out;
+        }
+        trace_span("decode t1/dwt", timeline_frame, t1_dwt_start);
+
+        ok = opj_end_decompress(codec, stream);
+        if (!ok) {
+            fprintf(stderr, "failedon end decompress [frame: %d]\n", current_frame);
+            goto free_and_out;
+        }
+    }
+
+    if (!frame && image->comps[0].data == NULL) {
         fprintf(stderr, "error getting image [frame: %d]\n", current_frame);
         ok = 0;
         goto free_and_out;
     }
 
+    metrics_stage_busy(METRICS_STAGE_DECODE, decode_start, frame_size);
+
     // TO-DO: move this to writeout thread. Tried but doesnt work.
     // Does openjpeg have some internal state that prevents us from
     // calling color_sycc_to_rgb from other thread?
-    if (image->color_space != OPJ_CLRSPC_SYCC
-        && image->numcomps == 3
-        && image->comps[0].dx == image->comps[0].dy
-        && image->comps[1].dx != 1) {
+    if (!frame && needs_rgb_conversion(image, av_context)) {
 
+        uint64_t color_start = stage_now();
         image->color_space = OPJ_CLRSPC_SYCC;
-        ok = color_sycc_to_rgb(image);
-        if (!ok) {
+        // the decoded image stays as it is for the next frame
+        opj_image_t *rgb_image = color_sycc_to_rgb_prepare(image, &decoder->rgb_image);
+        if (!rgb_image) {
             fprintf(stderr, "error converting sycc to rgb\n");
+            ok = 0;
             goto free_and_out;
         }
+        if (rgb_image != image) {
+            decoder->strips.image = image;
+            decoder->strips.rgb_image = rgb_image;
+            ok = opj_job_group_run(decoder->strips.group, color_strip_job, &decoder->strips, decoder->strips.num_strips);
+            if (!ok) {
+                fprintf(stderr, "error running colour jobs\n");
+                goto free_and_out;
+            }
+            image = rgb_image;
+        }
+        metrics_stage_busy(METRICS_STAGE_COLOR, color_start, 0);
+        trace_span("color", timeline_frame, color_start);
     }
    
+    // owned by the decoder, good until the next frame. with a frame the
+    // image only has the header
     *image_ptr = image;
+    *frame_ptr = frame;
 
 free_and_out:
-    if (stream) {
-        opj_stream_destroy(stream);
-    }
-    if (codec) {
-        opj_destroy_codec(codec);
+    // no telling what state the codecs are in after an error
+    if (!ok) {
+        jpeg2000_decoder_reset(decoder);
     }
     return !ok;
 }
 
-void *jpeg2000_to_r210_thread(void *thread_data) {
-    av_pipeline_context_t *av_context = thread_data;
+static void block_until_packet_turn(unsigned int timeline_frame, int sleep_ms) {
+    int wait = 1;
+    while (keep_running && wait) {
+        pthread_mutex_lock(&vid_packet_mutex);
+        wait = next_packet_frame != timeline_frame;
+        pthread_mutex_unlock(&vid_packet_mutex);
+        if (wait) {
+            usleep(sleep_ms);
+        }
+    }
+}
+
+// a decode worker, one per NUMA node with -N and -W of them on decode_pool
+// otherwise. workers take frames from the decoding queue in order but finish
+// them out of order, packing and queueing the packets goes by timeline frame
+typedef struct {
+    av_pipeline_context_t *av_context;
+    // index for numa_place_bind_thread, -1 for no placement
+    int node;
+    int num_threads;
+} decode_worker_t;
+
+static void *jpeg2000_to_r210_thread(void *thread_data) {
+    decode_worker_t *worker = thread_data;
+    av_pipeline_context_t *av_context = worker->av_context;
+    jpeg2000_decoder_t decoder = { .num_threads = worker->num_threads };
+    trace_thread_name("decode");
+
+    // without the pool the strips run one after the other on this thread
+    decoder.strips.num_strips = decode_pool ? worker->num_threads : 1;
+    decoder.strips.group = opj_create_job_group(decode_pool);
+    if (!decoder.strips.group) {
+        fprintf(stderr, "error creating job group\n");
+        keep_running = 0;
+    }
+
+    // openjpeg's threads are created from this one and stay on the node too
+    if (worker->node >= 0 && numa_place_bind_thread(worker->node)) {
+        keep_running = 0;
+    }
+    int copy_to_node = worker->node >= 0 && numa_place_num_nodes() > 1;
+
     while (keep_running) {
+        uint64_t wait_start = stage_now();
         linked_list_t *head = blocked_pop_queue(
                 &decoding_mutex,
                 &decoding_queue_s,
@@ -366,57 +1474,280 @@ void *jpeg2000_to_r210_thread(void *thread_data) {
         
         decoding_queue_context_t *decoding_queue_context = (decoding_queue_context_t *)head->user_data;
 
+        block_until_frame_ready(decoding_queue_context, QUEUE_SLEEP_MS);
+        metrics_stage_idle(METRICS_STAGE_DECODE, wait_start);
+        trace_span("decode queue wait", decoding_queue_context->timeline_frame, wait_start);
+        if (!keep_running) {
+            // a decrypt thread might still hold the context, leave it
+            free(head);
+            break;
+        }
+
+        // the reader or a decrypt thread touched the frame first, it is on
+        // their node. the decoder reads it several times over
+        if (copy_to_node && decoding_queue_context->frame_buf) {
+            unsigned char *local_buf = malloc(decoding_queue_context->frame_size);
+            if (local_buf) {
+                memcpy(local_buf, decoding_queue_context->frame_buf, decoding_queue_context->frame_size);
+                free(decoding_queue_context->frame_buf);
+                decoding_queue_context->frame_buf = local_buf;
+            }
+        }
+
         AVPacket *pkt = NULL;
+        opj_image_t *image = NULL;
+        AVFrame *decoded = NULL;
+        uint64_t decoded_size = 0;
 
         if (decoding_queue_context->frame_buf) {
-            opj_image_t *image = NULL;
-
             int err = decode_jpeg2000_frame(
                     decoding_queue_context->frame_buf,
                     decoding_queue_context->frame_size,
                     decoding_queue_context->current_frame,
+                    decoding_queue_context->timeline_frame,
                     av_context,
-                    &image);
+                    &decoder,
+                    &image,
+                    &decoded);
+            free(decoding_queue_context->frame_buf);
+            budget_give(decoding_queue_context->frame_size);
             if (err) {
                 fprintf(stderr, "err decode frame\n");
+                video_failed = 1;
                 keep_running = 0;
             } else {
-                err = encode_image_to_r210(image, av_context, &pkt);
-                if (err) {
-                    fprintf(stderr, "error encoding image\n");
+                decoded_size = decoded
+                    ? (uint64_t)av_image_get_buffer_size(decoded->format, decoded->width, decoded->height, 1)
+                    : image_size(image);
+                budget_take(decoded_size);
+            }
+        }
+
+        // packing shares the output frame and its pts with the other workers
+        wait_start = stage_now();
+        block_until_packet_turn(decoding_queue_context->timeline_frame, QUEUE_SLEEP_MS);
+        trace_span("packet turn wait", decoding_queue_context->timeline_frame, wait_start);
+
+        int send_receive = av_context->video_codec->id != AV_CODEC_ID_R210;
+        if (image && keep_running) {
+            uint64_t pack_start = stage_now();
+            int err;
+            if (send_receive) {
+                err = encode_image_send_receive(image, decoded, av_context, &decoder.strips, decoding_queue_context->timeline_frame);
+            } else {
+                err = encode_image_to_r210(image, decoded, av_context, &decoder.strips, &pkt);
+            }
+            if (err) {
+                fprintf(stderr, "error encoding image\n");
+                video_failed = 1;
+                keep_running = 0;
+            } else if (!send_receive) {
+                // until the writer muxed it
+                budget_take(pkt->size);
+                metrics_stage_busy(METRICS_STAGE_PACK, pack_start, pkt->size);
+                trace_span("pack", decoding_queue_context->timeline_frame, pack_start);
+            } else {
+                metrics_stage_busy(METRICS_STAGE_PACK, pack_start, 0);
+                trace_span("encode", decoding_queue_context->timeline_frame, pack_start);
+            }
+        }
+        // the decoder keeps the image for the next frame
+        if (image) {
+            budget_give(decoded_size);
+        }
+
+        if (!send_receive || !image) {
+            // no image at the end of the video, the frames the encoder
+            // still holds go out before the end of the stream
+            if (send_receive && keep_running) {
+                if (encode_image_send_receive(NULL, NULL, av_context, &decoder.strips, decoding_queue_context->timeline_frame)) {
+                    fprintf(stderr, "error flushing encoder\n");
+                    video_failed = 1;
                     keep_running = 0;
                 }
             }
-            free(decoding_queue_context->frame_buf);
-            if (image) {
-                opj_image_destroy(image);
-            }
+            queue_video_packet(pkt, decoding_queue_context->timeline_frame);
+        }
+        pthread_mutex_lock(&vid_packet_mutex);
+        next_packet_frame++;
+        pthread_mutex_unlock(&vid_packet_mutex);
+
+        free(decoding_queue_context);
+        free(head);
+    }
+
+    jpeg2000_decoder_reset(&decoder);
+    if (decoder.strips.group) {
+        opj_destroy_job_group(decoder.strips.group);
+    }
+    fprintf(stderr, "exit decoding thread\n");
+    return NULL;
+}
+
+struct av_pipeline_decoder_s {
+    av_pipeline_context_t *av_context;
+    jpeg2000_decoder_t decoder;
+};
+
+av_pipeline_decoder_t *av_pipeline_create_decoder(av_pipeline_context_t *av_context, int num_threads) {
+    av_pipeline_decoder_t *d = calloc(1, sizeof(av_pipeline_decoder_t));
+    if (!d) {
+        return NULL;
+    }
+    d->av_context = av_context;
+    d->decoder.num_threads = num_threads;
+    // the strips run one after the other on the calling thread, openjpeg's
+    // threads only do the code-blocks
+    d->decoder.strips.num_strips = 1;
+    d->decoder.strips.group = opj_create_job_group(NULL);
+    if (!d->decoder.strips.group) {
+        fprintf(stderr, "error creating job group\n");
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+int av_pipeline_decode_frame(av_pipeline_decoder_t *d, unsigned char *frame_buf, unsigned int frame_size, unsigned int timeline_frame, AVFrame *frame, int *depth) {
+    av_pipeline_context_t *av_context = d->av_context;
+    opj_image_t *image = NULL;
+    AVFrame *decoded = NULL;
+
+    int err = decode_jpeg2000_frame(frame_buf, frame_size, timeline_frame, timeline_frame, av_context, &d->decoder, &image, &decoded);
+    if (err) {
+        return err;
+    }
+    if (image->numcomps < 3) {
+        fprintf(stderr, "can only decode 3 components [frame: %d]\n", timeline_frame);
+        return 1;
+    }
+
+    // what encode_image_to_r210 and encode_image_send_receive pack
+    enum AVPixelFormat pix_fmt = AV_PIX_FMT_GBRP16;
+    void (*pack)(void *, int) = pack_gbrp16_strip_job;
+    if (av_context->encode_ycbcr && !av_context->rgb_essence) {
+        pack = pack_yuv16_strip_job;
+        if (image->comps[1].dx == image->comps[0].dx && image->comps[1].dy == image->comps[0].dy) {
+            pix_fmt = AV_PIX_FMT_YUV444P16;
+        } else if (image->comps[1].dy == image->comps[0].dy) {
+            pix_fmt = AV_PIX_FMT_YUV422P16;
+        } else {
+            pix_fmt = AV_PIX_FMT_YUV420P16;
+        }
+    }
+
+    int width = (int)image->comps[0].w;
+    int height = (int)image->comps[0].h;
+    if (frame->format != pix_fmt || frame->width != width || frame->height != height || !av_frame_is_writable(frame)) {
+        av_frame_unref(frame);
+        frame->format = pix_fmt;
+        frame->width = width;
+        frame->height = height;
+        err = av_frame_get_buffer(frame, 0);
+        if (err) {
+            fprintf(stderr, "error allocating decoding frame: %s\n", av_err2str(err));
+            return 1;
         }
+    }
+
+    *depth = (int)image->comps[0].prec;
+    return run_pack_strips(&d->decoder.strips, pack, image, frame);
+}
+
+void av_pipeline_free_decoder(av_pipeline_decoder_t *d) {
+    if (d) {
+        jpeg2000_decoder_reset(&d->decoder);
+        opj_destroy_job_group(d->decoder.strips.group);
+        free(d);
+    }
+}
 
-        block_until_queue_has_space(
-                &vid_packet_mutex,
-                &vid_packet_queue_s,
-                MAX_QUEUE_LEN,
+static void free_codestream_buffer(void *opaque, uint8_t *data) {
+    free(data);
+}
+
+// -c copy: hands the codestreams of the decoding queue to the muxer as they
+// are, in timeline order. the packet takes over the read buffer and the
+// memory budget it holds, the writer gives that back once it is muxed
+static void *rewrap_codestreams_thread(void *thread_data) {
+    decode_worker_t *worker = thread_data;
+    av_pipeline_context_t *av_context = worker->av_context;
+    AVCodecContext *c = av_context->video_stream.codec_context;
+    AVStream *st = av_context->video_stream.stream;
+    trace_thread_name("rewrap");
+
+    while (keep_running) {
+        uint64_t wait_start = stage_now();
+        linked_list_t *head = blocked_pop_queue(
+                &decoding_mutex,
+                &decoding_queue_s,
                 QUEUE_SLEEP_MS);
+        if (!head) {
+            keep_running = 0;
+            break;
+        }
 
-        push_to_queue(
-                &vid_packet_mutex,
-                &vid_packet_queue_s,
-                pkt);
+        decoding_queue_context_t *decoding_queue_context = (decoding_queue_context_t *)head->user_data;
+        free(head);
+
+        block_until_frame_ready(decoding_queue_context, QUEUE_SLEEP_MS);
+        metrics_stage_idle(METRICS_STAGE_PACK, wait_start);
+        if (!keep_running) {
+            // a decrypt thread might still hold the context, leave it
+            break;
+        }
 
+        unsigned int timeline_frame = decoding_queue_context->timeline_frame;
+        AVPacket *pkt = NULL;
+        if (decoding_queue_context->frame_buf) {
+            uint64_t pack_start = stage_now();
+            pkt = (AVPacket*)malloc(sizeof(AVPacket));
+            memset(pkt, 0, sizeof(AVPacket));
+            av_init_packet(pkt);
+            pkt->buf = av_buffer_create(decoding_queue_context->frame_buf, decoding_queue_context->frame_size,
+                                        free_codestream_buffer, NULL, 0);
+            if (!pkt->buf) {
+                fprintf(stderr, "error wrapping codestream [frame: %d]\n", decoding_queue_context->current_frame);
+                free(decoding_queue_context->frame_buf);
+                free(decoding_queue_context);
+                free(pkt);
+                keep_running = 0;
+                break;
+            }
+            pkt->data = decoding_queue_context->frame_buf;
+            pkt->size = decoding_queue_context->frame_size;
+            // every codestream is a key frame
+            pkt->flags |= AV_PKT_FLAG_KEY;
+            pkt->pts = timeline_frame;
+            pkt->dts = timeline_frame;
+            pkt->duration = 1;
+            av_packet_rescale_ts(pkt, c->time_base, st->time_base);
+            pkt->stream_index = st->index;
+            metrics_stage_busy(METRICS_STAGE_PACK, pack_start, pkt->size);
+            trace_span("rewrap", timeline_frame, pack_start);
+        }
         free(decoding_queue_context);
-        free(head);
+
+        // NULL at the end of the video
+        queue_video_packet(pkt, timeline_frame);
+        if (!pkt) {
+            break;
+        }
     }
 
-    fprintf(stderr, "exit decoding thread\n");
+    fprintf(stderr, "exit rewrap thread\n");
     return NULL;
 }
 
-int stop_decoding_signal() {
+int av_pipeline_stop() {
     keep_running = 0;
 }
 
-int encode_pcm24le_audio(unsigned char *buf, unsigned int length, unsigned int current_frame, void *user_data) {
+int av_pipeline_stopped() {
+    return !keep_running;
+}
+
+static int encode_pcm24le_audio(unsigned char *buf, unsigned int length, unsigned int current_frame, void *user_data) {
     int err = 0;
     if (!keep_running) {
         return -1;
@@ -430,16 +1761,8 @@ int encode_pcm24le_audio(unsigned char *buf, unsigned int length, unsigned int c
         AVCodecContext *c = ost->codec_context;
         AVFrame *frame = ost->frame;
 
-        int8_t *data_ptr = frame->data[0];
-        int8_t *src_ptr = buf;
-        for (int i = 0; i < length/(3*ost->codec_context->channels); ++i) {
-            for (int c = 0; c < ost->codec_context->channels; c++) {
-                *data_ptr++ = 0;
-                *data_ptr++ = *src_ptr++;
-                *data_ptr++ = *src_ptr++;
-                *data_ptr++ = *src_ptr++;
-            }
-        }
+        int channels = ost->codec_context->channels;
+        pack_pcm24le_to_s32(buf, frame->data[0], length / (3 * channels) * channels);
 
         frame->pts = ost->next_pts;
         ost->next_pts += frame->nb_samples;
@@ -478,13 +1801,22 @@ int encode_pcm24le_audio(unsigned char *buf, unsigned int length, unsigned int c
         
         av_packet_rescale_ts(pkt, c->time_base, ost->stream->time_base);
         pkt->stream_index = ost->stream->index;
+        // until the writer muxed it
+        budget_take(pkt->size);
+
+        // reading the frame and converting it
+        metrics_stage_busy(METRICS_STAGE_AUDIO, audio_read_resumed_ns, length);
+        trace_span("audio read", current_frame, audio_read_resumed_ns);
     }
 
+    uint64_t wait_start = stage_now();
     block_until_queue_has_space(
             &aud_packet_mutex,
             &aud_packet_queue_s,
             MAX_QUEUE_LEN,
             QUEUE_SLEEP_MS);
+    metrics_stage_idle(METRICS_STAGE_AUDIO, wait_start);
+    trace_span("audio queue wait", current_frame, wait_start);
 
     push_to_queue(
             &aud_packet_mutex,
@@ -495,6 +1827,7 @@ err_and_out:
     if (buf) {
         free(buf);
     }
+    audio_read_resumed_ns = stage_now();
     return err;
 }
 
@@ -503,14 +1836,15 @@ typedef struct {
     av_pipeline_context_t *av_context;
 } audio_thread_args_t;
 
-void* extract_audio_thread(void *data) {
+static void* extract_audio_thread(void *data) {
     audio_thread_args_t *args = data;
     linked_list_t *files = args->files;
     av_pipeline_context_t *av_context = args->av_context;
+    trace_thread_name("audio");
     int err = asdcp_read_audio_files(files, av_context, encode_pcm24le_audio, av_context);
     if (err && !keep_running) {
         fprintf(stderr, "error audio thread\n");
-        stop_decoding_signal();
+        av_pipeline_stop();
     }
 
     fprintf(stderr, "exit extract_audio_thread\n");
@@ -518,21 +1852,30 @@ void* extract_audio_thread(void *data) {
     return NULL;
 }
 
-void* write_output_file_thread(void *data) {
+static void* write_output_file_thread(void *data) {
     av_pipeline_context_t *av_context = data;
     int audio_done = 0;
     int video_done = 0;
 
     OutputStream *video_st = &(av_context->video_stream);
     OutputStream *audio_st = &(av_context->audio_stream);
+    unsigned int video_packets_written = 0;
+    unsigned int audio_packets_written = 0;
+
+    trace_thread_name("write");
 
     while (keep_running && (!audio_done || !video_done)) {
         AVPacket *packet = NULL;
-        if (!video_done && av_compare_ts(
-                    video_st->next_pts,
+        int is_video = 0;
+        uint64_t wait_start = stage_now();
+        // go by what was muxed so far. next_pts of the encoders runs ahead by
+        // their queues, so video frames would wait in the muxer's interleaving
+        // buffer until the decoder caught up with the audio
+        if (!video_done && (audio_done || av_compare_ts(
+                    video_packets_written,
                     video_st->codec_context->time_base,
-                    audio_st->next_pts,
-                    audio_st->codec_context->time_base) <= 0) {
+                    (int64_t)audio_packets_written * audio_st->frame->nb_samples,
+                    audio_st->codec_context->time_base) <= 0)) {
             linked_list_t *head = blocked_pop_queue(
                     &vid_packet_mutex,
                     &vid_packet_queue_s,
@@ -549,6 +1892,7 @@ void* write_output_file_thread(void *data) {
                 video_done = 1;
                 continue;
             } 
+            is_video = 1;
         } else {
             linked_list_t *head = blocked_pop_queue(
                     &aud_packet_mutex,
@@ -569,11 +1913,30 @@ void* write_output_file_thread(void *data) {
         }
 
         if (packet) {
+            metrics_stage_idle(METRICS_STAGE_WRITE, wait_start);
+            uint64_t write_start = stage_now();
+            int size = packet->size;
             int err = av_interleaved_write_frame(av_context->format_context, packet);
             if (err) {
                 fprintf(stderr, "error av_interleaved_write_frame: %s\n", av_err2str(err));
                 keep_running = 0;
             }
+            budget_give(size);
+            metrics_stage_busy(METRICS_STAGE_WRITE, write_start, size);
+            if (is_video) {
+                trace_span("mux queue wait", video_packets_written, wait_start);
+                trace_span("mux video", video_packets_written, write_start);
+                metrics_frame_written(video_packets_written++);
+            } else {
+                trace_span("mux audio", audio_packets_written++, write_start);
+            }
+            // the muxer interleaves, the first video frame leaves it once
+            // both streams have a packet. don't let it wait in the avio buffer
+            if (!first_frame_out && video_packets_written && audio_packets_written) {
+                avio_flush(av_context->format_context->pb);
+                metrics_first_frame_out();
+                first_frame_out = 1;
+            }
 
             free(packet);
         }
@@ -583,7 +1946,7 @@ void* write_output_file_thread(void *data) {
     return NULL;
 }
 
-int init_audio_output(av_pipeline_context_t *av_context, asset_t *asset) {
+static int init_audio_output(av_pipeline_context_t *av_context, asset_t *asset) {
     int err = 0;
     
     av_context->audio_codec = avcodec_find_encoder(AV_CODEC_ID_PCM_S24LE);
@@ -671,15 +2034,69 @@ err_and_out:
     return err;
 }
 
-int init_video_output(av_pipeline_context_t *av_context, asset_t *asset) {
+static int encoder_takes(const AVCodec *codec, enum AVPixelFormat pix_fmt) {
+    const enum AVPixelFormat *p = codec->pix_fmts;
+    while (p && *p != AV_PIX_FMT_NONE && *p != pix_fmt) {
+        p++;
+    }
+    return p && *p != AV_PIX_FMT_NONE;
+}
+
+// pixel format, threads and profile of the encoders fed with send/receive.
+// they take the Y'CbCr planes at the subsampling of CDCI essence, and the
+// G, B, R planes of RGBA essence at 12 bits when it has them and the
+// encoder takes them
+static int init_send_receive_encoder(av_pipeline_context_t *av_context, cpl_cdci_descriptor *cdci_desc, cpl_rgba_descriptor *rgba_desc) {
+    AVCodecContext *c = av_context->video_stream.codec_context;
+    AVCodec *codec = av_context->video_codec;
+
+    enum AVPixelFormat pix_fmt = AV_PIX_FMT_YUV444P10;
+    if (rgba_desc) {
+        pix_fmt = AV_PIX_FMT_GBRP10;
+        if (rgba_desc->component_max_ref > 1023 && encoder_takes(codec, AV_PIX_FMT_GBRP12)) {
+            pix_fmt = AV_PIX_FMT_GBRP12;
+        }
+    } else if (cdci_desc->horizontal_subsampling == 2) {
+        pix_fmt = cdci_desc->vertical_subsampling == 2 ? AV_PIX_FMT_YUV420P10 : AV_PIX_FMT_YUV422P10;
+    }
+    if (!encoder_takes(codec, pix_fmt)) {
+        fprintf(stderr, "%s can't encode %s\n", codec->name, av_get_pix_fmt_name(pix_fmt));
+        return 1;
+    }
+    c->pix_fmt = pix_fmt;
+
+    if (codec->id == AV_CODEC_ID_DNXHD) {
+        // DNxHR takes any frame size, the DNxHD profiles only a few
+        int is_444 = pix_fmt == AV_PIX_FMT_YUV444P10 || pix_fmt == AV_PIX_FMT_GBRP10;
+        av_opt_set(c->priv_data, "profile", is_444 ? "dnxhr_444" : "dnxhr_hqx", 0);
+    } else if (codec->id == AV_CODEC_ID_FFV1) {
+        // version 3 splits frames into slices that are coded on slice threads
+        c->level = 3;
+    }
+
+    // intra only encoders do whole frames on frame threads, slices
+    // otherwise. this runs alongside openjpeg's threads
+    c->thread_count = av_context->num_threads > 1 ? av_context->num_threads : 1;
+    c->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    av_context->encode_ycbcr = !rgba_desc;
+    return 0;
+}
+
+static int init_video_output(av_pipeline_context_t *av_context, asset_t *asset) {
     // set libav
     int averr = 0;
 
-    av_context->video_codec = avcodec_find_encoder(AV_CODEC_ID_R210);
-    if (!av_context->video_codec) {
-        fprintf(stderr, "error finding codec for r210\n");
-        averr = 1;
-        goto err_and_out;
+    // no encoder for -c copy, the codec context only carries the stream
+    // parameters and time base
+    const char *encoder = av_context->video_encoder ? av_context->video_encoder : "r210";
+    if (!av_context->passthrough) {
+        av_context->video_codec = avcodec_find_encoder_by_name(encoder);
+        if (!av_context->video_codec || av_context->video_codec->type != AVMEDIA_TYPE_VIDEO) {
+            fprintf(stderr, "error finding video encoder %s\n", encoder);
+            averr = 1;
+            goto err_and_out;
+        }
     }
     av_context->video_stream.stream = avformat_new_stream(av_context->format_context, NULL);
     if (!av_context->video_stream.stream) {
@@ -712,11 +2129,16 @@ int init_video_output(av_pipeline_context_t *av_context, asset_t *asset) {
     float fps;
     if (asset->picture_type == PICTURE_TYPE_CDCI) {
         cdci_desc = asset->essence_descriptor;
-        stored_width = cdci_desc->stored_width;
-        stored_height = cdci_desc->stored_height;
+        // decoded images are smaller when resolution levels are dropped
+        stored_width = ceildivpow2(cdci_desc->stored_width, av_context->reduce);
+        stored_height = ceildivpow2(cdci_desc->stored_height, av_context->reduce);
         fps = (float)edit_rate.num / (float)edit_rate.denom;
     } else if (asset->picture_type == PICTURE_TYPE_RGBA) {
-        //rgba_desc = asset->essence_descriptor;
+        rgba_desc = asset->essence_descriptor;
+        stored_width = ceildivpow2(rgba_desc->stored_width, av_context->reduce);
+        stored_height = ceildivpow2(rgba_desc->stored_height, av_context->reduce);
+        fps = (float)edit_rate.num / (float)edit_rate.denom;
+        av_context->rgb_essence = 1;
     }
     if (!cdci_desc && !rgba_desc) {
         fprintf(stderr, "couldnt find essence descriptor to init codecs\n");
@@ -726,7 +2148,12 @@ int init_video_output(av_pipeline_context_t *av_context, asset_t *asset) {
 
     fprintf(stderr, "init with w: %d, h: %d, r: %d/%d, fps: %f\n", stored_width, stored_height, edit_rate.num, edit_rate.denom, fps);
 
-    av_context->video_stream.codec_context->codec_id = AV_CODEC_ID_R210;
+    if (av_context->passthrough) {
+        av_context->video_stream.codec_context->codec_type = AVMEDIA_TYPE_VIDEO;
+        av_context->video_stream.codec_context->codec_id = AV_CODEC_ID_JPEG2000;
+    } else {
+        av_context->video_stream.codec_context->codec_id = av_context->video_codec->id;
+    }
     // TODO: get this from CPL
     av_context->video_stream.codec_context->width = stored_width;
     av_context->video_stream.codec_context->height = stored_height;
@@ -735,12 +2162,26 @@ int init_video_output(av_pipeline_context_t *av_context, asset_t *asset) {
     av_context->video_stream.codec_context->time_base = av_context->video_stream.stream->time_base;
     // set framerate
     av_context->format_context->streams[0]->r_frame_rate = (AVRational){ edit_rate.num, edit_rate.denom};
-    av_context->video_stream.codec_context->pix_fmt = AV_PIX_FMT_GBRP10;
+    if (av_context->passthrough) {
+        // the codestreams go out as they are
+        goto parameters_and_out;
+    } else if (av_context->video_codec->id == AV_CODEC_ID_R210) {
+        av_context->video_stream.codec_context->pix_fmt = AV_PIX_FMT_GBRP10;
+    } else {
+        averr = init_send_receive_encoder(av_context, cdci_desc, rgba_desc);
+        if (averr != 0) {
+            goto err_and_out;
+        }
+    }
+    // extradata is written on open
+    if (av_context->format_context->oformat->flags & AVFMT_GLOBALHEADER) {
+        av_context->video_stream.codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
 
     // allocate codec
     averr = avcodec_open2(av_context->video_stream.codec_context, av_context->video_codec, &av_context->encode_ops);
     if (averr != 0) {
-        fprintf(stderr, "error avcodec_open2\n");
+        fprintf(stderr, "error avcodec_open2: %s\n", av_err2str(averr));
         goto err_and_out;
     }
     // allocate frame that we reuse for encoding
@@ -754,10 +2195,7 @@ int init_video_output(av_pipeline_context_t *av_context, asset_t *asset) {
         goto err_and_out;
     }
 
-    if (av_context->format_context->oformat->flags & AVFMT_GLOBALHEADER) {
-        av_context->video_stream.codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-    }
-
+parameters_and_out:
     averr = avcodec_parameters_from_context(av_context->video_stream.stream->codecpar, av_context->video_stream.codec_context);
     if (averr != 0) {
         fprintf(stderr, "error copying avcodec_parameters\n");
@@ -768,7 +2206,7 @@ err_and_out:
     return averr;
 }
 
-void close_stream(OutputStream *ost) {
+static void close_stream(OutputStream *ost) {
     if (ost->codec_context) {
         avcodec_free_context(&ost->codec_context);
     }
@@ -781,6 +2219,11 @@ int av_pipeline_run(linked_list_t *video_files, linked_list_t *audio_files, av_p
         // setup openjpeg2000
     opj_dparameters_t core;
     opj_set_default_decoder_parameters(&core);
+    core.cp_reduce = av_context->reduce;
+    core.cp_layer = av_context->max_layers;
+    if (av_context->max_frame_bytes) {
+        core.flags |= OPJ_DPARAMETERS_ALLOW_TRUNCATION_FLAG;
+    }
 
     av_context->user_data = &core;
 
@@ -791,9 +2234,11 @@ int av_pipeline_run(linked_list_t *video_files, linked_list_t *audio_files, av_p
         goto free_and_out;
     }
     
-    err = avformat_alloc_output_context2(&av_context->format_context, NULL, "nut", NULL);
+    // the container of an output file goes by its name
+    const char *output_file = av_context->output_path ? av_context->output_path : "pipe:1";
+    err = avformat_alloc_output_context2(&av_context->format_context, NULL, av_context->output_path ? NULL : "nut", av_context->output_path);
     if (err < 0 || !&av_context->format_context) {
-        fprintf(stderr, "error creating output context\n");
+        fprintf(stderr, "error creating output context for %s\n", output_file);
         goto free_and_out;
     }
 
@@ -820,7 +2265,6 @@ int av_pipeline_run(linked_list_t *video_files, linked_list_t *audio_files, av_p
     }
 
     // open output
-    const char *output_file = "pipe:1";
     av_dump_format(av_context->format_context, 0, output_file, 1);
 
     err = avio_open(&av_context->format_context->pb, output_file, AVIO_FLAG_WRITE);
@@ -836,16 +2280,89 @@ int av_pipeline_run(linked_list_t *video_files, linked_list_t *audio_files, av_p
     }
 
     keep_running = 1;
+    video_failed = 0;
+    video_frames_read = 0;
+    first_frame_out = 0;
+    next_packet_frame = 0;
+
+    budget_init(av_context->memory_budget);
+    if (av_context->memory_budget) {
+        fprintf(stderr, "memory budget %llu MB\n", (unsigned long long)(av_context->memory_budget >> 20));
+    }
+
+    // decoded planes and packets of the previous frames get reused. what is
+    // idle in the pool is not in flight, it gets a quarter on top of the budget
+    if (!av_context->no_frame_pool) {
+        frame_pool_init(av_context->memory_budget / 4);
+        opj_set_image_data_allocator(frame_pool_alloc, frame_pool_free);
+    }
 
     pthread_t extract_audio_thread_id;
-    pthread_t decoding_queue_thread_id;
     pthread_t write_interleaved_thread_id;
 
     pthread_mutex_init(&decoding_mutex, NULL);
     pthread_mutex_init(&vid_packet_mutex, NULL);
     pthread_mutex_init(&aud_packet_mutex, NULL);
-    // start jpeg2000 decoding thread
-    pthread_create(&decoding_queue_thread_id, NULL, jpeg2000_to_r210_thread, av_context);
+    pthread_mutex_init(&decrypt_mutex, NULL);
+
+    err = metrics_start(av_context->metrics_fd, av_context->metrics_prom_path, sample_queue_depths);
+    if (err) {
+        goto close_and_out;
+    }
+    err = trace_start(av_context->trace_path, sample_queue_depths);
+    if (err) {
+        metrics_stop();
+        goto close_and_out;
+    }
+    // reader runs on this thread
+    trace_thread_name("read");
+    video_read_resumed_ns = stage_now();
+    audio_read_resumed_ns = video_read_resumed_ns;
+
+    pthread_t *decrypt_thread_ids = NULL;
+    if (av_context->content_keys) {
+        if (av_context->num_decrypt_threads < 1) {
+            av_context->num_decrypt_threads = 1;
+        }
+        decrypt_thread_ids = (pthread_t*)malloc(sizeof(pthread_t) * av_context->num_decrypt_threads);
+        for (int i = 0; i < av_context->num_decrypt_threads; ++i) {
+            pthread_create(&decrypt_thread_ids[i], NULL, decrypt_frames_thread, av_context);
+        }
+    } else {
+        av_context->num_decrypt_threads = 0;
+    }
+    // start jpeg2000 decoding threads, with -N one per node that splits the
+    // openjpeg threads with the others. otherwise the openjpeg threads are
+    // shared by all of them
+    int num_decode_workers = 1;
+    if (av_context->passthrough) {
+        // nothing gets decoded, one thread hands the codestreams on in order
+    } else if (av_context->numa) {
+        num_decode_workers = numa_place_init();
+    } else {
+        if (av_context->frames_in_flight > 1) {
+            num_decode_workers = av_context->frames_in_flight;
+        }
+        // NULL without thread support, each codec then decodes on its own
+        decode_pool = opj_create_shared_thread_pool(av_context->num_threads);
+    }
+    decode_worker_t *decode_workers = (decode_worker_t*)malloc(sizeof(decode_worker_t) * num_decode_workers);
+    pthread_t *decoding_queue_thread_ids = (pthread_t*)malloc(sizeof(pthread_t) * num_decode_workers);
+    for (int i = 0; i < num_decode_workers; ++i) {
+        decode_workers[i].av_context = av_context;
+        decode_workers[i].node = av_context->numa ? i : -1;
+        decode_workers[i].num_threads = av_context->num_threads;
+        if (av_context->numa && num_decode_workers > 1) {
+            int node_threads = av_context->num_threads / num_decode_workers;
+            if (node_threads > numa_place_num_cpus(i)) {
+                node_threads = numa_place_num_cpus(i);
+            }
+            decode_workers[i].num_threads = node_threads > 1 ? node_threads : 1;
+            fprintf(stderr, "decode worker on node %d with %d threads\n", i, decode_workers[i].num_threads);
+        }
+        pthread_create(&decoding_queue_thread_ids[i], NULL,
+                       av_context->passthrough ? rewrap_codestreams_thread : jpeg2000_to_r210_thread, &decode_workers[i]);
+    }
     // start encoding thread for avcodec
     pthread_create(&write_interleaved_thread_id, NULL, write_output_file_thread, av_context);
 
@@ -861,11 +2378,44 @@ int av_pipeline_run(linked_list_t *video_files, linked_list_t *audio_files, av_p
 
     pthread_join(extract_audio_thread_id, NULL);
     fprintf(stderr, "extract_audio done\n");
-    pthread_join(decoding_queue_thread_id, NULL);
+    for (int i = 0; i < av_context->num_decrypt_threads; ++i) {
+        pthread_join(decrypt_thread_ids[i], NULL);
+    }
+    free(decrypt_thread_ids);
+    fprintf(stderr, "decrypt done\n");
+    for (int i = 0; i < num_decode_workers; ++i) {
+        pthread_join(decoding_queue_thread_ids[i], NULL);
+    }
+    free(decoding_queue_thread_ids);
+    free(decode_workers);
+    // the codecs and job groups of the workers are gone, this stops the threads
+    if (decode_pool) {
+        opj_destroy_shared_thread_pool(decode_pool);
+        decode_pool = NULL;
+    }
     fprintf(stderr, "decoding_queue done\n");
     pthread_join(write_interleaved_thread_id, NULL);
     fprintf(stderr, "write_interleaved done\n");
+    if (video_failed) {
+        err = 0;
+    }
     fprintf(stderr, "all threads done\n");
+    if (av_context->memory_budget) {
+        fprintf(stderr, "memory budget peak %llu MB\n", (unsigned long long)(budget_peak() >> 20));
+    }
+    if (!av_context->no_frame_pool) {
+        frame_pool_stats_t pool_stats;
+        frame_pool_stats(&pool_stats);
+        fprintf(stderr, "frame pool: %u buffers, %llu MB mapped (%llu MB hugetlbfs), %u of %u allocations reused\n",
+                pool_stats.buffers,
+                (unsigned long long)(pool_stats.mapped_bytes >> 20),
+                (unsigned long long)(pool_stats.hugetlb_bytes >> 20),
+                pool_stats.reused,
+                pool_stats.allocs);
+        frame_pool_release();
+    }
+    metrics_stop();
+    trace_stop();
     av_write_trailer(av_context->format_context);
 
 close_and_out:
@@ -882,6 +2432,7 @@ free_and_out:
     pthread_mutex_destroy(&decoding_mutex);
     pthread_mutex_destroy(&vid_packet_mutex);
     pthread_mutex_destroy(&aud_packet_mutex);
+    pthread_mutex_destroy(&decrypt_mutex);
 
     return err;
 }
@@ -2,9 +2,14 @@
 #define AV_PIPELINE_H
 
 #include <libavformat/avformat.h>
+#include <pthread.h>
 #include "linked_list.h"
 #include "imf.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct {
     AVStream *stream;
     AVCodecContext *codec_context;
@@ -14,12 +19,93 @@ typedef struct {
     AVFrame *frame;
 } OutputStream;
 
+// first frame that failed HMAC verification
+typedef struct {
+    int failed;
+    // position in the composition
+    unsigned int timeline_frame;
+    // position in the track file
+    unsigned int frame;
+    char mxf_path[512];
+} integrity_report_t;
+
 typedef struct av_pipeline_context_s {
     void *user_data;
     int num_threads;
     int print_debug;
     unsigned int decode_frame_buffer_size;
 
+    // preview quality: resolution levels to drop, quality layers to decode
+    // (0 for all) and codestream bytes to decode per frame (0 for all)
+    int reduce;
+    int max_layers;
+    unsigned int max_frame_bytes;
+
+    // bytes the queued frames, packets and decoded images may take, the
+    // reader waits when they are used up. 0 for no limit
+    uint64_t memory_budget;
+
+    // -H: plain malloc for decoded planes and packets instead of the huge
+    // page backed frame pool
+    int no_frame_pool;
+
+    // -N: one decode worker per NUMA node, pinned to its CPUs and decoding
+    // into memory of that node. num_threads is split between them
+    int numa;
+
+    // -W: decode workers without -N. their codecs and the colour conversion
+    // and packing of their frames share one pool of num_threads threads, so
+    // the code-blocks of the next frame fill the gaps the DWT and the end of
+    // a frame leave
+    int frames_in_flight;
+
+    // asdcp_content_key_t for encrypted track files
+    linked_list_t *content_keys;
+    // number of threads decrypting video frames ahead of the decoder
+    int num_decrypt_threads;
+    // check HMAC values of encrypted frames
+    int verify_hmac;
+    integrity_report_t video_integrity;
+    integrity_report_t audio_integrity;
+
+    // -F: only the first resources are resolved before the pipeline starts,
+    // main appends the others to the asset lists while it runs. the read
+    // ahead stays short until the first frame is out
+    int fast_start;
+    // guards appending to and walking the asset lists
+    pthread_mutex_t assets_mutex;
+    // 1 once nothing gets appended to the asset lists anymore
+    int assets_resolved;
+
+    // -c: libavcodec encoder for the video, NULL for r210. anything else is
+    // fed with send/receive and its own frame and slice threads
+    const char *video_encoder;
+    // -c copy: the J2K codestreams are muxed as they are, nothing gets
+    // decoded
+    int passthrough;
+    // -X: directory the timeline is flattened into, NULL to run the
+    // pipeline
+    const char *flatten_dir;
+    // -D: -X may write encrypted track files decrypted, they are refused
+    // otherwise
+    int flatten_decrypt;
+    // -o: output file, the container goes by its extension. NULL for NUT
+    // on stdout
+    const char *output_path;
+    // the encoder takes the decoded Y'CbCr planes as they are, no
+    // conversion to RGB
+    int encode_ycbcr;
+    // RGBA essence, its codestreams decode to R, G, B that are packed as
+    // they are, color.c is never run
+    int rgb_essence;
+
+    // periodic JSON metrics line, -1 to disable
+    int metrics_fd;
+    // prometheus textfile, NULL to disable
+    const char *metrics_prom_path;
+    // chrome trace event file, NULL to disable
+    const char *trace_path;
+
     // libav related stuff
     OutputStream video_stream;
     OutputStream audio_stream;
@@ -32,8 +118,32 @@ typedef struct av_pipeline_context_s {
     cpl_composition_playlist *cpl;
 } av_pipeline_context_t;
 
-extern int stop_decoding_signal();
+extern int av_pipeline_stop();
+// 1 once av_pipeline_stop was called
+extern int av_pipeline_stopped();
+
+// asset after asset in video_files / audio_files, waits while it is still
+// being resolved. NULL at the end of the list
+extern linked_list_t *av_pipeline_next_asset(av_pipeline_context_t *av_context, linked_list_t *asset);
 
 extern int av_pipeline_run(linked_list_t *video_files, linked_list_t *audio_files, av_pipeline_context_t *parameters);
 
+// decodes single frames away from av_pipeline_run, for libimffs. the codecs
+// and images stay with it from frame to frame like with the decode workers
+typedef struct av_pipeline_decoder_s av_pipeline_decoder_t;
+
+// av_context->user_data holds the opj_dparameters_t, num_threads openjpeg
+// threads. not thread safe, one decoder per thread
+extern av_pipeline_decoder_t *av_pipeline_create_decoder(av_pipeline_context_t *av_context, int num_threads);
+// decodes the codestream into 16 bit planes of frame, AV_PIX_FMT_GBRP16 or,
+// with encode_ycbcr, AV_PIX_FMT_YUV444P16 / YUV422P16 / YUV420P16. the
+// buffers of frame get replaced when format or size change. *depth gets the
+// bits of the samples. returns 0 on success
+extern int av_pipeline_decode_frame(av_pipeline_decoder_t *decoder, unsigned char *frame_buf, unsigned int frame_size, unsigned int timeline_frame, AVFrame *frame, int *depth);
+extern void av_pipeline_free_decoder(av_pipeline_decoder_t *decoder);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,369 @@
+// microbenchmark for the per pixel/sample loops of the pipeline: sycc to rgb
+// (color.c), packing into the r210 planes and pcm24 widening (pack.c).
+// every kernel's output is compared against the plain scalar reference below.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <openjpeg-2.3/openjpeg.h>
+#include "color.h"
+#include "pack.h"
+
+#define PCM_SECONDS 10
+#define PCM_SAMPLE_RATE 48000
+#define PCM_CHANNELS 2
+
+typedef struct {
+    const char *name;
+    int width;
+    int height;
+} frame_size_t;
+
+static const frame_size_t frame_sizes[] = {
+    { "hd", 1920, 1080 },
+    { "uhd", 3840, 2160 },
+    { "8k", 7680, 4320 },
+};
+
+static const int bit_depths[] = { 8, 10, 12 };
+
+typedef struct {
+    int iterations;
+    const char *kernel;
+    const char *size;
+    int bits;
+} bench_options_t;
+
+typedef struct {
+    double best_ns;
+    int ok;
+} bench_result_t;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static opj_image_t* create_image(int width, int height, int bits, int dx, int dy, OPJ_COLOR_SPACE color_space) {
+    opj_image_cmptparm_t cmptparm[3];
+    memset(cmptparm, 0, sizeof(cmptparm));
+    for (int i = 0; i < 3; ++i) {
+        cmptparm[i].dx = i ? dx : 1;
+        cmptparm[i].dy = i ? dy : 1;
+        cmptparm[i].w = (width + cmptparm[i].dx - 1) / cmptparm[i].dx;
+        cmptparm[i].h = (height + cmptparm[i].dy - 1) / cmptparm[i].dy;
+        cmptparm[i].prec = bits;
+        cmptparm[i].bpp = bits;
+    }
+    opj_image_t *image = opj_image_create(3, cmptparm, color_space);
+    if (image) {
+        image->x1 = width;
+        image->y1 = height;
+    }
+    return image;
+}
+
+// values spill a bit out of range on both sides so clamping gets exercised
+static void fill_image(opj_image_t *image, int spill) {
+    uint32_t seed = 0x12345678;
+    for (int c = 0; c < image->numcomps; ++c) {
+        opj_image_comp_t *comp = &image->comps[c];
+        int range = (1 << comp->prec) + 2 * spill;
+        size_t n = (size_t)comp->w * comp->h;
+        for (size_t i = 0; i < n; ++i) {
+            comp->data[i] = (int)(next_random(&seed) % range) - spill;
+        }
+    }
+}
+
+static void copy_image_data(opj_image_t *dst, const opj_image_t *src) {
+    for (int c = 0; c < src->numcomps; ++c) {
+        memcpy(dst->comps[c].data, src->comps[c].data, sizeof(int) * src->comps[c].w * src->comps[c].h);
+    }
+}
+
+// --- scalar references, as simple as possible ---
+
+static void ref_sycc_to_rgb(int offset, int upb, int y, int cb, int cr, int *out_r, int *out_g, int *out_b) {
+    int r, g, b;
+
+    cb -= offset;
+    cr -= offset;
+    r = y + (int)(1.402 * (float)cr);
+    g = y - (int)(0.344 * (float)cb + 0.714 * (float)cr);
+    b = y + (int)(1.772 * (float)cb);
+    *out_r = r < 0 ? 0 : (r > upb ? upb : r);
+    *out_g = g < 0 ? 0 : (g > upb ? upb : g);
+    *out_b = b < 0 ? 0 : (b > upb ? upb : b);
+}
+
+// out gets 3 planes of w * h
+static void ref_sycc_image(const opj_image_t *image, int **out) {
+    const opj_image_comp_t *y = &image->comps[0];
+    const opj_image_comp_t *cb = &image->comps[1];
+    const opj_image_comp_t *cr = &image->comps[2];
+    int offset = 1 << (y->prec - 1);
+    int upb = (1 << y->prec) - 1;
+
+    for (size_t row = 0; row < y->h; ++row) {
+        for (size_t x = 0; x < y->w; ++x) {
+            size_t i = row * y->w + x;
+            size_t ci = (row / cb->dy) * cb->w + x / cb->dx;
+            ref_sycc_to_rgb(offset, upb, y->data[i], cb->data[ci], cr->data[ci], &out[0][i], &out[1][i], &out[2][i]);
+        }
+    }
+}
+
+static void ref_pack_image_gbrp16(const opj_image_t *image, unsigned char **planes, const int *linesizes) {
+    int comp_table[3] = { 1, 2, 0 };
+    int w = (int)image->comps[0].w;
+    int h = (int)image->comps[0].h;
+
+    for (int i = 0; i < 3; i++) {
+        const opj_image_comp_t *comp = &image->comps[comp_table[i]];
+        int mask = (1 << comp->prec) - 1;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                int v = comp->data[y * w + x];
+                if (v > 65535) {
+                    v = 65535;
+                } else if (v < 0) {
+                    v = 0;
+                }
+                v &= mask;
+                planes[i][y * linesizes[i] + 2 * x] = v & 0xff;
+                planes[i][y * linesizes[i] + 2 * x + 1] = v >> 8;
+            }
+        }
+    }
+}
+
+static void ref_pcm24le_to_s32(const unsigned char *src, unsigned char *dst, unsigned int num_samples) {
+    for (unsigned int i = 0; i < num_samples; ++i) {
+        int32_t v = (int32_t)((uint32_t)src[3 * i] << 8 | (uint32_t)src[3 * i + 1] << 16 | (uint32_t)src[3 * i + 2] << 24);
+        memcpy(dst + 4 * i, &v, 4);
+    }
+}
+
+// --- kernels ---
+
+static int bench_sycc(const bench_options_t *opts, int width, int height, int bits, int dx, int dy, bench_result_t *res) {
+    opj_image_t *src = create_image(width, height, bits, dx, dy, OPJ_CLRSPC_SYCC);
+    int *ref[3];
+    if (!src) {
+        return 1;
+    }
+    fill_image(src, 0);
+
+    size_t n = (size_t)width * height;
+    for (int c = 0; c < 3; ++c) {
+        ref[c] = malloc(sizeof(int) * n);
+    }
+    ref_sycc_image(src, ref);
+
+    res->best_ns = 0;
+    res->ok = 1;
+    for (int it = 0; it < opts->iterations; ++it) {
+        // color_sycc_to_rgb replaces the component buffers, so every run needs a fresh image
+        opj_image_t *image = create_image(width, height, bits, dx, dy, OPJ_CLRSPC_SYCC);
+        copy_image_data(image, src);
+
+        uint64_t start = now_ns();
+        color_sycc_to_rgb(image);
+        double ns = now_ns() - start;
+        if (it == 0 || ns < res->best_ns) {
+            res->best_ns = ns;
+        }
+
+        if (it == 0) {
+            for (int c = 0; c < 3; ++c) {
+                if (image->comps[c].w != width || image->comps[c].h != height
+                        || memcmp(image->comps[c].data, ref[c], sizeof(int) * n)) {
+                    res->ok = 0;
+                }
+            }
+        }
+        opj_image_destroy(image);
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        free(ref[c]);
+    }
+    opj_image_destroy(src);
+    return 0;
+}
+
+static int bench_pack(const bench_options_t *opts, int width, int height, int bits, bench_result_t *res) {
+    opj_image_t *image = create_image(width, height, bits, 1, 1, OPJ_CLRSPC_SRGB);
+    if (!image) {
+        return 1;
+    }
+    fill_image(image, 64);
+
+    // padded like av_frame_get_buffer does
+    int linesize = (2 * width + 63) & ~63;
+    int linesizes[3] = { linesize, linesize, linesize };
+    unsigned char *planes[3], *ref_planes[3];
+    for (int i = 0; i < 3; ++i) {
+        planes[i] = calloc(1, (size_t)linesize * height);
+        ref_planes[i] = calloc(1, (size_t)linesize * height);
+    }
+    ref_pack_image_gbrp16(image, ref_planes, linesizes);
+
+    res->best_ns = 0;
+    res->ok = 1;
+    for (int it = 0; it < opts->iterations; ++it) {
+        uint64_t start = now_ns();
+        pack_image_gbrp16(image, planes, linesizes);
+        double ns = now_ns() - start;
+        if (it == 0 || ns < res->best_ns) {
+            res->best_ns = ns;
+        }
+    }
+    for (int i = 0; i < 3; ++i) {
+        for (int y = 0; y < height; ++y) {
+            if (memcmp(planes[i] + (size_t)y * linesize, ref_planes[i] + (size_t)y * linesize, 2 * width)) {
+                res->ok = 0;
+            }
+        }
+        free(planes[i]);
+        free(ref_planes[i]);
+    }
+    opj_image_destroy(image);
+    return 0;
+}
+
+static int bench_pcm(const bench_options_t *opts, bench_result_t *res) {
+    unsigned int num_samples = PCM_SECONDS * PCM_SAMPLE_RATE * PCM_CHANNELS;
+    unsigned char *src = malloc(3 * num_samples);
+    unsigned char *dst = aligned_alloc(64, 4 * num_samples);
+    unsigned char *ref = malloc(4 * num_samples);
+    uint32_t seed = 0x87654321;
+    for (unsigned int i = 0; i < 3 * num_samples; ++i) {
+        src[i] = next_random(&seed);
+    }
+    ref_pcm24le_to_s32(src, ref, num_samples);
+
+    res->best_ns = 0;
+    for (int it = 0; it < opts->iterations; ++it) {
+        uint64_t start = now_ns();
+        pack_pcm24le_to_s32(src, dst, num_samples);
+        double ns = now_ns() - start;
+        if (it == 0 || ns < res->best_ns) {
+            res->best_ns = ns;
+        }
+    }
+    res->ok = !memcmp(dst, ref, 4 * num_samples);
+
+    free(src);
+    free(dst);
+    free(ref);
+    return 0;
+}
+
+static void print_result(const char *kernel, const char *size, int bits, double units, double bytes, bench_result_t *res) {
+    printf("%-14s %-5s %3d %10.3f %9.2f   %s\n",
+            kernel, size, bits, res->best_ns / units, bytes / res->best_ns, res->ok ? "ok" : "MISMATCH");
+}
+
+static int selected(const char *filter, const char *name) {
+    return !filter || !strcmp(filter, name);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: bench_kernels [options]\n");
+    fprintf(stderr, "\t-n iterations\truns per case, the fastest is reported (default 5)\n");
+    fprintf(stderr, "\t-k kernel\tonly run sycc444, sycc422, sycc420, pack_gbrp16 or pcm24_to_s32\n");
+    fprintf(stderr, "\t-s size\t\tonly run hd, uhd or 8k\n");
+    fprintf(stderr, "\t-b bits\t\tonly run 8, 10 or 12 bit\n");
+}
+
+int main(int argc, char **argv) {
+    bench_options_t opts;
+    memset(&opts, 0, sizeof(bench_options_t));
+    opts.iterations = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:k:s:b:")) != -1) {
+        switch (opt) {
+            case 'n':
+                opts.iterations = atoi(optarg);
+                break;
+            case 'k':
+                opts.kernel = optarg;
+                break;
+            case 's':
+                opts.size = optarg;
+                break;
+            case 'b':
+                opts.bits = atoi(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (opts.iterations <= 0) {
+        usage();
+        return 1;
+    }
+
+    int failed = 0;
+    bench_result_t res;
+
+    // ns per luma pixel (per sample for pcm), GB/s of bytes read + written
+    printf("%-14s %-5s %3s %10s %9s   %s\n", "kernel", "size", "bit", "ns/px", "GB/s", "check");
+
+    for (int s = 0; s < sizeof(frame_sizes) / sizeof(frame_sizes[0]); ++s) {
+        const frame_size_t *fs = &frame_sizes[s];
+        if (opts.size && strcmp(opts.size, fs->name)) {
+            continue;
+        }
+        double pixels = (double)fs->width * fs->height;
+
+        for (int b = 0; b < sizeof(bit_depths) / sizeof(bit_depths[0]); ++b) {
+            int bits = bit_depths[b];
+            if (opts.bits && opts.bits != bits) {
+                continue;
+            }
+
+            if (selected(opts.kernel, "sycc444") && !bench_sycc(&opts, fs->width, fs->height, bits, 1, 1, &res)) {
+                print_result("sycc444", fs->name, bits, pixels, pixels * (12 + 12), &res);
+                failed |= !res.ok;
+            }
+            if (selected(opts.kernel, "sycc422") && !bench_sycc(&opts, fs->width, fs->height, bits, 2, 1, &res)) {
+                print_result("sycc422", fs->name, bits, pixels, pixels * (8 + 12), &res);
+                failed |= !res.ok;
+            }
+            if (selected(opts.kernel, "sycc420") && !bench_sycc(&opts, fs->width, fs->height, bits, 2, 2, &res)) {
+                print_result("sycc420", fs->name, bits, pixels, pixels * (6 + 12), &res);
+                failed |= !res.ok;
+            }
+            if (selected(opts.kernel, "pack_gbrp16") && !bench_pack(&opts, fs->width, fs->height, bits, &res)) {
+                print_result("pack_gbrp16", fs->name, bits, pixels, pixels * (12 + 6), &res);
+                failed |= !res.ok;
+            }
+        }
+    }
+
+    // frame size and bit depth don't apply to audio
+    if (selected(opts.kernel, "pcm24_to_s32") && !opts.size && !opts.bits && !bench_pcm(&opts, &res)) {
+        double samples = (double)PCM_SECONDS * PCM_SAMPLE_RATE * PCM_CHANNELS;
+        print_result("pcm24_to_s32", "10s", 24, samples, samples * (3 + 4), &res);
+        failed |= !res.ok;
+    }
+
+    return failed;
+}
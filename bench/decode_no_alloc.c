@@ -0,0 +1,276 @@
+// checks that av_pipeline_decode_frame, once warmed up, decodes frame after
+// frame without going to the heap: the codecs, images, tile grid, tile bands
+// and the AVFrame are all kept by the decoder. the codestream is a synthetic
+// tiled 3 component one unless one is given, it is decoded with one thread
+// (opj_decode) and with several (the tile bands of decode_tiles_parallel).
+//
+// only allocations of the calling thread are counted, the scratch buffers of
+// openjpeg's threads grow until each of them has seen the biggest code-block,
+// which depends on how the jobs were scheduled.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <openjpeg-2.3/openjpeg.h>
+#include <libavutil/pixdesc.h>
+#include "av_pipeline.h"
+
+#define NUM_FRAMES 6
+// the first frame creates everything, the second one gives openjpeg a buffer
+// to swap with the image of the first
+#define WARMUP_FRAMES 2
+
+#define WIDTH 1024
+#define HEIGHT 512
+#define TILE_SIZE 256
+#define BITS 10
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+// only set in the decoding thread
+static __thread int counting = 0;
+static volatile int allocations = 0;
+
+static void count() {
+    if (counting) {
+        __sync_fetch_and_add(&allocations, 1);
+    }
+}
+
+void *malloc(size_t size) {
+    count();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    count();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    count();
+    void *ptr = __libc_memalign(alignment, size);
+    if (!ptr) {
+        return 12; // ENOMEM
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+static void quiet_callback(const char *msg, void *client_data) {
+}
+
+// irreversible, multi tile, the way IMF App 2E essence mostly comes. written
+// to path
+static int encode_codestream(const char *path) {
+    opj_image_cmptparm_t cmptparm[3];
+    memset(cmptparm, 0, sizeof(cmptparm));
+    for (int c = 0; c < 3; c++) {
+        cmptparm[c].dx = 1;
+        cmptparm[c].dy = 1;
+        cmptparm[c].w = WIDTH;
+        cmptparm[c].h = HEIGHT;
+        cmptparm[c].prec = BITS;
+        cmptparm[c].bpp = BITS;
+    }
+    opj_image_t *image = opj_image_create(3, cmptparm, OPJ_CLRSPC_SRGB);
+    if (!image) {
+        return 0;
+    }
+    image->x1 = WIDTH;
+    image->y1 = HEIGHT;
+
+    // gradients with some noise, something the wavelet has to work for
+    uint32_t seed = 0x12345678;
+    for (int c = 0; c < 3; c++) {
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x++) {
+                seed = seed * 1664525 + 1013904223;
+                int v = ((x + c * 300) * 3 + y * (c + 1)) % (1 << BITS) + (int)(seed >> 28) - 8;
+                image->comps[c].data[y * WIDTH + x] = v < 0 ? 0 : (v >= (1 << BITS) ? (1 << BITS) - 1 : v);
+            }
+        }
+    }
+
+    opj_cparameters_t parameters;
+    opj_set_default_encoder_parameters(&parameters);
+    parameters.tile_size_on = OPJ_TRUE;
+    parameters.cp_tdx = TILE_SIZE;
+    parameters.cp_tdy = TILE_SIZE;
+    parameters.irreversible = 1;
+    parameters.tcp_mct = 1;
+    parameters.tcp_numlayers = 1;
+    parameters.tcp_rates[0] = 0;
+    parameters.cp_disto_alloc = 1;
+
+    int ok = 0;
+    opj_codec_t *codec = opj_create_compress(OPJ_CODEC_J2K);
+    opj_stream_t *stream = NULL;
+    if (codec) {
+        opj_set_warning_handler(codec, quiet_callback, NULL);
+        opj_set_info_handler(codec, quiet_callback, NULL);
+        stream = opj_stream_create_default_file_stream(path, OPJ_FALSE);
+    }
+    if (stream) {
+        ok = opj_setup_encoder(codec, &parameters, image)
+            && opj_start_compress(codec, image, stream)
+            && opj_encode(codec, stream)
+            && opj_end_compress(codec, stream);
+        opj_stream_destroy(stream);
+    }
+    if (codec) {
+        opj_destroy_codec(codec);
+    }
+    opj_image_destroy(image);
+    return ok;
+}
+
+static unsigned char *read_file(const char *path, unsigned int *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *buf = malloc(len > 0 ? len : 1);
+    if (buf && fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    if (!buf) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return NULL;
+    }
+    *size = (unsigned int)len;
+    return buf;
+}
+
+static uint32_t checksum(const AVFrame *frame) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    uint32_t sum = 0;
+    for (int p = 0; p < 3; p++) {
+        int w = p ? AV_CEIL_RSHIFT(frame->width, desc->log2_chroma_w) : frame->width;
+        int h = p ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+        for (int y = 0; y < h; y++) {
+            const uint16_t *row = (const uint16_t *)(frame->data[p] + (size_t)y * frame->linesize[p]);
+            for (int x = 0; x < w; x++) {
+                sum = sum * 31 + row[x];
+            }
+        }
+    }
+    return sum;
+}
+
+// decodes the codestream NUM_FRAMES times with num_threads, 0 if it neither
+// allocated after the warmup nor decoded differently
+static int run(unsigned char *buf, unsigned int size, int num_threads) {
+    opj_dparameters_t core;
+    opj_set_default_decoder_parameters(&core);
+
+    av_pipeline_context_t av_context;
+    memset(&av_context, 0, sizeof(av_context));
+    av_context.user_data = &core;
+    av_context.num_threads = num_threads;
+    av_context.metrics_fd = -1;
+
+    int failed = 1;
+    uint32_t first_sum = 0;
+    AVFrame *frame = av_frame_alloc();
+    av_pipeline_decoder_t *decoder = av_pipeline_create_decoder(&av_context, num_threads);
+    if (!frame || !decoder) {
+        fprintf(stderr, "cannot create the decoder\n");
+        goto free_and_out;
+    }
+
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        int depth = 0;
+
+        allocations = 0;
+        counting = i >= WARMUP_FRAMES;
+        int err = av_pipeline_decode_frame(decoder, buf, size, i, frame, &depth);
+        counting = 0;
+        if (err) {
+            fprintf(stderr, "decoding frame %d failed [threads: %d]\n", i, num_threads);
+            goto free_and_out;
+        }
+
+        uint32_t sum = checksum(frame);
+        if (i == 0) {
+            first_sum = sum;
+        } else if (sum != first_sum) {
+            fprintf(stderr, "frame %d decoded differently [threads: %d]\n", i, num_threads);
+            goto free_and_out;
+        }
+        if (allocations) {
+            fprintf(stderr, "frame %d made %d allocations [threads: %d]\n", i, allocations, num_threads);
+            goto free_and_out;
+        }
+    }
+    printf("%d threads: OK\n", num_threads);
+    failed = 0;
+
+free_and_out:
+    av_pipeline_free_decoder(decoder);
+    av_frame_free(&frame);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/decode_no_alloc_XXXXXX";
+    const char *input = argc > 1 ? argv[1] : NULL;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: decode_no_alloc [codestream.j2k]\n");
+        return 1;
+    }
+    if (!input) {
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            fprintf(stderr, "cannot create %s\n", path);
+            return 1;
+        }
+        close(fd);
+        if (!encode_codestream(path)) {
+            fprintf(stderr, "cannot encode %s\n", path);
+            unlink(path);
+            return 1;
+        }
+        input = path;
+    }
+
+    unsigned int size = 0;
+    unsigned char *buf = read_file(input, &size);
+    if (input == path) {
+        unlink(path);
+    }
+    if (!buf) {
+        return 1;
+    }
+
+    int failed = run(buf, size, 1) || run(buf, size, 4);
+    free(buf);
+    return failed;
+}
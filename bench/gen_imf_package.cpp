@@ -0,0 +1,769 @@
+// writes a synthetic IMF package (CPL, ASSETMAP, J2K CDCI or RGBA and PCM track files)
+// that imf_fs can play. frames are encoded once with openjpeg and then cycled,
+// so generating long packages is cheap.
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <KM_platform.h>
+#include <KM_util.h>
+#include <KM_fileio.h>
+#include <KM_prng.h>
+#include <AS_02.h>
+#include <openjpeg-2.3/openjpeg.h>
+
+using namespace ASDCP;
+
+const ui32_t AUDIO_SAMPLE_RATE = 48000;
+const ui32_t AUDIO_CHANNELS = 2;
+const ui32_t AUDIO_BITS = 24;
+
+typedef struct {
+    int width;
+    int height;
+    int bits;
+    int chroma_444;
+    // full range R, G, B with an RGBA descriptor instead of Y'CbCr
+    int rgb;
+    // 0 for a single tile
+    int tile_width;
+    int tile_height;
+    // quality layers, more than one switches to layer progression
+    int layers;
+    int unique_frames;
+    int frames_per_segment;
+    int segments;
+    int max_repeat;
+    float compression_ratio;
+    Rational edit_rate;
+    int encrypt;
+    byte_t key[16];
+    const char *out_dir;
+} gen_options_t;
+
+typedef struct {
+    byte_t *data;
+    ui32_t length;
+} codestream_t;
+
+typedef struct {
+    byte_t asset_uuid[16];
+    byte_t key_id[16];
+    std::string path;
+    ui64_t size;
+} track_file_t;
+
+static std::string urn(const byte_t *uuid) {
+    char buf[64];
+    Kumu::bin2UUIDhex(uuid, UUIDlen, buf, sizeof(buf));
+    return std::string("urn:uuid:") + buf;
+}
+
+static std::string random_urn() {
+    byte_t uuid[UUIDlen];
+    Kumu::GenRandomUUID(uuid);
+    return urn(uuid);
+}
+
+// xorshift, we want the same package for the same options
+static ui32_t next_random(ui32_t *state) {
+    ui32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// moving ramps plus some noise so the entropy coder has real work to do
+static opj_image_t* make_image(const gen_options_t *opts, int n) {
+    opj_image_cmptparm_t cmptparm[3];
+    memset(cmptparm, 0, sizeof(cmptparm));
+    for (int i = 0; i < 3; ++i) {
+        int dx = (i > 0 && !opts->chroma_444) ? 2 : 1;
+        cmptparm[i].dx = dx;
+        cmptparm[i].dy = 1;
+        cmptparm[i].w = (opts->width + dx - 1) / dx;
+        cmptparm[i].h = opts->height;
+        cmptparm[i].prec = opts->bits;
+        cmptparm[i].bpp = opts->bits;
+        cmptparm[i].sgnd = 0;
+    }
+
+    opj_image_t *image = opj_image_create(3, cmptparm, opts->rgb ? OPJ_CLRSPC_SRGB : OPJ_CLRSPC_SYCC);
+    if (!image) {
+        return NULL;
+    }
+    image->x0 = 0;
+    image->y0 = 0;
+    image->x1 = opts->width;
+    image->y1 = opts->height;
+
+    int max = (1 << opts->bits) - 1;
+    int mid = 1 << (opts->bits - 1);
+    ui32_t seed = 0x9e3779b9u ^ (n * 2654435761u);
+    for (int c = 0; c < 3; ++c) {
+        opj_image_comp_t *comp = &image->comps[c];
+        int *ptr = comp->data;
+        for (int y = 0; y < (int)comp->h; ++y) {
+            for (int x = 0; x < (int)comp->w; ++x) {
+                int v;
+                int noise = (int)(next_random(&seed) & 0x3f) - 32;
+                if (c == 0) {
+                    v = ((x * comp->dx + y + n * 16) % opts->width) * max / opts->width;
+                } else {
+                    v = mid + (int)((max / 4) * sin((x * comp->dx + n * 8) * 0.01 + c * y * 0.02));
+                }
+                v += noise << (opts->bits - 8);
+                *ptr++ = v < 0 ? 0 : (v > max ? max : v);
+            }
+        }
+    }
+    return image;
+}
+
+static int encode_frame(const gen_options_t *opts, opj_image_t *image, codestream_t *out) {
+    int err = 0;
+    opj_cparameters_t parameters;
+    opj_codec_t *codec = NULL;
+    opj_stream_t *stream = NULL;
+    opj_buffer_info_t buffer_info;
+    memset(&buffer_info, 0, sizeof(buffer_info));
+
+    opj_set_default_encoder_parameters(&parameters);
+    // roughly what IMF App 2E encoders write
+    parameters.irreversible = 1;
+    // RGB gets the irreversible colour transform like DCI / App 4 masters
+    parameters.tcp_mct = opts->rgb ? 1 : 0;
+    parameters.prog_order = OPJ_CPRL;
+    parameters.numresolution = 6;
+    parameters.cblockw_init = 32;
+    parameters.cblockh_init = 32;
+    parameters.tcp_numlayers = opts->layers;
+    // every layer below the last one halves the rate
+    for (int i = 0; i < opts->layers; ++i) {
+        parameters.tcp_rates[i] = opts->compression_ratio * (float)(1 << (opts->layers - 1 - i));
+    }
+    if (opts->layers > 1) {
+        parameters.prog_order = OPJ_LRCP;
+    }
+    parameters.cp_disto_alloc = 1;
+    if (opts->tile_width > 0) {
+        parameters.tile_size_on = OPJ_TRUE;
+        parameters.cp_tdx = opts->tile_width;
+        parameters.cp_tdy = opts->tile_height;
+    }
+
+    codec = opj_create_compress(OPJ_CODEC_J2K);
+    if (!codec || !opj_setup_encoder(codec, &parameters, image)) {
+        fprintf(stderr, "error setting up encoder\n");
+        err = 1;
+        goto free_and_out;
+    }
+
+    stream = opj_stream_create_buffer_stream(&buffer_info, 0);
+    if (!stream) {
+        fprintf(stderr, "error creating output stream\n");
+        err = 1;
+        goto free_and_out;
+    }
+
+    if (!opj_start_compress(codec, image, stream) || !opj_encode(codec, stream) || !opj_end_compress(codec, stream)) {
+        fprintf(stderr, "error encoding frame\n");
+        err = 1;
+        goto free_and_out;
+    }
+
+    out->length = buffer_info.cur - buffer_info.buf;
+    out->data = (byte_t*)malloc(out->length);
+    memcpy(out->data, buffer_info.buf, out->length);
+
+free_and_out:
+    if (stream) {
+        opj_stream_destroy(stream);
+    }
+    if (codec) {
+        opj_destroy_codec(codec);
+    }
+    // opj_write_to_buffer grows it with opj_malloc, which is plain malloc
+    free(buffer_info.buf);
+    return err;
+}
+
+static Result_t setup_encryption(const gen_options_t *opts, WriterInfo &Info, AESEncContext **Context, HMACContext **HMAC, track_file_t *track_file) {
+    if (!opts->encrypt) {
+        return RESULT_OK;
+    }
+    Kumu::FortunaRNG RNG;
+    byte_t IV_buf[CBC_BLOCK_SIZE];
+
+    Kumu::GenRandomUUID(Info.ContextID);
+    Kumu::GenRandomUUID(Info.CryptographicKeyID);
+    memcpy(track_file->key_id, Info.CryptographicKeyID, UUIDlen);
+    Info.EncryptedEssence = true;
+    Info.UsesHMAC = true;
+
+    *Context = new AESEncContext;
+    Result_t result = (*Context)->InitKey(opts->key);
+    if (ASDCP_SUCCESS(result)) {
+        result = (*Context)->SetIVec(RNG.FillRandom(IV_buf, CBC_BLOCK_SIZE));
+    }
+    if (ASDCP_SUCCESS(result)) {
+        *HMAC = new HMACContext;
+        result = (*HMAC)->InitKey(opts->key, Info.LabelSetType);
+    }
+    return result;
+}
+
+// bytes before the first tile-part (SOT), the main header of a codestream.
+// 0 if there is none
+static ui32_t main_header_length(const byte_t *data, ui32_t length) {
+    // past SOC, then marker segment after marker segment
+    ui32_t pos = 2;
+    while (pos + 4 <= length) {
+        ui32_t marker = ((ui32_t)data[pos] << 8) | data[pos + 1];
+        if (marker == 0xFF90) {
+            return pos;
+        }
+        pos += 2 + (((ui32_t)data[pos + 2] << 8) | data[pos + 3]);
+    }
+    return 0;
+}
+
+// the picture descriptors the AS-02 writer takes, from the main header the way
+// asdcplib's own wrappers fill them in
+static void fill_JP2K_descriptors(const JP2K::PictureDescriptor& PDesc,
+                                  ASDCP::MXF::GenericPictureEssenceDescriptor *essence_descriptor,
+                                  ASDCP::MXF::JPEG2000PictureSubDescriptor *sub_descriptor) {
+    essence_descriptor->ContainerDuration = PDesc.ContainerDuration;
+    essence_descriptor->SampleRate = PDesc.EditRate;
+    essence_descriptor->StoredWidth = PDesc.StoredWidth;
+    essence_descriptor->StoredHeight = PDesc.StoredHeight;
+
+    sub_descriptor->Rsize = PDesc.Rsize;
+    sub_descriptor->Xsize = PDesc.Xsize;
+    sub_descriptor->Ysize = PDesc.Ysize;
+    sub_descriptor->XOsize = PDesc.XOsize;
+    sub_descriptor->YOsize = PDesc.YOsize;
+    sub_descriptor->XTsize = PDesc.XTsize;
+    sub_descriptor->YTsize = PDesc.YTsize;
+    sub_descriptor->XTOsize = PDesc.XTOsize;
+    sub_descriptor->YTOsize = PDesc.YTOsize;
+    sub_descriptor->Csize = PDesc.Csize;
+
+    // an array: big endian count and size of the entries, then the entries
+    byte_t sizing[8 + sizeof(PDesc.ImageComponents)];
+    *(ui32_t*)sizing = KM_i32_BE(JP2K::MaxComponents);
+    *(ui32_t*)(sizing + 4) = KM_i32_BE(sizeof(JP2K::ImageComponent_t));
+    memcpy(sizing + 8, PDesc.ImageComponents, sizeof(PDesc.ImageComponents));
+    sub_descriptor->PictureComponentSizing.get().Set(sizing, sizeof(sizing));
+    sub_descriptor->PictureComponentSizing.set_has_value();
+
+    // COD and QCD as in the codestream, without the unused precinct sizes
+    // and step sizes
+    ui32_t precincts = 0;
+    while (precincts < JP2K::MaxPrecincts && PDesc.CodingStyleDefault.SPcod.PrecinctSize[precincts]) {
+        precincts++;
+    }
+    sub_descriptor->CodingStyleDefault.get().Set((const byte_t*)&PDesc.CodingStyleDefault,
+                                                 sizeof(JP2K::CodingStyleDefault_t) - JP2K::MaxPrecincts + precincts);
+    sub_descriptor->CodingStyleDefault.set_has_value();
+    sub_descriptor->QuantizationDefault.get().Set((const byte_t*)&PDesc.QuantizationDefault,
+                                                  PDesc.QuantizationDefault.SPqcdLength + 1);
+    sub_descriptor->QuantizationDefault.set_has_value();
+}
+
+static Result_t write_JP2K_file(const gen_options_t *opts, codestream_t *frames, int duration, track_file_t *track_file) {
+    AESEncContext *Context = 0;
+    HMACContext *HMAC = 0;
+    AS_02::JP2K::MXFWriter Writer;
+    JP2K::FrameBuffer FrameBuffer;
+    JP2K::PictureDescriptor PDesc;
+    ASDCP::MXF::InterchangeObject_list_t essence_sub_descriptors;
+    const Dictionary *dict = &DefaultSMPTEDict();
+
+    FrameBuffer.SetData(frames[0].data, frames[0].length);
+    FrameBuffer.Size(frames[0].length);
+    Result_t result = JP2K::ParseMetadataIntoDesc(FrameBuffer, PDesc);
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error parsing codestream header\n");
+        return result;
+    }
+    PDesc.EditRate = opts->edit_rate;
+    PDesc.SampleRate = opts->edit_rate;
+    PDesc.ContainerDuration = duration;
+
+    ASDCP::MXF::GenericPictureEssenceDescriptor *essence_descriptor;
+    if (opts->rgb) {
+        ASDCP::MXF::RGBAEssenceDescriptor *rgba_descriptor = new ASDCP::MXF::RGBAEssenceDescriptor(dict);
+        // full range
+        rgba_descriptor->ComponentMaxRef = (1 << opts->bits) - 1;
+        rgba_descriptor->ComponentMinRef = 0;
+        essence_descriptor = rgba_descriptor;
+    } else {
+        ASDCP::MXF::CDCIEssenceDescriptor *cdci_descriptor = new ASDCP::MXF::CDCIEssenceDescriptor(dict);
+        cdci_descriptor->HorizontalSubsampling = opts->chroma_444 ? 1 : 2;
+        cdci_descriptor->VerticalSubsampling = 1;
+        cdci_descriptor->ComponentDepth = opts->bits;
+        // video range
+        cdci_descriptor->BlackRefLevel = 16 << (opts->bits - 8);
+        cdci_descriptor->WhiteReflevel = 235 << (opts->bits - 8);
+        cdci_descriptor->ColorRange = (224 << (opts->bits - 8)) + 1;
+        essence_descriptor = cdci_descriptor;
+    }
+    ASDCP::MXF::JPEG2000PictureSubDescriptor *sub_descriptor = new ASDCP::MXF::JPEG2000PictureSubDescriptor(dict);
+    essence_sub_descriptors.push_back(sub_descriptor);
+    fill_JP2K_descriptors(PDesc, essence_descriptor, sub_descriptor);
+    essence_descriptor->PictureEssenceCoding = dict->ul(MDD_JP2KEssenceCompression_BroadcastProfile_1);
+    essence_descriptor->FrameLayout = 0;
+    essence_descriptor->AspectRatio = Rational(opts->width, opts->height);
+
+    WriterInfo Info;
+    Info.LabelSetType = LS_MXF_SMPTE;
+    Kumu::GenRandomUUID(Info.AssetUUID);
+    memcpy(track_file->asset_uuid, Info.AssetUUID, UUIDlen);
+
+    result = setup_encryption(opts, Info, &Context, &HMAC, track_file);
+
+    std::string filename = std::string(opts->out_dir) + "/" + track_file->path;
+    if (ASDCP_SUCCESS(result)) {
+        result = Writer.OpenWrite(filename, Info, essence_descriptor, essence_sub_descriptors,
+                                  opts->edit_rate, 16384, AS_02::IS_FOLLOW, 10);
+    }
+
+    for (int i = 0; i < duration && ASDCP_SUCCESS(result); ++i) {
+        codestream_t *frame = &frames[i % opts->unique_frames];
+        FrameBuffer.SetData(frame->data, frame->length);
+        FrameBuffer.Size(frame->length);
+        // leave the codestream header in the clear like most encrypting encoders do
+        FrameBuffer.PlaintextOffset(main_header_length(frame->data, frame->length));
+        result = Writer.WriteFrame(FrameBuffer, Context, HMAC);
+    }
+
+    if (ASDCP_SUCCESS(result)) {
+        result = Writer.Finalize();
+    }
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error writing %s\n", filename.c_str());
+    }
+
+    delete Context;
+    delete HMAC;
+    return result;
+}
+
+// AS-02 PCM is clip wrapped which asdcplib can't encrypt, so audio always stays in the clear
+static Result_t write_PCM_file(const gen_options_t *opts, int duration, track_file_t *track_file) {
+    AS_02::PCM::MXFWriter Writer;
+    PCM::FrameBuffer FrameBuffer;
+    PCM::AudioDescriptor ADesc;
+    const Dictionary *dict = &DefaultSMPTEDict();
+    ASDCP::MXF::AS02_MCAConfigParser mca_config(dict);
+
+    ADesc.EditRate = opts->edit_rate;
+    ADesc.AudioSamplingRate = Rational(AUDIO_SAMPLE_RATE, 1);
+    ADesc.ChannelCount = AUDIO_CHANNELS;
+    ADesc.QuantizationBits = AUDIO_BITS;
+    ADesc.BlockAlign = AUDIO_CHANNELS * AUDIO_BITS / 8;
+    ADesc.AvgBps = AUDIO_SAMPLE_RATE * ADesc.BlockAlign;
+    ADesc.LinkedTrackID = 0;
+    ADesc.Locked = 0;
+    ADesc.ContainerDuration = duration;
+
+    ASDCP::MXF::WaveAudioDescriptor *essence_descriptor = new ASDCP::MXF::WaveAudioDescriptor(dict);
+    essence_descriptor->SampleRate = ADesc.EditRate;
+    essence_descriptor->AudioSamplingRate = ADesc.AudioSamplingRate;
+    essence_descriptor->Locked = ADesc.Locked;
+    essence_descriptor->ChannelCount = ADesc.ChannelCount;
+    essence_descriptor->QuantizationBits = ADesc.QuantizationBits;
+    essence_descriptor->BlockAlign = ADesc.BlockAlign;
+    essence_descriptor->AvgBps = ADesc.AvgBps;
+    essence_descriptor->LinkedTrackID = ADesc.LinkedTrackID;
+    essence_descriptor->ContainerDuration = ADesc.ContainerDuration;
+    essence_descriptor->ChannelAssignment = dict->ul(MDD_IMFAudioChannelCfg_MCA);
+
+    WriterInfo Info;
+    Info.LabelSetType = LS_MXF_SMPTE;
+    Kumu::GenRandomUUID(Info.AssetUUID);
+    memcpy(track_file->asset_uuid, Info.AssetUUID, UUIDlen);
+
+    std::string filename = std::string(opts->out_dir) + "/" + track_file->path;
+    Result_t result = Writer.OpenWrite(filename, Info, essence_descriptor, mca_config, opts->edit_rate);
+
+    // 1 kHz tone on the left, 440 Hz on the right
+    ui32_t samples_per_frame = PCM::CalcSamplesPerFrame(ADesc);
+    FrameBuffer.Capacity(PCM::CalcFrameBufferSize(ADesc));
+    ui64_t sample = 0;
+    for (int i = 0; i < duration && ASDCP_SUCCESS(result); ++i) {
+        byte_t *p = FrameBuffer.Data();
+        for (ui32_t s = 0; s < samples_per_frame; ++s, ++sample) {
+            double t = (double)sample / AUDIO_SAMPLE_RATE;
+            int v[AUDIO_CHANNELS] = {
+                (int)(0x3fffff * sin(2 * M_PI * 1000 * t)),
+                (int)(0x3fffff * sin(2 * M_PI * 440 * t))
+            };
+            for (ui32_t c = 0; c < AUDIO_CHANNELS; ++c) {
+                *p++ = v[c] & 0xff;
+                *p++ = (v[c] >> 8) & 0xff;
+                *p++ = (v[c] >> 16) & 0xff;
+            }
+        }
+        FrameBuffer.Size(samples_per_frame * ADesc.BlockAlign);
+        result = Writer.WriteFrame(FrameBuffer);
+    }
+
+    if (ASDCP_SUCCESS(result)) {
+        result = Writer.Finalize();
+    }
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error writing %s\n", filename.c_str());
+    }
+    return result;
+}
+
+static ui64_t file_size(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st)) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+// only what imf.c reads plus the mandatory elements around it
+static int write_cpl(const gen_options_t *opts, const std::string &cpl_id, track_file_t *video, track_file_t *audio) {
+    std::string filename = std::string(opts->out_dir) + "/CPL_" + cpl_id.substr(9) + ".xml";
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "error opening %s\n", filename.c_str());
+        return 1;
+    }
+
+    std::string video_desc = random_urn();
+    std::string audio_desc = random_urn();
+    ui32_t audio_duration = (ui64_t)opts->frames_per_segment * AUDIO_SAMPLE_RATE * opts->edit_rate.Denominator / opts->edit_rate.Numerator;
+
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n");
+    fprintf(f, "<CompositionPlaylist xmlns=\"http://www.smpte-ra.org/schemas/2067-3/2016\" xmlns:cc=\"http://www.smpte-ra.org/schemas/2067-2/2016\" "
+               "xmlns:r1=\"http://www.smpte-ra.org/reg/335/2012\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\">\n");
+    fprintf(f, "  <Id>%s</Id>\n", cpl_id.c_str());
+    fprintf(f, "  <IssueDate>2020-01-01T00:00:00+00:00</IssueDate>\n");
+    fprintf(f, "  <ContentTitle>imf_fs synthetic %dx%d %s %d bit</ContentTitle>\n",
+            opts->width, opts->height, opts->rgb ? "rgb" : (opts->chroma_444 ? "444" : "422"), opts->bits);
+    fprintf(f, "  <EditRate>%d %d</EditRate>\n", opts->edit_rate.Numerator, opts->edit_rate.Denominator);
+
+    fprintf(f, "  <EssenceDescriptorList>\n");
+    fprintf(f, "    <EssenceDescriptor>\n");
+    fprintf(f, "      <Id>%s</Id>\n", video_desc.c_str());
+    if (opts->rgb) {
+        fprintf(f, "      <r1:RGBADescriptor>\n");
+        fprintf(f, "        <r1:SampleRate>%d/%d</r1:SampleRate>\n", opts->edit_rate.Numerator, opts->edit_rate.Denominator);
+        fprintf(f, "        <r1:StoredWidth>%d</r1:StoredWidth>\n", opts->width);
+        fprintf(f, "        <r1:StoredHeight>%d</r1:StoredHeight>\n", opts->height);
+        fprintf(f, "        <r1:ComponentMaxRef>%d</r1:ComponentMaxRef>\n", (1 << opts->bits) - 1);
+        fprintf(f, "        <r1:ComponentMinRef>0</r1:ComponentMinRef>\n");
+        fprintf(f, "        <r1:FrameLayout>FullFrame</r1:FrameLayout>\n");
+        fprintf(f, "      </r1:RGBADescriptor>\n");
+    } else {
+        fprintf(f, "      <r1:CDCIDescriptor>\n");
+        fprintf(f, "        <r1:SampleRate>%d/%d</r1:SampleRate>\n", opts->edit_rate.Numerator, opts->edit_rate.Denominator);
+        fprintf(f, "        <r1:StoredWidth>%d</r1:StoredWidth>\n", opts->width);
+        fprintf(f, "        <r1:StoredHeight>%d</r1:StoredHeight>\n", opts->height);
+        fprintf(f, "        <r1:HorizontalSubsampling>%d</r1:HorizontalSubsampling>\n", opts->chroma_444 ? 1 : 2);
+        fprintf(f, "        <r1:VerticalSubsampling>1</r1:VerticalSubsampling>\n");
+        fprintf(f, "        <r1:ComponentDepth>%d</r1:ComponentDepth>\n", opts->bits);
+        fprintf(f, "        <r1:FrameLayout>FullFrame</r1:FrameLayout>\n");
+        fprintf(f, "      </r1:CDCIDescriptor>\n");
+    }
+    fprintf(f, "    </EssenceDescriptor>\n");
+    fprintf(f, "    <EssenceDescriptor>\n");
+    fprintf(f, "      <Id>%s</Id>\n", audio_desc.c_str());
+    fprintf(f, "      <r1:WAVEPCMDescriptor>\n");
+    fprintf(f, "        <r1:SampleRate>%d/1</r1:SampleRate>\n", AUDIO_SAMPLE_RATE);
+    fprintf(f, "        <r1:AudioSampleRate>%d/1</r1:AudioSampleRate>\n", AUDIO_SAMPLE_RATE);
+    fprintf(f, "        <r1:ChannelCount>%d</r1:ChannelCount>\n", AUDIO_CHANNELS);
+    fprintf(f, "        <r1:QuantizationBits>%d</r1:QuantizationBits>\n", AUDIO_BITS);
+    fprintf(f, "        <r1:BlockAlign>%d</r1:BlockAlign>\n", AUDIO_CHANNELS * AUDIO_BITS / 8);
+    fprintf(f, "        <r1:AverageBytesPerSecond>%d</r1:AverageBytesPerSecond>\n", AUDIO_SAMPLE_RATE * AUDIO_CHANNELS * AUDIO_BITS / 8);
+    fprintf(f, "        <r1:ReferenceImageEditRate>%d/%d</r1:ReferenceImageEditRate>\n", opts->edit_rate.Numerator, opts->edit_rate.Denominator);
+    fprintf(f, "        <r1:EssenceLength>%d</r1:EssenceLength>\n", audio_duration);
+    fprintf(f, "        <r1:ChannelAssignment>urn:smpte:ul:060e2b34.0401010d.04020210.04010000</r1:ChannelAssignment>\n");
+    fprintf(f, "      </r1:WAVEPCMDescriptor>\n");
+    fprintf(f, "    </EssenceDescriptor>\n");
+    fprintf(f, "  </EssenceDescriptorList>\n");
+
+    fprintf(f, "  <SegmentList>\n");
+    for (int s = 0; s < opts->segments; ++s) {
+        // 1, 2, .. max_repeat, 1, 2, ..
+        int repeat = 1 + s % opts->max_repeat;
+        fprintf(f, "    <Segment>\n");
+        fprintf(f, "      <Id>%s</Id>\n", random_urn().c_str());
+        fprintf(f, "      <SequenceList>\n");
+        fprintf(f, "        <cc:MainImageSequence>\n");
+        fprintf(f, "          <Id>%s</Id>\n", random_urn().c_str());
+        fprintf(f, "          <TrackId>urn:uuid:00000000-0000-4000-8000-000000000001</TrackId>\n");
+        fprintf(f, "          <ResourceList>\n");
+        fprintf(f, "            <Resource xsi:type=\"TrackFileResourceType\">\n");
+        fprintf(f, "              <Id>%s</Id>\n", random_urn().c_str());
+        fprintf(f, "              <EditRate>%d %d</EditRate>\n", opts->edit_rate.Numerator, opts->edit_rate.Denominator);
+        fprintf(f, "              <IntrinsicDuration>%d</IntrinsicDuration>\n", opts->frames_per_segment);
+        fprintf(f, "              <EntryPoint>0</EntryPoint>\n");
+        fprintf(f, "              <SourceDuration>%d</SourceDuration>\n", opts->frames_per_segment);
+        fprintf(f, "              <RepeatCount>%d</RepeatCount>\n", repeat);
+        fprintf(f, "              <SourceEncoding>%s</SourceEncoding>\n", video_desc.c_str());
+        fprintf(f, "              <TrackFileId>%s</TrackFileId>\n", urn(video->asset_uuid).c_str());
+        fprintf(f, "            </Resource>\n");
+        fprintf(f, "          </ResourceList>\n");
+        fprintf(f, "        </cc:MainImageSequence>\n");
+        fprintf(f, "        <cc:MainAudioSequence>\n");
+        fprintf(f, "          <Id>%s</Id>\n", random_urn().c_str());
+        fprintf(f, "          <TrackId>urn:uuid:00000000-0000-4000-8000-000000000002</TrackId>\n");
+        fprintf(f, "          <ResourceList>\n");
+        fprintf(f, "            <Resource xsi:type=\"TrackFileResourceType\">\n");
+        fprintf(f, "              <Id>%s</Id>\n", random_urn().c_str());
+        fprintf(f, "              <EditRate>%d 1</EditRate>\n", AUDIO_SAMPLE_RATE);
+        fprintf(f, "              <IntrinsicDuration>%d</IntrinsicDuration>\n", audio_duration);
+        fprintf(f, "              <EntryPoint>0</EntryPoint>\n");
+        fprintf(f, "              <SourceDuration>%d</SourceDuration>\n", audio_duration);
+        fprintf(f, "              <RepeatCount>%d</RepeatCount>\n", repeat);
+        fprintf(f, "              <SourceEncoding>%s</SourceEncoding>\n", audio_desc.c_str());
+        fprintf(f, "              <TrackFileId>%s</TrackFileId>\n", urn(audio->asset_uuid).c_str());
+        fprintf(f, "            </Resource>\n");
+        fprintf(f, "          </ResourceList>\n");
+        fprintf(f, "        </cc:MainAudioSequence>\n");
+        fprintf(f, "      </SequenceList>\n");
+        fprintf(f, "    </Segment>\n");
+    }
+    fprintf(f, "  </SegmentList>\n");
+    fprintf(f, "</CompositionPlaylist>\n");
+    fclose(f);
+
+    fprintf(stderr, "wrote %s\n", filename.c_str());
+    return 0;
+}
+
+static void write_assetmap_asset(FILE *f, const std::string &id, const std::string &path, ui64_t size) {
+    fprintf(f, "    <Asset>\n");
+    fprintf(f, "      <Id>%s</Id>\n", id.c_str());
+    fprintf(f, "      <ChunkList>\n");
+    fprintf(f, "        <Chunk>\n");
+    fprintf(f, "          <Path>%s</Path>\n", path.c_str());
+    fprintf(f, "          <VolumeIndex>1</VolumeIndex>\n");
+    fprintf(f, "          <Offset>0</Offset>\n");
+    fprintf(f, "          <Length>%llu</Length>\n", (unsigned long long)size);
+    fprintf(f, "        </Chunk>\n");
+    fprintf(f, "      </ChunkList>\n");
+    fprintf(f, "    </Asset>\n");
+}
+
+static int write_assetmap(const gen_options_t *opts, const std::string &cpl_id, track_file_t *video, track_file_t *audio) {
+    std::string filename = std::string(opts->out_dir) + "/ASSETMAP.xml";
+    std::string cpl_path = "CPL_" + cpl_id.substr(9) + ".xml";
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "error opening %s\n", filename.c_str());
+        return 1;
+    }
+
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n");
+    fprintf(f, "<AssetMap xmlns=\"http://www.smpte-ra.org/schemas/429-9/2007/AM\">\n");
+    fprintf(f, "  <Id>%s</Id>\n", random_urn().c_str());
+    fprintf(f, "  <Creator>imf_fs gen_imf_package</Creator>\n");
+    fprintf(f, "  <VolumeCount>1</VolumeCount>\n");
+    fprintf(f, "  <IssueDate>2020-01-01T00:00:00+00:00</IssueDate>\n");
+    fprintf(f, "  <Issuer>imf_fs</Issuer>\n");
+    fprintf(f, "  <AssetList>\n");
+    write_assetmap_asset(f, cpl_id, cpl_path, file_size(std::string(opts->out_dir) + "/" + cpl_path));
+    write_assetmap_asset(f, urn(video->asset_uuid), video->path, video->size);
+    write_assetmap_asset(f, urn(audio->asset_uuid), audio->path, audio->size);
+    fprintf(f, "  </AssetList>\n");
+    fprintf(f, "</AssetMap>\n");
+    fclose(f);
+
+    fprintf(stderr, "wrote %s\n", filename.c_str());
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: gen_imf_package [options] OUTDIR\n");
+    fprintf(stderr, "\t-s WxH\t\tframe size (default 1920x1080)\n");
+    fprintf(stderr, "\t-c 422|444|rgb\tchroma subsampling, rgb for RGBA essence (default 422)\n");
+    fprintf(stderr, "\t-b bits\t\tcomponent depth (default 10)\n");
+    fprintf(stderr, "\t-t WxH\t\tJ2K tile size (default one tile per frame)\n");
+    fprintf(stderr, "\t-l layers\tJ2K quality layers, LRCP when more than 1 (default 1)\n");
+    fprintf(stderr, "\t-r num/den\tedit rate (default 25/1)\n");
+    fprintf(stderr, "\t-d frames\tframes per segment (default 250)\n");
+    fprintf(stderr, "\t-S segments\tnumber of segments (default 4)\n");
+    fprintf(stderr, "\t-R count\tsegments repeat 1..count times (default 2)\n");
+    fprintf(stderr, "\t-u frames\tnumber of distinct encoded frames (default 8)\n");
+    fprintf(stderr, "\t-q ratio\tJ2K compression ratio (default 12)\n");
+    fprintf(stderr, "\t-k key\t\tencrypt the video track file with this AES key (hex)\n");
+}
+
+int main(int argc, char **argv) {
+    gen_options_t opts = gen_options_t();
+    opts.width = 1920;
+    opts.height = 1080;
+    opts.bits = 10;
+    opts.layers = 1;
+    opts.unique_frames = 8;
+    opts.frames_per_segment = 250;
+    opts.segments = 4;
+    opts.max_repeat = 2;
+    opts.compression_ratio = 12;
+    opts.edit_rate = Rational(25, 1);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:b:t:l:r:d:S:R:u:q:k:")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &opts.width, &opts.height) != 2) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'c':
+                opts.rgb = !strcmp(optarg, "rgb");
+                opts.chroma_444 = opts.rgb || !strcmp(optarg, "444");
+                break;
+            case 'b':
+                opts.bits = atoi(optarg);
+                break;
+            case 't':
+                if (sscanf(optarg, "%dx%d", &opts.tile_width, &opts.tile_height) != 2
+                    || opts.tile_width <= 0 || opts.tile_height <= 0) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'l':
+                opts.layers = atoi(optarg);
+                break;
+            case 'r':
+                if (sscanf(optarg, "%d/%d", &opts.edit_rate.Numerator, &opts.edit_rate.Denominator) != 2) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'd':
+                opts.frames_per_segment = atoi(optarg);
+                break;
+            case 'S':
+                opts.segments = atoi(optarg);
+                break;
+            case 'R':
+                opts.max_repeat = atoi(optarg);
+                break;
+            case 'u':
+                opts.unique_frames = atoi(optarg);
+                break;
+            case 'q':
+                opts.compression_ratio = atof(optarg);
+                break;
+            case 'k':
+                ui32_t key_length;
+                // dashes and other non hex characters are skipped
+                if (Kumu::hex2bin(optarg, opts.key, sizeof(opts.key), &key_length) || key_length != sizeof(opts.key)) {
+                    fprintf(stderr, "invalid key %s\n", optarg);
+                    return 1;
+                }
+                opts.encrypt = 1;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage();
+        return 1;
+    }
+    opts.out_dir = argv[optind];
+
+    if (opts.width <= 0 || opts.height <= 0 || opts.bits < 8 || opts.bits > 16 ||
+        opts.layers <= 0 || opts.layers > 10 ||
+        opts.frames_per_segment <= 0 || opts.segments <= 0 || opts.max_repeat <= 0 || opts.unique_frames <= 0) {
+        fprintf(stderr, "invalid options\n");
+        usage();
+        return 1;
+    }
+    // audio resources are cut in samples, keep them frame aligned
+    if (((ui64_t)opts.frames_per_segment * AUDIO_SAMPLE_RATE * opts.edit_rate.Denominator) % opts.edit_rate.Numerator) {
+        fprintf(stderr, "frames per segment must map to a whole number of audio samples at %d/%d\n",
+                opts.edit_rate.Numerator, opts.edit_rate.Denominator);
+        return 1;
+    }
+
+    if (mkdir(opts.out_dir, 0755) && errno != EEXIST) {
+        fprintf(stderr, "error creating %s\n", opts.out_dir);
+        return 1;
+    }
+
+    int err = 0;
+    codestream_t *frames = (codestream_t*)calloc(opts.unique_frames, sizeof(codestream_t));
+    track_file_t video, audio;
+    ui64_t total_bytes = 0;
+
+    for (int i = 0; i < opts.unique_frames && !err; ++i) {
+        opj_image_t *image = make_image(&opts, i);
+        if (!image) {
+            fprintf(stderr, "error creating image\n");
+            err = 1;
+            break;
+        }
+        err = encode_frame(&opts, image, &frames[i]);
+        opj_image_destroy(image);
+        if (!err) {
+            fprintf(stderr, "encoded frame %d: %u bytes\n", i, frames[i].length);
+            total_bytes += frames[i].length;
+        }
+    }
+    if (err) {
+        goto free_and_out;
+    }
+
+    video.path = "video.mxf";
+    audio.path = "audio.mxf";
+    unlink((std::string(opts.out_dir) + "/" + video.path).c_str());
+    unlink((std::string(opts.out_dir) + "/" + audio.path).c_str());
+
+    if (!ASDCP_SUCCESS(write_JP2K_file(&opts, frames, opts.frames_per_segment, &video))
+        || !ASDCP_SUCCESS(write_PCM_file(&opts, opts.frames_per_segment, &audio))) {
+        err = 1;
+        goto free_and_out;
+    }
+    video.size = file_size(std::string(opts.out_dir) + "/" + video.path);
+    audio.size = file_size(std::string(opts.out_dir) + "/" + audio.path);
+
+    {
+        std::string cpl_id = random_urn();
+        err = write_cpl(&opts, cpl_id, &video, &audio);
+        if (!err) {
+            err = write_assetmap(&opts, cpl_id, &video, &audio);
+        }
+    }
+
+    if (!err) {
+        int total_frames = 0;
+        for (int s = 0; s < opts.segments; ++s) {
+            total_frames += opts.frames_per_segment * (1 + s % opts.max_repeat);
+        }
+        fprintf(stderr, "package %s: %d frames, avg %u bytes per frame\n",
+                opts.out_dir, total_frames, (unsigned int)(total_bytes / opts.unique_frames));
+        if (opts.encrypt) {
+            char buf[64];
+            fprintf(stderr, "video key id %s\n", Kumu::bin2UUIDhex(video.key_id, UUIDlen, buf, sizeof(buf)));
+        }
+    }
+
+free_and_out:
+    for (int i = 0; i < opts.unique_frames; ++i) {
+        free(frames[i].data);
+    }
+    free(frames);
+    return err;
+}
@@ -0,0 +1,264 @@
+// checks libimffs on a package from gen_imf_package: frames fetched in
+// random order by several threads at once, with a small cache and prefetch
+// hints coming and going, have to be the same as the frames decoded one
+// after the other. audio read in chunks of random size has to be the same as
+// one linear read, and the first resource has to be the tone
+// gen_imf_package writes, sample for sample, at any edit rate.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <glob.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "imffs.h"
+
+#define NUM_THREADS 4
+#define FETCHES_PER_THREAD 60
+// small enough that the random fetches keep evicting
+#define CACHE_FRAMES 6
+#define PREFETCH_THREADS 2
+// each thread holds on to this many frames while it fetches the next ones
+#define HELD_FRAMES 2
+#define MAX_CHUNK 3000
+
+// what gen_imf_package writes, a 1 kHz tone on the left and 440 Hz on the
+// right. its first resource has to be longer than this
+#define TONE_SAMPLE_RATE 48000
+#define TONE_SAMPLES 20000
+
+typedef struct {
+    imffs_t *fs;
+    const uint64_t *hashes;
+    unsigned int num_frames;
+    unsigned int seed;
+    int failures;
+} fetch_thread_t;
+
+static uint64_t hash_frame(const imffs_frame_t *frame) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int p = 0; p < 3; p++) {
+        for (int y = 0; y < frame->heights[p]; y++) {
+            const unsigned char *row = (const unsigned char *)frame->planes[p] + (size_t)y * frame->linesizes[p];
+            for (int x = 0; x < frame->widths[p] * 2; x++) {
+                h = (h ^ row[x]) * 1099511628211ULL;
+            }
+        }
+    }
+    return h;
+}
+
+// every frame in order, one at a time, nothing in the background
+static uint64_t *decode_sequentially(const char *cpl, const char *assetmap, unsigned int *num_frames) {
+    imffs_options_t options;
+    imffs_default_options(&options);
+    options.num_prefetch_threads = 0;
+    options.cache_frames = 1;
+    imffs_t *fs = imffs_open(cpl, assetmap, &options);
+    if (!fs) {
+        fprintf(stderr, "cannot open %s\n", cpl);
+        return NULL;
+    }
+
+    *num_frames = imffs_get_timeline(fs)->video_frames;
+    uint64_t *hashes = calloc(*num_frames ? *num_frames : 1, sizeof(uint64_t));
+    for (unsigned int n = 0; hashes && n < *num_frames; n++) {
+        const imffs_frame_t *frame = imffs_get_video_frame(fs, n);
+        if (!frame) {
+            fprintf(stderr, "decoding frame %u failed\n", n);
+            free(hashes);
+            hashes = NULL;
+            break;
+        }
+        hashes[n] = hash_frame(frame);
+        imffs_release_frame(fs, frame);
+    }
+    imffs_close(fs);
+    return hashes;
+}
+
+static void *fetch_thread(void *data) {
+    fetch_thread_t *t = data;
+    const imffs_frame_t *held[HELD_FRAMES] = { NULL };
+
+    for (int i = 0; i < FETCHES_PER_THREAD; i++) {
+        unsigned int n = rand_r(&t->seed) % t->num_frames;
+        // new hints replace the ones of the other threads
+        if (i % 7 == 0) {
+            imffs_prefetch(t->fs, n + 1, 1 + rand_r(&t->seed) % (2 * CACHE_FRAMES));
+        }
+        const imffs_frame_t *frame = imffs_get_video_frame(t->fs, n);
+        if (!frame) {
+            fprintf(stderr, "fetching frame %u failed\n", n);
+            t->failures++;
+            continue;
+        }
+        if (frame->timeline_frame != n || hash_frame(frame) != t->hashes[n]) {
+            fprintf(stderr, "frame %u differs from the sequential decode\n", n);
+            t->failures++;
+        }
+        imffs_release_frame(t->fs, held[i % HELD_FRAMES]);
+        held[i % HELD_FRAMES] = frame;
+    }
+    for (int i = 0; i < HELD_FRAMES; i++) {
+        imffs_release_frame(t->fs, held[i]);
+    }
+    return NULL;
+}
+
+static int check_video(const char *cpl, const char *assetmap) {
+    unsigned int num_frames = 0;
+    uint64_t *hashes = decode_sequentially(cpl, assetmap, &num_frames);
+    if (!hashes) {
+        return 1;
+    }
+    if (!num_frames) {
+        free(hashes);
+        return 0;
+    }
+
+    imffs_options_t options;
+    imffs_default_options(&options);
+    options.num_threads = 1;
+    options.num_prefetch_threads = PREFETCH_THREADS;
+    options.cache_frames = CACHE_FRAMES;
+    imffs_t *fs = imffs_open(cpl, assetmap, &options);
+    if (!fs) {
+        free(hashes);
+        return 1;
+    }
+
+    fetch_thread_t threads[NUM_THREADS];
+    pthread_t ids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        threads[i] = (fetch_thread_t){ fs, hashes, num_frames, 1234u + i, 0 };
+        pthread_create(&ids[i], NULL, fetch_thread, &threads[i]);
+    }
+    int failures = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(ids[i], NULL);
+        failures += threads[i].failures;
+    }
+    imffs_close(fs);
+    free(hashes);
+
+    printf("video: %u frames, %d random fetches from %d threads: %s\n", num_frames,
+           NUM_THREADS * FETCHES_PER_THREAD, NUM_THREADS, failures ? "FAILED" : "OK");
+    return failures != 0;
+}
+
+static int32_t tone_sample(uint64_t sample, unsigned int channel) {
+    double t = (double)sample / TONE_SAMPLE_RATE;
+    int v = (int)(0x3fffff * sin(2 * M_PI * (channel ? 440 : 1000) * t));
+    // 24 bit samples in the upper bits of 32
+    return (int32_t)((uint32_t)v << 8);
+}
+
+static int check_audio(const char *cpl, const char *assetmap) {
+    imffs_options_t options;
+    imffs_default_options(&options);
+    options.num_prefetch_threads = 0;
+    imffs_t *fs = imffs_open(cpl, assetmap, &options);
+    if (!fs) {
+        return 1;
+    }
+    const imffs_timeline_t *timeline = imffs_get_timeline(fs);
+    uint64_t num_samples = timeline->audio_samples;
+    unsigned int channels = timeline->audio_channels;
+    if (!num_samples) {
+        imffs_close(fs);
+        return 0;
+    }
+
+    int failed = 0;
+    // a bit past the end, which has to be silence
+    uint64_t total = num_samples + MAX_CHUNK;
+    int32_t *linear = malloc(total * channels * sizeof(int32_t));
+    int32_t *chunked = malloc(total * channels * sizeof(int32_t));
+    if (!linear || !chunked || imffs_get_audio(fs, 0, (unsigned int)total, linear)) {
+        fprintf(stderr, "linear audio read failed\n");
+        failed = 1;
+        goto free_and_out;
+    }
+
+    for (uint64_t s = 0; s < num_samples && s < TONE_SAMPLES; s++) {
+        for (unsigned int c = 0; c < channels && c < 2; c++) {
+            if (linear[s * channels + c] != tone_sample(s, c)) {
+                fprintf(stderr, "sample %llu of channel %u is not the tone\n", (unsigned long long)s, c);
+                failed = 1;
+                goto free_and_out;
+            }
+        }
+    }
+    for (uint64_t i = num_samples * channels; i < total * channels; i++) {
+        if (linear[i]) {
+            fprintf(stderr, "no silence past the end\n");
+            failed = 1;
+            goto free_and_out;
+        }
+    }
+
+    // front to back in chunks of random size, then chunks at random places
+    unsigned int seed = 42;
+    memset(chunked, 0x55, total * channels * sizeof(int32_t));
+    for (uint64_t s = 0; s < total; ) {
+        unsigned int count = 1 + rand_r(&seed) % MAX_CHUNK;
+        if (s + count > total) {
+            count = (unsigned int)(total - s);
+        }
+        if (imffs_get_audio(fs, s, count, chunked + s * channels)) {
+            fprintf(stderr, "audio read of %u samples at %llu failed\n", count, (unsigned long long)s);
+            failed = 1;
+            goto free_and_out;
+        }
+        s += count;
+    }
+    for (int i = 0; i < 200 && !failed; i++) {
+        uint64_t s = ((uint64_t)rand_r(&seed) * rand_r(&seed)) % total;
+        unsigned int count = 1 + rand_r(&seed) % MAX_CHUNK;
+        if (s + count > total) {
+            count = (unsigned int)(total - s);
+        }
+        failed = imffs_get_audio(fs, s, count, chunked + s * channels) != 0;
+    }
+    if (!failed && memcmp(linear, chunked, total * channels * sizeof(int32_t))) {
+        for (uint64_t i = 0; i < total * channels; i++) {
+            if (linear[i] != chunked[i]) {
+                fprintf(stderr, "chunked audio read differs at sample %llu\n", (unsigned long long)(i / channels));
+                break;
+            }
+        }
+        failed = 1;
+    }
+
+free_and_out:
+    printf("audio: %llu samples at %d/%d: %s\n", (unsigned long long)num_samples,
+           timeline->edit_rate.num, timeline->edit_rate.denom, failed ? "FAILED" : "OK");
+    free(linear);
+    free(chunked);
+    imffs_close(fs);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: imffs_check PACKAGE_DIR\n");
+        return 1;
+    }
+
+    // the ASSETMAP paths are relative to it, as for imf_fs
+    if (chdir(argv[1])) {
+        fprintf(stderr, "cannot change to %s\n", argv[1]);
+        return 1;
+    }
+    glob_t cpls;
+    if (glob("CPL_*.xml", 0, NULL, &cpls) || cpls.gl_pathc != 1) {
+        fprintf(stderr, "no single CPL in %s\n", argv[1]);
+        return 1;
+    }
+
+    int failed = check_video(cpls.gl_pathv[0], "ASSETMAP.xml") || check_audio(cpls.gl_pathv[0], "ASSETMAP.xml");
+    globfree(&cpls);
+    return failed;
+}
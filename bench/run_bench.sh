@@ -0,0 +1,92 @@
+#!/bin/sh
+# runs imf_fs against synthetic packages (make bench-packages) and reports
+# fps, MB/s, peak RSS, page faults, time to first byte, average decode time
+# per frame and per stage busy seconds (wall time a stage spent working).
+#
+# usage: bench/run_bench.sh [PACKAGE_DIR ...]
+#   IMF_FS      imf_fs binary (default ./imf_fs)
+#   IMF_FS_ARGS extra options, e.g. "-k <key>" for encrypted packages or
+#               "-r 1 -l 2" for a preview quality profile
+#   RUNS        runs per package, the fastest one is reported (default 3)
+#   PERF=1      also report dTLB misses, counted with perf stat
+
+CUR_PATH=$(pwd)
+IMF_FS=$(readlink -f ${IMF_FS:-${CUR_PATH}/imf_fs})
+RUNS=${RUNS:-3}
+PERF=${PERF:-0}
+
+# hack for development, see test.sh
+export LD_LIBRARY_PATH=${CUR_PATH}/third_party/openssl/lib
+
+if [ $# -eq 0 ]; then
+    set -- ${CUR_PATH}/bench/packages/*
+fi
+
+if [ ! -x "${IMF_FS}" ]; then
+    echo "no imf_fs at ${IMF_FS}, run make first" >&2
+    exit 1
+fi
+
+printf "%-24s %8s %8s %9s %9s %9s %9s %9s %9s  %s\n" "package" "frames" "fps" "MB/s" "rss MB" "faults k" "dTLB M" "ttfb ms" "decode ms" "busy s (read/decrypt/decode/color/pack/audio/write)"
+
+for PACKAGE in "$@"; do
+    CPL=$(ls ${PACKAGE}/CPL_*.xml 2>/dev/null | head -n 1)
+    if [ -z "${CPL}" ]; then
+        echo "no CPL in ${PACKAGE}" >&2
+        continue
+    fi
+
+    # we need to be in IMF directory for relative path resolve to work
+    (cd ${PACKAGE} && python3 - "${IMF_FS}" "$(basename ${CPL})" "${RUNS}" "${PERF}" ${IMF_FS_ARGS} <<'EOF'
+import json, os, resource, subprocess, sys, time
+
+imf_fs, cpl, runs, perf, extra = sys.argv[1], sys.argv[2], int(sys.argv[3]), sys.argv[4] == "1", sys.argv[5:]
+stages = ["read", "decrypt", "decode", "color", "pack", "audio", "write"]
+best = None
+
+for run in range(runs):
+    rfd, wfd = os.pipe()
+    start = time.monotonic()
+    cmd = [imf_fs, "-J", str(wfd)] + extra + [cpl, "ASSETMAP.xml"]
+    if perf:
+        cmd = ["perf", "stat", "-x", ",", "-o", "imf_fs.perf",
+               "-e", "dTLB-load-misses,dTLB-store-misses", "--"] + cmd
+    proc = subprocess.Popen(cmd,
+                            stdout=subprocess.DEVNULL, stderr=open("imf_fs.log", "w"),
+                            pass_fds=(wfd,))
+    os.close(wfd)
+    last = None
+    with os.fdopen(rfd) as metrics:
+        for line in metrics:
+            last = line
+    # rusage of just this run
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.monotonic() - start
+    returncode = os.waitstatus_to_exitcode(status)
+    if returncode != 0 or not last:
+        sys.exit("imf_fs failed (%d), see %s/imf_fs.log" % (returncode, os.getcwd()))
+    tlb_misses = None
+    if perf:
+        tlb_misses = 0
+        for line in open("imf_fs.perf"):
+            fields = line.split(",")
+            if len(fields) > 2 and fields[0].isdigit():
+                tlb_misses += int(fields[0])
+    last = json.loads(last)
+    m = last["stages"]
+    if best is None or wall < best[0]:
+        best = (wall, m, last["ttfb_ms"], usage.ru_minflt + usage.ru_majflt, tlb_misses)
+
+# children that exited so far, this is the biggest of all runs
+rss_mb = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss / 1024.0
+wall, m, ttfb_ms, faults, tlb_misses = best
+frames = m["decode"]["frames"]
+print("%-24s %8d %8.2f %9.1f %9.1f %9.1f %9s %9.1f %9.2f  %s" % (
+    os.path.basename(os.getcwd()), frames, frames / wall,
+    m["read"]["bytes"] / wall / 1e6, rss_mb, faults / 1e3,
+    "-" if tlb_misses is None else "%.1f" % (tlb_misses / 1e6),
+    ttfb_ms, m["decode"]["frame_ms_avg"],
+    "/".join("%.1f" % m[s]["busy_s"] for s in stages)))
+EOF
+    ) || exit 1
+done
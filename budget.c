@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "budget.h"
+
+static pthread_mutex_t budget_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t limit_s = 0;
+static uint64_t used_s = 0;
+static uint64_t peak_s = 0;
+
+void budget_init(uint64_t limit) {
+    pthread_mutex_lock(&budget_mutex);
+    limit_s = limit;
+    used_s = 0;
+    peak_s = 0;
+    pthread_mutex_unlock(&budget_mutex);
+}
+
+// needs budget_mutex
+static void take(uint64_t bytes) {
+    used_s += bytes;
+    if (used_s > peak_s) {
+        peak_s = used_s;
+    }
+}
+
+int budget_try_take(uint64_t bytes) {
+    int taken = 0;
+    pthread_mutex_lock(&budget_mutex);
+    if (!limit_s || used_s + bytes <= limit_s) {
+        take(bytes);
+        taken = 1;
+    }
+    pthread_mutex_unlock(&budget_mutex);
+    return taken;
+}
+
+void budget_take(uint64_t bytes) {
+    pthread_mutex_lock(&budget_mutex);
+    take(bytes);
+    pthread_mutex_unlock(&budget_mutex);
+}
+
+void budget_give(uint64_t bytes) {
+    pthread_mutex_lock(&budget_mutex);
+    used_s = bytes < used_s ? used_s - bytes : 0;
+    pthread_mutex_unlock(&budget_mutex);
+}
+
+uint64_t budget_limit() {
+    return limit_s;
+}
+
+uint64_t budget_peak() {
+    pthread_mutex_lock(&budget_mutex);
+    uint64_t peak = peak_s;
+    pthread_mutex_unlock(&budget_mutex);
+    return peak;
+}
+
+// first number in path, 0 if there is none ("max" in cgroup v2)
+static uint64_t read_limit(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    unsigned long long limit = 0;
+    if (fscanf(f, "%llu", &limit) != 1) {
+        limit = 0;
+    }
+    fclose(f);
+    return limit;
+}
+
+uint64_t budget_cgroup_limit() {
+    uint64_t limit = read_limit("/sys/fs/cgroup/memory.max");
+    if (!limit) {
+        limit = read_limit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+    }
+    // v1 reports "no limit" as a page aligned LONG_MAX
+    if (limit >= (1ull << 62)) {
+        limit = 0;
+    }
+    return limit;
+}
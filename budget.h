@@ -0,0 +1,26 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+
+// memory budget in bytes shared by everything the pipeline keeps in flight
+// (queued frames and packets, decoded images). only the readers wait for it,
+// every other stage just accounts what it holds so that the readers see it.
+// waiting anywhere downstream could deadlock the pipeline
+
+// limit 0 disables the budget, budget_try_take always succeeds then
+extern void budget_init(uint64_t limit);
+// takes bytes if they fit into the budget. returns 1 if taken
+extern int budget_try_take(uint64_t bytes);
+// takes bytes, even beyond the limit
+extern void budget_take(uint64_t bytes);
+extern void budget_give(uint64_t bytes);
+// limit and the most that was taken at a time since budget_init
+extern uint64_t budget_limit();
+extern uint64_t budget_peak();
+
+// memory limit of our cgroup (v2 memory.max or v1 memory.limit_in_bytes),
+// 0 if there is none
+extern uint64_t budget_cgroup_limit();
+
+#endif
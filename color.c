@@ -100,9 +100,8 @@ static void sycc_to_rgb(int offset, int upb, int y, int cb, int cr,
 	*out_b = b;
 }
 
-static int sycc444_to_rgb(opj_image_t *img)
+static void sycc444_to_rgb(const opj_image_t *img, int *r, int *g, int *b)
 {
-	int *d0, *d1, *d2, *r, *g, *b;
 	const int *y, *cb, *cr;
 	size_t maxw, maxh, max, i;
 	int offset, upb;
@@ -119,14 +118,6 @@ static int sycc444_to_rgb(opj_image_t *img)
 	cb = img->comps[1].data;
 	cr = img->comps[2].data;
 
-	d0 = r = (int*)opj_image_data_alloc(sizeof(int) * max);
-	d1 = g = (int*)opj_image_data_alloc(sizeof(int) * max);
-	d2 = b = (int*)opj_image_data_alloc(sizeof(int) * max);
-
-	if (r == NULL || g == NULL || b == NULL) {
-		goto fails;
-	}
-
 	for (i = 0U; i < max; ++i) {
 		sycc_to_rgb(offset, upb, *y, *cb, *cr, r, g, b);
 		++y;
@@ -136,28 +127,12 @@ static int sycc444_to_rgb(opj_image_t *img)
 		++g;
 		++b;
 	}
-	opj_image_data_free(img->comps[0].data);
-	img->comps[0].data = d0;
-	opj_image_data_free(img->comps[1].data);
-	img->comps[1].data = d1;
-	opj_image_data_free(img->comps[2].data);
-	img->comps[2].data = d2;
-	img->color_space = OPJ_CLRSPC_SRGB;
-	return 1;
-
-fails:
-	opj_image_data_free(r);
-	opj_image_data_free(g);
-	opj_image_data_free(b);
-
-	return 0;
 }/* sycc444_to_rgb() */
 
-static int sycc422_to_rgb(opj_image_t *img)
+static void sycc422_to_rgb(const opj_image_t *img, int *r, int *g, int *b)
 {
-	int *d0, *d1, *d2, *r, *g, *b;
 	const int *y, *cb, *cr;
-	size_t maxw, maxh, max, offx, loopmaxw;
+	size_t maxw, maxh, offx, loopmaxw;
 	int offset, upb;
 	size_t i;
 
@@ -167,20 +142,11 @@ static int sycc422_to_rgb(opj_image_t *img)
 
 	maxw = (size_t)img->comps[0].w;
 	maxh = (size_t)img->comps[0].h;
-	max = maxw * maxh;
 
 	y = img->comps[0].data;
 	cb = img->comps[1].data;
 	cr = img->comps[2].data;
 
-	d0 = r = (int*)opj_image_data_alloc(sizeof(int) * max);
-	d1 = g = (int*)opj_image_data_alloc(sizeof(int) * max);
-	d2 = b = (int*)opj_image_data_alloc(sizeof(int) * max);
-
-	if (r == NULL || g == NULL || b == NULL) {
-		goto fails;
-	}
-
 	/* if img->x0 is odd, then first column shall use Cb/Cr = 0 */
 	offx = img->x0 & 1U;
 	loopmaxw = maxw - offx;
@@ -220,33 +186,13 @@ static int sycc422_to_rgb(opj_image_t *img)
 			++cr;
 		}
 	}
-
-	opj_image_data_free(img->comps[0].data);
-	img->comps[0].data = d0;
-	opj_image_data_free(img->comps[1].data);
-	img->comps[1].data = d1;
-	opj_image_data_free(img->comps[2].data);
-	img->comps[2].data = d2;
-
-	img->comps[1].w = img->comps[2].w = img->comps[0].w;
-	img->comps[1].h = img->comps[2].h = img->comps[0].h;
-	img->comps[1].dx = img->comps[2].dx = img->comps[0].dx;
-	img->comps[1].dy = img->comps[2].dy = img->comps[0].dy;
-	img->color_space = OPJ_CLRSPC_SRGB;
-	return 1;
-
-fails:
-	opj_image_data_free(r);
-	opj_image_data_free(g);
-	opj_image_data_free(b);
-	return 0;
 }/* sycc422_to_rgb() */
 
-static int sycc420_to_rgb(opj_image_t *img)
+static void sycc420_to_rgb(const opj_image_t *img, int *r, int *g, int *b)
 {
-	int *d0, *d1, *d2, *r, *g, *b, *nr, *ng, *nb;
+	int *nr, *ng, *nb;
 	const int *y, *cb, *cr, *ny;
-	size_t maxw, maxh, max, offx, loopmaxw, offy, loopmaxh;
+	size_t maxw, maxh, offx, loopmaxw, offy, loopmaxh;
 	int offset, upb;
 	size_t i;
 
@@ -256,20 +202,11 @@ static int sycc420_to_rgb(opj_image_t *img)
 
 	maxw = (size_t)img->comps[0].w;
 	maxh = (size_t)img->comps[0].h;
-	max = maxw * maxh;
 
 	y = img->comps[0].data;
 	cb = img->comps[1].data;
 	cr = img->comps[2].data;
 
-	d0 = r = (int*)opj_image_data_alloc(sizeof(int) * max);
-	d1 = g = (int*)opj_image_data_alloc(sizeof(int) * max);
-	d2 = b = (int*)opj_image_data_alloc(sizeof(int) * max);
-
-	if (r == NULL || g == NULL || b == NULL) {
-		goto fails;
-	}
-
 	/* if img->x0 is odd, then first column shall use Cb/Cr = 0 */
 	offx = img->x0 & 1U;
 	loopmaxw = maxw - offx;
@@ -379,61 +316,198 @@ static int sycc420_to_rgb(opj_image_t *img)
 			sycc_to_rgb(offset, upb, *y, *cb, *cr, r, g, b);
 		}
 	}
-
-	opj_image_data_free(img->comps[0].data);
-	img->comps[0].data = d0;
-	opj_image_data_free(img->comps[1].data);
-	img->comps[1].data = d1;
-	opj_image_data_free(img->comps[2].data);
-	img->comps[2].data = d2;
-
-	img->comps[1].w = img->comps[2].w = img->comps[0].w;
-	img->comps[1].h = img->comps[2].h = img->comps[0].h;
-	img->comps[1].dx = img->comps[2].dx = img->comps[0].dx;
-	img->comps[1].dy = img->comps[2].dy = img->comps[0].dy;
-	img->color_space = OPJ_CLRSPC_SRGB;
-	return 1;
-
-fails:
-	opj_image_data_free(r);
-	opj_image_data_free(g);
-	opj_image_data_free(b);
-	return 0;
 }/* sycc420_to_rgb() */
 
-int color_sycc_to_rgb(opj_image_t *img)
-{
-	if (img->numcomps < 3) {
-		img->color_space = OPJ_CLRSPC_GRAY;
-		return 0;
-	}
+typedef void (*sycc_to_rgb_fn)(const opj_image_t *img, int *r, int *g, int *b);
 
+/* NULL when the sub-sampling is not one of the known ones */
+static sycc_to_rgb_fn sycc_converter(const opj_image_t *img)
+{
 	if ((img->comps[0].dx == 1)
 			&& (img->comps[1].dx == 2)
 			&& (img->comps[2].dx == 2)
 			&& (img->comps[0].dy == 1)
 			&& (img->comps[1].dy == 2)
 			&& (img->comps[2].dy == 2)) { /* horizontal and vertical sub-sample */
-		return sycc420_to_rgb(img);
+		return sycc420_to_rgb;
 	} else if ((img->comps[0].dx == 1)
 			&& (img->comps[1].dx == 2)
 			&& (img->comps[2].dx == 2)
 			&& (img->comps[0].dy == 1)
 			&& (img->comps[1].dy == 1)
 			&& (img->comps[2].dy == 1)) { /* horizontal sub-sample only */
-		return sycc422_to_rgb(img);
+		return sycc422_to_rgb;
 	} else if ((img->comps[0].dx == 1)
 			&& (img->comps[1].dx == 1)
 			&& (img->comps[2].dx == 1)
 			&& (img->comps[0].dy == 1)
 			&& (img->comps[1].dy == 1)
 			&& (img->comps[2].dy == 1)) { /* no sub-sample */
-		return sycc444_to_rgb(img);
+		return sycc444_to_rgb;
 	}
 
+	return NULL;
+}/* sycc_converter() */
+
+int color_sycc_to_rgb(opj_image_t *img)
+{
+	sycc_to_rgb_fn convert;
+	size_t max;
+	int *r, *g, *b;
+
+	if (img->numcomps < 3) {
+		img->color_space = OPJ_CLRSPC_GRAY;
+		return 0;
+	}
+
+	convert = sycc_converter(img);
+	if (convert == NULL) {
+		return 1;
+	}
+
+	max = (size_t)img->comps[0].w * (size_t)img->comps[0].h;
+	r = (int*)opj_image_data_alloc(sizeof(int) * max);
+	g = (int*)opj_image_data_alloc(sizeof(int) * max);
+	b = (int*)opj_image_data_alloc(sizeof(int) * max);
+
+	if (r == NULL || g == NULL || b == NULL) {
+		opj_image_data_free(r);
+		opj_image_data_free(g);
+		opj_image_data_free(b);
+		return 0;
+	}
+
+	convert(img, r, g, b);
+
+	opj_image_data_free(img->comps[0].data);
+	img->comps[0].data = r;
+	opj_image_data_free(img->comps[1].data);
+	img->comps[1].data = g;
+	opj_image_data_free(img->comps[2].data);
+	img->comps[2].data = b;
+
+	img->comps[1].w = img->comps[2].w = img->comps[0].w;
+	img->comps[1].h = img->comps[2].h = img->comps[0].h;
+	img->comps[1].dx = img->comps[2].dx = img->comps[0].dx;
+	img->comps[1].dy = img->comps[2].dy = img->comps[0].dy;
+	img->color_space = OPJ_CLRSPC_SRGB;
 	return 1;
 }/* color_sycc_to_rgb() */
 
+opj_image_t *color_sycc_to_rgb_prepare(opj_image_t *img, opj_image_t **rgb)
+{
+	opj_image_comp_t *comp0;
+	opj_image_t *out;
+	int c;
+
+	if (img->numcomps < 3) {
+		img->color_space = OPJ_CLRSPC_GRAY;
+		return img;
+	}
+
+	if (sycc_converter(img) == NULL) {
+		return img;
+	}
+
+	/* the planes of the previous frame are used as long as they fit */
+	comp0 = &img->comps[0];
+	out = *rgb;
+	if (out != NULL && (out->comps[0].w != comp0->w || out->comps[0].h != comp0->h)) {
+		opj_image_destroy(out);
+		out = *rgb = NULL;
+	}
+	if (out == NULL) {
+		opj_image_cmptparm_t parms[3];
+
+		memset(parms, 0, sizeof(parms));
+		for (c = 0; c < 3; ++c) {
+			parms[c].dx = comp0->dx;
+			parms[c].dy = comp0->dy;
+			parms[c].w = comp0->w;
+			parms[c].h = comp0->h;
+			parms[c].x0 = comp0->x0;
+			parms[c].y0 = comp0->y0;
+			parms[c].prec = comp0->prec;
+			parms[c].sgnd = comp0->sgnd;
+		}
+		out = *rgb = opj_image_create(3, parms, OPJ_CLRSPC_SRGB);
+		if (out == NULL) {
+			return NULL;
+		}
+	}
+
+	out->x0 = img->x0;
+	out->y0 = img->y0;
+	out->x1 = img->x1;
+	out->y1 = img->y1;
+	out->color_space = OPJ_CLRSPC_SRGB;
+	for (c = 0; c < 3; ++c) {
+		OPJ_INT32 *data = out->comps[c].data;
+
+		out->comps[c] = *comp0;
+		out->comps[c].data = data;
+		out->comps[c].alpha = 0;
+	}
+	return out;
+}/* color_sycc_to_rgb_prepare() */
+
+void color_sycc_to_rgb_strip(const opj_image_t *img, opj_image_t *out,
+		int strip, int num_strips)
+{
+	sycc_to_rgb_fn convert = sycc_converter(img);
+	opj_image_t view;
+	opj_image_comp_t comps[3];
+	size_t w, h, y0, y1, offy, cy0;
+	int c;
+
+	w = (size_t)img->comps[0].w;
+	h = (size_t)img->comps[0].h;
+	y0 = h * (size_t)strip / (size_t)num_strips;
+	y1 = h * (size_t)(strip + 1) / (size_t)num_strips;
+
+	/* 4:2:0 strips start on the first line of a pair sharing a chroma line,
+	 * the line before the first pair is on its own when img->y0 is odd */
+	offy = 0U;
+	if (img->comps[1].dy == 2) {
+		offy = img->y0 & 1U;
+		if (y0 > 0U) {
+			y0 = offy + ((y0 - offy + 1U) & ~(size_t)1U);
+		}
+		if (y1 > 0U && y1 < h) {
+			y1 = offy + ((y1 - offy + 1U) & ~(size_t)1U);
+		}
+		y0 = y0 < h ? y0 : h;
+		y1 = y1 < h ? y1 : h;
+	}
+	if (y0 >= y1) {
+		return;
+	}
+	cy0 = img->comps[1].dy == 2 && y0 > 0U ? (y0 - offy) / 2U : y0;
+
+	/* the strip as an image of its own, for the converters */
+	view = *img;
+	view.comps = comps;
+	view.y0 = y0 == 0U ? img->y0 : 0U;
+	for (c = 0; c < 3; ++c) {
+		comps[c] = img->comps[c];
+		comps[c].data += (c == 0 ? y0 : cy0) * (size_t)comps[c].w;
+	}
+	comps[0].h = (OPJ_UINT32)(y1 - y0);
+
+	convert(&view, out->comps[0].data + y0 * w, out->comps[1].data + y0 * w,
+			out->comps[2].data + y0 * w);
+}/* color_sycc_to_rgb_strip() */
+
+opj_image_t *color_sycc_to_rgb_into(opj_image_t *img, opj_image_t **rgb)
+{
+	opj_image_t *out = color_sycc_to_rgb_prepare(img, rgb);
+
+	if (out != NULL && out != img) {
+		color_sycc_to_rgb_strip(img, out, 0, 1);
+	}
+	return out;
+}/* color_sycc_to_rgb_into() */
+
 #if defined(OPJ_HAVE_LIBLCMS2) || defined(OPJ_HAVE_LIBLCMS1)
 
 #ifdef OPJ_HAVE_LIBLCMS1
@@ -41,6 +41,17 @@
 #include <openjpeg-2.3/openjpeg.h>
 
 extern int color_sycc_to_rgb(opj_image_t *img);
+/* converts into the planes of *rgb, which is (re)created when img has another
+ * size and kept for the next call. returns *rgb, img when there is nothing to
+ * convert and NULL when out of memory */
+extern opj_image_t *color_sycc_to_rgb_into(opj_image_t *img, opj_image_t **rgb);
+/* color_sycc_to_rgb_into in strips: prepare sets up *rgb and returns what
+ * color_sycc_to_rgb_into would, without converting. when that is not img,
+ * the strips of 0 to num_strips - 1 convert their rows into it and can run at
+ * the same time */
+extern opj_image_t *color_sycc_to_rgb_prepare(opj_image_t *img, opj_image_t **rgb);
+extern void color_sycc_to_rgb_strip(const opj_image_t *img, opj_image_t *out,
+		int strip, int num_strips);
 extern void color_apply_icc_profile(opj_image_t *image);
 extern void color_cielab_to_rgb(opj_image_t *image);
 
@@ -0,0 +1,433 @@
+#include "flatten.h"
+#include <string>
+#include <deque>
+#include <pthread.h>
+#include <KM_fileio.h>
+#include <AS_02.h>
+#include <cstdlib>
+#include "asdcp.h"
+#include "av_pipeline.h"
+
+using namespace ASDCP;
+
+// frames a reader may be ahead of its writer
+const unsigned int FLATTEN_QUEUE_LEN = 25;
+
+typedef struct {
+    // NULL marks the end of the track
+    unsigned char *data;
+    unsigned int length;
+    // frame in the source track file, for reporting
+    unsigned int frame;
+    asdcp_encrypted_frame_t *encrypted;
+} flatten_frame_t;
+
+// frames from a reader to its writer. the reader waits while it is full
+typedef struct flatten_queue_s {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    std::deque<flatten_frame_t> frames;
+    // shared by the queues of all tracks, set when a reader or a writer gave
+    // up. the readers stop then, the writers drop what is left
+    volatile int *failed;
+    // woken up as well when this track fails
+    struct flatten_queue_s *other;
+    // next position in the composition
+    unsigned int timeline_frame;
+} flatten_queue_t;
+
+static void free_flatten_frame(flatten_frame_t *frame) {
+    free(frame->data);
+    free(frame->encrypted);
+}
+
+static void init_flatten_queue(flatten_queue_t *queue, volatile int *failed, flatten_queue_t *other) {
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->failed = failed;
+    queue->other = other;
+    queue->timeline_frame = 0;
+}
+
+static void destroy_flatten_queue(flatten_queue_t *queue) {
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->mutex);
+}
+
+// takes ownership of frame. the end marker always gets through so that the
+// writer sees it. returns nonzero if a track failed, the reader stops then
+static int push_flatten_frame(flatten_queue_t *queue, flatten_frame_t *frame) {
+    pthread_mutex_lock(&queue->mutex);
+    while (frame->data && !*queue->failed && queue->frames.size() >= FLATTEN_QUEUE_LEN) {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    int failed = *queue->failed;
+    if (failed && frame->data) {
+        free_flatten_frame(frame);
+    } else {
+        queue->frames.push_back(*frame);
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return failed || av_pipeline_stopped();
+}
+
+static flatten_frame_t pop_flatten_frame(flatten_queue_t *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->frames.empty()) {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    flatten_frame_t frame = queue->frames.front();
+    queue->frames.pop_front();
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return frame;
+}
+
+static void wake_flatten_queue(flatten_queue_t *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// a reader or writer of queue's track gave up, stops the readers of all
+// tracks. the waits test the flag under their queue's lock, so waking them
+// after setting it is enough
+static void fail_flatten(flatten_queue_t *queue) {
+    *queue->failed = 1;
+    wake_flatten_queue(queue);
+    wake_flatten_queue(queue->other);
+}
+
+static int on_flatten_j2k_frame(unsigned char *data, unsigned int length, unsigned int frame_count, asdcp_encrypted_frame_t *encrypted, void *user_data) {
+    flatten_frame_t frame = { data, length, frame_count, encrypted };
+    return push_flatten_frame((flatten_queue_t*)user_data, &frame);
+}
+
+static int on_flatten_pcm_frame(unsigned char *data, unsigned int length, unsigned int current_frame, void *user_data) {
+    flatten_frame_t frame = { data, length, current_frame, NULL };
+    return push_flatten_frame((flatten_queue_t*)user_data, &frame);
+}
+
+// the copy constructors of the metadata objects keep a reference to the
+// dictionary pointer of the source, which goes away with its reader
+static const Dictionary *&flatten_dict() {
+    static const Dictionary *dict = &DefaultCompositeDict();
+    return dict;
+}
+
+// copy of obj that outlives the reader obj came from, NULL if obj is no T
+template <class T>
+static T *copy_md_object(MXF::InterchangeObject *obj) {
+    T *source = dynamic_cast<T*>(obj);
+    if (!source) {
+        return 0;
+    }
+    T *copy = new T(flatten_dict());
+    copy->Copy(*source);
+    return copy;
+}
+
+// the source's writer info without the encryption, the frames are written
+// decrypted (-D, the readers refuse encrypted track files otherwise). new
+// asset id, it is a new track file
+static void flatten_writer_info(const WriterInfo &source, WriterInfo &Info) {
+    Info = source;
+    Info.EncryptedEssence = false;
+    Info.UsesHMAC = false;
+    memset(Info.ContextID, 0, sizeof(Info.ContextID));
+    memset(Info.CryptographicKeyID, 0, sizeof(Info.CryptographicKeyID));
+    Kumu::GenRandomUUID(Info.AssetUUID);
+}
+
+// opens path with the essence descriptor and JPEG 2000 sub-descriptor of the
+// first track file
+static Result_t open_video_writer(asset_t *first, av_pipeline_context_t *av_context, const std::string &path, AS_02::JP2K::MXFWriter &Writer) {
+    AS_02::JP2K::MXFReader Reader;
+    // just the descriptors, none of the index
+    Result_t result = Reader.OpenRead(first->mxf_path, AS_02::IM_ON_DEMAND);
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error opening %s\n", first->mxf_path);
+        return result;
+    }
+
+    MXF::FileDescriptor *descriptor = 0;
+    MXF::InterchangeObject *tmp_obj = 0;
+    result = Reader.OP1aHeader().GetMDObjectByType(DefaultCompositeDict().ul(MDD_RGBAEssenceDescriptor), &tmp_obj);
+    if (KM_SUCCESS(result)) {
+        descriptor = copy_md_object<MXF::RGBAEssenceDescriptor>(tmp_obj);
+    } else {
+        result = Reader.OP1aHeader().GetMDObjectByType(DefaultCompositeDict().ul(MDD_CDCIEssenceDescriptor), &tmp_obj);
+        if (!KM_SUCCESS(result)) {
+            fprintf(stderr, "%s does not contain an essence descriptor\n", first->mxf_path);
+            return result;
+        }
+        descriptor = copy_md_object<MXF::CDCIEssenceDescriptor>(tmp_obj);
+    }
+    // the writer links the sub-descriptors it gets
+    descriptor->SubDescriptors.clear();
+    Kumu::GenRandomValue(descriptor->InstanceUID);
+
+    MXF::InterchangeObject_list_t sub_descriptors;
+    result = Reader.OP1aHeader().GetMDObjectByType(DefaultCompositeDict().ul(MDD_JPEG2000PictureSubDescriptor), &tmp_obj);
+    if (!KM_SUCCESS(result)) {
+        fprintf(stderr, "%s does not contain a JPEG 2000 sub-descriptor\n", first->mxf_path);
+        delete descriptor;
+        return result;
+    }
+    sub_descriptors.push_back(copy_md_object<MXF::JPEG2000PictureSubDescriptor>(tmp_obj));
+
+    WriterInfo SourceInfo, Info;
+    Reader.FillWriterInfo(SourceInfo);
+    flatten_writer_info(SourceInfo, Info);
+
+    // the writer owns the descriptors from here on
+    result = Writer.OpenWrite(path, Info, descriptor, sub_descriptors,
+            Rational(av_context->cpl->edit_rate.num, av_context->cpl->edit_rate.denom));
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error opening %s for writing\n", path.c_str());
+    }
+    return result;
+}
+
+// opens path with the wave descriptor and MCA labels of the first track file
+static Result_t open_audio_writer(asset_t *first, av_pipeline_context_t *av_context, const std::string &path, AS_02::PCM::MXFWriter &Writer) {
+    Rational edit_rate = Rational(av_context->cpl->edit_rate.num, av_context->cpl->edit_rate.denom);
+    AS_02::PCM::MXFReader Reader;
+    Result_t result = Reader.OpenRead(first->mxf_path, edit_rate);
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error opening %s\n", first->mxf_path);
+        return result;
+    }
+
+    MXF::InterchangeObject *tmp_obj = 0;
+    result = Reader.OP1aHeader().GetMDObjectByType(DefaultCompositeDict().ul(MDD_WaveAudioDescriptor), &tmp_obj);
+    MXF::WaveAudioDescriptor *source = dynamic_cast<MXF::WaveAudioDescriptor*>(tmp_obj);
+    if (!KM_SUCCESS(result) || !source) {
+        fprintf(stderr, "%s does not contain an essence descriptor\n", first->mxf_path);
+        return RESULT_FAIL;
+    }
+
+    MXF::InterchangeObject_list_t sub_descriptors;
+    for (MXF::Array<UUID>::const_iterator i = source->SubDescriptors.begin(); i != source->SubDescriptors.end(); ++i) {
+        if (!KM_SUCCESS(Reader.OP1aHeader().GetMDObjectByID(*i, &tmp_obj))) {
+            continue;
+        }
+        MXF::InterchangeObject *label = copy_md_object<MXF::AudioChannelLabelSubDescriptor>(tmp_obj);
+        if (!label) {
+            label = copy_md_object<MXF::SoundfieldGroupLabelSubDescriptor>(tmp_obj);
+        }
+        if (!label) {
+            label = copy_md_object<MXF::GroupOfSoundfieldGroupsLabelSubDescriptor>(tmp_obj);
+        }
+        if (label) {
+            sub_descriptors.push_back(label);
+        }
+    }
+
+    MXF::WaveAudioDescriptor *descriptor = copy_md_object<MXF::WaveAudioDescriptor>(source);
+    descriptor->SubDescriptors.clear();
+    Kumu::GenRandomValue(descriptor->InstanceUID);
+
+    WriterInfo SourceInfo, Info;
+    Reader.FillWriterInfo(SourceInfo);
+    flatten_writer_info(SourceInfo, Info);
+
+    result = Writer.OpenWrite(path, Info, descriptor, sub_descriptors, edit_rate);
+    if (!ASDCP_SUCCESS(result)) {
+        fprintf(stderr, "error opening %s for writing\n", path.c_str());
+    }
+    return result;
+}
+
+typedef struct {
+    flatten_queue_t queue;
+    av_pipeline_context_t *av_context;
+    std::string path;
+    AS_02::JP2K::MXFWriter video_writer;
+    AS_02::PCM::MXFWriter audio_writer;
+    int err;
+} flatten_track_t;
+
+static void report_flatten_integrity_failure(av_pipeline_context_t *av_context, flatten_track_t *track, flatten_frame_t *frame) {
+    integrity_report_t *report = &av_context->video_integrity;
+    // frames are verified in order here, the first one is the earliest
+    if (!report->failed) {
+        report->failed = 1;
+        report->timeline_frame = track->queue.timeline_frame;
+        report->frame = frame->frame;
+        strcpy(report->mxf_path, frame->encrypted->mxf_path);
+    }
+}
+
+static void *write_video_thread(void *data) {
+    flatten_track_t *track = (flatten_track_t*)data;
+    JP2K::FrameBuffer FrameBuffer;
+    Result_t result = RESULT_OK;
+
+    for (;;) {
+        flatten_frame_t frame = pop_flatten_frame(&track->queue);
+        if (!frame.data) {
+            break;
+        }
+        // dropped up to the end marker, the reader is about to stop
+        if (*track->queue.failed) {
+            free_flatten_frame(&frame);
+            continue;
+        }
+
+        unsigned char *buf = frame.data;
+        unsigned int length = frame.length;
+        if (frame.encrypted) {
+            if (frame.encrypted->verify_hmac && asdcp_verify_frame(frame.encrypted, frame.data, frame.length)) {
+                report_flatten_integrity_failure(track->av_context, track, &frame);
+            }
+            if (asdcp_decrypt_frame(frame.encrypted, frame.data, frame.length, &buf, &length)) {
+                fprintf(stderr, "error decrypting frame %d of %s\n", frame.frame, frame.encrypted->mxf_path);
+                free_flatten_frame(&frame);
+                fail_flatten(&track->queue);
+                continue;
+            }
+        }
+
+        FrameBuffer.SetData(buf, length);
+        FrameBuffer.Size(length);
+        result = track->video_writer.WriteFrame(FrameBuffer);
+
+        if (buf != frame.data) {
+            free(buf);
+        }
+        free_flatten_frame(&frame);
+        if (!ASDCP_SUCCESS(result)) {
+            fprintf(stderr, "error writing video frame %d to %s\n", track->queue.timeline_frame, track->path.c_str());
+            fail_flatten(&track->queue);
+            continue;
+        }
+        track->queue.timeline_frame++;
+    }
+
+    // an incomplete track file is left as it is
+    if (*track->queue.failed) {
+        track->err = 1;
+    } else if (!ASDCP_SUCCESS(track->video_writer.Finalize())) {
+        fprintf(stderr, "error finalizing %s\n", track->path.c_str());
+        track->err = 1;
+    }
+    return NULL;
+}
+
+static void *write_audio_thread(void *data) {
+    flatten_track_t *track = (flatten_track_t*)data;
+    ASDCP::FrameBuffer FrameBuffer;
+    Result_t result = RESULT_OK;
+
+    for (;;) {
+        flatten_frame_t frame = pop_flatten_frame(&track->queue);
+        if (!frame.data) {
+            break;
+        }
+        if (*track->queue.failed) {
+            free_flatten_frame(&frame);
+            continue;
+        }
+
+        // decrypted by the reader already
+        FrameBuffer.SetData(frame.data, frame.length);
+        FrameBuffer.Size(frame.length);
+        result = track->audio_writer.WriteFrame(FrameBuffer);
+        free_flatten_frame(&frame);
+        if (!ASDCP_SUCCESS(result)) {
+            fprintf(stderr, "error writing audio frame %d to %s\n", track->queue.timeline_frame, track->path.c_str());
+            fail_flatten(&track->queue);
+            continue;
+        }
+        track->queue.timeline_frame++;
+    }
+
+    if (*track->queue.failed) {
+        track->err = 1;
+    } else if (!ASDCP_SUCCESS(track->audio_writer.Finalize())) {
+        fprintf(stderr, "error finalizing %s\n", track->path.c_str());
+        track->err = 1;
+    }
+    return NULL;
+}
+
+typedef struct {
+    linked_list_t *audio_files;
+    av_pipeline_context_t *av_context;
+    flatten_queue_t *queue;
+    int ok;
+} flatten_audio_reader_t;
+
+static void *read_audio_thread(void *data) {
+    flatten_audio_reader_t *reader = (flatten_audio_reader_t*)data;
+    reader->ok = asdcp_read_audio_files(reader->audio_files, reader->av_context, on_flatten_pcm_frame, reader->queue);
+    if (!reader->ok) {
+        fail_flatten(reader->queue);
+    }
+    return NULL;
+}
+
+int flatten_run(linked_list_t *video_files, linked_list_t *audio_files, av_pipeline_context_t *av_context) {
+    const char *out_dir = av_context->flatten_dir;
+
+    if (!video_files || !audio_files) {
+        fprintf(stderr, "can only flatten CPLs with both picture and audio\n");
+        return 0;
+    }
+
+    if (!Kumu::PathIsDirectory(out_dir) && !KM_SUCCESS(Kumu::CreateDirectoriesInPath(std::string(out_dir) + "/"))) {
+        fprintf(stderr, "error creating %s\n", out_dir);
+        return 0;
+    }
+
+    flatten_track_t *video = new flatten_track_t();
+    flatten_track_t *audio = new flatten_track_t();
+    video->av_context = audio->av_context = av_context;
+    video->path = Kumu::PathJoin(out_dir, "video.mxf");
+    audio->path = Kumu::PathJoin(out_dir, "audio.mxf");
+    video->err = audio->err = 0;
+    volatile int failed = 0;
+    init_flatten_queue(&video->queue, &failed, &audio->queue);
+    init_flatten_queue(&audio->queue, &failed, &video->queue);
+
+    int ok = 0;
+    if (!ASDCP_SUCCESS(open_video_writer((asset_t*)video_files->user_data, av_context, video->path, video->video_writer)) ||
+            !ASDCP_SUCCESS(open_audio_writer((asset_t*)audio_files->user_data, av_context, audio->path, audio->audio_writer))) {
+        goto free_and_out;
+    }
+
+    {
+        fprintf(stderr, "flatten to %s and %s\n", video->path.c_str(), audio->path.c_str());
+
+        pthread_t video_writer_id, audio_writer_id, audio_reader_id;
+        pthread_create(&video_writer_id, NULL, write_video_thread, video);
+        pthread_create(&audio_writer_id, NULL, write_audio_thread, audio);
+
+        flatten_audio_reader_t audio_reader = { audio_files, av_context, &audio->queue, 0 };
+        pthread_create(&audio_reader_id, NULL, read_audio_thread, &audio_reader);
+
+        ok = asdcp_read_video_files(video_files, av_context, on_flatten_j2k_frame, &video->queue);
+        if (!ok) {
+            fail_flatten(&video->queue);
+        }
+
+        pthread_join(audio_reader_id, NULL);
+        pthread_join(video_writer_id, NULL);
+        pthread_join(audio_writer_id, NULL);
+
+        ok = ok && audio_reader.ok && !failed && !video->err && !audio->err && !av_pipeline_stopped();
+        fprintf(stderr, "flattened %d video frames, %d audio frames\n", video->queue.timeline_frame, audio->queue.timeline_frame);
+    }
+
+free_and_out:
+    destroy_flatten_queue(&video->queue);
+    destroy_flatten_queue(&audio->queue);
+    delete video;
+    delete audio;
+
+    return ok;
+}
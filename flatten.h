@@ -0,0 +1,27 @@
+#ifndef FLATTEN_H
+#define FLATTEN_H
+
+#include "linked_list.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct av_pipeline_context_s;
+
+// -X: copies the frames of video_files and the samples of audio_files in
+// timeline order into two new AS-02 track files, video.mxf and audio.mxf in
+// av_context->flatten_dir, nothing gets decoded and no CPL is written. the
+// descriptors come from the first track file of each list. encrypted track
+// files are refused unless av_context->flatten_decrypt is set, they are
+// written decrypted then. a reader and a writer thread per track file, the
+// reads of the next frames overlap with writing the current one, a failure
+// in any of them stops all. returns 1 on success like
+// asdcp_read_video_files
+extern int flatten_run(linked_list_t *video_files, linked_list_t *audio_files, struct av_pipeline_context_s *av_context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
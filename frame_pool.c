@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "frame_pool.h"
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+typedef struct pool_buf_s {
+    void *ptr;
+    size_t size;
+    int in_use;
+    int hugetlb;
+    // NUMA node of the thread that mapped it, first touch put it there
+    unsigned int node;
+    struct pool_buf_s *next;
+} pool_buf_t;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+// most recently freed first
+static pool_buf_t *bufs_s = NULL;
+static uint64_t max_idle_s = 0;
+static uint64_t idle_s = 0;
+// hugetlbfs had no pages for us, don't ask again
+static int no_hugetlb_s = 0;
+static frame_pool_stats_t stats_s;
+
+void frame_pool_init(uint64_t max_idle_bytes) {
+    pthread_mutex_lock(&pool_mutex);
+    max_idle_s = max_idle_bytes;
+    memset(&stats_s, 0, sizeof(stats_s));
+    for (pool_buf_t *buf = bufs_s; buf; buf = buf->next) {
+        stats_s.buffers++;
+        stats_s.mapped_bytes += buf->size;
+        if (buf->hugetlb) {
+            stats_s.hugetlb_bytes += buf->size;
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// needs pool_mutex
+static void unmap(pool_buf_t **link) {
+    pool_buf_t *buf = *link;
+    *link = buf->next;
+    munmap(buf->ptr, buf->size);
+    idle_s -= buf->size;
+    stats_s.buffers--;
+    stats_s.mapped_bytes -= buf->size;
+    if (buf->hugetlb) {
+        stats_s.hugetlb_bytes -= buf->size;
+    }
+    free(buf);
+}
+
+// needs pool_mutex. unmaps the oldest idle buffers until bytes more fit
+static void trim(uint64_t bytes) {
+    while (max_idle_s && idle_s + bytes > max_idle_s) {
+        pool_buf_t **oldest = NULL;
+        for (pool_buf_t **link = &bufs_s; *link; link = &(*link)->next) {
+            if (!(*link)->in_use) {
+                oldest = link;
+            }
+        }
+        if (!oldest) {
+            break;
+        }
+        unmap(oldest);
+    }
+}
+
+static unsigned int current_node() {
+    unsigned int cpu = 0, node = 0;
+    syscall(SYS_getcpu, &cpu, &node, NULL);
+    return node;
+}
+
+// size is a multiple of HUGE_PAGE_SIZE
+static void *map(size_t size, int *hugetlb) {
+    void *ptr;
+    if (!no_hugetlb_s) {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            *hugetlb = 1;
+            return ptr;
+        }
+        no_hugetlb_s = 1;
+    }
+
+    // transparent huge pages need 2 MB aligned ranges, cut the slack off
+    unsigned char *raw = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    size_t head = (HUGE_PAGE_SIZE - ((uintptr_t)raw & (HUGE_PAGE_SIZE - 1))) & (HUGE_PAGE_SIZE - 1);
+    if (head) {
+        munmap(raw, head);
+    }
+    munmap(raw + head + size, HUGE_PAGE_SIZE - head);
+    ptr = raw + head;
+    // only a hint, fine if THP is disabled
+    madvise(ptr, size, MADV_HUGEPAGE);
+    *hugetlb = 0;
+    return ptr;
+}
+
+void *frame_pool_alloc(size_t size) {
+    if (!size) {
+        return NULL;
+    }
+    if (size < FRAME_POOL_MIN_SIZE) {
+        void *ptr = NULL;
+        return posix_memalign(&ptr, 64, size) ? NULL : ptr;
+    }
+
+    size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    unsigned int node = current_node();
+    pthread_mutex_lock(&pool_mutex);
+    stats_s.allocs++;
+    // one from our node if there is one (decode workers are pinned with -N)
+    pool_buf_t *idle = NULL;
+    for (pool_buf_t *buf = bufs_s; buf; buf = buf->next) {
+        if (!buf->in_use && buf->size == size && (!idle || buf->node == node)) {
+            idle = buf;
+            if (buf->node == node) {
+                break;
+            }
+        }
+    }
+    if (idle) {
+        idle->in_use = 1;
+        idle_s -= size;
+        stats_s.reused++;
+        pthread_mutex_unlock(&pool_mutex);
+        return idle->ptr;
+    }
+    // idle buffers of other sizes make room for the new one
+    trim(size);
+    pthread_mutex_unlock(&pool_mutex);
+
+    pool_buf_t *buf = malloc(sizeof(pool_buf_t));
+    if (!buf) {
+        return NULL;
+    }
+    buf->ptr = map(size, &buf->hugetlb);
+    if (!buf->ptr) {
+        free(buf);
+        return NULL;
+    }
+    buf->size = size;
+    buf->in_use = 1;
+    buf->node = node;
+
+    pthread_mutex_lock(&pool_mutex);
+    buf->next = bufs_s;
+    bufs_s = buf;
+    stats_s.buffers++;
+    stats_s.mapped_bytes += size;
+    if (buf->hugetlb) {
+        stats_s.hugetlb_bytes += size;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return buf->ptr;
+}
+
+void frame_pool_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    pthread_mutex_lock(&pool_mutex);
+    for (pool_buf_t **link = &bufs_s; *link; link = &(*link)->next) {
+        pool_buf_t *buf = *link;
+        if (buf->ptr == ptr) {
+            buf->in_use = 0;
+            idle_s += buf->size;
+            // to the front, trim goes for the back
+            *link = buf->next;
+            buf->next = bufs_s;
+            bufs_s = buf;
+            trim(0);
+            pthread_mutex_unlock(&pool_mutex);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    // not ours, from posix_memalign
+    free(ptr);
+}
+
+void frame_pool_release() {
+    pthread_mutex_lock(&pool_mutex);
+    pool_buf_t **link = &bufs_s;
+    while (*link) {
+        if ((*link)->in_use) {
+            link = &(*link)->next;
+        } else {
+            unmap(link);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void frame_pool_stats(frame_pool_stats_t *stats) {
+    pthread_mutex_lock(&pool_mutex);
+    *stats = stats_s;
+    pthread_mutex_unlock(&pool_mutex);
+}
@@ -0,0 +1,36 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// buffers for decoded component planes (openjpeg's image data, see
+// opj_set_image_data_allocator) and output packets. buffers of
+// FRAME_POOL_MIN_SIZE and more come from 2 MB aligned mappings backed by
+// huge pages (hugetlbfs if there are reserved pages, transparent huge pages
+// otherwise) and are kept for the next frame instead of being unmapped.
+// smaller ones go to malloc. thread safe
+#define FRAME_POOL_MIN_SIZE (1 << 20)
+
+typedef struct {
+    // buffers mapped right now, in use or idle
+    unsigned int buffers;
+    uint64_t mapped_bytes;
+    // part of mapped_bytes from hugetlbfs, the rest is madvised
+    uint64_t hugetlb_bytes;
+    // pooled allocations and how many of them reused an idle buffer
+    unsigned int allocs;
+    unsigned int reused;
+} frame_pool_stats_t;
+
+// max_idle_bytes caps what is kept unused, the oldest idle buffers get
+// unmapped beyond it. 0 for no cap
+extern void frame_pool_init(uint64_t max_idle_bytes);
+// NULL if size is 0 or out of memory
+extern void *frame_pool_alloc(size_t size);
+extern void frame_pool_free(void *ptr);
+// unmaps all idle buffers
+extern void frame_pool_release();
+extern void frame_pool_stats(frame_pool_stats_t *stats);
+
+#endif
@@ -6,6 +6,10 @@
 #include <string.h>
 #include "imf.h"
 
+struct imf_doc_s {
+    xmlDoc *doc;
+};
+
 static int has_key(xmlNode *n, const char *key) {
     return !strcmp(n->name, key);
 }
@@ -145,6 +149,50 @@ static cpl_cdci_descriptor *cpl_cdci_descriptor_from_xml_node(xmlNode *node) {
     return res;
 }
 
+static cpl_rgba_descriptor *cpl_rgba_descriptor_from_xml_node(xmlNode *node) {
+    if (!node) {
+        return NULL;
+    }
+
+    cpl_rgba_descriptor *res = (cpl_rgba_descriptor*)malloc(sizeof(cpl_rgba_descriptor));
+    memset(res, 0, sizeof(cpl_rgba_descriptor));
+
+    for (xmlNode *el = node->children; el != NULL; el = el->next) {
+        if (el->type == XML_ELEMENT_NODE) {
+            if (has_key(el, "StoredWidth")) {
+                res->stored_width = get_int(el);
+            }
+            if (has_key(el, "StoredHeight")) {
+                res->stored_height = get_int(el);
+            }
+            if (has_key(el, "ComponentMaxRef")) {
+                res->component_max_ref = get_int(el);
+            }
+            if (has_key(el, "ComponentMinRef")) {
+                res->component_min_ref = get_int(el);
+            }
+            if (has_key(el, "SampleRate")) {
+                res->sample_rate = get_fraction_slash(el);
+            }
+            // ULs or enum names, cut to the field size
+            if (has_key(el, "ColorPrimaries")) {
+                snprintf(res->color_primaries, sizeof(res->color_primaries), "%s", get_text(el));
+            }
+            if (has_key(el, "TransferCharacteristic")) {
+                snprintf(res->transfer_characteristic, sizeof(res->transfer_characteristic), "%s", get_text(el));
+            }
+            if (has_key(el, "PictureCompression")) {
+                snprintf(res->picture_compression, sizeof(res->picture_compression), "%s", get_text(el));
+            }
+            if (has_key(el, "FrameLayout")) {
+                snprintf(res->frame_layout, sizeof(res->frame_layout), "%s", get_text(el));
+            }
+        }
+    }
+
+    return res;
+}
+
 static am_chunk_t* am_chunk_from_xml_node(xmlNode *node) {
     if (!node) {
         return NULL;
@@ -230,19 +278,30 @@ static xmlXPathContextPtr setup_xpath_context(xmlDoc *cplDoc) {
 
 typedef void* (*collect_func_t)(xmlNode *node);
 
-linked_list_t* collect_xpath_results(const char* filename, const char *xpath, collect_func_t collect_func) {
+imf_doc_t* imf_doc_open(const char *filename) {
     xmlInitParser();
 
     LIBXML_TEST_VERSION
-        xmlDoc *cplDoc = xmlReadFile(filename, NULL, 0);
-    if (!cplDoc) {
-        xmlFreeDoc(cplDoc);
-        xmlCleanupParser();
+        xmlDoc *xml_doc = xmlReadFile(filename, NULL, 0);
+    if (!xml_doc) {
         return NULL;
     }
 
+    imf_doc_t *doc = (imf_doc_t*)malloc(sizeof(imf_doc_t));
+    doc->doc = xml_doc;
+    return doc;
+}
+
+void imf_doc_close(imf_doc_t *doc) {
+    if (doc) {
+        xmlFreeDoc(doc->doc);
+        free(doc);
+    }
+}
+
+linked_list_t* collect_xpath_results(imf_doc_t *doc, const char *xpath, collect_func_t collect_func) {
     linked_list_t *resources = NULL;
-    xmlXPathContextPtr ctx = setup_xpath_context(cplDoc);
+    xmlXPathContextPtr ctx = setup_xpath_context(doc->doc);
 
     xmlXPathObjectPtr search_res = xmlXPathEvalExpression(xpath, ctx);
     if (!xmlXPathNodeSetIsEmpty(search_res->nodesetval)) {
@@ -266,18 +325,16 @@ linked_list_t* collect_xpath_results(const char* filename, const char *xpath, co
 
     xmlXPathFreeObject(search_res);
     xmlXPathFreeContext(ctx);
-    xmlFreeDoc(cplDoc);
-    xmlCleanupParser();
 
     return resources;
 }
 
-linked_list_t* cpl_get_video_resources(const char* filename) {
-    return collect_xpath_results(filename, "//*[local-name()='MainImageSequence']//*[local-name()='Resource']", (collect_func_t)cpl_resource_from_xml_node);
+linked_list_t* cpl_get_video_resources(imf_doc_t *doc) {
+    return collect_xpath_results(doc, "//*[local-name()='MainImageSequence']//*[local-name()='Resource']", (collect_func_t)cpl_resource_from_xml_node);
 }
 
-linked_list_t* cpl_get_audio_resources(const char* filename) {
-    return collect_xpath_results(filename, "//*[local-name()='MainAudioSequence']//*[local-name()='Resource']", (collect_func_t)cpl_resource_from_xml_node);
+linked_list_t* cpl_get_audio_resources(imf_doc_t *doc) {
+    return collect_xpath_results(doc, "//*[local-name()='MainAudioSequence']//*[local-name()='Resource']", (collect_func_t)cpl_resource_from_xml_node);
 }
 
 extern void cpl_free_resources(linked_list_t *ll) {
@@ -289,7 +346,7 @@ extern void cpl_free_resources(linked_list_t *ll) {
     }
 }
 
-cpl_cdci_descriptor* cpl_get_cdci_descriptor_for_resource(const char *filename, cpl_resource_t *resource) {
+cpl_cdci_descriptor* cpl_get_cdci_descriptor_for_resource(imf_doc_t *doc, cpl_resource_t *resource) {
     // need to use local names because of namespace shizzle
     const char *query_s = "//*[local-name()='EssenceDescriptor'][*[local-name()='Id']='";
     const char *query_e = "']/*[local-name()='CDCIDescriptor']";
@@ -299,7 +356,26 @@ cpl_cdci_descriptor* cpl_get_cdci_descriptor_for_resource(const char *filename,
     strcat(xpath, resource->source_encoding);
     strcat(xpath, query_e);
 
-    linked_list_t *ll = collect_xpath_results(filename, xpath, (collect_func_t)cpl_cdci_descriptor_from_xml_node);
+    linked_list_t *ll = collect_xpath_results(doc, xpath, (collect_func_t)cpl_cdci_descriptor_from_xml_node);
+    if (!ll) {
+        return NULL;
+    }
+    void *user_data = ll->user_data;
+    free(ll);
+    return user_data;
+}
+
+cpl_rgba_descriptor* cpl_get_rgba_descriptor_for_resource(imf_doc_t *doc, cpl_resource_t *resource) {
+    // need to use local names because of namespace shizzle
+    const char *query_s = "//*[local-name()='EssenceDescriptor'][*[local-name()='Id']='";
+    const char *query_e = "']/*[local-name()='RGBADescriptor']";
+
+    char xpath[1024];
+    strcpy(xpath, query_s);
+    strcat(xpath, resource->source_encoding);
+    strcat(xpath, query_e);
+
+    linked_list_t *ll = collect_xpath_results(doc, xpath, (collect_func_t)cpl_rgba_descriptor_from_xml_node);
     if (!ll) {
         return NULL;
     }
@@ -308,7 +384,7 @@ cpl_cdci_descriptor* cpl_get_cdci_descriptor_for_resource(const char *filename,
     return user_data;
 }
 
-cpl_wave_pcm_descriptor *cpl_get_wave_pcm_descriptor_for_resource(const char *filename, cpl_resource_t *resource) {
+cpl_wave_pcm_descriptor *cpl_get_wave_pcm_descriptor_for_resource(imf_doc_t *doc, cpl_resource_t *resource) {
     // need to use local names because of namespace shizzle
     const char *query_s = "//*[local-name()='EssenceDescriptor'][*[local-name()='Id']='";
     const char *query_e = "']/*[local-name()='WAVEPCMDescriptor']";
@@ -318,7 +394,7 @@ cpl_wave_pcm_descriptor *cpl_get_wave_pcm_descriptor_for_resource(const char *fi
     strcat(xpath, resource->source_encoding);
     strcat(xpath, query_e);
 
-    linked_list_t *ll = collect_xpath_results(filename, xpath, (collect_func_t)cpl_wave_pcm_descriptor_from_xml_node);
+    linked_list_t *ll = collect_xpath_results(doc, xpath, (collect_func_t)cpl_wave_pcm_descriptor_from_xml_node);
     if (!ll) {
         return NULL;
     }
@@ -327,8 +403,8 @@ cpl_wave_pcm_descriptor *cpl_get_wave_pcm_descriptor_for_resource(const char *fi
     return user_data;
 }
 
-cpl_composition_playlist* cpl_get_composition_playlist(const char *filename) {
-    linked_list_t * ll = collect_xpath_results(filename, "//*[local-name()='CompositionPlaylist']", (collect_func_t)cpl_compositon_playlist_from_node);
+cpl_composition_playlist* cpl_get_composition_playlist(imf_doc_t *doc) {
+    linked_list_t * ll = collect_xpath_results(doc, "//*[local-name()='CompositionPlaylist']", (collect_func_t)cpl_compositon_playlist_from_node);
     if (!ll) {
         return NULL;
     }
@@ -337,7 +413,7 @@ cpl_composition_playlist* cpl_get_composition_playlist(const char *filename) {
     return user_data;
 }
 
-am_chunk_t* am_get_chunk_for_resource(const char *filename, cpl_resource_t *resource) {
+am_chunk_t* am_get_chunk_for_resource(imf_doc_t *doc, cpl_resource_t *resource) {
 
     // need to use local names because of namespace shizzle
     const char *query_s = "//*[local-name()='Asset'][*[local-name()='Id']='";
@@ -348,7 +424,7 @@ am_chunk_t* am_get_chunk_for_resource(const char *filename, cpl_resource_t *reso
     strcat(xpath, resource->track_file_id);
     strcat(xpath, query_e);
 
-    linked_list_t *ll = collect_xpath_results(filename, xpath, (collect_func_t)am_chunk_from_xml_node);
+    linked_list_t *ll = collect_xpath_results(doc, xpath, (collect_func_t)am_chunk_from_xml_node);
     if (!ll) {
         return NULL;
     }
@@ -68,6 +68,17 @@ typedef struct {
 } cpl_cdci_descriptor;
 
 typedef struct {
+    unsigned int stored_width;
+    unsigned int stored_height;
+    // code values of full white and black, the component depth follows
+    // from component_max_ref
+    unsigned int component_max_ref;
+    unsigned int component_min_ref;
+    char color_primaries[64];
+    char transfer_characteristic[64];
+    char picture_compression[64];
+    char frame_layout[32];
+    fraction_t sample_rate;
 } cpl_rgba_descriptor;
 
 typedef struct {
@@ -88,13 +99,20 @@ typedef struct {
     int length;
 } am_chunk_t;
 
-extern cpl_composition_playlist* cpl_get_composition_playlist(const char *filename);
-extern cpl_cdci_descriptor* cpl_get_cdci_descriptor_for_resource(const char *filename, cpl_resource_t *resource);
-extern cpl_wave_pcm_descriptor* cpl_get_wave_pcm_descriptor_for_resource(const char *filename, cpl_resource_t *resource);
-extern am_chunk_t* am_get_chunk_for_resource(const char *filename, cpl_resource_t *resource);
+// parsed CPL or ASSETMAP. parse once and run all queries against it
+typedef struct imf_doc_s imf_doc_t;
+
+extern imf_doc_t* imf_doc_open(const char *filename);
+extern void imf_doc_close(imf_doc_t *doc);
+
+extern cpl_composition_playlist* cpl_get_composition_playlist(imf_doc_t *doc);
+extern cpl_cdci_descriptor* cpl_get_cdci_descriptor_for_resource(imf_doc_t *doc, cpl_resource_t *resource);
+extern cpl_rgba_descriptor* cpl_get_rgba_descriptor_for_resource(imf_doc_t *doc, cpl_resource_t *resource);
+extern cpl_wave_pcm_descriptor* cpl_get_wave_pcm_descriptor_for_resource(imf_doc_t *doc, cpl_resource_t *resource);
+extern am_chunk_t* am_get_chunk_for_resource(imf_doc_t *doc, cpl_resource_t *resource);
 extern void am_free_chunk(am_chunk_t *chunk);
-extern linked_list_t* cpl_get_video_resources(const char *filename);
-extern linked_list_t* cpl_get_audio_resources(const char *filename);
+extern linked_list_t* cpl_get_video_resources(imf_doc_t *doc);
+extern linked_list_t* cpl_get_audio_resources(imf_doc_t *doc);
 extern void cpl_free_resources(linked_list_t *resources);
 
 #endif
@@ -0,0 +1,692 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <openjpeg-2.3/openjpeg.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#include "imffs.h"
+#include "asdcp.h"
+#include "assets.h"
+#include "av_pipeline.h"
+#include "pack.h"
+
+#define DEFAULT_CACHE_FRAMES 16
+
+// a track file, shared by all assets that play from it
+typedef struct {
+    char mxf_path[512];
+    enum asset_type asset_type;
+    asdcp_track_reader_t *reader;
+    // readers aren't thread safe
+    pthread_mutex_t mutex;
+} track_t;
+
+// an asset on the timeline
+typedef struct {
+    track_t *track;
+    // timeline frames [timeline_start, timeline_start + end_frame - start_frame)
+    unsigned int timeline_start;
+    // of the track file, in edit units of the CPL
+    unsigned int start_frame;
+    unsigned int end_frame;
+} segment_t;
+
+typedef struct {
+    // handed out to the caller, first so that it can be cast back
+    imffs_frame_t frame;
+    AVFrame *av_frame;
+    // callers and decoders holding it, the entry can't go while > 0
+    int refs;
+    // 0 while it is being decoded
+    int ready;
+    int failed;
+    // cache clock of the last time it was asked for
+    uint64_t last_used;
+} cache_entry_t;
+
+struct imffs_s {
+    imffs_options_t options;
+    imffs_timeline_t timeline;
+    opj_dparameters_t core;
+    av_pipeline_context_t av_context;
+
+    linked_list_t *video_assets;
+    linked_list_t *audio_assets;
+    linked_list_t *tracks;
+    segment_t *video_segments;
+    int num_video_segments;
+    segment_t *audio_segments;
+    int num_audio_segments;
+
+    // decoder of the threads calling imffs_get_video_frame
+    av_pipeline_decoder_t *decoder;
+    pthread_mutex_t decoder_mutex;
+
+    // guards the cache and the prefetch hint
+    pthread_mutex_t cache_mutex;
+    // an entry got ready, a hint came in or the handle is closing
+    pthread_cond_t cache_changed;
+    cache_entry_t **entries;
+    int num_entries;
+    uint64_t clock;
+    // frames of the last hint the prefetch threads didn't take yet
+    unsigned int prefetch_next;
+    unsigned int prefetch_end;
+    int closing;
+    pthread_t *prefetch_threads;
+    int num_prefetch_threads;
+
+    // the last audio frame read, consecutive reads mostly hit it
+    pthread_mutex_t audio_mutex;
+    unsigned int audio_samples_per_frame;
+    unsigned char *audio_buf;
+    unsigned int audio_length;
+    int64_t audio_frame;
+
+    // frames are read by several threads at once
+    pthread_mutex_t integrity_mutex;
+    imffs_integrity_t video_integrity;
+    imffs_integrity_t audio_integrity;
+};
+
+typedef struct {
+    imffs_t *fs;
+    av_pipeline_decoder_t *decoder;
+} prefetch_worker_t;
+
+void imffs_default_options(imffs_options_t *options) {
+    memset(options, 0, sizeof(imffs_options_t));
+    options->num_prefetch_threads = 2;
+    // the caller's decoder and the prefetch decoders share the machine
+    options->num_threads = opj_get_num_cpus() / (options->num_prefetch_threads + 1);
+    if (options->num_threads < 1) {
+        options->num_threads = 1;
+    }
+    options->cache_frames = DEFAULT_CACHE_FRAMES;
+}
+
+static track_t *get_track(imffs_t *fs, asset_t *asset, unsigned int *start_frame, unsigned int *end_frame) {
+    track_t *track = NULL;
+    for (linked_list_t *c = fs->tracks; c; c = c->next) {
+        track_t *t = c->user_data;
+        if (t->asset_type == asset->asset_type && !strcmp(t->mxf_path, asset->mxf_path)) {
+            track = t;
+            break;
+        }
+    }
+
+    // the reader works out the frames of the asset, for an open track it is
+    // opened once more only to do that
+    asdcp_track_reader_t *reader = asdcp_open_track_reader(asset, &fs->av_context, start_frame, end_frame);
+    if (!reader) {
+        return NULL;
+    }
+    if (track) {
+        asdcp_close_track_reader(reader);
+        return track;
+    }
+
+    track = calloc(1, sizeof(track_t));
+    if (!track) {
+        asdcp_close_track_reader(reader);
+        return NULL;
+    }
+    strcpy(track->mxf_path, asset->mxf_path);
+    track->asset_type = asset->asset_type;
+    track->reader = reader;
+    pthread_mutex_init(&track->mutex, NULL);
+    fs->tracks = ll_append(fs->tracks, track);
+    return track;
+}
+
+static void free_track(track_t *track) {
+    asdcp_close_track_reader(track->reader);
+    pthread_mutex_destroy(&track->mutex);
+    free(track);
+}
+
+// lays the assets out on the timeline, returns the frames they take
+static int build_segments(imffs_t *fs, linked_list_t *assets, segment_t **segments, int *num_segments, unsigned int *num_frames) {
+    *num_frames = 0;
+    *num_segments = 0;
+    *segments = calloc(ll_len(assets) + 1, sizeof(segment_t));
+    if (!*segments) {
+        return 1;
+    }
+    for (linked_list_t *c = assets; c; c = c->next) {
+        asset_t *asset = c->user_data;
+        segment_t *segment = &(*segments)[*num_segments];
+
+        segment->track = get_track(fs, asset, &segment->start_frame, &segment->end_frame);
+        if (!segment->track) {
+            fprintf(stderr, "error opening %s\n", asset->mxf_path);
+            return 1;
+        }
+        if (segment->end_frame < segment->start_frame) {
+            segment->end_frame = segment->start_frame;
+        }
+        segment->timeline_start = *num_frames;
+        *num_frames += segment->end_frame - segment->start_frame;
+        (*num_segments)++;
+    }
+    return 0;
+}
+
+// segment playing timeline_frame, NULL past the end. the segments are in
+// timeline order
+static segment_t *find_segment(segment_t *segments, int num_segments, unsigned int timeline_frame) {
+    int lo = 0;
+    int hi = num_segments - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        segment_t *segment = &segments[mid];
+        if (timeline_frame < segment->timeline_start) {
+            hi = mid - 1;
+        } else if (timeline_frame >= segment->timeline_start + segment->end_frame - segment->start_frame) {
+            lo = mid + 1;
+        } else {
+            return segment;
+        }
+    }
+    return NULL;
+}
+
+// a failed HMAC verification goes into integrity, the earliest one on the
+// timeline is kept
+static int read_timeline_frame(imffs_t *fs, segment_t *segments, int num_segments, unsigned int timeline_frame, unsigned char **buf, unsigned int *length, imffs_integrity_t *integrity) {
+    segment_t *segment = find_segment(segments, num_segments, timeline_frame);
+    if (!segment) {
+        return 0;
+    }
+    track_t *track = segment->track;
+    unsigned int frame = segment->start_frame + timeline_frame - segment->timeline_start;
+    int hmac_failed = 0;
+    pthread_mutex_lock(&track->mutex);
+    int ok = asdcp_read_track_frame(track->reader, frame, buf, length, &hmac_failed);
+    pthread_mutex_unlock(&track->mutex);
+
+    if (ok && hmac_failed) {
+        pthread_mutex_lock(&fs->integrity_mutex);
+        if (!integrity->failed || timeline_frame < integrity->timeline_frame) {
+            integrity->failed = 1;
+            integrity->timeline_frame = timeline_frame;
+            integrity->frame = frame;
+            strcpy(integrity->mxf_path, track->mxf_path);
+        }
+        pthread_mutex_unlock(&fs->integrity_mutex);
+    }
+    return ok;
+}
+
+static void free_cache_entry(cache_entry_t *entry) {
+    av_frame_free(&entry->av_frame);
+    free(entry);
+}
+
+// removes entries[i], the order of the others doesn't matter. cache_mutex
+// held
+static void remove_cache_entry(imffs_t *fs, int i) {
+    free_cache_entry(fs->entries[i]);
+    fs->entries[i] = fs->entries[--fs->num_entries];
+}
+
+// gets rid of the least recently used entry nobody holds once the cache is
+// full. the cache grows past cache_frames while all entries are held.
+// cache_mutex held
+static void evict_cache_entry(imffs_t *fs) {
+    if (fs->num_entries < fs->options.cache_frames) {
+        return;
+    }
+    int lru = -1;
+    for (int i = 0; i < fs->num_entries; i++) {
+        cache_entry_t *entry = fs->entries[i];
+        if (!entry->refs && (lru < 0 || entry->last_used < fs->entries[lru]->last_used)) {
+            lru = i;
+        }
+    }
+    if (lru >= 0) {
+        remove_cache_entry(fs, lru);
+    }
+}
+
+static void unref_cache_entry(imffs_t *fs, cache_entry_t *entry) {
+    pthread_mutex_lock(&fs->cache_mutex);
+    entry->refs--;
+    // failed frames get decoded again the next time they are asked for
+    if (!entry->refs && entry->failed) {
+        for (int i = 0; i < fs->num_entries; i++) {
+            if (fs->entries[i] == entry) {
+                remove_cache_entry(fs, i);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&fs->cache_mutex);
+}
+
+static int decode_cache_entry(imffs_t *fs, av_pipeline_decoder_t *decoder, cache_entry_t *entry) {
+    imffs_frame_t *frame = &entry->frame;
+    unsigned char *buf = NULL;
+    unsigned int length = 0;
+
+    if (!read_timeline_frame(fs, fs->video_segments, fs->num_video_segments, frame->timeline_frame, &buf, &length, &fs->video_integrity)) {
+        fprintf(stderr, "error reading frame %d\n", frame->timeline_frame);
+        return 1;
+    }
+    int err = av_pipeline_decode_frame(decoder, buf, length, frame->timeline_frame, entry->av_frame, &frame->depth);
+    free(buf);
+    if (err) {
+        fprintf(stderr, "error decoding frame %d\n", frame->timeline_frame);
+        return 1;
+    }
+
+    // R, G, B from the G, B, R planes
+    static const int gbr_planes[3] = { 2, 0, 1 };
+    AVFrame *av_frame = entry->av_frame;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(av_frame->format);
+    int gbr = desc->flags & AV_PIX_FMT_FLAG_RGB;
+    for (int i = 0; i < 3; i++) {
+        int plane = gbr ? gbr_planes[i] : i;
+        int chroma = !gbr && i > 0;
+        frame->planes[i] = (const uint16_t *)av_frame->data[plane];
+        frame->linesizes[i] = av_frame->linesize[plane];
+        frame->widths[i] = chroma ? AV_CEIL_RSHIFT(av_frame->width, desc->log2_chroma_w) : av_frame->width;
+        frame->heights[i] = chroma ? AV_CEIL_RSHIFT(av_frame->height, desc->log2_chroma_h) : av_frame->height;
+    }
+    return 0;
+}
+
+// the cache entry of timeline frame n with a reference taken, decoded with
+// decoder unless it's in the cache already. decoder_mutex, if any, is held
+// while decoding. with wait 0 NULL is returned for frames that are in the
+// cache or being decoded, for prefetching
+static cache_entry_t *acquire_frame(imffs_t *fs, av_pipeline_decoder_t *decoder, pthread_mutex_t *decoder_mutex, unsigned int n, int wait) {
+    cache_entry_t *entry = NULL;
+
+    pthread_mutex_lock(&fs->cache_mutex);
+    for (int i = 0; i < fs->num_entries; i++) {
+        if (fs->entries[i]->frame.timeline_frame == n && !fs->entries[i]->failed) {
+            entry = fs->entries[i];
+            break;
+        }
+    }
+    if (entry) {
+        // hinted again, it stays in the cache a while longer
+        entry->last_used = ++fs->clock;
+        if (!wait) {
+            pthread_mutex_unlock(&fs->cache_mutex);
+            return NULL;
+        }
+        entry->refs++;
+        // another thread is on it
+        while (!entry->ready) {
+            pthread_cond_wait(&fs->cache_changed, &fs->cache_mutex);
+        }
+        pthread_mutex_unlock(&fs->cache_mutex);
+        if (entry->failed) {
+            unref_cache_entry(fs, entry);
+            return NULL;
+        }
+        return entry;
+    }
+
+    evict_cache_entry(fs);
+    cache_entry_t **entries = realloc(fs->entries, (fs->num_entries + 1) * sizeof(cache_entry_t *));
+    entry = calloc(1, sizeof(cache_entry_t));
+    if (entries) {
+        fs->entries = entries;
+    }
+    if (!entries || !entry || !(entry->av_frame = av_frame_alloc())) {
+        pthread_mutex_unlock(&fs->cache_mutex);
+        fprintf(stderr, "out of memory for frame %d\n", n);
+        if (entry) {
+            free_cache_entry(entry);
+        }
+        return NULL;
+    }
+    entry->frame.timeline_frame = n;
+    entry->refs = 1;
+    entry->last_used = ++fs->clock;
+    fs->entries[fs->num_entries++] = entry;
+    pthread_mutex_unlock(&fs->cache_mutex);
+
+    if (decoder_mutex) {
+        pthread_mutex_lock(decoder_mutex);
+    }
+    int err = decode_cache_entry(fs, decoder, entry);
+    if (decoder_mutex) {
+        pthread_mutex_unlock(decoder_mutex);
+    }
+
+    pthread_mutex_lock(&fs->cache_mutex);
+    entry->ready = 1;
+    entry->failed = err;
+    pthread_cond_broadcast(&fs->cache_changed);
+    pthread_mutex_unlock(&fs->cache_mutex);
+
+    if (err) {
+        unref_cache_entry(fs, entry);
+        return NULL;
+    }
+    return entry;
+}
+
+static void *prefetch_thread(void *data) {
+    prefetch_worker_t *worker = data;
+    imffs_t *fs = worker->fs;
+
+    while (1) {
+        pthread_mutex_lock(&fs->cache_mutex);
+        while (!fs->closing && fs->prefetch_next >= fs->prefetch_end) {
+            pthread_cond_wait(&fs->cache_changed, &fs->cache_mutex);
+        }
+        if (fs->closing) {
+            pthread_mutex_unlock(&fs->cache_mutex);
+            break;
+        }
+        unsigned int n = fs->prefetch_next++;
+        pthread_mutex_unlock(&fs->cache_mutex);
+
+        cache_entry_t *entry = acquire_frame(fs, worker->decoder, NULL, n, 0);
+        if (entry) {
+            unref_cache_entry(fs, entry);
+        }
+    }
+
+    av_pipeline_free_decoder(worker->decoder);
+    free(worker);
+    return NULL;
+}
+
+static int init_timeline(imffs_t *fs) {
+    imffs_timeline_t *timeline = &fs->timeline;
+    av_pipeline_context_t *av_context = &fs->av_context;
+
+    timeline->edit_rate = av_context->cpl->edit_rate;
+
+    if (fs->video_assets) {
+        asset_t *asset = fs->video_assets->user_data;
+        unsigned int stored_width;
+        unsigned int stored_height;
+        if (asset->picture_type == PICTURE_TYPE_RGBA) {
+            cpl_rgba_descriptor *desc = asset->essence_descriptor;
+            stored_width = desc->stored_width;
+            stored_height = desc->stored_height;
+            // see init_video_output
+            av_context->rgb_essence = 1;
+        } else {
+            cpl_cdci_descriptor *desc = asset->essence_descriptor;
+            stored_width = desc->stored_width;
+            stored_height = desc->stored_height;
+        }
+        // decoded images are smaller when resolution levels are dropped
+        timeline->width = (int)((stored_width + (1u << fs->options.reduce) - 1) >> fs->options.reduce);
+        timeline->height = (int)((stored_height + (1u << fs->options.reduce) - 1) >> fs->options.reduce);
+        timeline->rgb = av_context->rgb_essence || !av_context->encode_ycbcr;
+        if (build_segments(fs, fs->video_assets, &fs->video_segments, &fs->num_video_segments, &timeline->video_frames)) {
+            return 1;
+        }
+    }
+
+    if (fs->audio_assets) {
+        asset_t *asset = fs->audio_assets->user_data;
+        cpl_wave_pcm_descriptor *desc = asset->essence_descriptor;
+        if (desc->quantization_bits != 24 || !desc->channel_count || !desc->sample_rate.denom) {
+            fprintf(stderr, "only 24 bit PCM supported for now\n");
+            return 1;
+        }
+        unsigned int frames;
+        if (build_segments(fs, fs->audio_assets, &fs->audio_segments, &fs->num_audio_segments, &frames)) {
+            return 1;
+        }
+        timeline->audio_channels = desc->channel_count;
+        timeline->audio_sample_rate = desc->sample_rate.num / desc->sample_rate.denom;
+        // what the reader hands out per frame. at 30000/1001 that's 1602
+        // samples, not 1601, the same frames imf_fs writes one after the other
+        fs->audio_samples_per_frame = fs->num_audio_segments ? asdcp_track_samples_per_frame(fs->audio_segments[0].track->reader) : 0;
+        timeline->audio_samples = (uint64_t)frames * fs->audio_samples_per_frame;
+    }
+    return 0;
+}
+
+static int resolve_composition(imffs_t *fs, const char *cpl_path, const char *assetmap_path) {
+    int err = 1;
+    imf_doc_t *cpl_doc = imf_doc_open(cpl_path);
+    imf_doc_t *assetmap_doc = imf_doc_open(assetmap_path);
+    linked_list_t *video_resources = NULL;
+    linked_list_t *audio_resources = NULL;
+
+    if (!cpl_doc || !assetmap_doc) {
+        fprintf(stderr, "couldn't parse %s\n", cpl_doc ? assetmap_path : cpl_path);
+        goto free_and_out;
+    }
+    fs->av_context.cpl = cpl_get_composition_playlist(cpl_doc);
+    if (!fs->av_context.cpl || !fs->av_context.cpl->edit_rate.num || !fs->av_context.cpl->edit_rate.denom) {
+        fprintf(stderr, "couldn't get cpl from %s\n", cpl_path);
+        goto free_and_out;
+    }
+
+    video_resources = cpl_get_video_resources(cpl_doc);
+    audio_resources = cpl_get_audio_resources(cpl_doc);
+    if (get_video_assets(cpl_doc, assetmap_doc, video_resources, NULL, &fs->video_assets, &fs->av_context.assets_mutex)
+            || get_audio_assets(cpl_doc, assetmap_doc, audio_resources, NULL, &fs->audio_assets, &fs->av_context.assets_mutex)) {
+        fprintf(stderr, "error getting assets from CPL\n");
+        goto free_and_out;
+    }
+    fs->av_context.assets_resolved = 1;
+    err = 0;
+
+free_and_out:
+    cpl_free_resources(video_resources);
+    cpl_free_resources(audio_resources);
+    if (cpl_doc) {
+        imf_doc_close(cpl_doc);
+    }
+    if (assetmap_doc) {
+        imf_doc_close(assetmap_doc);
+    }
+    return err;
+}
+
+imffs_t *imffs_open(const char *cpl_path, const char *assetmap_path, const imffs_options_t *options) {
+    imffs_t *fs = calloc(1, sizeof(imffs_t));
+    if (!fs) {
+        return NULL;
+    }
+    if (options) {
+        fs->options = *options;
+    } else {
+        imffs_default_options(&fs->options);
+    }
+    if (fs->options.num_threads < 1) {
+        fs->options.num_threads = 1;
+    }
+    if (fs->options.cache_frames < 1) {
+        fs->options.cache_frames = 1;
+    }
+    pthread_mutex_init(&fs->decoder_mutex, NULL);
+    pthread_mutex_init(&fs->cache_mutex, NULL);
+    pthread_cond_init(&fs->cache_changed, NULL);
+    pthread_mutex_init(&fs->audio_mutex, NULL);
+    fs->audio_frame = -1;
+    pthread_mutex_init(&fs->integrity_mutex, NULL);
+
+    // what av_pipeline_run sets up for its decode workers
+    opj_set_default_decoder_parameters(&fs->core);
+    fs->core.cp_reduce = fs->options.reduce;
+    fs->core.cp_layer = fs->options.max_layers;
+
+    av_pipeline_context_t *av_context = &fs->av_context;
+    av_context->user_data = &fs->core;
+    av_context->num_threads = fs->options.num_threads;
+    av_context->print_debug = fs->options.print_debug;
+    av_context->reduce = fs->options.reduce;
+    av_context->max_layers = fs->options.max_layers;
+    av_context->encode_ycbcr = fs->options.ycbcr;
+    av_context->content_keys = fs->options.content_keys;
+    av_context->verify_hmac = fs->options.verify_hmac;
+    av_context->metrics_fd = -1;
+    pthread_mutex_init(&av_context->assets_mutex, NULL);
+
+    if (resolve_composition(fs, cpl_path, assetmap_path) || init_timeline(fs)) {
+        goto err_and_out;
+    }
+
+    fs->decoder = av_pipeline_create_decoder(av_context, fs->options.num_threads);
+    if (!fs->decoder) {
+        goto err_and_out;
+    }
+
+    fs->prefetch_threads = calloc(fs->options.num_prefetch_threads + 1, sizeof(pthread_t));
+    if (!fs->prefetch_threads) {
+        goto err_and_out;
+    }
+    for (int i = 0; i < fs->options.num_prefetch_threads && fs->timeline.video_frames; i++) {
+        prefetch_worker_t *worker = calloc(1, sizeof(prefetch_worker_t));
+        if (!worker) {
+            goto err_and_out;
+        }
+        worker->fs = fs;
+        worker->decoder = av_pipeline_create_decoder(av_context, fs->options.num_threads);
+        if (!worker->decoder || pthread_create(&fs->prefetch_threads[i], NULL, prefetch_thread, worker)) {
+            fprintf(stderr, "error starting prefetch thread\n");
+            av_pipeline_free_decoder(worker->decoder);
+            free(worker);
+            goto err_and_out;
+        }
+        fs->num_prefetch_threads++;
+    }
+
+    return fs;
+
+err_and_out:
+    imffs_close(fs);
+    return NULL;
+}
+
+void imffs_close(imffs_t *fs) {
+    if (!fs) {
+        return;
+    }
+    pthread_mutex_lock(&fs->cache_mutex);
+    fs->closing = 1;
+    pthread_cond_broadcast(&fs->cache_changed);
+    pthread_mutex_unlock(&fs->cache_mutex);
+    for (int i = 0; i < fs->num_prefetch_threads; i++) {
+        pthread_join(fs->prefetch_threads[i], NULL);
+    }
+    free(fs->prefetch_threads);
+
+    for (int i = 0; i < fs->num_entries; i++) {
+        free_cache_entry(fs->entries[i]);
+    }
+    free(fs->entries);
+    av_pipeline_free_decoder(fs->decoder);
+
+    free(fs->video_segments);
+    free(fs->audio_segments);
+    ll_free(fs->tracks, (free_user_data_func_t)free_track);
+    ll_free(fs->video_assets, (free_user_data_func_t)free_asset);
+    ll_free(fs->audio_assets, (free_user_data_func_t)free_asset);
+    free(fs->audio_buf);
+    free(fs->av_context.cpl);
+
+    pthread_mutex_destroy(&fs->av_context.assets_mutex);
+    pthread_mutex_destroy(&fs->integrity_mutex);
+    pthread_mutex_destroy(&fs->audio_mutex);
+    pthread_cond_destroy(&fs->cache_changed);
+    pthread_mutex_destroy(&fs->cache_mutex);
+    pthread_mutex_destroy(&fs->decoder_mutex);
+    free(fs);
+}
+
+const imffs_timeline_t *imffs_get_timeline(imffs_t *fs) {
+    return &fs->timeline;
+}
+
+const imffs_frame_t *imffs_get_video_frame(imffs_t *fs, unsigned int n) {
+    if (n >= fs->timeline.video_frames) {
+        fprintf(stderr, "frame %d past the end of the composition\n", n);
+        return NULL;
+    }
+    // callers on several threads take turns with the decoder, frames in
+    // the cache come back without it
+    cache_entry_t *entry = acquire_frame(fs, fs->decoder, &fs->decoder_mutex, n, 1);
+    return entry ? &entry->frame : NULL;
+}
+
+void imffs_release_frame(imffs_t *fs, const imffs_frame_t *frame) {
+    if (frame) {
+        unref_cache_entry(fs, (cache_entry_t *)frame);
+    }
+}
+
+int imffs_get_audio(imffs_t *fs, uint64_t first_sample, unsigned int num_samples, int32_t *samples) {
+    unsigned int channels = fs->timeline.audio_channels;
+    int err = 0;
+
+    memset(samples, 0, (size_t)num_samples * channels * sizeof(int32_t));
+    if (!fs->audio_samples_per_frame) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&fs->audio_mutex);
+    while (num_samples && first_sample < fs->timeline.audio_samples) {
+        int64_t frame = first_sample / fs->audio_samples_per_frame;
+        unsigned int offset = first_sample % fs->audio_samples_per_frame;
+
+        if (frame != fs->audio_frame) {
+            free(fs->audio_buf);
+            fs->audio_buf = NULL;
+            fs->audio_frame = -1;
+            if (!read_timeline_frame(fs, fs->audio_segments, fs->num_audio_segments, (unsigned int)frame, &fs->audio_buf, &fs->audio_length, &fs->audio_integrity)) {
+                fprintf(stderr, "error reading audio frame %d\n", (int)frame);
+                err = 1;
+                break;
+            }
+            fs->audio_frame = frame;
+        }
+
+        unsigned int frame_samples = fs->audio_length / (3 * channels);
+        unsigned int count = frame_samples > offset ? frame_samples - offset : 0;
+        count = count < num_samples ? count : num_samples;
+        if (!count) {
+            break;
+        }
+        pack_pcm24le_to_s32(fs->audio_buf + (size_t)offset * 3 * channels, (unsigned char *)samples, count * channels);
+
+        samples += (size_t)count * channels;
+        first_sample += count;
+        num_samples -= count;
+    }
+    pthread_mutex_unlock(&fs->audio_mutex);
+    return err;
+}
+
+void imffs_prefetch(imffs_t *fs, unsigned int first, unsigned int count) {
+    unsigned int end = first + count;
+    if (end > fs->timeline.video_frames || end < first) {
+        end = fs->timeline.video_frames;
+    }
+    // more would push the first frames of the hint out again
+    if (end - first > (unsigned int)fs->options.cache_frames && first < end) {
+        end = first + fs->options.cache_frames;
+    }
+    pthread_mutex_lock(&fs->cache_mutex);
+    fs->prefetch_next = first;
+    fs->prefetch_end = end;
+    pthread_cond_broadcast(&fs->cache_changed);
+    pthread_mutex_unlock(&fs->cache_mutex);
+}
+
+void imffs_get_integrity(imffs_t *fs, imffs_integrity_t *video, imffs_integrity_t *audio) {
+    pthread_mutex_lock(&fs->integrity_mutex);
+    if (video) {
+        *video = fs->video_integrity;
+    }
+    if (audio) {
+        *audio = fs->audio_integrity;
+    }
+    pthread_mutex_unlock(&fs->integrity_mutex);
+}
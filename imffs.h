@@ -0,0 +1,114 @@
+#ifndef IMFFS_H
+#define IMFFS_H
+
+#include <stdint.h>
+#include "imf.h"
+#include "linked_list.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libimffs: random access to the frames and samples of a composition, for
+// players and editors that seek and scrub instead of running the pipeline
+// through. the track files stay open and the decoders keep their codecs
+// between frames, decoded frames are kept in a cache
+
+typedef struct imffs_s imffs_t;
+
+typedef struct {
+    // openjpeg threads of each decoder
+    int num_threads;
+    // decoders in the background working through imffs_prefetch
+    int num_prefetch_threads;
+    // decoded frames kept for going back and forth
+    int cache_frames;
+    // preview quality: resolution levels to drop and quality layers to
+    // decode (0 for all), as with -r and -l
+    int reduce;
+    int max_layers;
+    // Y'CbCr essence comes out as its Y'CbCr planes, R'G'B' otherwise
+    int ycbcr;
+    // asdcp_content_key_t for encrypted track files, kept by the caller as
+    // long as the composition is open. the caller links the nodes itself,
+    // user_data pointing to the key, ll_* are not part of the library
+    linked_list_t *content_keys;
+    // check the HMAC values of encrypted frames as they are read, as with -m.
+    // see imffs_get_integrity
+    int verify_hmac;
+    int print_debug;
+} imffs_options_t;
+
+typedef struct {
+    fraction_t edit_rate;
+    // 0 without a picture or sound track
+    unsigned int video_frames;
+    uint64_t audio_samples;
+    // of the decoded frames, reduce included
+    int width;
+    int height;
+    // 1 if the frames have R, G, B planes, 0 for Y, Cb, Cr
+    int rgb;
+    unsigned int audio_channels;
+    unsigned int audio_sample_rate;
+} imffs_timeline_t;
+
+typedef struct {
+    unsigned int timeline_frame;
+    // R, G, B or Y, Cb, Cr planes of 16 bit samples, depth bits of them in
+    // use. the chroma planes of Y'CbCr can be subsampled
+    const uint16_t *planes[3];
+    // in bytes
+    int linesizes[3];
+    int widths[3];
+    int heights[3];
+    int depth;
+} imffs_frame_t;
+
+// HMAC verification of the frames of one track read so far
+typedef struct {
+    // 1 if a frame failed it. it was handed out anyway
+    int failed;
+    // the earliest of those on the timeline, audio in frames of the CPL's
+    // edit rate
+    unsigned int timeline_frame;
+    // and where it is in its track file
+    unsigned int frame;
+    char mxf_path[512];
+} imffs_integrity_t;
+
+// defaults for the machine this runs on
+extern void imffs_default_options(imffs_options_t *options);
+
+// resolves the composition and opens all its track files. options NULL for
+// the defaults. NULL on error
+extern imffs_t *imffs_open(const char *cpl_path, const char *assetmap_path, const imffs_options_t *options);
+extern void imffs_close(imffs_t *fs);
+
+extern const imffs_timeline_t *imffs_get_timeline(imffs_t *fs);
+
+// frame n of the composition, decoded or from the cache. the frame stays
+// valid until it is handed back with imffs_release_frame. NULL on error.
+// can be called from several threads
+extern const imffs_frame_t *imffs_get_video_frame(imffs_t *fs, unsigned int n);
+extern void imffs_release_frame(imffs_t *fs, const imffs_frame_t *frame);
+
+// num_samples samples per channel from first_sample on, interleaved 32 bit
+// (AV_SAMPLE_FMT_S32) into samples. what lies past the end is silence.
+// returns 0 on success
+extern int imffs_get_audio(imffs_t *fs, uint64_t first_sample, unsigned int num_samples, int32_t *samples);
+
+// frames [first, first + count) are about to be asked for, the background
+// decoders get them into the cache. replaces the previous hint, what of it
+// isn't decoded yet is dropped
+extern void imffs_prefetch(imffs_t *fs, unsigned int first, unsigned int count);
+
+// with verify_hmac, whether frames failed verification up to now, for the
+// picture and the sound track. either can be NULL
+extern void imffs_get_integrity(imffs_t *fs, imffs_integrity_t *video, imffs_integrity_t *audio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,7 +27,8 @@ if [ ! -e third_party/openssl/include/openssl ]; then
   mkdir -p third_party/openssl
 
   cd openssl
-  ./config no-asm no-tests shared --prefix=${ROOT_DIR}/third_party/openssl
+  # keep assembly enabled so that AES-NI is used for decrypting essence
+  ./config no-tests shared --prefix=${ROOT_DIR}/third_party/openssl
   make
   make install
   make clean
@@ -6,23 +6,84 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "av_pipeline.h"
 #include "asdcp.h"
 #include "imf.h"
+#include "metrics.h"
+#include "budget.h"
+#include "flatten.h"
+#include "assets.h"
 
 void SIGINT_handler(int dummy) {
     fprintf(stderr, "got signal\n");
-    stop_decoding_signal();
+    av_pipeline_stop();
     signal(SIGINT, 0);
 }
 
-static void free_asset(asset_t *asset) {
-    if (asset) {
-        if (asset->essence_descriptor) {
-            free(asset->essence_descriptor);
+static int parse_hex(const char *s, unsigned char *out, int len) {
+    for (int i = 0; i < len; ++i) {
+        unsigned int byte;
+        if (sscanf(s + 2 * i, "%2x", &byte) != 1) {
+            return 1;
         }
-        free(asset);
+        out[i] = byte;
     }
+    return s[2 * len] != '\0' && s[2 * len] != ':';
+}
+
+// [keyid:]key, both as hex. dashes in the key id are ignored
+static asdcp_content_key_t *parse_content_key(const char *arg) {
+    asdcp_content_key_t *key = (asdcp_content_key_t*)malloc(sizeof(asdcp_content_key_t));
+    memset(key, 0, sizeof(asdcp_content_key_t));
+
+    char buf[128];
+    int len = 0;
+    for (const char *c = arg; *c && len < sizeof(buf) - 1; ++c) {
+        if (*c != '-') {
+            buf[len++] = *c;
+        }
+    }
+    buf[len] = '\0';
+
+    const char *key_s = buf;
+    char *sep = strchr(buf, ':');
+    if (sep) {
+        if (parse_hex(buf, key->key_id, sizeof(key->key_id))) {
+            free(key);
+            return NULL;
+        }
+        key->has_key_id = 1;
+        key_s = sep + 1;
+    }
+    if (strlen(key_s) != 2 * sizeof(key->key) || parse_hex(key_s, key->key, sizeof(key->key))) {
+        free(key);
+        return NULL;
+    }
+    return key;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: imf_fs [options] CPL ASSETMAP\n");
+    fprintf(stderr, "\t-k [keyid:]key\tcontent key for encrypted track files (hex), can be repeated\n");
+    fprintf(stderr, "\t-e threads\tnumber of threads decrypting video frames\n");
+    fprintf(stderr, "\t-m\t\tverify HMAC values of encrypted frames\n");
+    fprintf(stderr, "\t-r levels\tdecode at 1/2^levels of the stored size\n");
+    fprintf(stderr, "\t-l layers\tdecode only the first quality layers\n");
+    fprintf(stderr, "\t-B bytes\tdecode only the first bytes of each frame codestream (LRCP, single tile)\n");
+    fprintf(stderr, "\t-F\t\tfast start, resolve all but the first resources in the background\n");
+    fprintf(stderr, "\t-M MB\t\tmemory budget for frames in flight, 0 for none (default: half the cgroup limit)\n");
+    fprintf(stderr, "\t-N\t\tone decode worker per NUMA node, pinned to it\n");
+    fprintf(stderr, "\t-W frames\tframes decoded at the same time on one pool of threads (default: 2)\n");
+    fprintf(stderr, "\t-H\t\tno huge page frame pool, malloc decoded planes and packets every frame\n");
+    fprintf(stderr, "\t-J fd\t\twrite a JSON metrics line to fd every second\n");
+    fprintf(stderr, "\t-P file\t\twrite metrics to file in prometheus text format every second\n");
+    fprintf(stderr, "\t-T file\t\twrite a chrome trace of all frames to file\n");
+    fprintf(stderr, "\t-c encoder\tencode the video in process with prores_ks, dnxhd or ffv1 (default: r210),\n");
+    fprintf(stderr, "\t\t\tcopy to mux the J2K codestreams without decoding them\n");
+    fprintf(stderr, "\t-o file\t\twrite to file, the container goes by the extension (default: NUT on stdout)\n");
+    fprintf(stderr, "\t-X dir\t\tflatten the timeline into dir/video.mxf and dir/audio.mxf without decoding\n");
+    fprintf(stderr, "\t-D\t\twith -X, write encrypted track files decrypted instead of refusing them\n");
 }
 
 typedef struct {
@@ -30,117 +91,238 @@ typedef struct {
     linked_list_t *audio_assets;
 } decoding_assets_t;
 
-int get_audio_assets(const char *cpl_path, const char *assetmap_path, decoding_assets_t *decoding_assets) {
-    int err = 0;
-    linked_list_t *resources = cpl_get_audio_resources(cpl_path);
-
-    for (linked_list_t *head = resources; head && !err; head = head->next) {
-        cpl_resource_t *cpl_res = head->user_data;
-        am_chunk_t *chunk = am_get_chunk_for_resource(assetmap_path, cpl_res);
-        if (!chunk) {
-            fprintf(stderr, "error resolving asset %s for resource %s\n", cpl_res->track_file_id, cpl_res->id);
-            err = 1;
-        } else {
-
-            cpl_wave_pcm_descriptor *wave_pcm_desc = cpl_get_wave_pcm_descriptor_for_resource(cpl_path, cpl_res);
-            if (!wave_pcm_desc) {
-                fprintf(stderr, "error resolving essence descriptor [%s] for resource %s [%s]\n", cpl_res->source_encoding, cpl_res->id, chunk->path);
-                err = 1;
-            } else {
-                for (int i = 0; i < cpl_res->repeat_count; ++i) {
-                    asset_t* asset = (asset_t*)malloc(sizeof(asset_t));
-                    memset(asset, 0, sizeof(asset_t));
-                    asset->asset_type = ASSET_TYPE_AUDIO;
-                    asset->essence_descriptor = wave_pcm_desc;
-                    strcpy(asset->mxf_path, chunk->path);
-                    asset->start_frame = cpl_res->entry_point;
-                    asset->end_frame = cpl_res->source_duration;
-
-                    decoding_assets->audio_assets = ll_append(decoding_assets->audio_assets, asset);
-                }
-            }
+static void print_assets(decoding_assets_t *decoding_assets) {
+    fprintf(stderr, "loaded resources:\n");
+    fprintf(stderr, "VIDEO\n");
+    for (linked_list_t *i = decoding_assets->video_assets; i; i = i->next) {
+        asset_t *asset = i->user_data;
+        fprintf(stderr, "\t%s\n", asset->mxf_path);
+        if (asset->picture_type == PICTURE_TYPE_CDCI) {
+            cpl_cdci_descriptor *desc = asset->essence_descriptor;
+            fprintf(stderr, "\t\tCDCI\n");
+            fprintf(stderr, "\t\tVertical Subsampling\t\t%d\n", desc->vertical_subsampling);
+            fprintf(stderr, "\t\tHorizontal Subsampling\t\t%d\n", desc->horizontal_subsampling);
+            fprintf(stderr, "\t\tStoredWidth\t\t\t%d\n", desc->stored_width);
+            fprintf(stderr, "\t\tStoredHeight\t\t\t%d\n", desc->stored_height);
+            fprintf(stderr, "\t\tSampleRate\t\t\t%d/%d\n", desc->sample_rate.num, desc->sample_rate.denom);
+        } else if (asset->picture_type == PICTURE_TYPE_RGBA) {
+            cpl_rgba_descriptor *desc = asset->essence_descriptor;
+            fprintf(stderr, "\t\tRGBA\n");
+            fprintf(stderr, "\t\tComponentMaxRef\t\t\t%d\n", desc->component_max_ref);
+            fprintf(stderr, "\t\tComponentMinRef\t\t\t%d\n", desc->component_min_ref);
+            fprintf(stderr, "\t\tStoredWidth\t\t\t%d\n", desc->stored_width);
+            fprintf(stderr, "\t\tStoredHeight\t\t\t%d\n", desc->stored_height);
+            fprintf(stderr, "\t\tSampleRate\t\t\t%d/%d\n", desc->sample_rate.num, desc->sample_rate.denom);
         }
-        am_free_chunk(chunk);
     }
+    fprintf(stderr, "AUDIO\n");
+    for (linked_list_t *i = decoding_assets->audio_assets; i; i = i->next) {
+        asset_t *asset = i->user_data;
+        fprintf(stderr, "\t%s\n", asset->mxf_path);
+        cpl_wave_pcm_descriptor *desc = asset->essence_descriptor;
+        fprintf(stderr, "\t\tWAVE_PCM\n");
+        fprintf(stderr, "\t\tAverageBytesPerSecond\t\t%d\n", desc->average_bytes_per_second);
+        fprintf(stderr, "\t\tBlockAlign\t\t\t%d\n", desc->block_align);
+        fprintf(stderr, "\t\tChannelCount\t\t\t%d\n", desc->channel_count);
+        fprintf(stderr, "\t\tQuantizationBits\t\t%d\n", desc->quantization_bits);
+        fprintf(stderr, "\t\tSampleRate\t\t\t%d/%d\n", desc->sample_rate.num, desc->sample_rate.denom);
 
-    cpl_free_resources(resources);
-    return err;
+    }
 }
 
-int get_video_assets(const char *cpl_path, const char *assetmap_path, decoding_assets_t *decoding_assets) {
-    int err = 0;
-    linked_list_t *resources = cpl_get_video_resources(cpl_path);
-
-    for (linked_list_t *head = resources; head && !err; head = head->next) {
-        cpl_resource_t *cpl_res = head->user_data;
-        am_chunk_t *chunk = am_get_chunk_for_resource(assetmap_path, cpl_res);
-        if (!chunk) {
-            fprintf(stderr, "error resolving asset %s for resource %s\n", cpl_res->track_file_id, cpl_res->id);
-            err = 1;
-        } else {
-            cpl_cdci_descriptor *cdci_desc = cpl_get_cdci_descriptor_for_resource(cpl_path, cpl_res);
-            if (!cdci_desc) {
-                // try to get rgba
-                fprintf(stderr, "error resolving essence descriptor [%s] for resource %s [%s]\n", cpl_res->source_encoding, cpl_res->id, chunk->path);
-                err = 1;
-            } else {
-                for (int i = 0; i < cpl_res->repeat_count; ++i) {
-                    asset_t* asset = (asset_t*)malloc(sizeof(asset_t));
-                    memset(asset, 0, sizeof(asset_t));
-                    asset->asset_type = ASSET_TYPE_PICTURE;
-                    if (cdci_desc) {
-                        asset->picture_type = PICTURE_TYPE_CDCI;
-                        asset->essence_descriptor = cdci_desc;
-                    } else {
-                        asset->picture_type = PICTURE_TYPE_RGBA;
-                        //asset->essence_descriptor = rgba_desc;
-                    }
-                    strcpy(asset->mxf_path, chunk->path);
-                    asset->start_frame = cpl_res->entry_point;
-                    asset->end_frame = cpl_res->source_duration;
-
-                    decoding_assets->video_assets = ll_append(decoding_assets->video_assets, asset);
-                }
-            }
-        }
-        am_free_chunk(chunk);
+typedef struct {
+    imf_doc_t *cpl_doc;
+    imf_doc_t *assetmap_doc;
+    // resolve video and audio resources from these on
+    linked_list_t *video_resources;
+    linked_list_t *audio_resources;
+    decoding_assets_t *decoding_assets;
+    av_pipeline_context_t *av_context;
+    int err;
+} resolve_args_t;
+
+// -F: resolves the remaining resources while the pipeline already runs
+void *resolve_assets_thread(void *data) {
+    resolve_args_t *args = data;
+    av_pipeline_context_t *av_context = args->av_context;
+
+    args->err = get_video_assets(args->cpl_doc, args->assetmap_doc, args->video_resources, NULL, &args->decoding_assets->video_assets, &av_context->assets_mutex);
+    if (!args->err) {
+        args->err = get_audio_assets(args->cpl_doc, args->assetmap_doc, args->audio_resources, NULL, &args->decoding_assets->audio_assets, &av_context->assets_mutex);
     }
+    if (args->err) {
+        fprintf(stderr, "error getting assets from CPL\n");
+        av_pipeline_stop();
+    }
+
+    pthread_mutex_lock(&av_context->assets_mutex);
+    av_context->assets_resolved = 1;
+    pthread_mutex_unlock(&av_context->assets_mutex);
 
-    cpl_free_resources(resources);
-    return err;
+    print_assets(args->decoding_assets);
+    return NULL;
 }
 
 int main(int argc, char **argv) {
 
     int err;
-    if (argc != 3) {
-        fprintf(stderr, "no cpl and assetmap");
-        return 1;
-    }
 
-    signal(SIGINT, SIGINT_handler);
+    metrics_mark_start();
 
     av_pipeline_context_t av_context;
     memset(&av_context, 0, sizeof(av_pipeline_context_t));
     av_context.num_threads = opj_get_num_cpus() - 2; 
     av_context.print_debug = 0;
     av_context.decode_frame_buffer_size = 50;
+    av_context.num_decrypt_threads = opj_get_num_cpus() / 4;
+    av_context.frames_in_flight = 2;
+    av_context.metrics_fd = -1;
+
+    int memory_budget_set = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:e:mr:l:B:FM:NW:HJ:P:T:c:o:X:D")) != -1) {
+        switch (opt) {
+            case 'k': {
+                asdcp_content_key_t *key = parse_content_key(optarg);
+                if (!key) {
+                    fprintf(stderr, "invalid content key %s\n", optarg);
+                    return 1;
+                }
+                av_context.content_keys = ll_append(av_context.content_keys, key);
+                break;
+            }
+            case 'e':
+                av_context.num_decrypt_threads = atoi(optarg);
+                break;
+            case 'm':
+                av_context.verify_hmac = 1;
+                break;
+            case 'r':
+                av_context.reduce = atoi(optarg);
+                break;
+            case 'l':
+                av_context.max_layers = atoi(optarg);
+                break;
+            case 'B':
+                av_context.max_frame_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'F':
+                av_context.fast_start = 1;
+                break;
+            case 'M':
+                av_context.memory_budget = strtoull(optarg, NULL, 10) << 20;
+                memory_budget_set = 1;
+                break;
+            case 'N':
+                av_context.numa = 1;
+                break;
+            case 'W':
+                av_context.frames_in_flight = atoi(optarg);
+                break;
+            case 'H':
+                av_context.no_frame_pool = 1;
+                break;
+            case 'J':
+                av_context.metrics_fd = atoi(optarg);
+                break;
+            case 'P':
+                av_context.metrics_prom_path = optarg;
+                break;
+            case 'T':
+                av_context.trace_path = optarg;
+                break;
+            case 'c':
+                av_context.video_encoder = optarg;
+                break;
+            case 'o':
+                av_context.output_path = optarg;
+                break;
+            case 'X':
+                av_context.flatten_dir = optarg;
+                break;
+            case 'D':
+                av_context.flatten_decrypt = 1;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    // leave the other half for the decoder's working buffers, code and libs
+    if (!memory_budget_set) {
+        av_context.memory_budget = budget_cgroup_limit() / 2;
+    }
+
+    if (av_context.frames_in_flight < 1) {
+        fprintf(stderr, "invalid number of frames in flight\n");
+        usage();
+        return 1;
+    }
+
+    if (av_context.reduce < 0 || av_context.max_layers < 0) {
+        fprintf(stderr, "invalid preview quality\n");
+        usage();
+        return 1;
+    }
+
+    if (av_context.video_encoder && !strcmp(av_context.video_encoder, "copy")) {
+        av_context.passthrough = 1;
+        if (av_context.reduce || av_context.max_layers || av_context.max_frame_bytes) {
+            fprintf(stderr, "preview quality needs decoding, not with -c copy\n");
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "no cpl and assetmap\n");
+        usage();
+        return 1;
+    }
+    const char *cpl_path = argv[optind];
+    const char *assetmap_path = argv[optind + 1];
+
+    signal(SIGINT, SIGINT_handler);
 
     decoding_assets_t decoding_assets;
     memset(&decoding_assets, 0, sizeof(decoding_assets_t));
 
-    cpl_composition_playlist* cpl = cpl_get_composition_playlist(argv[1]);
+    // every query runs against these, parse them only once
+    imf_doc_t *cpl_doc = imf_doc_open(cpl_path);
+    if (!cpl_doc) {
+        fprintf(stderr, "couldn't parse %s\n", cpl_path);
+        return 1;
+    }
+    imf_doc_t *assetmap_doc = imf_doc_open(assetmap_path);
+    if (!assetmap_doc) {
+        fprintf(stderr, "couldn't parse %s\n", assetmap_path);
+        imf_doc_close(cpl_doc);
+        return 1;
+    }
+
+    cpl_composition_playlist* cpl = cpl_get_composition_playlist(cpl_doc);
     if (!cpl) {
-        fprintf(stderr, "couldn't get cpl from %s\n", argv[1]);
+        fprintf(stderr, "couldn't get cpl from %s\n", cpl_path);
         return 1;
     }
 
-    err = get_video_assets(argv[1], argv[2], &decoding_assets);
+    linked_list_t *video_resources = cpl_get_video_resources(cpl_doc);
+    linked_list_t *audio_resources = cpl_get_audio_resources(cpl_doc);
+    // everything now, or with -F only what the pipeline needs to start
+    linked_list_t *video_resources_later = NULL;
+    linked_list_t *audio_resources_later = NULL;
+    if (av_context.fast_start) {
+        video_resources_later = video_resources ? video_resources->next : NULL;
+        audio_resources_later = audio_resources ? audio_resources->next : NULL;
+    }
+
+    pthread_mutex_init(&av_context.assets_mutex, NULL);
+    err = get_video_assets(cpl_doc, assetmap_doc, video_resources, video_resources_later, &decoding_assets.video_assets, &av_context.assets_mutex);
     if (err) {
         fprintf(stderr, "error getting video assets from CPL\n");
         return 1;
     }
-    err = get_audio_assets(argv[1], argv[2], &decoding_assets);
+    err = get_audio_assets(cpl_doc, assetmap_doc, audio_resources, audio_resources_later, &decoding_assets.audio_assets, &av_context.assets_mutex);
     if (err) {
         fprintf(stderr, "error getting audio assets from CPL\n");
         return 1;
@@ -149,44 +331,65 @@ int main(int argc, char **argv) {
     fprintf(stderr, "loaded CPL:\n");
     fprintf(stderr, "\tEditRate:\t\t%d/%d\n", cpl->edit_rate.num, cpl->edit_rate.denom);
 
-    fprintf(stderr, "loaded resources:\n");
-    fprintf(stderr, "VIDEO\n");
-    for (linked_list_t *i = decoding_assets.video_assets; i; i = i->next) {
-        asset_t *asset = i->user_data;
-        fprintf(stderr, "\t%s\n", asset->mxf_path);
-        if (asset->picture_type == PICTURE_TYPE_CDCI) {
-            cpl_cdci_descriptor *desc = asset->essence_descriptor;
-            fprintf(stderr, "\t\tCDCI\n");
-            fprintf(stderr, "\t\tVertical Subsampling\t\t%d\n", desc->vertical_subsampling);
-            fprintf(stderr, "\t\tHorizontal Subsampling\t\t%d\n", desc->horizontal_subsampling);
-            fprintf(stderr, "\t\tStoredWidth\t\t\t%d\n", desc->stored_width);
-            fprintf(stderr, "\t\tStoredHeight\t\t\t%d\n", desc->stored_height);
-            fprintf(stderr, "\t\tSampleRate\t\t\t%d/%d\n", desc->sample_rate.num, desc->sample_rate.denom);
-        }
+    resolve_args_t resolve_args;
+    memset(&resolve_args, 0, sizeof(resolve_args_t));
+    pthread_t resolve_thread_id;
+    if (av_context.fast_start) {
+        resolve_args.cpl_doc = cpl_doc;
+        resolve_args.assetmap_doc = assetmap_doc;
+        resolve_args.video_resources = video_resources_later;
+        resolve_args.audio_resources = audio_resources_later;
+        resolve_args.decoding_assets = &decoding_assets;
+        resolve_args.av_context = &av_context;
+        pthread_create(&resolve_thread_id, NULL, resolve_assets_thread, &resolve_args);
+    } else {
+        av_context.assets_resolved = 1;
+        print_assets(&decoding_assets);
     }
-    fprintf(stderr, "AUDIO\n");
-    for (linked_list_t *i = decoding_assets.audio_assets; i; i = i->next) {
-        asset_t *asset = i->user_data;
-        fprintf(stderr, "\t%s\n", asset->mxf_path);
-        cpl_wave_pcm_descriptor *desc = asset->essence_descriptor;
-        fprintf(stderr, "\t\tWAVE_PCM\n");
-        fprintf(stderr, "\t\tAverageBytesPerSecond\t\t%d\n", desc->average_bytes_per_second);
-        fprintf(stderr, "\t\tBlockAlign\t\t\t%d\n", desc->block_align);
-        fprintf(stderr, "\t\tChannelCount\t\t\t%d\n", desc->channel_count);
-        fprintf(stderr, "\t\tQuantizationBits\t\t%d\n", desc->quantization_bits);
-        fprintf(stderr, "\t\tSampleRate\t\t\t%d/%d\n", desc->sample_rate.num, desc->sample_rate.denom);
 
+    av_context.cpl = cpl;
+
+    if (av_context.flatten_dir) {
+        err = flatten_run(decoding_assets.video_assets, decoding_assets.audio_assets, &av_context);
+    } else {
+        err = av_pipeline_run(decoding_assets.video_assets, decoding_assets.audio_assets, &av_context);
     }
 
-    av_context.cpl = cpl;
+    if (av_context.fast_start) {
+        pthread_join(resolve_thread_id, NULL);
+    }
 
-    err = av_pipeline_run(decoding_assets.video_assets, decoding_assets.audio_assets, &av_context);
+    int integrity_failed = 0;
+    if (av_context.verify_hmac) {
+        if (av_context.video_integrity.failed) {
+            fprintf(stderr, "HMAC verification FAILED: first mismatch at video frame %d (frame %d of %s)\n",
+                    av_context.video_integrity.timeline_frame,
+                    av_context.video_integrity.frame,
+                    av_context.video_integrity.mxf_path);
+            integrity_failed = 1;
+        }
+        if (av_context.audio_integrity.failed) {
+            fprintf(stderr, "HMAC verification FAILED: first mismatch at audio frame %d of %s\n",
+                    av_context.audio_integrity.frame,
+                    av_context.audio_integrity.mxf_path);
+            integrity_failed = 1;
+        }
+        if (!integrity_failed) {
+            fprintf(stderr, "HMAC verification passed\n");
+        }
+    }
 
     ll_free(decoding_assets.video_assets, (free_user_data_func_t)free_asset);
     ll_free(decoding_assets.audio_assets, (free_user_data_func_t)free_asset);
+    ll_free(av_context.content_keys, free);
+    cpl_free_resources(video_resources);
+    cpl_free_resources(audio_resources);
+    imf_doc_close(cpl_doc);
+    imf_doc_close(assetmap_doc);
+    pthread_mutex_destroy(&av_context.assets_mutex);
     free(cpl);
 
     fprintf(stderr, "shutdown imf-fs - bye bye \n");
 
-    return !err;
+    return !err || integrity_failed || resolve_args.err;
 }
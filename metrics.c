@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "metrics.h"
+
+// queue depths get sampled every SAMPLE_MS, exported every EXPORT_MS
+#define SAMPLE_MS   100
+#define EXPORT_MS   1000
+
+// more than there can be frames in flight
+#define LATENCY_RING_SIZE 1024
+
+// upper bounds of histogram buckets in ms. last bucket is +Inf
+static const double bucket_bounds_ms[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+#define NUM_BUCKETS (sizeof(bucket_bounds_ms) / sizeof(bucket_bounds_ms[0]) + 1)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t buckets[NUM_BUCKETS];
+} histogram_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t busy_ns;
+    uint64_t idle_ns;
+    histogram_t frame_time;
+} stage_metrics_t;
+
+typedef struct {
+    unsigned int depth;
+    unsigned int max;
+    uint64_t sum;
+    uint64_t samples;
+} queue_metrics_t;
+
+static const char *stage_names[METRICS_STAGE_COUNT] = {
+    "read", "decrypt", "decode", "color", "pack", "audio", "write"
+};
+
+static const char *queue_names[METRICS_QUEUE_COUNT] = {
+    "decoding", "decrypt", "video_packets", "audio_packets"
+};
+
+volatile int metrics_enabled = 0;
+
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t exporter_thread_id;
+static volatile int exporter_running = 0;
+
+static int json_fd_s = -1;
+static char *prom_path_s = NULL;
+static metrics_sample_queues_func sample_queues_s = NULL;
+static uint64_t start_ns_s = 0;
+static uint64_t process_start_ns_s = 0;
+// 0 until the first video frame is out
+static uint64_t ttfb_ns_s = 0;
+
+static stage_metrics_t stages_s[METRICS_STAGE_COUNT];
+static queue_metrics_t queues_s[METRICS_QUEUE_COUNT];
+static histogram_t latency_s;
+static uint64_t read_ns_ring[LATENCY_RING_SIZE];
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void histogram_add(histogram_t *h, uint64_t ns) {
+    double ms = ns / 1e6;
+    int i = 0;
+    while (i < NUM_BUCKETS - 1 && ms > bucket_bounds_ms[i]) {
+        i++;
+    }
+    h->buckets[i]++;
+    h->count++;
+    h->sum_ns += ns;
+}
+
+// value in ms below which fraction q of the samples are. upper bucket bound
+static double histogram_quantile_ms(histogram_t *h, double q) {
+    if (!h->count) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(q * h->count);
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS - 1; ++i) {
+        seen += h->buckets[i];
+        if (seen > target) {
+            return bucket_bounds_ms[i];
+        }
+    }
+    return bucket_bounds_ms[NUM_BUCKETS - 2];
+}
+
+void metrics_mark_start() {
+    process_start_ns_s = monotonic_ns();
+}
+
+uint64_t metrics_now() {
+    if (!metrics_enabled) {
+        return 0;
+    }
+    return monotonic_ns();
+}
+
+void metrics_stage_busy(enum metrics_stage stage, uint64_t start_ns, uint64_t bytes) {
+    if (!metrics_enabled) {
+        return;
+    }
+    uint64_t ns = monotonic_ns() - start_ns;
+    pthread_mutex_lock(&metrics_mutex);
+    stage_metrics_t *s = &stages_s[stage];
+    s->frames++;
+    s->bytes += bytes;
+    s->busy_ns += ns;
+    histogram_add(&s->frame_time, ns);
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+void metrics_stage_idle(enum metrics_stage stage, uint64_t start_ns) {
+    if (!metrics_enabled) {
+        return;
+    }
+    uint64_t ns = monotonic_ns() - start_ns;
+    pthread_mutex_lock(&metrics_mutex);
+    stages_s[stage].idle_ns += ns;
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+void metrics_frame_read(unsigned int n) {
+    if (!metrics_enabled) {
+        return;
+    }
+    read_ns_ring[n % LATENCY_RING_SIZE] = monotonic_ns();
+}
+
+void metrics_frame_written(unsigned int n) {
+    if (!metrics_enabled) {
+        return;
+    }
+    uint64_t ns = monotonic_ns() - read_ns_ring[n % LATENCY_RING_SIZE];
+    pthread_mutex_lock(&metrics_mutex);
+    histogram_add(&latency_s, ns);
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+void metrics_first_frame_out() {
+    if (!metrics_enabled) {
+        return;
+    }
+    uint64_t ns = monotonic_ns() - process_start_ns_s;
+    pthread_mutex_lock(&metrics_mutex);
+    ttfb_ns_s = ns;
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+static void sample_queues() {
+    if (!sample_queues_s) {
+        return;
+    }
+    unsigned int depths[METRICS_QUEUE_COUNT];
+    memset(depths, 0, sizeof(depths));
+    sample_queues_s(depths);
+
+    pthread_mutex_lock(&metrics_mutex);
+    for (int i = 0; i < METRICS_QUEUE_COUNT; ++i) {
+        queue_metrics_t *q = &queues_s[i];
+        q->depth = depths[i];
+        if (depths[i] > q->max) {
+            q->max = depths[i];
+        }
+        q->sum += depths[i];
+        q->samples++;
+    }
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+static void write_json_line(stage_metrics_t *stages, queue_metrics_t *queues, histogram_t *latency, double elapsed, uint64_t ttfb_ns) {
+    char line[8192];
+    int len = 0;
+
+    len += snprintf(line + len, sizeof(line) - len, "{\"elapsed_s\":%.3f,\"ttfb_ms\":%.1f,\"stages\":{", elapsed, ttfb_ns / 1e6);
+    for (int i = 0; i < METRICS_STAGE_COUNT; ++i) {
+        stage_metrics_t *s = &stages[i];
+        len += snprintf(line + len, sizeof(line) - len,
+                "%s\"%s\":{\"frames\":%llu,\"bytes\":%llu,\"busy_s\":%.3f,\"idle_s\":%.3f,\"fps\":%.2f,\"frame_ms_avg\":%.2f,\"frame_ms_p50\":%.0f,\"frame_ms_p99\":%.0f}",
+                i ? "," : "",
+                stage_names[i],
+                (unsigned long long)s->frames,
+                (unsigned long long)s->bytes,
+                s->busy_ns / 1e9,
+                s->idle_ns / 1e9,
+                elapsed > 0 ? s->frames / elapsed : 0,
+                s->frames ? s->busy_ns / 1e6 / s->frames : 0,
+                histogram_quantile_ms(&s->frame_time, 0.5),
+                histogram_quantile_ms(&s->frame_time, 0.99));
+    }
+    len += snprintf(line + len, sizeof(line) - len, "},\"queues\":{");
+    for (int i = 0; i < METRICS_QUEUE_COUNT; ++i) {
+        queue_metrics_t *q = &queues[i];
+        len += snprintf(line + len, sizeof(line) - len,
+                "%s\"%s\":{\"depth\":%u,\"max\":%u,\"avg\":%.1f}",
+                i ? "," : "",
+                queue_names[i],
+                q->depth,
+                q->max,
+                q->samples ? (double)q->sum / q->samples : 0);
+    }
+    len += snprintf(line + len, sizeof(line) - len,
+            "},\"latency_ms\":{\"frames\":%llu,\"p50\":%.0f,\"p90\":%.0f,\"p99\":%.0f}}\n",
+            (unsigned long long)latency->count,
+            histogram_quantile_ms(latency, 0.5),
+            histogram_quantile_ms(latency, 0.9),
+            histogram_quantile_ms(latency, 0.99));
+
+    if (len >= sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    if (write(json_fd_s, line, len) != len) {
+        fprintf(stderr, "error writing metrics to fd %d\n", json_fd_s);
+    }
+}
+
+static void write_prom_histogram(FILE *f, const char *name, const char *labels, histogram_t *h) {
+    uint64_t cumulative = 0;
+    for (int i = 0; i < NUM_BUCKETS - 1; ++i) {
+        cumulative += h->buckets[i];
+        fprintf(f, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, *labels ? "," : "", bucket_bounds_ms[i] / 1000.0, (unsigned long long)cumulative);
+    }
+    fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, *labels ? "," : "", (unsigned long long)h->count);
+    fprintf(f, "%s_sum{%s} %.6f\n", name, labels, h->sum_ns / 1e9);
+    fprintf(f, "%s_count{%s} %llu\n", name, labels, (unsigned long long)h->count);
+}
+
+// textfile collector may read at any time, so write to tmp and rename
+static void write_prom_file(stage_metrics_t *stages, queue_metrics_t *queues, histogram_t *latency, uint64_t ttfb_ns) {
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", prom_path_s);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        fprintf(stderr, "error opening %s for metrics\n", tmp_path);
+        return;
+    }
+
+    fprintf(f, "# HELP imf_fs_stage_frames_total Frames processed per pipeline stage.\n");
+    fprintf(f, "# TYPE imf_fs_stage_frames_total counter\n");
+    for (int i = 0; i < METRICS_STAGE_COUNT; ++i) {
+        fprintf(f, "imf_fs_stage_frames_total{stage=\"%s\"} %llu\n", stage_names[i], (unsigned long long)stages[i].frames);
+    }
+    fprintf(f, "# HELP imf_fs_stage_bytes_total Bytes processed per pipeline stage.\n");
+    fprintf(f, "# TYPE imf_fs_stage_bytes_total counter\n");
+    for (int i = 0; i < METRICS_STAGE_COUNT; ++i) {
+        fprintf(f, "imf_fs_stage_bytes_total{stage=\"%s\"} %llu\n", stage_names[i], (unsigned long long)stages[i].bytes);
+    }
+    fprintf(f, "# HELP imf_fs_stage_busy_seconds_total Time a stage spent working.\n");
+    fprintf(f, "# TYPE imf_fs_stage_busy_seconds_total counter\n");
+    for (int i = 0; i < METRICS_STAGE_COUNT; ++i) {
+        fprintf(f, "imf_fs_stage_busy_seconds_total{stage=\"%s\"} %.6f\n", stage_names[i], stages[i].busy_ns / 1e9);
+    }
+    fprintf(f, "# HELP imf_fs_stage_idle_seconds_total Time a stage spent waiting on its queues.\n");
+    fprintf(f, "# TYPE imf_fs_stage_idle_seconds_total counter\n");
+    for (int i = 0; i < METRICS_STAGE_COUNT; ++i) {
+        fprintf(f, "imf_fs_stage_idle_seconds_total{stage=\"%s\"} %.6f\n", stage_names[i], stages[i].idle_ns / 1e9);
+    }
+    fprintf(f, "# HELP imf_fs_stage_frame_seconds Time per frame spent in a stage.\n");
+    fprintf(f, "# TYPE imf_fs_stage_frame_seconds histogram\n");
+    for (int i = 0; i < METRICS_STAGE_COUNT; ++i) {
+        char labels[64];
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", stage_names[i]);
+        write_prom_histogram(f, "imf_fs_stage_frame_seconds", labels, &stages[i].frame_time);
+    }
+    fprintf(f, "# HELP imf_fs_queue_depth Last sampled queue length.\n");
+    fprintf(f, "# TYPE imf_fs_queue_depth gauge\n");
+    for (int i = 0; i < METRICS_QUEUE_COUNT; ++i) {
+        fprintf(f, "imf_fs_queue_depth{queue=\"%s\"} %u\n", queue_names[i], queues[i].depth);
+    }
+    fprintf(f, "# HELP imf_fs_queue_depth_max Largest sampled queue length.\n");
+    fprintf(f, "# TYPE imf_fs_queue_depth_max gauge\n");
+    for (int i = 0; i < METRICS_QUEUE_COUNT; ++i) {
+        fprintf(f, "imf_fs_queue_depth_max{queue=\"%s\"} %u\n", queue_names[i], queues[i].max);
+    }
+    fprintf(f, "# HELP imf_fs_frame_latency_seconds Time from reading a video frame to muxing it.\n");
+    fprintf(f, "# TYPE imf_fs_frame_latency_seconds histogram\n");
+    write_prom_histogram(f, "imf_fs_frame_latency_seconds", "", latency);
+    fprintf(f, "# HELP imf_fs_time_to_first_byte_seconds Time from start until the first video frame was written, 0 before.\n");
+    fprintf(f, "# TYPE imf_fs_time_to_first_byte_seconds gauge\n");
+    fprintf(f, "imf_fs_time_to_first_byte_seconds %.6f\n", ttfb_ns / 1e9);
+
+    fclose(f);
+    if (rename(tmp_path, prom_path_s)) {
+        fprintf(stderr, "error renaming %s to %s\n", tmp_path, prom_path_s);
+    }
+}
+
+static void export_metrics() {
+    stage_metrics_t stages[METRICS_STAGE_COUNT];
+    queue_metrics_t queues[METRICS_QUEUE_COUNT];
+    histogram_t latency;
+    uint64_t ttfb_ns;
+
+    // copy so that the pipeline doesn't wait on our IO
+    pthread_mutex_lock(&metrics_mutex);
+    memcpy(stages, stages_s, sizeof(stages));
+    memcpy(queues, queues_s, sizeof(queues));
+    memcpy(&latency, &latency_s, sizeof(latency));
+    ttfb_ns = ttfb_ns_s;
+    pthread_mutex_unlock(&metrics_mutex);
+
+    double elapsed = (monotonic_ns() - start_ns_s) / 1e9;
+
+    if (json_fd_s >= 0) {
+        write_json_line(stages, queues, &latency, elapsed, ttfb_ns);
+    }
+    if (prom_path_s) {
+        write_prom_file(stages, queues, &latency, ttfb_ns);
+    }
+}
+
+static void *metrics_exporter_thread(void *data) {
+    int ticks = 0;
+    while (exporter_running) {
+        usleep(SAMPLE_MS * 1000);
+        sample_queues();
+        if (++ticks * SAMPLE_MS >= EXPORT_MS) {
+            ticks = 0;
+            export_metrics();
+        }
+    }
+    return NULL;
+}
+
+int metrics_start(int json_fd, const char *prom_path, metrics_sample_queues_func sample_queues) {
+    if (json_fd < 0 && !prom_path) {
+        return 0;
+    }
+
+    memset(stages_s, 0, sizeof(stages_s));
+    memset(queues_s, 0, sizeof(queues_s));
+    memset(&latency_s, 0, sizeof(latency_s));
+    ttfb_ns_s = 0;
+
+    json_fd_s = json_fd;
+    prom_path_s = prom_path ? strdup(prom_path) : NULL;
+    sample_queues_s = sample_queues;
+    start_ns_s = monotonic_ns();
+    metrics_enabled = 1;
+    exporter_running = 1;
+
+    if (pthread_create(&exporter_thread_id, NULL, metrics_exporter_thread, NULL)) {
+        fprintf(stderr, "error starting metrics thread\n");
+        metrics_enabled = 0;
+        exporter_running = 0;
+        return 1;
+    }
+    return 0;
+}
+
+void metrics_stop() {
+    if (!exporter_running) {
+        return;
+    }
+    exporter_running = 0;
+    pthread_join(exporter_thread_id, NULL);
+
+    sample_queues();
+    export_metrics();
+
+    metrics_enabled = 0;
+    free(prom_path_s);
+    prom_path_s = NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+enum metrics_stage {
+    METRICS_STAGE_READ = 0,
+    METRICS_STAGE_DECRYPT,
+    METRICS_STAGE_DECODE,
+    METRICS_STAGE_COLOR,
+    METRICS_STAGE_PACK,
+    METRICS_STAGE_AUDIO,
+    METRICS_STAGE_WRITE,
+    METRICS_STAGE_COUNT
+};
+
+enum metrics_queue {
+    METRICS_QUEUE_DECODING = 0,
+    METRICS_QUEUE_DECRYPT,
+    METRICS_QUEUE_VIDEO_PACKETS,
+    METRICS_QUEUE_AUDIO_PACKETS,
+    METRICS_QUEUE_COUNT
+};
+
+// fills depths[METRICS_QUEUE_COUNT] with the current queue lengths
+typedef void (*metrics_sample_queues_func)(unsigned int *depths);
+
+// 0 unless metrics_start was called. all functions below return
+// immediately if it is 0
+extern volatile int metrics_enabled;
+
+// start of the process, time to first byte is measured from here. works
+// before metrics_start
+extern void metrics_mark_start();
+
+// json_fd < 0 and prom_path NULL disable the respective output
+extern int metrics_start(int json_fd, const char *prom_path, metrics_sample_queues_func sample_queues);
+// writes the final values and joins the exporter thread
+extern void metrics_stop();
+
+// monotonic ns, 0 if disabled
+extern uint64_t metrics_now();
+// one unit of work (frame) of a stage done that started at start_ns
+extern void metrics_stage_busy(enum metrics_stage stage, uint64_t start_ns, uint64_t bytes);
+// stage waited on a queue since start_ns
+extern void metrics_stage_idle(enum metrics_stage stage, uint64_t start_ns);
+// video frame n (composition order) entered / left the pipeline
+extern void metrics_frame_read(unsigned int n);
+extern void metrics_frame_written(unsigned int n);
+// the first video frame was flushed to the output
+extern void metrics_first_frame_out();
+
+#endif
@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "numa_place.h"
+
+#define MAX_NODES 64
+
+typedef struct {
+    // node number in sysfs, might have holes
+    int id;
+    cpu_set_t cpus;
+} numa_node_t;
+
+static numa_node_t nodes_s[MAX_NODES];
+static int num_nodes_s = 0;
+
+// "0-3,8-11\n" into cpus. returns the number of CPUs
+static int parse_cpulist(const char *list, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    const char *p = list;
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, cpus);
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return CPU_COUNT(cpus);
+}
+
+int numa_place_init() {
+    num_nodes_s = 0;
+    for (int id = 0; id < MAX_NODES && num_nodes_s < MAX_NODES; ++id) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            continue;
+        }
+        char list[4096];
+        int n = fgets(list, sizeof(list), f) ? parse_cpulist(list, &nodes_s[num_nodes_s].cpus) : 0;
+        fclose(f);
+        // memory only nodes get no workers
+        if (n > 0) {
+            nodes_s[num_nodes_s].id = id;
+            num_nodes_s++;
+        }
+    }
+
+    if (num_nodes_s == 0) {
+        num_nodes_s = 1;
+        nodes_s[0].id = -1;
+        CPU_ZERO(&nodes_s[0].cpus);
+    }
+    return num_nodes_s;
+}
+
+int numa_place_num_nodes() {
+    return num_nodes_s;
+}
+
+int numa_place_num_cpus(int n) {
+    if (nodes_s[n].id < 0) {
+        return sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return CPU_COUNT(&nodes_s[n].cpus);
+}
+
+int numa_place_bind_thread(int n) {
+    // nothing to place on a single node
+    if (num_nodes_s < 2) {
+        return 0;
+    }
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &nodes_s[n].cpus);
+    if (err) {
+        fprintf(stderr, "error pinning thread to node %d: %s\n", nodes_s[n].id, strerror(err));
+        return 1;
+    }
+
+    // preferred rather than bound, a full node falls back to the others
+    unsigned long mask = 1ul << nodes_s[n].id;
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1)) {
+        perror("error setting memory policy");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef NUMA_PLACE_H
+#define NUMA_PLACE_H
+
+// NUMA nodes with CPUs, from /sys/devices/system/node. no libnuma, pinning
+// goes through pthread_setaffinity_np and the memory policy through the
+// set_mempolicy syscall
+
+// reads the nodes, returns how many have CPUs. 1 on machines without NUMA
+// (or without sysfs), numa_place_bind_thread does nothing then
+extern int numa_place_init();
+extern int numa_place_num_nodes();
+// CPUs of the n-th node
+extern int numa_place_num_cpus(int n);
+// pins the calling thread to the CPUs of the n-th node and makes its
+// allocations prefer that node. threads it creates afterwards inherit both.
+// returns 0 on success
+extern int numa_place_bind_thread(int n);
+
+#endif
@@ -49,7 +49,8 @@ void init_tilec(opj_tcd_tilecomp_t * l_tilec,
                 OPJ_INT32 y0,
                 OPJ_INT32 x1,
                 OPJ_INT32 y1,
-                OPJ_UINT32 numresolutions)
+                OPJ_UINT32 numresolutions,
+                OPJ_BOOL irreversible)
 {
     opj_tcd_resolution_t* l_res;
     OPJ_UINT32 resno, l_level_no;
@@ -64,9 +65,15 @@ void init_tilec(opj_tcd_tilecomp_t * l_tilec,
               (size_t)(l_tilec->y1 - l_tilec->y0);
     l_tilec->data = (OPJ_INT32*) opj_malloc(sizeof(OPJ_INT32) * nValues);
     for (i = 0; i < nValues; i++) {
-        l_tilec->data[i] = getValue((OPJ_UINT32)i);
+        if (irreversible) {
+            OPJ_FLOAT32 f = (OPJ_FLOAT32)getValue((OPJ_UINT32)i);
+            memcpy(&l_tilec->data[i], &f, sizeof(f));
+        } else {
+            l_tilec->data[i] = getValue((OPJ_UINT32)i);
+        }
     }
     l_tilec->numresolutions = numresolutions;
+    l_tilec->minimum_num_resolutions = numresolutions;
     l_tilec->resolutions = (opj_tcd_resolution_t*) opj_calloc(
                                l_tilec->numresolutions,
                                sizeof(opj_tcd_resolution_t));
@@ -100,7 +107,9 @@ void usage(void)
     printf(
         "bench_dwt [-size value] [-check] [-display] [-num_resolutions val]\n");
     printf(
-        "          [-offset x y] [-num_threads val]\n");
+        "          [-offset x y] [-num_threads val] [-irreversible]\n");
+    printf(
+        "          [-lanes val]\n");
     exit(1);
 }
 
@@ -149,6 +158,9 @@ int main(int argc, char** argv)
     OPJ_UINT32 offset_x = ((OPJ_UINT32)size + 1) / 2 - 1;
     OPJ_UINT32 offset_y = ((OPJ_UINT32)size + 1) / 2 - 1;
     OPJ_UINT32 num_resolutions = 6;
+    OPJ_BOOL irreversible = OPJ_FALSE;
+    OPJ_UINT32 lanes = 0;
+    OPJ_INT32* ref_data = NULL;
 
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-display") == 0) {
@@ -174,6 +186,15 @@ int main(int argc, char** argv)
             offset_x = (OPJ_UINT32)atoi(argv[i + 1]);
             offset_y = (OPJ_UINT32)atoi(argv[i + 2]);
             i += 2;
+        } else if (strcmp(argv[i], "-irreversible") == 0) {
+            irreversible = OPJ_TRUE;
+        } else if (strcmp(argv[i], "-lanes") == 0 && i + 1 < argc) {
+            lanes = (OPJ_UINT32)atoi(argv[i + 1]);
+            if (lanes != 4 && lanes != 8 && lanes != 16) {
+                fprintf(stderr, "Invalid value for lanes. Should be 4, 8 or 16\n");
+                exit(1);
+            }
+            i ++;
         } else {
             usage();
         }
@@ -183,7 +204,7 @@ int main(int argc, char** argv)
 
     init_tilec(&tilec, (OPJ_INT32)offset_x, (OPJ_INT32)offset_y,
                (OPJ_INT32)offset_x + size, (OPJ_INT32)offset_y + size,
-               num_resolutions);
+               num_resolutions, irreversible);
 
     if (display) {
         printf("Before\n");
@@ -222,6 +243,48 @@ int main(int argc, char** argv)
     image_comp.dx = 1;
     image_comp.dy = 1;
 
+    if (irreversible) {
+        size_t nValues = (size_t)(tilec.x1 - tilec.x0) *
+                         (size_t)(tilec.y1 - tilec.y0);
+
+        /* The 9-7 decode has no exact inverse to check against: */
+        /* compare with the 4 lanes (SSE) result instead */
+        if (check) {
+            OPJ_INT32* data = tilec.data;
+            ref_data = (OPJ_INT32*) opj_malloc(sizeof(OPJ_INT32) * nValues);
+            memcpy(ref_data, data, sizeof(OPJ_INT32) * nValues);
+            tilec.data = ref_data;
+            opj_dwt_set_97_lanes(4);
+            opj_dwt_decode_real(&tcd, &tilec, tilec.numresolutions);
+            tilec.data = data;
+        }
+
+        opj_dwt_set_97_lanes(lanes);
+        printf("lanes for dwt_decode_real: %u\n", opj_dwt_get_97_lanes());
+        start = opj_clock();
+        opj_dwt_decode_real(&tcd, &tilec, tilec.numresolutions);
+        stop = opj_clock();
+        printf("time for dwt_decode_real: %.03f s\n", stop - start);
+
+        if (check && memcmp(ref_data, tilec.data,
+                            sizeof(OPJ_INT32) * nValues) != 0) {
+            size_t idx;
+            for (idx = 0; idx < nValues; idx++) {
+                if (tilec.data[idx] != ref_data[idx]) {
+                    printf("Difference found at idx = %u\n", (OPJ_UINT32)idx);
+                    exit(1);
+                }
+            }
+        }
+
+        opj_free(ref_data);
+        free_tilec(&tilec);
+        opj_aligned_free(tcd.dwt_mem);
+
+        opj_thread_pool_destroy(tp);
+        return 0;
+    }
+
     start = opj_clock();
     opj_dwt_decode(&tcd, &tilec, tilec.numresolutions);
     stop = opj_clock();
@@ -267,6 +330,7 @@ int main(int argc, char** argv)
     }
 
     free_tilec(&tilec);
+    opj_aligned_free(tcd.dwt_mem);
 
     opj_thread_pool_destroy(tp);
     return 0;
@@ -282,6 +282,18 @@ OPJ_SIZE_T opj_stream_read_data(opj_stream_private_t * p_stream,
                                 OPJ_BYTE * p_buffer, OPJ_SIZE_T p_size, opj_event_mgr_t * p_event_mgr)
 {
     OPJ_SIZE_T l_read_nb_bytes = 0;
+
+    if (p_stream->m_memory_data) {
+        const OPJ_BYTE *l_data;
+
+        l_read_nb_bytes = opj_stream_read_data_in_place(p_stream, &l_data, p_size,
+                          p_event_mgr);
+        if (l_read_nb_bytes != (OPJ_SIZE_T) - 1) {
+            memcpy(p_buffer, l_data, l_read_nb_bytes);
+        }
+        return l_read_nb_bytes;
+    }
+
     if (p_stream->m_bytes_in_buffer >= p_size) {
         memcpy(p_buffer, p_stream->m_current_data, p_size);
         p_stream->m_current_data += p_size;
@@ -382,6 +394,45 @@ OPJ_SIZE_T opj_stream_read_data(opj_stream_private_t * p_stream,
     }
 }
 
+OPJ_SIZE_T opj_stream_read_data_in_place(opj_stream_private_t * p_stream,
+        const OPJ_BYTE ** p_data, OPJ_SIZE_T p_size, opj_event_mgr_t * p_event_mgr)
+{
+    OPJ_UINT64 l_left;
+
+    assert(p_stream->m_memory_data != 00);
+
+    l_left = p_stream->m_user_data_length - (OPJ_UINT64)p_stream->m_byte_offset;
+    if (l_left < p_size) {
+        p_size = (OPJ_SIZE_T)l_left;
+        /* end of stream */
+        opj_event_msg(p_event_mgr, EVT_INFO, "Stream reached its end !\n");
+        p_stream->m_status |= OPJ_STREAM_STATUS_END;
+        if (p_size == 0) {
+            return (OPJ_SIZE_T) - 1;
+        }
+    }
+
+    *p_data = p_stream->m_memory_data + p_stream->m_byte_offset;
+    p_stream->m_byte_offset += (OPJ_OFF_T)p_size;
+    return p_size;
+}
+
+void opj_stream_set_memory(opj_stream_private_t * p_stream,
+                           const OPJ_BYTE * p_data, OPJ_UINT64 p_size)
+{
+    assert(p_stream->m_status & OPJ_STREAM_STATUS_INPUT);
+
+    p_stream->m_memory_data = p_data;
+    p_stream->m_user_data_length = p_size;
+    p_stream->m_current_data = p_stream->m_stored_data;
+    p_stream->m_bytes_in_buffer = 0;
+}
+
+OPJ_BOOL opj_stream_is_memory(const opj_stream_private_t * p_stream)
+{
+    return p_stream->m_memory_data != 00;
+}
+
 OPJ_SIZE_T opj_stream_write_data(opj_stream_private_t * p_stream,
                                  const OPJ_BYTE * p_buffer,
                                  OPJ_SIZE_T p_size,
@@ -468,6 +519,18 @@ OPJ_OFF_T opj_stream_read_skip(opj_stream_private_t * p_stream,
 
     assert(p_size >= 0);
 
+    if (p_stream->m_memory_data) {
+        OPJ_OFF_T l_left = (OPJ_OFF_T)p_stream->m_user_data_length -
+                           p_stream->m_byte_offset;
+        if (p_size > l_left) {
+            opj_event_msg(p_event_mgr, EVT_INFO, "Stream reached its end !\n");
+            p_stream->m_status |= OPJ_STREAM_STATUS_END;
+            p_size = l_left;
+        }
+        p_stream->m_byte_offset += p_size;
+        return p_size ? p_size : (OPJ_OFF_T) - 1;
+    }
+
     if (p_stream->m_bytes_in_buffer >= (OPJ_SIZE_T)p_size) {
         p_stream->m_current_data += p_size;
         /* it is safe to cast p_size to OPJ_SIZE_T since it is <= m_bytes_in_buffer
@@ -604,6 +667,15 @@ OPJ_BOOL opj_stream_read_seek(opj_stream_private_t * p_stream, OPJ_OFF_T p_size,
     p_stream->m_current_data = p_stream->m_stored_data;
     p_stream->m_bytes_in_buffer = 0;
 
+    if (p_stream->m_memory_data) {
+        if ((OPJ_UINT64)p_size > p_stream->m_user_data_length) {
+            p_size = (OPJ_OFF_T)p_stream->m_user_data_length;
+        }
+        p_stream->m_status &= (~OPJ_STREAM_STATUS_END);
+        p_stream->m_byte_offset = p_size;
+        return OPJ_TRUE;
+    }
+
     if (!(p_stream->m_seek_fn(p_size, p_stream->m_user_data))) {
         p_stream->m_status |= OPJ_STREAM_STATUS_END;
         return OPJ_FALSE;
@@ -161,6 +161,13 @@ typedef struct opj_stream_private {
      */
     OPJ_UINT32 m_status;
 
+    /**
+     * Buffer of a memory stream, NULL for streams read through m_read_fn.
+     * Its m_user_data_length bytes are read in place, m_byte_offset being
+     * the read position, so it must stay valid until decoding is done.
+     */
+    const OPJ_BYTE *    m_memory_data;
+
 }
 opj_stream_private_t;
 
@@ -274,6 +281,33 @@ void opj_write_float_BE(OPJ_BYTE * p_buffer, OPJ_FLOAT32 p_value);
 OPJ_SIZE_T opj_stream_read_data(opj_stream_private_t * p_stream,
                                 OPJ_BYTE * p_buffer, OPJ_SIZE_T p_size, struct opj_event_mgr * p_event_mgr);
 
+/**
+ * Reads some bytes of a memory stream without copying them.
+ * @param       p_stream    the stream to read data from, opj_stream_is_memory() must be true.
+ * @param       p_data      set to the first byte read, in the buffer of the stream.
+ * @param       p_size      number of bytes to read.
+ * @param       p_event_mgr the user event manager to be notified of special events.
+ * @return      the number of bytes read, or -1 if the stream is at the end.
+ */
+OPJ_SIZE_T opj_stream_read_data_in_place(opj_stream_private_t * p_stream,
+        const OPJ_BYTE ** p_data, OPJ_SIZE_T p_size,
+        struct opj_event_mgr * p_event_mgr);
+
+/**
+ * Makes an input stream read p_size bytes from p_data in place instead of
+ * going through its read, skip and seek functions. The position is kept.
+ * @param       p_stream    the stream.
+ * @param       p_data      the buffer holding the whole stream, NULL to go back to the functions.
+ * @param       p_size      size of p_data.
+ */
+void opj_stream_set_memory(opj_stream_private_t * p_stream,
+                           const OPJ_BYTE * p_data, OPJ_UINT64 p_size);
+
+/**
+ * Tells if the given stream is read in place from memory.
+ */
+OPJ_BOOL opj_stream_is_memory(const opj_stream_private_t * p_stream);
+
 /**
  * Writes some bytes to the stream.
  * @param       p_stream    the stream to write data to.
@@ -43,6 +43,13 @@
 #define OPJ_SKIP_POISON
 #include "opj_includes.h"
 
+/* The whole-tile 9-7 decoder picks 8 wide AVX or 16 wide AVX-512 kernels */
+/* at run time when the CPU has them, whatever the compiler flags */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__)) && !defined(OPJ_NO_DWT97_DISPATCH)
+#define OPJ_DWT97_DISPATCH
+#endif
+
 #ifdef __SSE__
 #include <xmmintrin.h>
 #endif
@@ -52,7 +59,7 @@
 #ifdef __SSSE3__
 #include <tmmintrin.h>
 #endif
-#ifdef __AVX2__
+#if defined(__AVX2__) || defined(OPJ_DWT97_DISPATCH)
 #include <immintrin.h>
 #endif
 
@@ -91,6 +98,16 @@ typedef union {
     OPJ_FLOAT32 f[4];
 } opj_v4_t;
 
+/* Element i of the wavelet holds lanes floats from wavelet + i * lanes, */
+/* otherwise the same layout as opj_v4dwt_t. Used by the whole-tile path */
+/* only, so there is no window of interest */
+typedef struct vndwt_local {
+    OPJ_FLOAT32* wavelet ;
+    OPJ_INT32       dn ;  /* number of elements in high pass band */
+    OPJ_INT32       sn ;  /* number of elements in low pass band */
+    OPJ_INT32       cas ; /* 0 = start on even coord, 1 = start on odd coord */
+} opj_vndwt_t ;
+
 typedef struct v4dwt_local {
     opj_v4_t*   wavelet ;
     OPJ_INT32       dn ;  /* number of elements in high pass band */
@@ -148,8 +165,16 @@ static void opj_dwt_encode_stepsize(OPJ_INT32 stepsize, OPJ_INT32 numbps,
 /**
 Inverse wavelet transform in 2-D.
 */
-static OPJ_BOOL opj_dwt_decode_tile(opj_thread_pool_t* tp,
+static OPJ_BOOL opj_dwt_decode_tile(opj_tcd_t *p_tcd,
                                     opj_tcd_tilecomp_t* tilec, OPJ_UINT32 i);
+/**
+Makes sure the decoding memory kept in p_tcd is big enough, so that the
+wavelet buffers and thread jobs are only allocated for the first tile.
+The content of the memory is not kept when it grows.
+*/
+static OPJ_BOOL opj_dwt_reserve_decode_memory(opj_tcd_t *p_tcd,
+        OPJ_SIZE_T p_mem_size,
+        OPJ_SIZE_T p_jobs_size);
 
 static OPJ_BOOL opj_dwt_decode_partial_tile(
     opj_tcd_tilecomp_t* tilec,
@@ -1207,7 +1232,7 @@ OPJ_BOOL opj_dwt_decode(opj_tcd_t *p_tcd, opj_tcd_tilecomp_t* tilec,
                         OPJ_UINT32 numres)
 {
     if (p_tcd->whole_tile_decoding) {
-        return opj_dwt_decode_tile(p_tcd->thread_pool, tilec, numres);
+        return opj_dwt_decode_tile(p_tcd, tilec, numres);
     } else {
         return opj_dwt_decode_partial_tile(tilec, numres);
     }
@@ -1340,9 +1365,6 @@ static void opj_dwt_decode_h_func(void* user_data, opj_tls_t* tls)
     for (j = job->min_j; j < job->max_j; j++) {
         opj_idwt53_h(&job->h, &job->tiledp[j * job->w]);
     }
-
-    opj_aligned_free(job->h.mem);
-    opj_free(job);
 }
 
 typedef struct {
@@ -1369,20 +1391,47 @@ static void opj_dwt_decode_v_func(void* user_data, opj_tls_t* tls)
     if (j < job->max_j)
         opj_idwt53_v(&job->v, &job->tiledp[j], (OPJ_SIZE_T)job->w,
                      (OPJ_INT32)(job->max_j - j));
-
-    opj_aligned_free(job->v.mem);
-    opj_free(job);
 }
 
 
 /* <summary>                            */
 /* Inverse wavelet transform in 2-D.    */
 /* </summary>                           */
-static OPJ_BOOL opj_dwt_decode_tile(opj_thread_pool_t* tp,
+static OPJ_BOOL opj_dwt_reserve_decode_memory(opj_tcd_t *p_tcd,
+        OPJ_SIZE_T p_mem_size,
+        OPJ_SIZE_T p_jobs_size)
+{
+    if (p_mem_size > p_tcd->dwt_mem_size) {
+        opj_aligned_free(p_tcd->dwt_mem);
+        p_tcd->dwt_mem_size = 0;
+        p_tcd->dwt_mem = opj_aligned_32_malloc(p_mem_size);
+        if (!p_tcd->dwt_mem) {
+            return OPJ_FALSE;
+        }
+        p_tcd->dwt_mem_size = p_mem_size;
+    }
+    if (p_jobs_size > p_tcd->dwt_jobs_size) {
+        opj_free(p_tcd->dwt_jobs);
+        p_tcd->dwt_jobs_size = 0;
+        p_tcd->dwt_jobs = opj_malloc(p_jobs_size);
+        if (!p_tcd->dwt_jobs) {
+            return OPJ_FALSE;
+        }
+        p_tcd->dwt_jobs_size = p_jobs_size;
+    }
+    return OPJ_TRUE;
+}
+
+static OPJ_BOOL opj_dwt_decode_tile(opj_tcd_t *p_tcd,
                                     opj_tcd_tilecomp_t* tilec, OPJ_UINT32 numres)
 {
+    opj_thread_pool_t* tp = p_tcd->thread_pool;
     opj_dwt_t h;
     opj_dwt_t v;
+    opj_dwd_decode_h_job_t* h_jobs;
+    opj_dwd_decode_v_job_t* v_jobs;
+    OPJ_SIZE_T jobs_size;
+    OPJ_SIZE_T num_jobs_max;
 
     opj_tcd_resolution_t* tr = tilec->resolutions;
 
@@ -1411,13 +1460,27 @@ static OPJ_BOOL opj_dwt_decode_tile(opj_thread_pool_t* tp,
     /* since for the vertical pass */
     /* we process PARALLEL_COLS_53 columns at a time */
     h_mem_size *= PARALLEL_COLS_53 * sizeof(OPJ_INT32);
-    h.mem = (OPJ_INT32*)opj_aligned_32_malloc(h_mem_size);
-    if (! h.mem) {
+    /* h_mem_size is a multiple of 32, so each thread job gets its own */
+    /* aligned slice after the one of the single thread case */
+    num_jobs_max = num_threads > 1 ? (OPJ_SIZE_T)num_threads : 0U;
+    if (h_mem_size > SIZE_MAX / (1U + num_jobs_max)) {
         /* FIXME event manager error callback */
         return OPJ_FALSE;
     }
-
+    jobs_size = sizeof(opj_dwd_decode_h_job_t);
+    if (jobs_size < sizeof(opj_dwd_decode_v_job_t)) {
+        jobs_size = sizeof(opj_dwd_decode_v_job_t);
+    }
+    if (!opj_dwt_reserve_decode_memory(p_tcd, h_mem_size * (1U + num_jobs_max),
+                                       jobs_size * num_jobs_max)) {
+        /* FIXME event manager error callback */
+        return OPJ_FALSE;
+    }
+    h.mem = (OPJ_INT32*)p_tcd->dwt_mem;
     v.mem = h.mem;
+    /* the horizontal jobs are all done before the vertical ones start */
+    h_jobs = (opj_dwd_decode_h_job_t*)p_tcd->dwt_jobs;
+    v_jobs = (opj_dwd_decode_v_job_t*)p_tcd->dwt_jobs;
 
     while (--numres) {
         OPJ_INT32 * OPJ_RESTRICT tiledp = tilec->data;
@@ -1447,18 +1510,8 @@ static OPJ_BOOL opj_dwt_decode_tile(opj_thread_pool_t* tp,
             step_j = (rh / num_jobs);
 
             for (j = 0; j < num_jobs; j++) {
-                opj_dwd_decode_h_job_t* job;
+                opj_dwd_decode_h_job_t* job = &h_jobs[j];
 
-                job = (opj_dwd_decode_h_job_t*) opj_malloc(sizeof(opj_dwd_decode_h_job_t));
-                if (!job) {
-                    /* It would be nice to fallback to single thread case, but */
-                    /* unfortunately some jobs may be launched and have modified */
-                    /* tiledp, so it is not practical to recover from that error */
-                    /* FIXME event manager error callback */
-                    opj_thread_pool_wait_completion(tp, 0);
-                    opj_aligned_free(h.mem);
-                    return OPJ_FALSE;
-                }
                 job->h = h;
                 job->rw = rw;
                 job->w = w;
@@ -1468,14 +1521,7 @@ static OPJ_BOOL opj_dwt_decode_tile(opj_thread_pool_t* tp,
                 if (j == (num_jobs - 1U)) {  /* this will take care of the overflow */
                     job->max_j = rh;
                 }
-                job->h.mem = (OPJ_INT32*)opj_aligned_32_malloc(h_mem_size);
-                if (!job->h.mem) {
-                    /* FIXME event manager error callback */
-                    opj_thread_pool_wait_completion(tp, 0);
-                    opj_free(job);
-                    opj_aligned_free(h.mem);
-                    return OPJ_FALSE;
-                }
+                job->h.mem = (OPJ_INT32*)((OPJ_BYTE*)h.mem + (1U + j) * h_mem_size);
                 opj_thread_pool_submit_job(tp, opj_dwt_decode_h_func, job);
             }
             opj_thread_pool_wait_completion(tp, 0);
@@ -1502,18 +1548,8 @@ static OPJ_BOOL opj_dwt_decode_tile(opj_thread_pool_t* tp,
             step_j = (rw / num_jobs);
 
             for (j = 0; j < num_jobs; j++) {
-                opj_dwd_decode_v_job_t* job;
+                opj_dwd_decode_v_job_t* job = &v_jobs[j];
 
-                job = (opj_dwd_decode_v_job_t*) opj_malloc(sizeof(opj_dwd_decode_v_job_t));
-                if (!job) {
-                    /* It would be nice to fallback to single thread case, but */
-                    /* unfortunately some jobs may be launched and have modified */
-                    /* tiledp, so it is not practical to recover from that error */
-                    /* FIXME event manager error callback */
-                    opj_thread_pool_wait_completion(tp, 0);
-                    opj_aligned_free(v.mem);
-                    return OPJ_FALSE;
-                }
                 job->v = v;
                 job->rh = rh;
                 job->w = w;
@@ -1523,20 +1559,12 @@ static OPJ_BOOL opj_dwt_decode_tile(opj_thread_pool_t* tp,
                 if (j == (num_jobs - 1U)) {  /* this will take care of the overflow */
                     job->max_j = rw;
                 }
-                job->v.mem = (OPJ_INT32*)opj_aligned_32_malloc(h_mem_size);
-                if (!job->v.mem) {
-                    /* FIXME event manager error callback */
-                    opj_thread_pool_wait_completion(tp, 0);
-                    opj_free(job);
-                    opj_aligned_free(v.mem);
-                    return OPJ_FALSE;
-                }
+                job->v.mem = (OPJ_INT32*)((OPJ_BYTE*)v.mem + (1U + j) * h_mem_size);
                 opj_thread_pool_submit_job(tp, opj_dwt_decode_v_func, job);
             }
             opj_thread_pool_wait_completion(tp, 0);
         }
     }
-    opj_aligned_free(h.mem);
     return OPJ_TRUE;
 }
 
@@ -2503,15 +2531,397 @@ static void opj_v4dwt_decode(opj_v4dwt_t* OPJ_RESTRICT dwt)
 }
 
 
+/* Forced number of lanes of the 9-7 kernels, 0 to go by the CPU */
+static OPJ_UINT32 opj_dwt97_forced_lanes = 0;
+/* What the CPU supports, 0 until it has been checked */
+static volatile OPJ_UINT32 opj_dwt97_cpu_lanes = 0;
+
+static OPJ_UINT32 opj_dwt97_get_cpu_lanes(void)
+{
+    OPJ_UINT32 lanes = opj_dwt97_cpu_lanes;
+    if (lanes == 0) {
+        lanes = 4;
+#ifdef OPJ_DWT97_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            lanes = 16;
+        } else if (__builtin_cpu_supports("avx")) {
+            lanes = 8;
+        }
+#endif
+        opj_dwt97_cpu_lanes = lanes;
+    }
+    return lanes;
+}
+
+void opj_dwt_set_97_lanes(OPJ_UINT32 lanes)
+{
+    opj_dwt97_forced_lanes = lanes;
+}
+
+OPJ_UINT32 opj_dwt_get_97_lanes(void)
+{
+    OPJ_UINT32 lanes = opj_dwt97_get_cpu_lanes();
+    if (opj_dwt97_forced_lanes != 0 && opj_dwt97_forced_lanes < lanes) {
+        lanes = opj_dwt97_forced_lanes;
+    }
+    return lanes;
+}
+
+#ifdef OPJ_DWT97_DISPATCH
+
+/* AVX-512 has fused multiply-adds, which would round differently */
+#if defined(__clang__)
+#define OPJ_DWT97_NO_CONTRACT
+#else
+#define OPJ_DWT97_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#endif
+
+/* Same steps as opj_v4dwt_decode_step1_sse() and */
+/* opj_v4dwt_decode_step2_sse() for the whole band, on lanes floats per */
+/* element. Every lane goes through the same operations in the same order, */
+/* so the result is the same as with the SSE kernels */
+
+__attribute__((target("avx")))
+static void opj_v8dwt_decode_step1_avx(OPJ_FLOAT32* w,
+                                       OPJ_UINT32 end,
+                                       const OPJ_FLOAT32 cst)
+{
+    const __m256 c = _mm256_set1_ps(cst);
+    OPJ_UINT32 i;
+    for (i = 0; i < end; ++i, w += 2 * 8) {
+        _mm256_storeu_ps(w, _mm256_mul_ps(_mm256_loadu_ps(w), c));
+    }
+}
+
+__attribute__((target("avx")))
+static void opj_v8dwt_decode_step2_avx(OPJ_FLOAT32* l, OPJ_FLOAT32* w,
+                                       OPJ_UINT32 end,
+                                       OPJ_UINT32 m,
+                                       const OPJ_FLOAT32 cst)
+{
+    __m256 c = _mm256_set1_ps(cst);
+    OPJ_UINT32 i;
+    OPJ_UINT32 imax = opj_uint_min(end, m);
+    __m256 tmp1 = _mm256_loadu_ps(l);
+
+    for (i = 0; i < imax; ++i, w += 2 * 8) {
+        __m256 tmp2 = _mm256_loadu_ps(w - 8);
+        __m256 tmp3 = _mm256_loadu_ps(w);
+        _mm256_storeu_ps(w - 8, _mm256_add_ps(tmp2,
+                                              _mm256_mul_ps(_mm256_add_ps(tmp1, tmp3), c)));
+        tmp1 = tmp3;
+    }
+    if (m < end) {
+        assert(m + 1 == end);
+        c = _mm256_add_ps(c, c);
+        c = _mm256_mul_ps(c, _mm256_loadu_ps(w - 2 * 8));
+        _mm256_storeu_ps(w - 8, _mm256_add_ps(_mm256_loadu_ps(w - 8), c));
+    }
+}
+
+__attribute__((target("avx512f"))) OPJ_DWT97_NO_CONTRACT
+static void opj_v16dwt_decode_step1_avx512(OPJ_FLOAT32* w,
+        OPJ_UINT32 end,
+        const OPJ_FLOAT32 cst)
+{
+    const __m512 c = _mm512_set1_ps(cst);
+    OPJ_UINT32 i;
+    for (i = 0; i < end; ++i, w += 2 * 16) {
+        _mm512_storeu_ps(w, _mm512_mul_ps(_mm512_loadu_ps(w), c));
+    }
+}
+
+__attribute__((target("avx512f"))) OPJ_DWT97_NO_CONTRACT
+static void opj_v16dwt_decode_step2_avx512(OPJ_FLOAT32* l, OPJ_FLOAT32* w,
+        OPJ_UINT32 end,
+        OPJ_UINT32 m,
+        const OPJ_FLOAT32 cst)
+{
+    __m512 c = _mm512_set1_ps(cst);
+    OPJ_UINT32 i;
+    OPJ_UINT32 imax = opj_uint_min(end, m);
+    __m512 tmp1 = _mm512_loadu_ps(l);
+
+    for (i = 0; i < imax; ++i, w += 2 * 16) {
+        __m512 tmp2 = _mm512_loadu_ps(w - 16);
+        __m512 tmp3 = _mm512_loadu_ps(w);
+        _mm512_storeu_ps(w - 16, _mm512_add_ps(tmp2,
+                                               _mm512_mul_ps(_mm512_add_ps(tmp1, tmp3), c)));
+        tmp1 = tmp3;
+    }
+    if (m < end) {
+        assert(m + 1 == end);
+        c = _mm512_add_ps(c, c);
+        c = _mm512_mul_ps(c, _mm512_loadu_ps(w - 2 * 16));
+        _mm512_storeu_ps(w - 16, _mm512_add_ps(_mm512_loadu_ps(w - 16), c));
+    }
+}
+
+/* Inverse 9-7 wavelet transform in 1-D, 8 lanes. */
+__attribute__((target("avx")))
+static void opj_v8dwt_decode_avx(opj_vndwt_t* OPJ_RESTRICT dwt)
+{
+    OPJ_INT32 a, b;
+    OPJ_FLOAT32* wav = dwt->wavelet;
+    if (dwt->cas == 0) {
+        if (!((dwt->dn > 0) || (dwt->sn > 1))) {
+            return;
+        }
+        a = 0;
+        b = 1;
+    } else {
+        if (!((dwt->sn > 0) || (dwt->dn > 1))) {
+            return;
+        }
+        a = 1;
+        b = 0;
+    }
+    opj_v8dwt_decode_step1_avx(wav + a * 8, (OPJ_UINT32)dwt->sn, opj_K);
+    opj_v8dwt_decode_step1_avx(wav + b * 8, (OPJ_UINT32)dwt->dn, opj_c13318);
+    opj_v8dwt_decode_step2_avx(wav + b * 8, wav + (a + 1) * 8,
+                               (OPJ_UINT32)dwt->sn,
+                               (OPJ_UINT32)opj_int_min(dwt->sn, dwt->dn - a),
+                               opj_dwt_delta);
+    opj_v8dwt_decode_step2_avx(wav + a * 8, wav + (b + 1) * 8,
+                               (OPJ_UINT32)dwt->dn,
+                               (OPJ_UINT32)opj_int_min(dwt->dn, dwt->sn - b),
+                               opj_dwt_gamma);
+    opj_v8dwt_decode_step2_avx(wav + b * 8, wav + (a + 1) * 8,
+                               (OPJ_UINT32)dwt->sn,
+                               (OPJ_UINT32)opj_int_min(dwt->sn, dwt->dn - a),
+                               opj_dwt_beta);
+    opj_v8dwt_decode_step2_avx(wav + a * 8, wav + (b + 1) * 8,
+                               (OPJ_UINT32)dwt->dn,
+                               (OPJ_UINT32)opj_int_min(dwt->dn, dwt->sn - b),
+                               opj_dwt_alpha);
+}
+
+/* Inverse 9-7 wavelet transform in 1-D, 16 lanes. */
+__attribute__((target("avx512f"))) OPJ_DWT97_NO_CONTRACT
+static void opj_v16dwt_decode_avx512(opj_vndwt_t* OPJ_RESTRICT dwt)
+{
+    OPJ_INT32 a, b;
+    OPJ_FLOAT32* wav = dwt->wavelet;
+    if (dwt->cas == 0) {
+        if (!((dwt->dn > 0) || (dwt->sn > 1))) {
+            return;
+        }
+        a = 0;
+        b = 1;
+    } else {
+        if (!((dwt->sn > 0) || (dwt->dn > 1))) {
+            return;
+        }
+        a = 1;
+        b = 0;
+    }
+    opj_v16dwt_decode_step1_avx512(wav + a * 16, (OPJ_UINT32)dwt->sn, opj_K);
+    opj_v16dwt_decode_step1_avx512(wav + b * 16, (OPJ_UINT32)dwt->dn, opj_c13318);
+    opj_v16dwt_decode_step2_avx512(wav + b * 16, wav + (a + 1) * 16,
+                                   (OPJ_UINT32)dwt->sn,
+                                   (OPJ_UINT32)opj_int_min(dwt->sn, dwt->dn - a),
+                                   opj_dwt_delta);
+    opj_v16dwt_decode_step2_avx512(wav + a * 16, wav + (b + 1) * 16,
+                                   (OPJ_UINT32)dwt->dn,
+                                   (OPJ_UINT32)opj_int_min(dwt->dn, dwt->sn - b),
+                                   opj_dwt_gamma);
+    opj_v16dwt_decode_step2_avx512(wav + b * 16, wav + (a + 1) * 16,
+                                   (OPJ_UINT32)dwt->sn,
+                                   (OPJ_UINT32)opj_int_min(dwt->sn, dwt->dn - a),
+                                   opj_dwt_beta);
+    opj_v16dwt_decode_step2_avx512(wav + a * 16, wav + (b + 1) * 16,
+                                   (OPJ_UINT32)dwt->dn,
+                                   (OPJ_UINT32)opj_int_min(dwt->dn, dwt->sn - b),
+                                   opj_dwt_alpha);
+}
+
+/* Up to lanes rows of a, into the wavelet */
+static INLINE void opj_vndwt_interleave_h(opj_vndwt_t* OPJ_RESTRICT dwt,
+        const OPJ_FLOAT32* OPJ_RESTRICT a,
+        OPJ_UINT32 width,
+        OPJ_UINT32 nb_rows,
+        const OPJ_UINT32 lanes)
+{
+    OPJ_FLOAT32* OPJ_RESTRICT bi = dwt->wavelet + (OPJ_UINT32)dwt->cas * lanes;
+    OPJ_UINT32 i, k;
+
+    for (i = 0; i < (OPJ_UINT32)dwt->sn; ++i) {
+        for (k = 0; k < nb_rows; ++k) {
+            bi[i * 2 * lanes + k] = a[i + k * (OPJ_SIZE_T)width];
+        }
+    }
+
+    a += dwt->sn;
+    bi = dwt->wavelet + (OPJ_UINT32)(1 - dwt->cas) * lanes;
+
+    for (i = 0; i < (OPJ_UINT32)dwt->dn; ++i) {
+        for (k = 0; k < nb_rows; ++k) {
+            bi[i * 2 * lanes + k] = a[i + k * (OPJ_SIZE_T)width];
+        }
+    }
+}
+
+/* Up to lanes columns of a, into the wavelet */
+static INLINE void opj_vndwt_interleave_v(opj_vndwt_t* OPJ_RESTRICT dwt,
+        const OPJ_FLOAT32* OPJ_RESTRICT a,
+        OPJ_UINT32 width,
+        OPJ_UINT32 nb_cols,
+        const OPJ_UINT32 lanes)
+{
+    OPJ_FLOAT32* OPJ_RESTRICT bi = dwt->wavelet + (OPJ_UINT32)dwt->cas * lanes;
+    OPJ_UINT32 i, k;
+
+    for (i = 0; i < (OPJ_UINT32)dwt->sn; ++i) {
+        for (k = 0; k < nb_cols; ++k) {
+            bi[i * 2 * lanes + k] = a[i * (OPJ_SIZE_T)width + k];
+        }
+    }
+
+    a += (OPJ_UINT32)dwt->sn * (OPJ_SIZE_T)width;
+    bi = dwt->wavelet + (OPJ_UINT32)(1 - dwt->cas) * lanes;
+
+    for (i = 0; i < (OPJ_UINT32)dwt->dn; ++i) {
+        for (k = 0; k < nb_cols; ++k) {
+            bi[i * 2 * lanes + k] = a[i * (OPJ_SIZE_T)width + k];
+        }
+    }
+}
+
+/* opj_dwt_decode_tile_97() with h_lanes rows and v_lanes columns at a */
+/* time. Only called with constant lanes, so that the copies from and to */
+/* the tile get unrolled for them. p_tcd->dwt_mem has room for the wavelet */
+static INLINE void opj_dwt_decode_tile_97_lanes(opj_tcd_t *p_tcd,
+        opj_tcd_tilecomp_t* OPJ_RESTRICT tilec,
+        OPJ_UINT32 numres,
+        const OPJ_UINT32 h_lanes,
+        void (*h_decode)(opj_vndwt_t * OPJ_RESTRICT),
+        const OPJ_UINT32 v_lanes,
+        void (*v_decode)(opj_vndwt_t * OPJ_RESTRICT))
+{
+    opj_vndwt_t h;
+    opj_vndwt_t v;
+
+    opj_tcd_resolution_t* res = tilec->resolutions;
+
+    OPJ_UINT32 rw = (OPJ_UINT32)(res->x1 -
+                                 res->x0);    /* width of the resolution level computed */
+    OPJ_UINT32 rh = (OPJ_UINT32)(res->y1 -
+                                 res->y0);    /* height of the resolution level computed */
+
+    OPJ_UINT32 w = (OPJ_UINT32)(tilec->resolutions[tilec->minimum_num_resolutions -
+                                                               1].x1 -
+                                tilec->resolutions[tilec->minimum_num_resolutions - 1].x0);
+
+    h.wavelet = (OPJ_FLOAT32*) p_tcd->dwt_mem;
+    v.wavelet = h.wavelet;
+
+    while (--numres) {
+        OPJ_FLOAT32 * OPJ_RESTRICT aj = (OPJ_FLOAT32*) tilec->data;
+        OPJ_UINT32 j;
+
+        h.sn = (OPJ_INT32)rw;
+        v.sn = (OPJ_INT32)rh;
+
+        ++res;
+
+        rw = (OPJ_UINT32)(res->x1 -
+                          res->x0);   /* width of the resolution level computed */
+        rh = (OPJ_UINT32)(res->y1 -
+                          res->y0);   /* height of the resolution level computed */
+
+        h.dn = (OPJ_INT32)(rw - (OPJ_UINT32)h.sn);
+        h.cas = res->x0 % 2;
+
+        for (j = 0; j < rh; j += h_lanes) {
+            OPJ_UINT32 k, l;
+
+            if (rh - j >= h_lanes) {
+                opj_vndwt_interleave_h(&h, aj, w, h_lanes, h_lanes);
+                h_decode(&h);
+                for (k = 0; k < rw; k++) {
+                    for (l = 0; l < h_lanes; l++) {
+                        aj[k + (OPJ_SIZE_T)w * l] = h.wavelet[k * h_lanes + l];
+                    }
+                }
+            } else {
+                opj_vndwt_interleave_h(&h, aj, w, rh - j, h_lanes);
+                h_decode(&h);
+                for (k = 0; k < rw; k++) {
+                    for (l = 0; l < rh - j; l++) {
+                        aj[k + (OPJ_SIZE_T)w * l] = h.wavelet[k * h_lanes + l];
+                    }
+                }
+            }
+
+            aj += (OPJ_SIZE_T)w * h_lanes;
+        }
+
+        v.dn = (OPJ_INT32)(rh - (OPJ_UINT32)v.sn);
+        v.cas = res->y0 % 2;
+
+        aj = (OPJ_FLOAT32*) tilec->data;
+        for (j = 0; j < rw; j += v_lanes) {
+            OPJ_UINT32 k, l;
+
+            if (rw - j >= v_lanes) {
+                opj_vndwt_interleave_v(&v, aj, w, v_lanes, v_lanes);
+                v_decode(&v);
+                for (k = 0; k < rh; ++k) {
+                    for (l = 0; l < v_lanes; l++) {
+                        aj[k * (OPJ_SIZE_T)w + l] = v.wavelet[k * v_lanes + l];
+                    }
+                }
+            } else {
+                opj_vndwt_interleave_v(&v, aj, w, rw - j, v_lanes);
+                v_decode(&v);
+                for (k = 0; k < rh; ++k) {
+                    for (l = 0; l < rw - j; l++) {
+                        aj[k * (OPJ_SIZE_T)w + l] = v.wavelet[k * v_lanes + l];
+                    }
+                }
+            }
+            aj += v_lanes;
+        }
+    }
+}
+
+__attribute__((target("avx")))
+static void opj_dwt_decode_tile_97_avx(opj_tcd_t *p_tcd,
+                                       opj_tcd_tilecomp_t* OPJ_RESTRICT tilec,
+                                       OPJ_UINT32 numres)
+{
+    opj_dwt_decode_tile_97_lanes(p_tcd, tilec, numres,
+                                 8, opj_v8dwt_decode_avx,
+                                 8, opj_v8dwt_decode_avx);
+}
+
+__attribute__((target("avx512f"))) OPJ_DWT97_NO_CONTRACT
+static void opj_dwt_decode_tile_97_avx512(opj_tcd_t *p_tcd,
+        opj_tcd_tilecomp_t* OPJ_RESTRICT tilec,
+        OPJ_UINT32 numres)
+{
+    /* 16 rows at a time read from too many places at once to be any */
+    /* faster, but 16 columns are exactly a cache line */
+    opj_dwt_decode_tile_97_lanes(p_tcd, tilec, numres,
+                                 8, opj_v8dwt_decode_avx,
+                                 16, opj_v16dwt_decode_avx512);
+}
+
+#endif /* OPJ_DWT97_DISPATCH */
+
+
 /* <summary>                             */
 /* Inverse 9-7 wavelet transform in 2-D. */
 /* </summary>                            */
 static
-OPJ_BOOL opj_dwt_decode_tile_97(opj_tcd_tilecomp_t* OPJ_RESTRICT tilec,
+OPJ_BOOL opj_dwt_decode_tile_97(opj_tcd_t *p_tcd,
+                                opj_tcd_tilecomp_t* OPJ_RESTRICT tilec,
                                 OPJ_UINT32 numres)
 {
     opj_v4dwt_t h;
     opj_v4dwt_t v;
+    OPJ_UINT32 lanes = opj_dwt_get_97_lanes();
 
     opj_tcd_resolution_t* res = tilec->resolutions;
 
@@ -2534,15 +2944,26 @@ OPJ_BOOL opj_dwt_decode_tile_97(opj_tcd_tilecomp_t* OPJ_RESTRICT tilec,
     }
     l_data_size += 5U;
     /* overflow check */
-    if (l_data_size > (SIZE_MAX / sizeof(opj_v4_t))) {
+    if (l_data_size > (SIZE_MAX / (lanes * sizeof(OPJ_FLOAT32)))) {
         /* FIXME event manager error callback */
         return OPJ_FALSE;
     }
-    h.wavelet = (opj_v4_t*) opj_aligned_malloc(l_data_size * sizeof(opj_v4_t));
-    if (!h.wavelet) {
+    if (!opj_dwt_reserve_decode_memory(p_tcd,
+                                       l_data_size * lanes * sizeof(OPJ_FLOAT32), 0)) {
         /* FIXME event manager error callback */
         return OPJ_FALSE;
     }
+#ifdef OPJ_DWT97_DISPATCH
+    if (lanes > 4) {
+        if (lanes == 16) {
+            opj_dwt_decode_tile_97_avx512(p_tcd, tilec, numres);
+        } else {
+            opj_dwt_decode_tile_97_avx(p_tcd, tilec, numres);
+        }
+        return OPJ_TRUE;
+    }
+#endif
+    h.wavelet = (opj_v4_t*) p_tcd->dwt_mem;
     v.wavelet = h.wavelet;
 
     while (--numres) {
@@ -2634,7 +3055,6 @@ OPJ_BOOL opj_dwt_decode_tile_97(opj_tcd_tilecomp_t* OPJ_RESTRICT tilec,
         }
     }
 
-    opj_aligned_free(h.wavelet);
     return OPJ_TRUE;
 }
 
@@ -2885,7 +3305,7 @@ OPJ_BOOL opj_dwt_decode_real(opj_tcd_t *p_tcd,
                              OPJ_UINT32 numres)
 {
     if (p_tcd->whole_tile_decoding) {
-        return opj_dwt_decode_tile_97(tilec, numres);
+        return opj_dwt_decode_tile_97(p_tcd, tilec, numres);
     } else {
         return opj_dwt_decode_partial_97(tilec, numres);
     }
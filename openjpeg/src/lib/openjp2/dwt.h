@@ -101,6 +101,21 @@ OPJ_BOOL opj_dwt_decode_real(opj_tcd_t *p_tcd,
                              opj_tcd_tilecomp_t* OPJ_RESTRICT tilec,
                              OPJ_UINT32 numres);
 
+/**
+Limit the number of columns the whole-tile inverse 9-7 DWT processes at a
+time: 4 for SSE, 8 for AVX, 16 for AVX-512 (which still does 8 rows at a
+time). The widest the CPU supports is used by default; lanes beyond that are
+ignored. Not thread-safe, meant for benchmarks.
+@param lanes Maximum number of lanes, 0 to go by the CPU
+*/
+void opj_dwt_set_97_lanes(OPJ_UINT32 lanes);
+
+/**
+Number of rows or columns the whole-tile inverse 9-7 DWT processes at a time.
+@return 4, 8 or 16
+*/
+OPJ_UINT32 opj_dwt_get_97_lanes(void);
+
 /**
 Get the gain of a subband for the irreversible 9-7 DWT.
 @param orient Number that identifies the subband (0->LL, 1->HL, 2->LH, 3->HH)
@@ -225,6 +225,61 @@ void opj_copy_image_header(const opj_image_t* p_image_src,
     return;
 }
 
+void opj_copy_image_header_keep_data(const opj_image_t* p_image_src,
+                                     opj_image_t* p_image_dest)
+{
+    OPJ_UINT32 compno;
+
+    /* preconditions */
+    assert(p_image_src != 00);
+    assert(p_image_dest != 00);
+
+    if (p_image_dest->comps == NULL ||
+            p_image_dest->numcomps != p_image_src->numcomps) {
+        opj_copy_image_header(p_image_src, p_image_dest);
+        return;
+    }
+
+    p_image_dest->x0 = p_image_src->x0;
+    p_image_dest->y0 = p_image_src->y0;
+    p_image_dest->x1 = p_image_src->x1;
+    p_image_dest->y1 = p_image_src->y1;
+
+    for (compno = 0; compno < p_image_dest->numcomps; compno++) {
+        opj_image_comp_t *dest_comp = &(p_image_dest->comps[compno]);
+        OPJ_INT32 *data = dest_comp->data;
+
+        if (data != NULL && (dest_comp->w != p_image_src->comps[compno].w ||
+                             dest_comp->h != p_image_src->comps[compno].h)) {
+            opj_image_data_free(data);
+            data = NULL;
+        }
+        memcpy(dest_comp, &(p_image_src->comps[compno]), sizeof(opj_image_comp_t));
+        dest_comp->data = data;
+    }
+
+    p_image_dest->color_space = p_image_src->color_space;
+
+    if (p_image_dest->icc_profile_len != p_image_src->icc_profile_len) {
+        opj_free(p_image_dest->icc_profile_buf);
+        p_image_dest->icc_profile_buf = NULL;
+        p_image_dest->icc_profile_len = 0;
+        if (p_image_src->icc_profile_len) {
+            p_image_dest->icc_profile_buf = (OPJ_BYTE*)opj_malloc(
+                                                p_image_src->icc_profile_len);
+            if (!p_image_dest->icc_profile_buf) {
+                return;
+            }
+            p_image_dest->icc_profile_len = p_image_src->icc_profile_len;
+        }
+    }
+    if (p_image_dest->icc_profile_len) {
+        memcpy(p_image_dest->icc_profile_buf,
+               p_image_src->icc_profile_buf,
+               p_image_src->icc_profile_len);
+    }
+}
+
 opj_image_t* OPJ_CALLCONV opj_image_tile_create(OPJ_UINT32 numcmpts,
         opj_image_cmptparm_t *cmptparms, OPJ_COLOR_SPACE clrspc)
 {
@@ -64,6 +64,18 @@ void opj_image_comp_header_update(opj_image_t * p_image,
 void opj_copy_image_header(const opj_image_t* p_image_src,
                            opj_image_t* p_image_dest);
 
+/**
+ * Copy only header of image and its component header, like
+ * opj_copy_image_header(), but keep the components of the dest image when
+ * their number does not change, and the data of each component whose size
+ * does not change. Data of other components is freed.
+ *
+ * @param   p_image_src     the src image
+ * @param   p_image_dest    the dest image
+ */
+void opj_copy_image_header_keep_data(const opj_image_t* p_image_src,
+                                     opj_image_t* p_image_dest);
+
 /*@}*/
 
 #endif /* OPJ_IMAGE_H */
@@ -180,6 +180,35 @@ static OPJ_BOOL opj_j2k_copy_default_tcp_and_create_tcd(opj_j2k_t * p_j2k,
         opj_stream_private_t *p_stream,
         opj_event_mgr_t * p_manager);
 
+/**
+ * Copies the decoding tile parameters onto all the tile parameters.
+ */
+static OPJ_BOOL opj_j2k_copy_default_tcp(opj_j2k_t * p_j2k);
+
+/**
+ * Does what destroying the tile parameters and opj_j2k_copy_default_tcp()
+ * do, without allocating, when no tile owns more than its empty MCT and
+ * MCC record arrays. Used between codestreams sharing a main header.
+ *
+ * @return OPJ_FALSE if a tile owns more, nothing is changed then.
+ */
+static OPJ_BOOL opj_j2k_reset_tcps(opj_j2k_t * p_j2k);
+
+/**
+ * Returns whether a main header marker segment takes part in the comparison
+ * done by opj_j2k_read_next_header().
+ */
+static OPJ_BOOL opj_j2k_is_main_header_marker_kept(OPJ_UINT32 p_id);
+
+/**
+ * Appends a main header marker segment to the copy kept for
+ * opj_j2k_read_next_header().
+ */
+static OPJ_BOOL opj_j2k_keep_main_header_marker(opj_j2k_t *p_j2k,
+        OPJ_UINT32 p_id,
+        const OPJ_BYTE * p_header_data,
+        OPJ_UINT32 p_header_size);
+
 /**
  * Destroys the memory associated with the decoding of headers.
  */
@@ -204,6 +233,16 @@ static const struct opj_dec_memory_marker_handler * opj_j2k_get_marker_handler(
  */
 static void opj_j2k_tcp_destroy(opj_tcp_t *p_tcp);
 
+/**
+ * Takes back the component buffers of an image returned by a previous
+ * opj_j2k_decode() for the next one, and updates its header from the main
+ * header.
+ *
+ * @param       p_j2k           the jpeg2000 codec.
+ * @param       p_image         image of the previous codestream.
+ */
+static OPJ_BOOL opj_j2k_recycle_image(opj_j2k_t *p_j2k, opj_image_t *p_image);
+
 /**
  * Destroys the data inside a tile coding parameter structure.
  *
@@ -211,6 +250,15 @@ static void opj_j2k_tcp_destroy(opj_tcp_t *p_tcp);
  */
 static void opj_j2k_tcp_data_destroy(opj_tcp_t *p_tcp);
 
+/**
+ * Releases the tile data of a decoded tile, keeping the buffer for the
+ * next tile to read (see opj_j2k_read_sod()).
+ *
+ * @param       p_j2k           J2K codec.
+ * @param       p_tcp           the tile coding parameter whose data is released.
+ */
+static void opj_j2k_tcp_data_release(opj_j2k_t *p_j2k, opj_tcp_t *p_tcp);
+
 /**
  * Destroys a coding parameter structure.
  *
@@ -372,6 +420,20 @@ static OPJ_BOOL opj_j2k_pre_write_tile(opj_j2k_t * p_j2k,
 static OPJ_BOOL opj_j2k_update_image_data(opj_tcd_t * p_tcd,
         opj_image_t* p_output_image);
 
+/**
+ * Checks the planes set with opj_j2k_set_decoded_planes() against the
+ * codestream about to be decoded, and sets those the image leaves out to 0
+ * when truncated codestreams are allowed.
+ */
+static OPJ_BOOL opj_j2k_check_output_planes(opj_j2k_t *p_j2k,
+        opj_event_mgr_t * p_manager);
+
+/**
+ * Allocates zeroed data for the output components no tile was decoded into,
+ * which happens when the codestream is truncated.
+ */
+static OPJ_BOOL opj_j2k_alloc_missing_image_data(opj_image_t* p_output_image);
+
 static void opj_get_tile_dimensions(opj_image_t * l_image,
                                     opj_tcd_tilecomp_t * l_tilec,
                                     opj_image_comp_t * l_img_comp,
@@ -906,6 +968,21 @@ static OPJ_BOOL opj_j2k_read_sod(opj_j2k_t *p_j2k,
                                  opj_stream_private_t *p_stream,
                                  opj_event_mgr_t * p_manager);
 
+/**
+ * Tells whether a codestream decoded with allow_truncation ends before the
+ * next p_size bytes of a tile-part header. If so, the rest of the stream is
+ * dropped and the decoder goes to the J2K_STATE_NEOC state.
+ *
+ * @param       p_j2k                   the jpeg2000 codec.
+ * @param       p_stream                the stream to read data from.
+ * @param       p_size                  the number of bytes about to be read.
+ * @param       p_manager               the user event manager.
+*/
+static OPJ_BOOL opj_j2k_is_truncated_before(opj_j2k_t *p_j2k,
+        opj_stream_private_t *p_stream,
+        OPJ_UINT32 p_size,
+        opj_event_mgr_t * p_manager);
+
 static void opj_j2k_update_tlm(opj_j2k_t * p_j2k, OPJ_UINT32 p_tile_part_size)
 {
     opj_write_bytes(p_j2k->m_specific_param.m_encoder.m_tlm_sot_offsets_current,
@@ -4495,12 +4572,19 @@ static OPJ_BOOL opj_j2k_read_sot(opj_j2k_t *p_j2k,
             l_current_part;
 
         if (l_num_parts != 0) {
+            /* the index of the previous codestream may already be big enough */
+            OPJ_UINT32 l_nb_tps_allocated =
+                p_j2k->cstr_index->tile_index[p_j2k->m_current_tile_number].current_nb_tps;
+
             p_j2k->cstr_index->tile_index[p_j2k->m_current_tile_number].nb_tps =
                 l_num_parts;
             p_j2k->cstr_index->tile_index[p_j2k->m_current_tile_number].current_nb_tps =
                 l_num_parts;
 
-            if (!p_j2k->cstr_index->tile_index[p_j2k->m_current_tile_number].tp_index) {
+            if (p_j2k->cstr_index->tile_index[p_j2k->m_current_tile_number].tp_index &&
+                    l_nb_tps_allocated == l_num_parts) {
+                /* nothing to do */
+            } else if (!p_j2k->cstr_index->tile_index[p_j2k->m_current_tile_number].tp_index) {
                 p_j2k->cstr_index->tile_index[p_j2k->m_current_tile_number].tp_index =
                     (opj_tp_index_t*)opj_calloc(l_num_parts, sizeof(opj_tp_index_t));
                 if (!p_j2k->cstr_index->tile_index[p_j2k->m_current_tile_number].tp_index) {
@@ -4695,6 +4779,8 @@ static OPJ_BOOL opj_j2k_read_sod(opj_j2k_t *p_j2k,
     opj_tcp_t * l_tcp = 00;
     OPJ_UINT32 * l_tile_len = 00;
     OPJ_BOOL l_sot_length_pb_detected = OPJ_FALSE;
+    OPJ_BOOL l_truncated = OPJ_FALSE;
+    OPJ_BOOL l_in_place = OPJ_FALSE;
 
     /* preconditions */
     assert(p_j2k != 00);
@@ -4728,9 +4814,17 @@ static OPJ_BOOL opj_j2k_read_sod(opj_j2k_t *p_j2k,
         /* Check enough bytes left in stream before allocation */
         if ((OPJ_OFF_T)p_j2k->m_specific_param.m_decoder.m_sot_length >
                 opj_stream_get_number_byte_left(p_stream)) {
-            opj_event_msg(p_manager, EVT_ERROR,
-                          "Tile part length size inconsistent with stream length\n");
-            return OPJ_FALSE;
+            if (!p_j2k->m_cp.allow_truncation) {
+                opj_event_msg(p_manager, EVT_ERROR,
+                              "Tile part length size inconsistent with stream length\n");
+                return OPJ_FALSE;
+            }
+            /* Keep what is left, the stream ends inside this tile-part */
+            opj_event_msg(p_manager, EVT_WARNING,
+                          "Tile part truncated to stream length\n");
+            p_j2k->m_specific_param.m_decoder.m_sot_length = (OPJ_UINT32)
+                    opj_stream_get_number_byte_left(p_stream);
+            l_truncated = OPJ_TRUE;
         }
         if (p_j2k->m_specific_param.m_decoder.m_sot_length >
                 UINT_MAX - OPJ_COMMON_CBLK_DATA_EXTRA) {
@@ -4742,12 +4836,28 @@ static OPJ_BOOL opj_j2k_read_sod(opj_j2k_t *p_j2k,
         /* Add a margin of OPJ_COMMON_CBLK_DATA_EXTRA to the allocation we */
         /* do so that opj_mqc_init_dec_common() can safely add a synthetic */
         /* 0xFFFF marker. */
-        if (! *l_current_data) {
+        if (! *l_current_data && opj_stream_is_memory(p_stream)) {
+            /* The first tile-part of a memory stream is not copied, */
+            /* m_data points into the stream and m_data_max_size stays 0 */
+            l_in_place = OPJ_TRUE;
+        } else if (! *l_current_data) {
             /* LH: oddly enough, in this path, l_tile_len!=0.
              * TODO: If this was consistent, we could simplify the code to only use realloc(), as realloc(0,...) default to malloc(0,...).
              */
-            *l_current_data = (OPJ_BYTE*) opj_malloc(
-                                  p_j2k->m_specific_param.m_decoder.m_sot_length + OPJ_COMMON_CBLK_DATA_EXTRA);
+            OPJ_UINT32 l_size = p_j2k->m_specific_param.m_decoder.m_sot_length +
+                                OPJ_COMMON_CBLK_DATA_EXTRA;
+            opj_j2k_dec_t * l_dec = &p_j2k->m_specific_param.m_decoder;
+
+            /* Reuse the buffer of a tile already decoded */
+            if (l_dec->m_spare_tile_data && l_dec->m_spare_tile_data_size >= l_size) {
+                *l_current_data = l_dec->m_spare_tile_data;
+                l_tcp->m_data_max_size = l_dec->m_spare_tile_data_size;
+                l_dec->m_spare_tile_data = 00;
+                l_dec->m_spare_tile_data_size = 0;
+            } else {
+                *l_current_data = (OPJ_BYTE*) opj_malloc(l_size);
+                l_tcp->m_data_max_size = *l_current_data ? l_size : 0;
+            }
         } else {
             OPJ_BYTE *l_new_current_data;
             if (*l_tile_len > UINT_MAX - OPJ_COMMON_CBLK_DATA_EXTRA -
@@ -4758,20 +4868,40 @@ static OPJ_BOOL opj_j2k_read_sod(opj_j2k_t *p_j2k,
                 return OPJ_FALSE;
             }
 
-            l_new_current_data = (OPJ_BYTE *) opj_realloc(*l_current_data,
-                                 *l_tile_len + p_j2k->m_specific_param.m_decoder.m_sot_length +
-                                 OPJ_COMMON_CBLK_DATA_EXTRA);
-            if (! l_new_current_data) {
-                opj_free(*l_current_data);
-                /*nothing more is done as l_current_data will be set to null, and just
-                  afterward we enter in the error path
-                  and the actual tile_len is updated (committed) at the end of the
-                  function. */
+            if (l_tcp->m_data_max_size == 0) {
+                /* The tile-parts read in place so far are copied, so that */
+                /* this one can follow them */
+                l_tcp->m_data_max_size = *l_tile_len +
+                                         p_j2k->m_specific_param.m_decoder.m_sot_length +
+                                         OPJ_COMMON_CBLK_DATA_EXTRA;
+                l_new_current_data = (OPJ_BYTE *) opj_malloc(l_tcp->m_data_max_size);
+                if (! l_new_current_data) {
+                    l_tcp->m_data_max_size = 0;
+                } else {
+                    memcpy(l_new_current_data, *l_current_data, *l_tile_len);
+                }
+                *l_current_data = l_new_current_data;
+            } else if (*l_tile_len + p_j2k->m_specific_param.m_decoder.m_sot_length +
+                       OPJ_COMMON_CBLK_DATA_EXTRA > l_tcp->m_data_max_size) {
+                l_new_current_data = (OPJ_BYTE *) opj_realloc(*l_current_data,
+                                     *l_tile_len + p_j2k->m_specific_param.m_decoder.m_sot_length +
+                                     OPJ_COMMON_CBLK_DATA_EXTRA);
+                l_tcp->m_data_max_size = *l_tile_len +
+                                         p_j2k->m_specific_param.m_decoder.m_sot_length +
+                                         OPJ_COMMON_CBLK_DATA_EXTRA;
+                if (! l_new_current_data) {
+                    l_tcp->m_data_max_size = 0;
+                    opj_free(*l_current_data);
+                    /*nothing more is done as l_current_data will be set to null, and just
+                      afterward we enter in the error path
+                      and the actual tile_len is updated (committed) at the end of the
+                      function. */
+                }
+                *l_current_data = l_new_current_data;
             }
-            *l_current_data = l_new_current_data;
         }
 
-        if (*l_current_data == 00) {
+        if (*l_current_data == 00 && !l_in_place) {
             opj_event_msg(p_manager, EVT_ERROR, "Not enough memory to decode tile\n");
             return OPJ_FALSE;
         }
@@ -4806,7 +4936,15 @@ static OPJ_BOOL opj_j2k_read_sod(opj_j2k_t *p_j2k,
     }
 
     /* Patch to support new PHR data */
-    if (!l_sot_length_pb_detected) {
+    if (l_in_place) {
+        const OPJ_BYTE *l_data = 00;
+        l_current_read_size = opj_stream_read_data_in_place(
+                                  p_stream,
+                                  &l_data,
+                                  p_j2k->m_specific_param.m_decoder.m_sot_length,
+                                  p_manager);
+        *l_current_data = (OPJ_BYTE *)l_data;
+    } else if (!l_sot_length_pb_detected) {
         l_current_read_size = opj_stream_read_data(
                                   p_stream,
                                   *l_current_data + *l_tile_len,
@@ -4816,7 +4954,8 @@ static OPJ_BOOL opj_j2k_read_sod(opj_j2k_t *p_j2k,
         l_current_read_size = 0;
     }
 
-    if (l_current_read_size != p_j2k->m_specific_param.m_decoder.m_sot_length) {
+    if (l_truncated ||
+            l_current_read_size != p_j2k->m_specific_param.m_decoder.m_sot_length) {
         p_j2k->m_specific_param.m_decoder.m_state = J2K_STATE_NEOC;
     } else {
         p_j2k->m_specific_param.m_decoder.m_state = J2K_STATE_TPHSOT;
@@ -6404,6 +6543,11 @@ void opj_j2k_setup_decoder(opj_j2k_t *j2k, opj_dparameters_t *parameters)
         j2k->m_cp.m_specific_param.m_dec.m_reduce = parameters->cp_reduce;
 
         j2k->dump_state = (parameters->flags & OPJ_DPARAMETERS_DUMP_FLAG);
+        if (parameters->flags & OPJ_DPARAMETERS_ALLOW_TRUNCATION_FLAG) {
+            j2k->m_cp.allow_truncation = 1;
+        } else {
+            j2k->m_cp.allow_truncation = 0;
+        }
 #ifdef USE_JPWL
         j2k->m_cp.correct = parameters->jpwl_correct;
         j2k->m_cp.exp_comps = parameters->jpwl_exp_comps;
@@ -6431,6 +6575,22 @@ OPJ_BOOL opj_j2k_set_threads(opj_j2k_t *j2k, OPJ_UINT32 num_threads)
     return OPJ_FALSE;
 }
 
+OPJ_BOOL opj_j2k_set_thread_pool(opj_j2k_t *j2k, opj_thread_pool_t *shared)
+{
+    /* Same restriction as opj_j2k_set_threads() */
+    if (opj_has_thread_support() && j2k->m_tcd == NULL) {
+        opj_thread_pool_t *l_tp = opj_thread_pool_create_client(shared);
+
+        if (l_tp == NULL) {
+            return OPJ_FALSE;
+        }
+        opj_thread_pool_destroy(j2k->m_tp);
+        j2k->m_tp = l_tp;
+        return OPJ_TRUE;
+    }
+    return OPJ_FALSE;
+}
+
 static int opj_j2k_get_default_thread_count()
 {
     const char* num_threads_str = getenv("OPJ_NUM_THREADS");
@@ -7899,6 +8059,7 @@ static OPJ_BOOL opj_j2k_read_header_procedure(opj_j2k_t *p_j2k,
 
     /*  We enter in the main header */
     p_j2k->m_specific_param.m_decoder.m_state = J2K_STATE_MHSOC;
+    p_j2k->m_specific_param.m_decoder.m_main_header_size = 0;
 
     /* Try to read the SOC marker, the codestream must begin with SOC marker */
     if (! opj_j2k_read_soc(p_j2k, p_stream, p_manager)) {
@@ -8012,6 +8173,13 @@ static OPJ_BOOL opj_j2k_read_header_procedure(opj_j2k_t *p_j2k,
             return OPJ_FALSE;
         }
 
+        if (opj_j2k_is_main_header_marker_kept(l_marker_handler->id) &&
+                !opj_j2k_keep_main_header_marker(p_j2k, l_marker_handler->id,
+                        p_j2k->m_specific_param.m_decoder.m_header_data, l_marker_size)) {
+            opj_event_msg(p_manager, EVT_ERROR, "Not enough memory to keep main header\n");
+            return OPJ_FALSE;
+        }
+
         /* Add the marker to the codestream index*/
         if (OPJ_FALSE == opj_j2k_add_mhmarker(
                     p_j2k->cstr_index,
@@ -8096,11 +8264,351 @@ static OPJ_BOOL opj_j2k_exec(opj_j2k_t * p_j2k,
     return l_result;
 }
 
+static OPJ_BOOL opj_j2k_is_main_header_marker_kept(OPJ_UINT32 p_id)
+{
+    /* tile-part lengths and comments are not used for decoding */
+    return p_id != J2K_MS_TLM && p_id != J2K_MS_PLM && p_id != J2K_MS_COM &&
+           p_id != J2K_MS_UNK;
+}
+
+static OPJ_BOOL opj_j2k_keep_main_header_marker(opj_j2k_t *p_j2k,
+        OPJ_UINT32 p_id,
+        const OPJ_BYTE * p_header_data,
+        OPJ_UINT32 p_header_size)
+{
+    opj_j2k_dec_t *l_dec = &p_j2k->m_specific_param.m_decoder;
+    OPJ_UINT32 l_size = l_dec->m_main_header_size + 4 + p_header_size;
+
+    if (l_size > l_dec->m_main_header_max_size) {
+        OPJ_BYTE *l_new_main_header = (OPJ_BYTE *) opj_realloc(l_dec->m_main_header,
+                                      l_size);
+        if (! l_new_main_header) {
+            return OPJ_FALSE;
+        }
+        l_dec->m_main_header = l_new_main_header;
+        l_dec->m_main_header_max_size = l_size;
+    }
+
+    opj_write_bytes(l_dec->m_main_header + l_dec->m_main_header_size, p_id, 2);
+    opj_write_bytes(l_dec->m_main_header + l_dec->m_main_header_size + 2,
+                    p_header_size + 2, 2);
+    memcpy(l_dec->m_main_header + l_dec->m_main_header_size + 4, p_header_data,
+           p_header_size);
+    l_dec->m_main_header_size = l_size;
+
+    return OPJ_TRUE;
+}
+
+OPJ_BOOL opj_j2k_read_next_header(opj_stream_private_t *p_stream,
+                                  opj_j2k_t* p_j2k,
+                                  opj_image_t** p_image,
+                                  opj_event_mgr_t* p_manager)
+{
+    opj_j2k_dec_t *l_dec = &p_j2k->m_specific_param.m_decoder;
+    OPJ_UINT32 l_current_marker;
+    OPJ_UINT32 l_marker_size;
+    OPJ_UINT32 l_offset = 0;
+    OPJ_UINT32 l_nb_tiles;
+    OPJ_UINT32 i;
+
+    /* preconditions */
+    assert(p_j2k != 00);
+    assert(p_stream != 00);
+    assert(p_manager != 00);
+
+    /* PPM puts packet headers in the main header, which are consumed */
+    /* while decoding */
+    if (!p_j2k->m_is_decoder || p_j2k->m_private_image == NULL ||
+            p_j2k->m_tcd == NULL || l_dec->m_main_header_size == 0 ||
+            p_j2k->m_cp.ppm) {
+        opj_event_msg(p_manager, EVT_INFO, "No main header to reuse\n");
+        return OPJ_FALSE;
+    }
+
+    if (opj_stream_read_data(p_stream, l_dec->m_header_data, 2, p_manager) != 2) {
+        opj_event_msg(p_manager, EVT_ERROR, "Stream too short\n");
+        return OPJ_FALSE;
+    }
+    opj_read_bytes(l_dec->m_header_data, &l_current_marker, 2);
+    if (l_current_marker != J2K_MS_SOC) {
+        opj_event_msg(p_manager, EVT_ERROR, "Expected a SOC marker \n");
+        return OPJ_FALSE;
+    }
+    p_j2k->cstr_index->main_head_start = opj_stream_tell(p_stream) - 2;
+
+    /* Compare marker segments up to the first SOT with the kept ones */
+    for (;;) {
+        OPJ_BYTE l_marker_header[4];
+
+        if (opj_stream_read_data(p_stream, l_dec->m_header_data, 2, p_manager) != 2) {
+            opj_event_msg(p_manager, EVT_ERROR, "Stream too short\n");
+            return OPJ_FALSE;
+        }
+        opj_read_bytes(l_dec->m_header_data, &l_current_marker, 2);
+
+        if (l_current_marker == J2K_MS_SOT) {
+            break;
+        }
+        if (l_current_marker < 0xff00) {
+            opj_event_msg(p_manager, EVT_ERROR,
+                          "A marker ID was expected (0xff--) instead of %.8x\n", l_current_marker);
+            return OPJ_FALSE;
+        }
+
+        if (opj_stream_read_data(p_stream, l_dec->m_header_data, 2, p_manager) != 2) {
+            opj_event_msg(p_manager, EVT_ERROR, "Stream too short\n");
+            return OPJ_FALSE;
+        }
+        opj_read_bytes(l_dec->m_header_data, &l_marker_size, 2);
+        if (l_marker_size < 2) {
+            opj_event_msg(p_manager, EVT_ERROR, "Invalid marker size\n");
+            return OPJ_FALSE;
+        }
+        l_marker_size -= 2;
+
+        if (!opj_j2k_is_main_header_marker_kept(opj_j2k_get_marker_handler(
+                    l_current_marker)->id)) {
+            if (opj_stream_skip(p_stream, l_marker_size,
+                                p_manager) != (OPJ_OFF_T)l_marker_size) {
+                opj_event_msg(p_manager, EVT_ERROR, "Stream too short\n");
+                return OPJ_FALSE;
+            }
+            continue;
+        }
+
+        if (l_marker_size > l_dec->m_header_data_size) {
+            OPJ_BYTE *new_header_data = (OPJ_BYTE *) opj_realloc(l_dec->m_header_data,
+                                        l_marker_size);
+            if (! new_header_data) {
+                opj_free(l_dec->m_header_data);
+                l_dec->m_header_data = NULL;
+                l_dec->m_header_data_size = 0;
+                opj_event_msg(p_manager, EVT_ERROR, "Not enough memory to read header\n");
+                return OPJ_FALSE;
+            }
+            l_dec->m_header_data = new_header_data;
+            l_dec->m_header_data_size = l_marker_size;
+        }
+        if (opj_stream_read_data(p_stream, l_dec->m_header_data, l_marker_size,
+                                 p_manager) != l_marker_size) {
+            opj_event_msg(p_manager, EVT_ERROR, "Stream too short\n");
+            return OPJ_FALSE;
+        }
+
+        opj_write_bytes(l_marker_header, l_current_marker, 2);
+        opj_write_bytes(l_marker_header + 2, l_marker_size + 2, 2);
+        if (l_dec->m_main_header_size - l_offset < 4 + l_marker_size ||
+                memcmp(l_dec->m_main_header + l_offset, l_marker_header, 4) != 0 ||
+                memcmp(l_dec->m_main_header + l_offset + 4, l_dec->m_header_data,
+                       l_marker_size) != 0) {
+            opj_event_msg(p_manager, EVT_INFO,
+                          "Main header differs from the previous codestream\n");
+            return OPJ_FALSE;
+        }
+        l_offset += 4 + l_marker_size;
+    }
+
+    if (l_offset != l_dec->m_main_header_size) {
+        opj_event_msg(p_manager, EVT_INFO,
+                      "Main header differs from the previous codestream\n");
+        return OPJ_FALSE;
+    }
+
+    p_j2k->cstr_index->main_head_end = (OPJ_UINT32) opj_stream_tell(p_stream) - 2;
+
+    l_nb_tiles = p_j2k->m_cp.tw * p_j2k->m_cp.th;
+    for (i = 0; i < l_nb_tiles; ++i) {
+        /* the data of the previous codestream, if still there, is the */
+        /* buffer of the data of this one */
+        opj_j2k_tcp_data_release(p_j2k, &p_j2k->m_cp.tcps[i]);
+        if (p_j2k->cstr_index->tile_index) {
+            p_j2k->cstr_index->tile_index[i].nb_tps = 0;
+            p_j2k->cstr_index->tile_index[i].marknum = 0;
+        }
+    }
+    if (! opj_j2k_reset_tcps(p_j2k)) {
+        /* Drop what the previous codestream left in the tile parameters. */
+        /* The tile-compo parameters are overwritten by the copy below */
+        for (i = 0; i < l_nb_tiles; ++i) {
+            opj_tcp_t *l_tcp = &p_j2k->m_cp.tcps[i];
+            opj_tccp_t *l_tccps = l_tcp->tccps;
+
+            l_tcp->tccps = 00;
+            opj_j2k_tcp_destroy(l_tcp);
+            l_tcp->tccps = l_tccps;
+        }
+        if (! opj_j2k_copy_default_tcp(p_j2k)) {
+            return OPJ_FALSE;
+        }
+    }
+
+    p_j2k->m_current_tile_number = 0;
+    l_dec->m_state = J2K_STATE_TPHSOT;
+    l_dec->m_sot_length = 0;
+    l_dec->m_start_tile_x = 0;
+    l_dec->m_start_tile_y = 0;
+    l_dec->m_end_tile_x = p_j2k->m_cp.tw;
+    l_dec->m_end_tile_y = p_j2k->m_cp.th;
+    l_dec->m_tile_ind_to_dec = -1;
+    l_dec->m_last_sot_read_pos = 0;
+    l_dec->m_last_tile_part = 0;
+    l_dec->m_can_decode = 0;
+    l_dec->m_discard_tiles = 0;
+    l_dec->m_skip_data = 0;
+
+    if (*p_image) {
+        return opj_j2k_recycle_image(p_j2k, *p_image);
+    }
+
+    *p_image = opj_image_create0();
+    if (!(*p_image)) {
+        return OPJ_FALSE;
+    }
+
+    /* Copy codestream image information to the output image */
+    opj_copy_image_header(p_j2k->m_private_image, *p_image);
+
+    return OPJ_TRUE;
+}
+
+static OPJ_BOOL opj_j2k_recycle_image(opj_j2k_t *p_j2k, opj_image_t *p_image)
+{
+    opj_tcd_tile_t *l_tile = NULL;
+    OPJ_UINT32 compno;
+
+    if (p_j2k->m_output_image == NULL) {
+        p_j2k->m_output_image = opj_image_create0();
+        if (!(p_j2k->m_output_image)) {
+            return OPJ_FALSE;
+        }
+    }
+    if (p_j2k->m_output_image->numcomps != p_image->numcomps) {
+        opj_copy_image_header(p_image, p_j2k->m_output_image);
+        if (p_j2k->m_output_image->numcomps != p_image->numcomps) {
+            return OPJ_FALSE;
+        }
+    }
+
+    if (p_j2k->m_cp.tw == 1 && p_j2k->m_cp.th == 1 &&
+            p_j2k->m_tcd->tcd_image->tiles->numcomps == p_image->numcomps) {
+        l_tile = p_j2k->m_tcd->tcd_image->tiles;
+    }
+
+    /* A single tile is decoded in place of the buffer that ends up in the */
+    /* image, other buffers are kept by the output image, which is copied */
+    /* into tile by tile */
+    for (compno = 0; compno < p_image->numcomps; compno++) {
+        opj_image_comp_t *l_comp = &(p_image->comps[compno]);
+        opj_image_comp_t *l_out_comp = &(p_j2k->m_output_image->comps[compno]);
+
+        if (l_comp->data == NULL) {
+            continue;
+        }
+        if (l_tile && l_tile->comps[compno].data == NULL &&
+                l_tile->comps[compno].data_size_needed ==
+                (OPJ_SIZE_T)l_comp->w * l_comp->h * sizeof(OPJ_INT32)) {
+            opj_tcd_tilecomp_t *l_tilec = &(l_tile->comps[compno]);
+
+            l_tilec->data = l_comp->data;
+            l_tilec->data_size = l_tilec->data_size_needed;
+            l_tilec->ownsData = OPJ_TRUE;
+        } else {
+            opj_image_data_free(l_out_comp->data);
+            l_out_comp->w = l_comp->w;
+            l_out_comp->h = l_comp->h;
+            l_out_comp->data = l_comp->data;
+        }
+        l_comp->data = NULL;
+    }
+
+    /* Copy codestream image information to the output image */
+    opj_copy_image_header_keep_data(p_j2k->m_private_image, p_image);
+
+    return OPJ_TRUE;
+}
+
 /* FIXME DOC*/
 static OPJ_BOOL opj_j2k_copy_default_tcp_and_create_tcd(opj_j2k_t * p_j2k,
         opj_stream_private_t *p_stream,
         opj_event_mgr_t * p_manager
                                                        )
+{
+    /* preconditions */
+    assert(p_j2k != 00);
+    assert(p_stream != 00);
+    assert(p_manager != 00);
+
+    OPJ_UNUSED(p_stream);
+
+    if (! opj_j2k_copy_default_tcp(p_j2k)) {
+        return OPJ_FALSE;
+    }
+
+    /* Create the current tile decoder*/
+    p_j2k->m_tcd = opj_tcd_create(OPJ_TRUE);
+    if (! p_j2k->m_tcd) {
+        return OPJ_FALSE;
+    }
+
+    if (!opj_tcd_init(p_j2k->m_tcd, p_j2k->m_private_image, &(p_j2k->m_cp),
+                      p_j2k->m_tp)) {
+        opj_tcd_destroy(p_j2k->m_tcd);
+        p_j2k->m_tcd = 00;
+        opj_event_msg(p_manager, EVT_ERROR, "Cannot decode tile, memory error\n");
+        return OPJ_FALSE;
+    }
+
+    return OPJ_TRUE;
+}
+
+static OPJ_BOOL opj_j2k_reset_tcps(opj_j2k_t * p_j2k)
+{
+    opj_tcp_t * l_default_tcp = p_j2k->m_specific_param.m_decoder.m_default_tcp;
+    OPJ_UINT32 l_nb_tiles = p_j2k->m_cp.th * p_j2k->m_cp.tw;
+    OPJ_UINT32 l_tccp_size = p_j2k->m_private_image->numcomps * (OPJ_UINT32)sizeof(
+                                 opj_tccp_t);
+    OPJ_UINT32 i;
+
+    if (l_default_tcp->m_mct_decoding_matrix || l_default_tcp->m_nb_mct_records ||
+            l_default_tcp->m_nb_mcc_records) {
+        return OPJ_FALSE;
+    }
+    for (i = 0; i < l_nb_tiles; ++i) {
+        const opj_tcp_t * l_tcp = &p_j2k->m_cp.tcps[i];
+
+        if (l_tcp->ppt_markers || l_tcp->ppt_buffer || l_tcp->m_mct_coding_matrix ||
+                l_tcp->m_mct_decoding_matrix || l_tcp->m_nb_mct_records ||
+                l_tcp->m_nb_mcc_records || l_tcp->mct_norms || l_tcp->m_data ||
+                !l_tcp->m_mct_records || !l_tcp->m_mcc_records) {
+            return OPJ_FALSE;
+        }
+    }
+
+    for (i = 0; i < l_nb_tiles; ++i) {
+        opj_tcp_t * l_tcp = &p_j2k->m_cp.tcps[i];
+        opj_tccp_t * l_tccps = l_tcp->tccps;
+        opj_mct_data_t * l_mct_records = l_tcp->m_mct_records;
+        OPJ_UINT32 l_nb_max_mct_records = l_tcp->m_nb_max_mct_records;
+        opj_simple_mcc_decorrelation_data_t * l_mcc_records = l_tcp->m_mcc_records;
+        OPJ_UINT32 l_nb_max_mcc_records = l_tcp->m_nb_max_mcc_records;
+
+        /* as in opj_j2k_copy_default_tcp(), the records are all empty */
+        memcpy(l_tcp, l_default_tcp, sizeof(opj_tcp_t));
+        l_tcp->cod = 0;
+        l_tcp->ppt = 0;
+        l_tcp->ppt_data = 00;
+        l_tcp->m_current_tile_part_number = -1;
+        l_tcp->tccps = l_tccps;
+        l_tcp->m_mct_records = l_mct_records;
+        l_tcp->m_nb_max_mct_records = l_nb_max_mct_records;
+        l_tcp->m_mcc_records = l_mcc_records;
+        l_tcp->m_nb_max_mcc_records = l_nb_max_mcc_records;
+        memcpy(l_tccps, l_default_tcp->tccps, l_tccp_size);
+    }
+    return OPJ_TRUE;
+}
+
+static OPJ_BOOL opj_j2k_copy_default_tcp(opj_j2k_t * p_j2k)
 {
     opj_tcp_t * l_tcp = 00;
     opj_tcp_t * l_default_tcp = 00;
@@ -8117,10 +8625,6 @@ static OPJ_BOOL opj_j2k_copy_default_tcp_and_create_tcd(opj_j2k_t * p_j2k,
 
     /* preconditions */
     assert(p_j2k != 00);
-    assert(p_stream != 00);
-    assert(p_manager != 00);
-
-    OPJ_UNUSED(p_stream);
 
     l_image = p_j2k->m_private_image;
     l_nb_tiles = p_j2k->m_cp.th * p_j2k->m_cp.tw;
@@ -8231,19 +8735,6 @@ static OPJ_BOOL opj_j2k_copy_default_tcp_and_create_tcd(opj_j2k_t * p_j2k,
         ++l_tcp;
     }
 
-    /* Create the current tile decoder*/
-    p_j2k->m_tcd = opj_tcd_create(OPJ_TRUE);
-    if (! p_j2k->m_tcd) {
-        return OPJ_FALSE;
-    }
-
-    if (!opj_tcd_init(p_j2k->m_tcd, l_image, &(p_j2k->m_cp), p_j2k->m_tp)) {
-        opj_tcd_destroy(p_j2k->m_tcd);
-        p_j2k->m_tcd = 00;
-        opj_event_msg(p_manager, EVT_ERROR, "Cannot decode tile, memory error\n");
-        return OPJ_FALSE;
-    }
-
     return OPJ_TRUE;
 }
 
@@ -8279,10 +8770,23 @@ void opj_j2k_destroy(opj_j2k_t *p_j2k)
             p_j2k->m_specific_param.m_decoder.m_header_data_size = 0;
         }
 
+        opj_free(p_j2k->m_specific_param.m_decoder.m_main_header);
+        p_j2k->m_specific_param.m_decoder.m_main_header = 00;
+        p_j2k->m_specific_param.m_decoder.m_main_header_size = 0;
+        p_j2k->m_specific_param.m_decoder.m_main_header_max_size = 0;
+
+        opj_free(p_j2k->m_specific_param.m_decoder.m_spare_tile_data);
+        p_j2k->m_specific_param.m_decoder.m_spare_tile_data = 00;
+        p_j2k->m_specific_param.m_decoder.m_spare_tile_data_size = 0;
+
         opj_free(p_j2k->m_specific_param.m_decoder.m_comps_indices_to_decode);
         p_j2k->m_specific_param.m_decoder.m_comps_indices_to_decode = 00;
         p_j2k->m_specific_param.m_decoder.m_numcomps_to_decode = 0;
 
+        opj_free(p_j2k->m_specific_param.m_decoder.m_output_planes);
+        p_j2k->m_specific_param.m_decoder.m_output_planes = 00;
+        p_j2k->m_specific_param.m_decoder.m_nb_output_planes = 0;
+
     } else {
 
         if (p_j2k->m_specific_param.m_encoder.m_encoded_tile_data) {
@@ -8442,12 +8946,37 @@ static void opj_j2k_tcp_destroy(opj_tcp_t *p_tcp)
 static void opj_j2k_tcp_data_destroy(opj_tcp_t *p_tcp)
 {
     if (p_tcp->m_data) {
-        opj_free(p_tcp->m_data);
+        /* m_data_max_size is 0 for data read in place from a memory stream */
+        if (p_tcp->m_data_max_size) {
+            opj_free(p_tcp->m_data);
+        }
         p_tcp->m_data = NULL;
         p_tcp->m_data_size = 0;
+        p_tcp->m_data_max_size = 0;
     }
 }
 
+static void opj_j2k_tcp_data_release(opj_j2k_t *p_j2k, opj_tcp_t *p_tcp)
+{
+    opj_j2k_dec_t * l_dec = &p_j2k->m_specific_param.m_decoder;
+
+    if (p_tcp->m_data == NULL) {
+        return;
+    }
+    /* keep the biggest buffer. m_data_max_size is 0 for data read in */
+    /* place from a memory stream, which is not ours */
+    if (p_tcp->m_data_max_size > l_dec->m_spare_tile_data_size) {
+        opj_free(l_dec->m_spare_tile_data);
+        l_dec->m_spare_tile_data = p_tcp->m_data;
+        l_dec->m_spare_tile_data_size = p_tcp->m_data_max_size;
+    } else if (p_tcp->m_data_max_size) {
+        opj_free(p_tcp->m_data);
+    }
+    p_tcp->m_data = NULL;
+    p_tcp->m_data_size = 0;
+    p_tcp->m_data_max_size = 0;
+}
+
 static void opj_j2k_cp_destroy(opj_cp_t *p_cp)
 {
     OPJ_UINT32 l_nb_tiles;
@@ -8599,6 +9128,31 @@ static OPJ_BOOL opj_j2k_need_nb_tile_parts_correction(opj_stream_private_t
     return OPJ_TRUE;
 }
 
+static OPJ_BOOL opj_j2k_is_truncated_before(opj_j2k_t *p_j2k,
+        opj_stream_private_t *p_stream,
+        OPJ_UINT32 p_size,
+        opj_event_mgr_t * p_manager)
+{
+    OPJ_OFF_T l_bytes_left;
+
+    if (!p_j2k->m_cp.allow_truncation) {
+        return OPJ_FALSE;
+    }
+    l_bytes_left = opj_stream_get_number_byte_left(p_stream);
+    if ((OPJ_OFF_T)p_size <= l_bytes_left) {
+        return OPJ_FALSE;
+    }
+
+    opj_event_msg(p_manager, EVT_WARNING, "Codestream truncated\n");
+    if (l_bytes_left > 0) {
+        opj_stream_skip(p_stream, l_bytes_left, p_manager);
+    }
+    p_j2k->m_specific_param.m_decoder.m_state = J2K_STATE_NEOC;
+    /* The tile-part being read has no data, go on with the tiles that have */
+    p_j2k->m_specific_param.m_decoder.m_can_decode = 0;
+    return OPJ_TRUE;
+}
+
 OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
                                   OPJ_UINT32 * p_tile_index,
                                   OPJ_UINT32 * p_data_size,
@@ -8623,6 +9177,12 @@ OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
     if (p_j2k->m_specific_param.m_decoder.m_state == J2K_STATE_EOC) {
         l_current_marker = J2K_MS_EOC;
     }
+    /* A truncated codestream ended, go on with the tiles read so far */
+    else if (p_j2k->m_cp.allow_truncation &&
+             p_j2k->m_specific_param.m_decoder.m_state == J2K_STATE_NEOC &&
+             opj_stream_get_number_byte_left(p_stream) == 0) {
+        l_current_marker = J2K_MS_EOC;
+    }
     /* We need to encounter a SOT marker (a new tile-part header) */
     else if (p_j2k->m_specific_param.m_decoder.m_state != J2K_STATE_TPHSOT) {
         return OPJ_FALSE;
@@ -8639,6 +9199,9 @@ OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
                 p_j2k->m_specific_param.m_decoder.m_state = J2K_STATE_NEOC;
                 break;
             }
+            if (opj_j2k_is_truncated_before(p_j2k, p_stream, 2, p_manager)) {
+                break;
+            }
 
             /* Try to read 2 bytes (the marker size) from stream and copy them into the buffer */
             if (opj_stream_read_data(p_stream,
@@ -8681,6 +9244,10 @@ OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
             }
             /* FIXME manage case of unknown marker as in the main header ? */
 
+            if (opj_j2k_is_truncated_before(p_j2k, p_stream, l_marker_size, p_manager)) {
+                break;
+            }
+
             /* Check if the marker size is compatible with the header data size */
             if (l_marker_size > p_j2k->m_specific_param.m_decoder.m_header_data_size) {
                 OPJ_BYTE *new_header_data = NULL;
@@ -8745,6 +9312,10 @@ OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
             }
 
             if (p_j2k->m_specific_param.m_decoder.m_skip_data) {
+                if (opj_j2k_is_truncated_before(p_j2k, p_stream,
+                                                p_j2k->m_specific_param.m_decoder.m_sot_length, p_manager)) {
+                    break;
+                }
                 /* Skip the rest of the tile part header*/
                 if (opj_stream_skip(p_stream, p_j2k->m_specific_param.m_decoder.m_sot_length,
                                     p_manager) != p_j2k->m_specific_param.m_decoder.m_sot_length) {
@@ -8753,6 +9324,9 @@ OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
                 }
                 l_current_marker = J2K_MS_SOD; /* Normally we reached a SOD */
             } else {
+                if (opj_j2k_is_truncated_before(p_j2k, p_stream, 2, p_manager)) {
+                    break;
+                }
                 /* Try to read 2 bytes (the next marker ID) from stream and copy them into the buffer*/
                 if (opj_stream_read_data(p_stream,
                                          p_j2k->m_specific_param.m_decoder.m_header_data, 2, p_manager) != 2) {
@@ -8780,12 +9354,19 @@ OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
                 /* Issue 254 */
                 OPJ_BOOL l_correction_needed;
 
+                OPJ_OFF_T l_stream_pos = opj_stream_tell(p_stream);
+
                 p_j2k->m_specific_param.m_decoder.m_nb_tile_parts_correction_checked = 1;
                 if (!opj_j2k_need_nb_tile_parts_correction(p_stream,
                         p_j2k->m_current_tile_number, &l_correction_needed, p_manager)) {
-                    opj_event_msg(p_manager, EVT_ERROR,
-                                  "opj_j2k_apply_nb_tile_parts_correction error\n");
-                    return OPJ_FALSE;
+                    /* A truncated codestream can end inside the next SOT */
+                    if (!p_j2k->m_cp.allow_truncation ||
+                            !opj_stream_seek(p_stream, l_stream_pos, p_manager)) {
+                        opj_event_msg(p_manager, EVT_ERROR,
+                                      "opj_j2k_apply_nb_tile_parts_correction error\n");
+                        return OPJ_FALSE;
+                    }
+                    l_correction_needed = OPJ_FALSE;
                 }
                 if (l_correction_needed) {
                     OPJ_UINT32 l_nb_tiles = p_j2k->m_cp.tw * p_j2k->m_cp.th;
@@ -8804,6 +9385,14 @@ OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
                 }
             }
             if (! p_j2k->m_specific_param.m_decoder.m_can_decode) {
+                /* The stream ended inside this tile-part: decode the tile */
+                /* with what has been read so far */
+                if ((opj_stream_get_number_byte_left(p_stream) == 0
+                        && p_j2k->m_specific_param.m_decoder.m_state == J2K_STATE_NEOC) ||
+                        opj_j2k_is_truncated_before(p_j2k, p_stream, 2, p_manager)) {
+                    break;
+                }
+
                 /* Try to read 2 bytes (the next marker ID) from stream and copy them into the buffer */
                 if (opj_stream_read_data(p_stream,
                                          p_j2k->m_specific_param.m_decoder.m_header_data, 2, p_manager) != 2) {
@@ -8821,6 +9410,10 @@ OPJ_BOOL opj_j2k_read_tile_header(opj_j2k_t * p_j2k,
             p_j2k->m_specific_param.m_decoder.m_can_decode = 0;
             p_j2k->m_specific_param.m_decoder.m_state = J2K_STATE_TPHSOT;
 
+            if (opj_j2k_is_truncated_before(p_j2k, p_stream, 2, p_manager)) {
+                break;
+            }
+
             /* Try to read 2 bytes (the next marker ID) from stream and copy them into the buffer */
             if (opj_stream_read_data(p_stream,
                                      p_j2k->m_specific_param.m_decoder.m_header_data, 2, p_manager) != 2) {
@@ -8929,6 +9522,7 @@ OPJ_BOOL opj_j2k_decode_tile(opj_j2k_t * p_j2k,
     /* but full tile decoding is done */
     l_image_for_bounds = p_j2k->m_output_image ? p_j2k->m_output_image :
                          p_j2k->m_private_image;
+    p_j2k->m_tcd->src_in_place = (l_tcp->m_data_max_size == 0);
     if (! opj_tcd_decode_tile(p_j2k->m_tcd,
                               l_image_for_bounds->x0,
                               l_image_for_bounds->y0,
@@ -8958,7 +9552,7 @@ OPJ_BOOL opj_j2k_decode_tile(opj_j2k_t * p_j2k,
         * we destroy just the data which will be re-read in read_tile_header*/
         /*opj_j2k_tcp_destroy(l_tcp);
         p_j2k->m_tcd->tcp = 0;*/
-        opj_j2k_tcp_data_destroy(l_tcp);
+        opj_j2k_tcp_data_release(p_j2k, l_tcp);
     }
 
     p_j2k->m_specific_param.m_decoder.m_can_decode = 0;
@@ -8970,6 +9564,9 @@ OPJ_BOOL opj_j2k_decode_tile(opj_j2k_t * p_j2k,
     }
 
     if (p_j2k->m_specific_param.m_decoder.m_state != J2K_STATE_EOC) {
+        if (opj_j2k_is_truncated_before(p_j2k, p_stream, 2, p_manager)) {
+            return OPJ_TRUE;
+        }
         if (opj_stream_read_data(p_stream, l_data, 2, p_manager) != 2) {
             opj_event_msg(p_manager, EVT_ERROR, "Stream too short\n");
             return OPJ_FALSE;
@@ -8994,6 +9591,33 @@ OPJ_BOOL opj_j2k_decode_tile(opj_j2k_t * p_j2k,
     return OPJ_TRUE;
 }
 
+static OPJ_BOOL opj_j2k_alloc_missing_image_data(opj_image_t* p_output_image)
+{
+    OPJ_UINT32 compno;
+
+    for (compno = 0; compno < p_output_image->numcomps; compno++) {
+        opj_image_comp_t * l_img_comp = p_output_image->comps + compno;
+        OPJ_SIZE_T l_width = l_img_comp->w;
+        OPJ_SIZE_T l_height = l_img_comp->h;
+
+        if (l_img_comp->data != NULL) {
+            continue;
+        }
+        if ((l_height == 0U) || (l_width > (SIZE_MAX / l_height)) ||
+                l_width * l_height > SIZE_MAX / sizeof(OPJ_INT32)) {
+            /* would overflow */
+            return OPJ_FALSE;
+        }
+        l_img_comp->data = (OPJ_INT32*) opj_image_data_alloc(l_width * l_height *
+                           sizeof(OPJ_INT32));
+        if (! l_img_comp->data) {
+            return OPJ_FALSE;
+        }
+        memset(l_img_comp->data, 0, l_width * l_height * sizeof(OPJ_INT32));
+    }
+    return OPJ_TRUE;
+}
+
 static OPJ_BOOL opj_j2k_update_image_data(opj_tcd_t * p_tcd,
         opj_image_t* p_output_image)
 {
@@ -9314,6 +9938,90 @@ OPJ_BOOL opj_j2k_set_decoded_components(opj_j2k_t *p_j2k,
     return OPJ_TRUE;
 }
 
+OPJ_BOOL opj_j2k_set_decoded_planes(opj_j2k_t *p_j2k,
+                                    const opj_output_plane_t* planes,
+                                    OPJ_UINT32 numcomps,
+                                    opj_event_mgr_t * p_manager)
+{
+    OPJ_UINT32 i;
+
+    if (p_j2k->m_private_image == NULL) {
+        opj_event_msg(p_manager, EVT_ERROR,
+                      "opj_read_header() should be called before "
+                      "opj_set_decoded_planes().\n");
+        return OPJ_FALSE;
+    }
+
+    for (i = 0; i < numcomps; i++) {
+        if (planes[i].data == NULL ||
+                (planes[i].format != OPJ_PLANE_U16 &&
+                 planes[i].format != OPJ_PLANE_U16_MSB)) {
+            opj_event_msg(p_manager, EVT_ERROR,
+                          "Invalid output plane for component %u\n", i);
+            return OPJ_FALSE;
+        }
+    }
+
+    if (numcomps > p_j2k->m_specific_param.m_decoder.m_nb_output_planes) {
+        opj_output_plane_t* l_new_planes = (opj_output_plane_t*) opj_realloc(
+                                               p_j2k->m_specific_param.m_decoder.m_output_planes,
+                                               numcomps * sizeof(opj_output_plane_t));
+        if (l_new_planes == NULL) {
+            return OPJ_FALSE;
+        }
+        p_j2k->m_specific_param.m_decoder.m_output_planes = l_new_planes;
+    }
+    if (numcomps) {
+        memcpy(p_j2k->m_specific_param.m_decoder.m_output_planes, planes,
+               numcomps * sizeof(opj_output_plane_t));
+    }
+    p_j2k->m_specific_param.m_decoder.m_nb_output_planes = numcomps;
+
+    return OPJ_TRUE;
+}
+
+static OPJ_BOOL opj_j2k_check_output_planes(opj_j2k_t *p_j2k,
+        opj_event_mgr_t * p_manager)
+{
+    opj_image_t * l_image = p_j2k->m_output_image;
+    OPJ_UINT32 compno, j;
+
+    if (p_j2k->m_specific_param.m_decoder.m_numcomps_to_decode) {
+        opj_event_msg(p_manager, EVT_ERROR,
+                      "opj_set_decoded_planes() cannot be used together with "
+                      "opj_set_decoded_components().\n");
+        return OPJ_FALSE;
+    }
+    if (p_j2k->m_specific_param.m_decoder.m_nb_output_planes !=
+            l_image->numcomps) {
+        opj_event_msg(p_manager, EVT_ERROR,
+                      "%u output planes given for %u components\n",
+                      p_j2k->m_specific_param.m_decoder.m_nb_output_planes,
+                      l_image->numcomps);
+        return OPJ_FALSE;
+    }
+
+    for (compno = 0; compno < l_image->numcomps; compno++) {
+        const opj_output_plane_t * l_plane =
+            &(p_j2k->m_specific_param.m_decoder.m_output_planes[compno]);
+        const opj_image_comp_t * l_comp = &(l_image->comps[compno]);
+
+        if (l_comp->prec > 16) {
+            opj_event_msg(p_manager, EVT_ERROR,
+                          "Component %u has %u bits, more than its 16 bit "
+                          "output plane takes\n", compno, l_comp->prec);
+            return OPJ_FALSE;
+        }
+        if (p_j2k->m_cp.allow_truncation) {
+            for (j = 0; j < l_comp->h; j++) {
+                memset((OPJ_BYTE*)l_plane->data + j * l_plane->stride, 0,
+                       (OPJ_SIZE_T)l_comp->w * sizeof(OPJ_UINT16));
+            }
+        }
+    }
+
+    return OPJ_TRUE;
+}
 
 OPJ_BOOL opj_j2k_set_decode_area(opj_j2k_t *p_j2k,
                                  opj_image_t* p_image,
@@ -10651,6 +11359,9 @@ static OPJ_BOOL opj_j2k_decode_tiles(opj_j2k_t *p_j2k,
     OPJ_INT32 l_tile_x0, l_tile_y0, l_tile_x1, l_tile_y1;
     OPJ_UINT32 l_nb_comps;
     OPJ_UINT32 nr_tiles = 0;
+    OPJ_UINT32 i;
+    /* The TCD writes the samples to the output planes itself */
+    OPJ_BOOL l_planes = p_j2k->m_tcd->output_planes != NULL;
 
     /* Particular case for whole single tile decoding */
     /* We can avoid allocating intermediate tile buffers */
@@ -10660,7 +11371,6 @@ static OPJ_BOOL opj_j2k_decode_tiles(opj_j2k_t *p_j2k,
             p_j2k->m_output_image->y0 == 0 &&
             p_j2k->m_output_image->x1 == p_j2k->m_cp.tdx &&
             p_j2k->m_output_image->y1 == p_j2k->m_cp.tdy) {
-        OPJ_UINT32 i;
         if (! opj_j2k_read_tile_header(p_j2k,
                                        &l_current_tile_no,
                                        NULL,
@@ -10673,19 +11383,31 @@ static OPJ_BOOL opj_j2k_decode_tiles(opj_j2k_t *p_j2k,
             return OPJ_FALSE;
         }
 
+        if (! l_go_on && p_j2k->m_cp.allow_truncation) {
+            /* Truncated before any tile data */
+            if (l_planes) {
+                return OPJ_TRUE;
+            }
+            return opj_j2k_alloc_missing_image_data(p_j2k->m_output_image);
+        }
+
         if (! opj_j2k_decode_tile(p_j2k, l_current_tile_no, NULL, 0,
                                   p_stream, p_manager)) {
             opj_event_msg(p_manager, EVT_ERROR, "Failed to decode tile 1/1\n");
             return OPJ_FALSE;
         }
 
-        /* Transfer TCD data to output image data */
+        /* Transfer TCD data to output image data. With output planes the */
+        /* tile data stays with the TCD for the next codestream */
         for (i = 0; i < p_j2k->m_output_image->numcomps; i++) {
+            p_j2k->m_output_image->comps[i].resno_decoded =
+                p_j2k->m_tcd->image->comps[i].resno_decoded;
+            if (l_planes) {
+                continue;
+            }
             opj_image_data_free(p_j2k->m_output_image->comps[i].data);
             p_j2k->m_output_image->comps[i].data =
                 p_j2k->m_tcd->tcd_image->tiles->comps[i].data;
-            p_j2k->m_output_image->comps[i].resno_decoded =
-                p_j2k->m_tcd->image->comps[i].resno_decoded;
             p_j2k->m_tcd->tcd_image->tiles->comps[i].data = NULL;
         }
 
@@ -10726,8 +11448,13 @@ static OPJ_BOOL opj_j2k_decode_tiles(opj_j2k_t *p_j2k,
         opj_event_msg(p_manager, EVT_INFO, "Tile %d/%d has been decoded.\n",
                       l_current_tile_no + 1, p_j2k->m_cp.th * p_j2k->m_cp.tw);
 
-        if (! opj_j2k_update_image_data(p_j2k->m_tcd,
-                                        p_j2k->m_output_image)) {
+        if (l_planes) {
+            for (i = 0; i < p_j2k->m_output_image->numcomps; i++) {
+                p_j2k->m_output_image->comps[i].resno_decoded =
+                    p_j2k->m_tcd->image->comps[i].resno_decoded;
+            }
+        } else if (! opj_j2k_update_image_data(p_j2k->m_tcd,
+                                               p_j2k->m_output_image)) {
             return OPJ_FALSE;
         }
 
@@ -10738,14 +11465,16 @@ static OPJ_BOOL opj_j2k_decode_tiles(opj_j2k_t *p_j2k,
                   p_j2k->m_output_image->y1 == p_j2k->m_private_image->y1)) {
             /* Keep current tcp data */
         } else {
-            opj_j2k_tcp_data_destroy(&p_j2k->m_cp.tcps[l_current_tile_no]);
+            opj_j2k_tcp_data_release(p_j2k, &p_j2k->m_cp.tcps[l_current_tile_no]);
         }
 
         opj_event_msg(p_manager, EVT_INFO,
                       "Image data has been updated with tile %d.\n\n", l_current_tile_no + 1);
 
+        /* With allow_truncation the other tiles read so far get decoded too */
         if (opj_stream_get_number_byte_left(p_stream) == 0
-                && p_j2k->m_specific_param.m_decoder.m_state == J2K_STATE_NEOC) {
+                && p_j2k->m_specific_param.m_decoder.m_state == J2K_STATE_NEOC
+                && !p_j2k->m_cp.allow_truncation) {
             break;
         }
         if (++nr_tiles ==  p_j2k->m_cp.th * p_j2k->m_cp.tw) {
@@ -10753,6 +11482,9 @@ static OPJ_BOOL opj_j2k_decode_tiles(opj_j2k_t *p_j2k,
         }
     }
 
+    if (p_j2k->m_cp.allow_truncation && !l_planes) {
+        return opj_j2k_alloc_missing_image_data(p_j2k->m_output_image);
+    }
     return OPJ_TRUE;
 }
 
@@ -10860,7 +11592,7 @@ static OPJ_BOOL opj_j2k_decode_one_tile(opj_j2k_t *p_j2k,
                                         p_j2k->m_output_image)) {
             return OPJ_FALSE;
         }
-        opj_j2k_tcp_data_destroy(&p_j2k->m_cp.tcps[l_current_tile_no]);
+        opj_j2k_tcp_data_release(p_j2k, &p_j2k->m_cp.tcps[l_current_tile_no]);
 
         opj_event_msg(p_manager, EVT_INFO,
                       "Image data has been updated with tile %d.\n\n", l_current_tile_no + 1);
@@ -10968,6 +11700,8 @@ OPJ_BOOL opj_j2k_decode(opj_j2k_t * p_j2k,
                         opj_image_t * p_image,
                         opj_event_mgr_t * p_manager)
 {
+    OPJ_BOOL l_ret;
+
     if (!p_image) {
         return OPJ_FALSE;
     }
@@ -11003,7 +11737,28 @@ OPJ_BOOL opj_j2k_decode(opj_j2k_t * p_j2k,
             return OPJ_FALSE;
         }
     }
-    opj_copy_image_header(p_image, p_j2k->m_output_image);
+    /* Buffers handed back by opj_j2k_read_next_header() are kept */
+    opj_copy_image_header_keep_data(p_image, p_j2k->m_output_image);
+    if (p_j2k->m_specific_param.m_decoder.m_nb_output_planes) {
+        if (!opj_j2k_check_output_planes(p_j2k, p_manager)) {
+            return OPJ_FALSE;
+        }
+        p_j2k->m_tcd->output_planes =
+            p_j2k->m_specific_param.m_decoder.m_output_planes;
+        p_j2k->m_tcd->output_image = p_j2k->m_output_image;
+    } else if (p_j2k->m_cp.allow_truncation) {
+        OPJ_UINT32 compno;
+
+        /* Tiles missing from a truncated codestream must come out black, */
+        /* not with what the previous codestream left */
+        for (compno = 0; compno < p_j2k->m_output_image->numcomps; compno++) {
+            opj_image_comp_t *l_comp = &(p_j2k->m_output_image->comps[compno]);
+            if (l_comp->data) {
+                memset(l_comp->data, 0,
+                       (OPJ_SIZE_T)l_comp->w * l_comp->h * sizeof(OPJ_INT32));
+            }
+        }
+    }
 
     /* customization of the decoding */
     if (!opj_j2k_setup_decoding(p_j2k, p_manager)) {
@@ -11011,12 +11766,26 @@ OPJ_BOOL opj_j2k_decode(opj_j2k_t * p_j2k,
     }
 
     /* Decode the codestream */
-    if (! opj_j2k_exec(p_j2k, p_j2k->m_procedure_list, p_stream, p_manager)) {
+    l_ret = opj_j2k_exec(p_j2k, p_j2k->m_procedure_list, p_stream, p_manager);
+    p_j2k->m_tcd->output_planes = NULL;
+    p_j2k->m_tcd->output_image = NULL;
+    if (! l_ret) {
         opj_image_destroy(p_j2k->m_private_image);
         p_j2k->m_private_image = NULL;
         return OPJ_FALSE;
     }
 
+    if (p_j2k->m_specific_param.m_decoder.m_nb_output_planes) {
+        OPJ_UINT32 compno;
+
+        /* The samples are in the output planes */
+        for (compno = 0; compno < p_image->numcomps; compno++) {
+            p_image->comps[compno].resno_decoded =
+                p_j2k->m_output_image->comps[compno].resno_decoded;
+        }
+        return OPJ_TRUE;
+    }
+
     /* Move data and copy one information from codec to output image*/
     return opj_j2k_move_data_from_codec_to_output_image(p_j2k, p_image);
 }
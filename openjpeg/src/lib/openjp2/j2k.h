@@ -280,6 +280,8 @@ typedef struct opj_tcp {
     OPJ_BYTE *      m_data;
     /** size of data */
     OPJ_UINT32      m_data_size;
+    /** size of the m_data buffer, OPJ_COMMON_CBLK_DATA_EXTRA included */
+    OPJ_UINT32      m_data_max_size;
     /** encoding norms */
     OPJ_FLOAT64 *   mct_norms;
     /** the mct decoding matrix */
@@ -450,6 +452,8 @@ typedef struct opj_cp {
     OPJ_BITFIELD m_is_decoder : 1;
     /** whether different bit depth or sign per component is allowed. Decoder only for ow */
     OPJ_BITFIELD allow_different_bit_depth_sign : 1;
+    /** whether a truncated codestream is decoded as far as it goes. Decoder only */
+    OPJ_BITFIELD allow_truncation : 1;
     /* <<UniPG */
 } opj_cp_t;
 
@@ -486,6 +490,10 @@ typedef struct opj_j2k_dec {
     OPJ_UINT32   m_numcomps_to_decode;
     OPJ_UINT32  *m_comps_indices_to_decode;
 
+    /** Caller allocated planes opj_j2k_decode() writes to, one per component */
+    OPJ_UINT32   m_nb_output_planes;
+    opj_output_plane_t *m_output_planes;
+
     /** to tell that a tile can be decoded. */
     OPJ_BITFIELD m_can_decode : 1;
     OPJ_BITFIELD m_discard_tiles : 1;
@@ -494,6 +502,23 @@ typedef struct opj_j2k_dec {
     OPJ_BITFIELD m_nb_tile_parts_correction_checked : 1;
     OPJ_BITFIELD m_nb_tile_parts_correction : 1;
 
+    /**
+     * Marker segments of the last main header read, except TLM, PLM and COM
+     * which can differ from one codestream to the next. Used by
+     * opj_j2k_read_next_header() to check that a codestream can reuse it.
+     */
+    OPJ_BYTE  *m_main_header;
+    OPJ_UINT32 m_main_header_size;
+    OPJ_UINT32 m_main_header_max_size;
+
+    /**
+     * Tile data buffer of an already decoded tile, given to the next tile
+     * read so that decoding codestreams one after the other doesn't
+     * allocate it each time.
+     */
+    OPJ_BYTE  *m_spare_tile_data;
+    OPJ_UINT32 m_spare_tile_data_size;
+
 } opj_j2k_dec_t;
 
 typedef struct opj_j2k_enc {
@@ -607,6 +632,16 @@ void opj_j2k_setup_decoder(opj_j2k_t *j2k, opj_dparameters_t *parameters);
 
 OPJ_BOOL opj_j2k_set_threads(opj_j2k_t *j2k, OPJ_UINT32 num_threads);
 
+/**
+ * Runs the jobs of the decoder on the threads of a shared pool.
+ * Like opj_j2k_set_threads(), only possible before the tile decoder exists.
+ *
+ * @param j2k J2K decompressor handle
+ * @param shared pool created with opj_thread_pool_create()
+ * @return OPJ_TRUE in case of success.
+ */
+OPJ_BOOL opj_j2k_set_thread_pool(opj_j2k_t *j2k, opj_thread_pool_t *shared);
+
 /**
  * Creates a J2K compression structure
  *
@@ -638,6 +673,24 @@ OPJ_BOOL opj_j2k_end_decompress(opj_j2k_t *j2k,
                                 opj_stream_private_t *p_stream,
                                 opj_event_mgr_t * p_manager);
 
+/**
+ * Reads the main header of the next codestream of a sequence, reusing what
+ * was set up for the previous one (parsed main header, tile decoder, thread
+ * pool) when both main headers are the same.
+ *
+ * @param p_stream the stream to read data from.
+ * @param p_j2k the jpeg2000 codec, opj_j2k_read_header() must have succeeded.
+ * @param p_image the image structure initialized with the characteristics of encoded image.
+ * @param p_manager the user event manager.
+ *
+ * @return false if the main header differs or couldn't be read, the stream
+ * position is then undefined and the codec must not be used further.
+ */
+OPJ_BOOL opj_j2k_read_next_header(opj_stream_private_t *p_stream,
+                                  opj_j2k_t* p_j2k,
+                                  opj_image_t** p_image,
+                                  opj_event_mgr_t* p_manager);
+
 /**
  * Reads a jpeg2000 codestream header structure.
  *
@@ -726,6 +779,20 @@ OPJ_BOOL opj_j2k_set_decoded_components(opj_j2k_t *p_j2k,
                                         const OPJ_UINT32* comps_indices,
                                         opj_event_mgr_t * p_manager);
 
+/** Sets the caller allocated planes to decode into.
+ *
+ * @param p_j2k         the jpeg2000 codec.
+ * @param planes        Array of numcomps planes, in codestream order.
+ * @param numcomps      Number of planes, 0 to decode into the image again.
+ * @param p_manager     Event manager
+ *
+ * @return OPJ_TRUE in case of success.
+ */
+OPJ_BOOL opj_j2k_set_decoded_planes(opj_j2k_t *p_j2k,
+                                    const opj_output_plane_t* planes,
+                                    OPJ_UINT32 numcomps,
+                                    opj_event_mgr_t * p_manager);
+
 /**
  * Sets the given area to be decoded. This function should be called right after opj_read_header and before any tile header reading.
  *
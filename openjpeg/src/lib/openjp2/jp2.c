@@ -1606,7 +1606,8 @@ OPJ_BOOL opj_jp2_decode(opj_jp2_t *jp2,
         return OPJ_FALSE;
     }
 
-    if (jp2->j2k->m_specific_param.m_decoder.m_numcomps_to_decode) {
+    if (jp2->j2k->m_specific_param.m_decoder.m_numcomps_to_decode ||
+            jp2->j2k->m_specific_param.m_decoder.m_nb_output_planes) {
         /* Bypass all JP2 component transforms */
         return OPJ_TRUE;
     }
@@ -1902,6 +1903,11 @@ OPJ_BOOL opj_jp2_set_threads(opj_jp2_t *jp2, OPJ_UINT32 num_threads)
     return opj_j2k_set_threads(jp2->j2k, num_threads);
 }
 
+OPJ_BOOL opj_jp2_set_thread_pool(opj_jp2_t *jp2, opj_thread_pool_t *shared)
+{
+    return opj_j2k_set_thread_pool(jp2->j2k, shared);
+}
+
 /* ----------------------------------------------------------------------- */
 /* JP2 encoder interface                                             */
 /* ----------------------------------------------------------------------- */
@@ -3083,6 +3089,15 @@ OPJ_BOOL opj_jp2_set_decoded_components(opj_jp2_t *p_jp2,
                                           p_manager);
 }
 
+OPJ_BOOL opj_jp2_set_decoded_planes(opj_jp2_t *p_jp2,
+                                    const opj_output_plane_t* planes,
+                                    OPJ_UINT32 numcomps,
+                                    opj_event_mgr_t * p_manager)
+{
+    return opj_j2k_set_decoded_planes(p_jp2->j2k, planes, numcomps,
+                                      p_manager);
+}
+
 OPJ_BOOL opj_jp2_set_decode_area(opj_jp2_t *p_jp2,
                                  opj_image_t* p_image,
                                  OPJ_INT32 p_start_x, OPJ_INT32 p_start_y,
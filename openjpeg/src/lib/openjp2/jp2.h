@@ -243,6 +243,14 @@ void opj_jp2_setup_decoder(opj_jp2_t *jp2, opj_dparameters_t *parameters);
  */
 OPJ_BOOL opj_jp2_set_threads(opj_jp2_t *jp2, OPJ_UINT32 num_threads);
 
+/** Runs the jobs of the decompressor on a shared thread pool.
+ *
+ * @param jp2 JP2 decompressor handle
+ * @param shared pool created with opj_thread_pool_create()
+ * @return OPJ_TRUE in case of success.
+ */
+OPJ_BOOL opj_jp2_set_thread_pool(opj_jp2_t *jp2, opj_thread_pool_t *shared);
+
 /**
  * Decode an image from a JPEG-2000 file stream
  * @param jp2 JP2 decompressor handle
@@ -348,6 +356,21 @@ OPJ_BOOL opj_jp2_set_decoded_components(opj_jp2_t *jp2,
                                         const OPJ_UINT32* comps_indices,
                                         opj_event_mgr_t * p_manager);
 
+/**
+ * Sets the caller allocated planes to decode into.
+ *
+ * @param jp2 JP2 decompressor handle
+ * @param planes Array of numcomps planes, in codestream order.
+ * @param numcomps Number of planes, 0 to decode into the image.
+ * @param p_manager Event manager;
+ *
+ * @return OPJ_TRUE in case of success.
+ */
+OPJ_BOOL opj_jp2_set_decoded_planes(opj_jp2_t *jp2,
+                                    const opj_output_plane_t* planes,
+                                    OPJ_UINT32 numcomps,
+                                    opj_event_mgr_t * p_manager);
+
 /**
  * Reads a tile header.
  * @param  p_jp2         the jpeg2000 codec.
@@ -47,6 +47,14 @@
 #include <smmintrin.h>
 #endif
 
+/* The inverse MCT fused with the DC level shift picks an AVX2 kernel at */
+/* run time when the CPU has it, whatever the compiler flags */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__)) && !defined(OPJ_NO_MCT_DISPATCH)
+#define OPJ_MCT_DISPATCH
+#include <immintrin.h>
+#endif
+
 #include "opj_includes.h"
 
 /* <summary> */
@@ -440,6 +448,243 @@ void opj_mct_decode_real(
     }
 }
 
+/* OPJ_FALSE to leave everything to the separate passes */
+static OPJ_BOOL opj_mct_dc_shift_fused = OPJ_TRUE;
+
+#ifdef OPJ_MCT_DISPATCH
+
+static volatile OPJ_INT32 opj_mct_cpu_has_avx2 = -1;
+
+static OPJ_BOOL opj_mct_has_avx2(void)
+{
+    OPJ_INT32 has_avx2 = opj_mct_cpu_has_avx2;
+    if (has_avx2 < 0) {
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        opj_mct_cpu_has_avx2 = has_avx2;
+    }
+    return has_avx2 != 0;
+}
+
+/* <summary> */
+/* Inverse reversible MCT, DC level shift and clamping. */
+/* Same operations as opj_mct_decode() then opj_int_clamp() */
+/* </summary> */
+__attribute__((target("avx2")))
+static void opj_mct_decode_dc_shift_avx2(
+    OPJ_INT32* OPJ_RESTRICT c0,
+    OPJ_INT32* OPJ_RESTRICT c1,
+    OPJ_INT32* OPJ_RESTRICT c2,
+    OPJ_SIZE_T n,
+    const OPJ_INT32 shift[3],
+    const OPJ_INT32 min[3],
+    const OPJ_INT32 max[3])
+{
+    const __m256i vshift0 = _mm256_set1_epi32(shift[0]);
+    const __m256i vshift1 = _mm256_set1_epi32(shift[1]);
+    const __m256i vshift2 = _mm256_set1_epi32(shift[2]);
+    const __m256i vmin0 = _mm256_set1_epi32(min[0]);
+    const __m256i vmin1 = _mm256_set1_epi32(min[1]);
+    const __m256i vmin2 = _mm256_set1_epi32(min[2]);
+    const __m256i vmax0 = _mm256_set1_epi32(max[0]);
+    const __m256i vmax1 = _mm256_set1_epi32(max[1]);
+    const __m256i vmax2 = _mm256_set1_epi32(max[2]);
+    OPJ_SIZE_T i;
+
+    for (i = 0; i < (n & ~(OPJ_SIZE_T)7); i += 8) {
+        __m256i r, g, b;
+        __m256i y = _mm256_loadu_si256((const __m256i *) & (c0[i]));
+        __m256i u = _mm256_loadu_si256((const __m256i *) & (c1[i]));
+        __m256i v = _mm256_loadu_si256((const __m256i *) & (c2[i]));
+        g = _mm256_sub_epi32(y, _mm256_srai_epi32(_mm256_add_epi32(u, v), 2));
+        r = _mm256_add_epi32(v, g);
+        b = _mm256_add_epi32(u, g);
+        r = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(r, vshift0), vmin0),
+                             vmax0);
+        g = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(g, vshift1), vmin1),
+                             vmax1);
+        b = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(b, vshift2), vmin2),
+                             vmax2);
+        _mm256_storeu_si256((__m256i *) & (c0[i]), r);
+        _mm256_storeu_si256((__m256i *) & (c1[i]), g);
+        _mm256_storeu_si256((__m256i *) & (c2[i]), b);
+    }
+    for (; i < n; ++i) {
+        OPJ_INT32 y = c0[i];
+        OPJ_INT32 u = c1[i];
+        OPJ_INT32 v = c2[i];
+        OPJ_INT32 g = y - ((u + v) >> 2);
+        OPJ_INT32 r = v + g;
+        OPJ_INT32 b = u + g;
+        c0[i] = opj_int_clamp(r + shift[0], min[0], max[0]);
+        c1[i] = opj_int_clamp(g + shift[1], min[1], max[1]);
+        c2[i] = opj_int_clamp(b + shift[2], min[2], max[2]);
+    }
+}
+
+/* <summary> */
+/* Rounding, DC level shift and clamping of one irreversible sample, */
+/* as in opj_tcd_dc_level_shift_decode() */
+/* </summary> */
+static INLINE OPJ_INT32 opj_mct_dc_shift_real(OPJ_FLOAT32 value,
+        OPJ_INT32 shift,
+        OPJ_INT32 min,
+        OPJ_INT32 max)
+{
+    if (value > INT_MAX) {
+        return max;
+    } else if (value < INT_MIN) {
+        return min;
+    }
+    return (OPJ_INT32)opj_int64_clamp((OPJ_INT64)opj_lrintf(value) + shift,
+                                      min, max);
+}
+
+/* <summary> */
+/* Inverse irreversible MCT, rounding, DC level shift and clamping. */
+/* Same operations as opj_mct_decode_real() then opj_mct_dc_shift_real(): */
+/* as rounding keeps the order, clamping the float to [min - shift, */
+/* max - shift] before converting it gives the same integer */
+/* </summary> */
+__attribute__((target("avx2")))
+static void opj_mct_decode_real_dc_shift_avx2(
+    OPJ_FLOAT32* OPJ_RESTRICT c0,
+    OPJ_FLOAT32* OPJ_RESTRICT c1,
+    OPJ_FLOAT32* OPJ_RESTRICT c2,
+    OPJ_SIZE_T n,
+    const OPJ_INT32 shift[3],
+    const OPJ_INT32 min[3],
+    const OPJ_INT32 max[3])
+{
+    const __m256 vrv = _mm256_set1_ps(1.402f);
+    const __m256 vgu = _mm256_set1_ps(0.34413f);
+    const __m256 vgv = _mm256_set1_ps(0.71414f);
+    const __m256 vbu = _mm256_set1_ps(1.772f);
+    const __m256i vshift0 = _mm256_set1_epi32(shift[0]);
+    const __m256i vshift1 = _mm256_set1_epi32(shift[1]);
+    const __m256i vshift2 = _mm256_set1_epi32(shift[2]);
+    const __m256 vlo0 = _mm256_set1_ps((OPJ_FLOAT32)(min[0] - shift[0]));
+    const __m256 vlo1 = _mm256_set1_ps((OPJ_FLOAT32)(min[1] - shift[1]));
+    const __m256 vlo2 = _mm256_set1_ps((OPJ_FLOAT32)(min[2] - shift[2]));
+    const __m256 vhi0 = _mm256_set1_ps((OPJ_FLOAT32)(max[0] - shift[0]));
+    const __m256 vhi1 = _mm256_set1_ps((OPJ_FLOAT32)(max[1] - shift[1]));
+    const __m256 vhi2 = _mm256_set1_ps((OPJ_FLOAT32)(max[2] - shift[2]));
+    OPJ_INT32* OPJ_RESTRICT d0 = (OPJ_INT32*)c0;
+    OPJ_INT32* OPJ_RESTRICT d1 = (OPJ_INT32*)c1;
+    OPJ_INT32* OPJ_RESTRICT d2 = (OPJ_INT32*)c2;
+    OPJ_SIZE_T i;
+
+    for (i = 0; i < (n & ~(OPJ_SIZE_T)7); i += 8) {
+        __m256 vy, vu, vv;
+        __m256 vr, vg, vb;
+
+        vy = _mm256_loadu_ps(c0 + i);
+        vu = _mm256_loadu_ps(c1 + i);
+        vv = _mm256_loadu_ps(c2 + i);
+        vr = _mm256_add_ps(vy, _mm256_mul_ps(vv, vrv));
+        vg = _mm256_sub_ps(_mm256_sub_ps(vy, _mm256_mul_ps(vu, vgu)),
+                           _mm256_mul_ps(vv, vgv));
+        vb = _mm256_add_ps(vy, _mm256_mul_ps(vu, vbu));
+        /* max first, so that a NaN ends up at min as with opj_lrintf() */
+        vr = _mm256_min_ps(_mm256_max_ps(vr, vlo0), vhi0);
+        vg = _mm256_min_ps(_mm256_max_ps(vg, vlo1), vhi1);
+        vb = _mm256_min_ps(_mm256_max_ps(vb, vlo2), vhi2);
+        _mm256_storeu_si256((__m256i *)(d0 + i),
+                            _mm256_add_epi32(_mm256_cvtps_epi32(vr), vshift0));
+        _mm256_storeu_si256((__m256i *)(d1 + i),
+                            _mm256_add_epi32(_mm256_cvtps_epi32(vg), vshift1));
+        _mm256_storeu_si256((__m256i *)(d2 + i),
+                            _mm256_add_epi32(_mm256_cvtps_epi32(vb), vshift2));
+    }
+    for (; i < n; ++i) {
+        OPJ_FLOAT32 y = c0[i];
+        OPJ_FLOAT32 u = c1[i];
+        OPJ_FLOAT32 v = c2[i];
+        OPJ_FLOAT32 r = y + (v * 1.402f);
+        OPJ_FLOAT32 g = y - (u * 0.34413f) - (v * (0.71414f));
+        OPJ_FLOAT32 b = y + (u * 1.772f);
+        d0[i] = opj_mct_dc_shift_real(r, shift[0], min[0], max[0]);
+        d1[i] = opj_mct_dc_shift_real(g, shift[1], min[1], max[1]);
+        d2[i] = opj_mct_dc_shift_real(b, shift[2], min[2], max[2]);
+    }
+}
+
+#endif /* OPJ_MCT_DISPATCH */
+
+void opj_mct_set_dc_shift_fused(OPJ_BOOL fused)
+{
+    opj_mct_dc_shift_fused = fused;
+}
+
+OPJ_BOOL opj_mct_get_dc_shift_fused(void)
+{
+#ifdef OPJ_MCT_DISPATCH
+    return opj_mct_dc_shift_fused && opj_mct_has_avx2();
+#else
+    return OPJ_FALSE;
+#endif
+}
+
+OPJ_BOOL opj_mct_decode_dc_shift(
+    OPJ_INT32* OPJ_RESTRICT c0,
+    OPJ_INT32* OPJ_RESTRICT c1,
+    OPJ_INT32* OPJ_RESTRICT c2,
+    OPJ_SIZE_T n,
+    const OPJ_INT32 shift[3],
+    const OPJ_INT32 min[3],
+    const OPJ_INT32 max[3])
+{
+#ifdef OPJ_MCT_DISPATCH
+    if (opj_mct_get_dc_shift_fused()) {
+        opj_mct_decode_dc_shift_avx2(c0, c1, c2, n, shift, min, max);
+        return OPJ_TRUE;
+    }
+#else
+    (void)c0;
+    (void)c1;
+    (void)c2;
+    (void)n;
+    (void)shift;
+    (void)min;
+    (void)max;
+#endif
+    return OPJ_FALSE;
+}
+
+OPJ_BOOL opj_mct_decode_real_dc_shift(
+    OPJ_FLOAT32* OPJ_RESTRICT c0,
+    OPJ_FLOAT32* OPJ_RESTRICT c1,
+    OPJ_FLOAT32* OPJ_RESTRICT c2,
+    OPJ_SIZE_T n,
+    const OPJ_INT32 shift[3],
+    const OPJ_INT32 min[3],
+    const OPJ_INT32 max[3])
+{
+#ifdef OPJ_MCT_DISPATCH
+    OPJ_UINT32 compno;
+    /* min - shift and max - shift must be exact as floats */
+    for (compno = 0; compno < 3; ++compno) {
+        if (min[compno] < -(1 << 23) || max[compno] > (1 << 23) ||
+                shift[compno] < -(1 << 23) || shift[compno] > (1 << 23)) {
+            return OPJ_FALSE;
+        }
+    }
+    if (opj_mct_get_dc_shift_fused()) {
+        opj_mct_decode_real_dc_shift_avx2(c0, c1, c2, n, shift, min, max);
+        return OPJ_TRUE;
+    }
+#else
+    (void)c0;
+    (void)c1;
+    (void)c2;
+    (void)n;
+    (void)shift;
+    (void)min;
+    (void)max;
+#endif
+    return OPJ_FALSE;
+}
+
 /* <summary> */
 /* Get norm of basis function of irreversible MCT. */
 /* </summary> */
@@ -97,6 +97,51 @@ Apply an irreversible multi-component inverse transform to an image
 void opj_mct_decode_real(OPJ_FLOAT32* OPJ_RESTRICT c0,
                          OPJ_FLOAT32* OPJ_RESTRICT c1, OPJ_FLOAT32* OPJ_RESTRICT c2, OPJ_SIZE_T n);
 /**
+Turn the fused passes of opj_mct_decode_dc_shift() and
+opj_mct_decode_real_dc_shift() off, so that the separate passes do the work
+whatever the CPU. Not thread-safe, meant for tests and benchmarks.
+@param fused OPJ_FALSE to turn them off, OPJ_TRUE to go by the CPU again
+*/
+void opj_mct_set_dc_shift_fused(OPJ_BOOL fused);
+
+/**
+Whether the fused passes are in use.
+@return OPJ_TRUE if the CPU has them and they are not turned off
+*/
+OPJ_BOOL opj_mct_get_dc_shift_fused(void);
+
+/**
+Apply a reversible multi-component inverse transform, then the DC level
+shift and clamping of each component, in a single pass. Only done when the
+CPU has AVX2, opj_mct_decode() then a separate DC level shift are the fallback.
+@param c0 Samples for luminance component
+@param c1 Samples for red chrominance component
+@param c2 Samples for blue chrominance component
+@param n Number of samples for each component
+@param shift DC level shift of each component
+@param min Lowest value of each component
+@param max Highest value of each component
+@return OPJ_FALSE if nothing was done
+*/
+OPJ_BOOL opj_mct_decode_dc_shift(OPJ_INT32* OPJ_RESTRICT c0,
+                                 OPJ_INT32* OPJ_RESTRICT c1, OPJ_INT32* OPJ_RESTRICT c2, OPJ_SIZE_T n,
+                                 const OPJ_INT32 shift[3], const OPJ_INT32 min[3], const OPJ_INT32 max[3]);
+/**
+Same as opj_mct_decode_dc_shift() for the irreversible transform: the float
+samples are rounded and replaced by the integer ones.
+@param c0 Samples for luminance component
+@param c1 Samples for red chrominance component
+@param c2 Samples for blue chrominance component
+@param n Number of samples for each component
+@param shift DC level shift of each component
+@param min Lowest value of each component
+@param max Highest value of each component
+@return OPJ_FALSE if nothing was done
+*/
+OPJ_BOOL opj_mct_decode_real_dc_shift(OPJ_FLOAT32* OPJ_RESTRICT c0,
+                                      OPJ_FLOAT32* OPJ_RESTRICT c1, OPJ_FLOAT32* OPJ_RESTRICT c2, OPJ_SIZE_T n,
+                                      const OPJ_INT32 shift[3], const OPJ_INT32 min[3], const OPJ_INT32 max[3]);
+/**
 Get norm of the basis function used for the irreversible multi-component transform
 @param compno Number of the component (0->Y, 1->U, 2->V)
 @return
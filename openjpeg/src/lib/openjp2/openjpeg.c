@@ -205,9 +205,35 @@ opj_stream_t* OPJ_CALLCONV opj_stream_create_buffer_stream (opj_buffer_info_t* p
 
     opj_stream_set_seek_function(ps, (opj_stream_seek_fn)opj_seek_from_buffer);
 
+    /* Input is read in place, the tile data pointing into psrc->buf */
+    if (input) {
+        opj_stream_set_memory((opj_stream_private_t*)ps, psrc->cur,
+                              (OPJ_UINT64)(psrc->buf + psrc->len - psrc->cur));
+    }
+
     return ps;
 }
 
+OPJ_BOOL OPJ_CALLCONV opj_stream_reset_buffer_stream(opj_stream_t* p_stream,
+        opj_buffer_info_t* psrc)
+{
+    opj_stream_private_t* l_stream = (opj_stream_private_t*) p_stream;
+
+    if (!l_stream || !psrc || !(l_stream->m_status & OPJ_STREAM_STATUS_INPUT)) {
+        return OPJ_FALSE;
+    }
+
+    l_stream->m_user_data = psrc;
+    l_stream->m_user_data_length = psrc->len;
+    l_stream->m_current_data = l_stream->m_stored_data;
+    l_stream->m_bytes_in_buffer = 0;
+    l_stream->m_byte_offset = 0;
+    l_stream->m_status = OPJ_STREAM_STATUS_INPUT;
+    opj_stream_set_memory(l_stream, psrc->cur,
+                          (OPJ_UINT64)(psrc->buf + psrc->len - psrc->cur));
+    return OPJ_TRUE;
+}
+
 /* ---------------------------------------------------------------------- */
 
 static OPJ_SIZE_T opj_read_from_file(void * p_buffer, OPJ_SIZE_T p_nb_bytes,
@@ -324,6 +350,12 @@ opj_codec_t* OPJ_CALLCONV opj_create_decompress(OPJ_CODEC_FORMAT p_format)
                          opj_image_t **,
                          struct opj_event_mgr *)) opj_j2k_read_header;
 
+        l_codec->m_codec_data.m_decompression.opj_read_next_header =
+            (OPJ_BOOL(*)(struct opj_stream_private *,
+                         void *,
+                         opj_image_t **,
+                         struct opj_event_mgr *)) opj_j2k_read_next_header;
+
         l_codec->m_codec_data.m_decompression.opj_destroy =
             (void (*)(void *))opj_j2k_destroy;
 
@@ -373,9 +405,19 @@ opj_codec_t* OPJ_CALLCONV opj_create_decompress(OPJ_CODEC_FORMAT p_format)
                          const OPJ_UINT32 * comps_indices,
                          struct opj_event_mgr * p_manager)) opj_j2k_set_decoded_components;
 
+        l_codec->m_codec_data.m_decompression.opj_set_decoded_planes =
+            (OPJ_BOOL(*)(void * p_codec,
+                         const opj_output_plane_t * planes,
+                         OPJ_UINT32 numcomps,
+                         struct opj_event_mgr * p_manager)) opj_j2k_set_decoded_planes;
+
         l_codec->opj_set_threads =
             (OPJ_BOOL(*)(void * p_codec, OPJ_UINT32 num_threads)) opj_j2k_set_threads;
 
+        l_codec->opj_set_thread_pool =
+            (OPJ_BOOL(*)(void * p_codec,
+                         opj_thread_pool_t * p_pool)) opj_j2k_set_thread_pool;
+
         l_codec->m_codec = opj_j2k_create_decompress();
 
         if (! l_codec->m_codec) {
@@ -461,9 +503,19 @@ opj_codec_t* OPJ_CALLCONV opj_create_decompress(OPJ_CODEC_FORMAT p_format)
                          const OPJ_UINT32 * comps_indices,
                          struct opj_event_mgr * p_manager)) opj_jp2_set_decoded_components;
 
+        l_codec->m_codec_data.m_decompression.opj_set_decoded_planes =
+            (OPJ_BOOL(*)(void * p_codec,
+                         const opj_output_plane_t * planes,
+                         OPJ_UINT32 numcomps,
+                         struct opj_event_mgr * p_manager)) opj_jp2_set_decoded_planes;
+
         l_codec->opj_set_threads =
             (OPJ_BOOL(*)(void * p_codec, OPJ_UINT32 num_threads)) opj_jp2_set_threads;
 
+        l_codec->opj_set_thread_pool =
+            (OPJ_BOOL(*)(void * p_codec,
+                         opj_thread_pool_t * p_pool)) opj_jp2_set_thread_pool;
+
         l_codec->m_codec = opj_jp2_create(OPJ_TRUE);
 
         if (! l_codec->m_codec) {
@@ -517,6 +569,132 @@ OPJ_BOOL OPJ_CALLCONV opj_codec_set_threads(opj_codec_t *p_codec,
     return OPJ_FALSE;
 }
 
+opj_shared_thread_pool_t OPJ_CALLCONV opj_create_shared_thread_pool(
+    int num_threads)
+{
+    if (!opj_has_thread_support() || num_threads <= 0) {
+        return NULL;
+    }
+    return (opj_shared_thread_pool_t)opj_thread_pool_create(num_threads);
+}
+
+void OPJ_CALLCONV opj_destroy_shared_thread_pool(opj_shared_thread_pool_t
+        p_pool)
+{
+    opj_thread_pool_destroy((opj_thread_pool_t *)p_pool);
+}
+
+OPJ_BOOL OPJ_CALLCONV opj_codec_set_shared_thread_pool(opj_codec_t *p_codec,
+        opj_shared_thread_pool_t p_pool)
+{
+    if (p_codec && p_pool) {
+        opj_codec_private_t * l_codec = (opj_codec_private_t *) p_codec;
+
+        if (! l_codec->opj_set_thread_pool) {
+            return OPJ_FALSE;
+        }
+        return l_codec->opj_set_thread_pool(l_codec->m_codec,
+                                            (opj_thread_pool_t *)p_pool);
+    }
+    return OPJ_FALSE;
+}
+
+/* opj_job_group_run() items, one per index */
+typedef struct opj_job_group_item {
+    void (*m_function)(void *p_data, int p_index);
+    void *m_data;
+    int m_index;
+} opj_job_group_item_t;
+
+typedef struct opj_job_group {
+    /* client of the shared pool */
+    opj_thread_pool_t *m_tp;
+    /* grown as needed, kept from one run to the next */
+    opj_job_group_item_t *m_items;
+    int m_items_size;
+} opj_job_group_private_t;
+
+static void opj_job_group_run_item(void *user_data, opj_tls_t *tls)
+{
+    opj_job_group_item_t *l_item = (opj_job_group_item_t *)user_data;
+
+    (void)tls;
+    l_item->m_function(l_item->m_data, l_item->m_index);
+}
+
+opj_job_group_t OPJ_CALLCONV opj_create_job_group(opj_shared_thread_pool_t
+        p_pool)
+{
+    opj_job_group_private_t *l_group;
+
+    l_group = (opj_job_group_private_t *)opj_calloc(1,
+              sizeof(opj_job_group_private_t));
+    if (! l_group) {
+        return NULL;
+    }
+    if (p_pool) {
+        l_group->m_tp = opj_thread_pool_create_client((opj_thread_pool_t *)p_pool);
+    } else {
+        l_group->m_tp = opj_thread_pool_create(0);
+    }
+    if (! l_group->m_tp) {
+        opj_free(l_group);
+        return NULL;
+    }
+    return (opj_job_group_t)l_group;
+}
+
+OPJ_BOOL OPJ_CALLCONV opj_job_group_run(opj_job_group_t p_group,
+                                        void (*p_function)(void *p_data, int p_index),
+                                        void *p_data,
+                                        int p_count)
+{
+    opj_job_group_private_t *l_group = (opj_job_group_private_t *)p_group;
+    OPJ_BOOL l_ret = OPJ_TRUE;
+    int i;
+
+    if (! l_group || ! p_function || p_count < 0) {
+        return OPJ_FALSE;
+    }
+    if (p_count > l_group->m_items_size) {
+        opj_job_group_item_t *l_items = (opj_job_group_item_t *)opj_realloc(
+                                            l_group->m_items, (size_t)p_count * sizeof(opj_job_group_item_t));
+        if (! l_items) {
+            return OPJ_FALSE;
+        }
+        l_group->m_items = l_items;
+        l_group->m_items_size = p_count;
+    }
+
+    for (i = 0; i < p_count; ++i) {
+        opj_job_group_item_t *l_item = &l_group->m_items[i];
+
+        l_item->m_function = p_function;
+        l_item->m_data = p_data;
+        l_item->m_index = i;
+        if (! opj_thread_pool_submit_job(l_group->m_tp, opj_job_group_run_item,
+                                         l_item)) {
+            /* the jobs submitted so far still have to finish */
+            l_ret = OPJ_FALSE;
+            break;
+        }
+    }
+    opj_thread_pool_wait_completion(l_group->m_tp, 0);
+    return l_ret;
+}
+
+void OPJ_CALLCONV opj_destroy_job_group(opj_job_group_t p_group)
+{
+    opj_job_group_private_t *l_group = (opj_job_group_private_t *)p_group;
+
+    if (! l_group) {
+        return;
+    }
+    opj_thread_pool_destroy(l_group->m_tp);
+    opj_free(l_group->m_items);
+    opj_free(l_group);
+}
+
 OPJ_BOOL OPJ_CALLCONV opj_setup_decoder(opj_codec_t *p_codec,
                                         opj_dparameters_t *parameters
                                        )
@@ -560,6 +738,32 @@ OPJ_BOOL OPJ_CALLCONV opj_read_header(opj_stream_t *p_stream,
     return OPJ_FALSE;
 }
 
+OPJ_BOOL OPJ_CALLCONV opj_read_next_header(opj_stream_t *p_stream,
+        opj_codec_t *p_codec,
+        opj_image_t **p_image)
+{
+    if (p_codec && p_stream) {
+        opj_codec_private_t* l_codec = (opj_codec_private_t*) p_codec;
+        opj_stream_private_t* l_stream = (opj_stream_private_t*) p_stream;
+
+        if (! l_codec->is_decompressor) {
+            opj_event_msg(&(l_codec->m_event_mgr), EVT_ERROR,
+                          "Codec provided to the opj_read_next_header function is not a decompressor handler.\n");
+            return OPJ_FALSE;
+        }
+
+        if (! l_codec->m_codec_data.m_decompression.opj_read_next_header) {
+            return OPJ_FALSE;
+        }
+
+        return l_codec->m_codec_data.m_decompression.opj_read_next_header(l_stream,
+                l_codec->m_codec,
+                p_image,
+                &(l_codec->m_event_mgr));
+    }
+
+    return OPJ_FALSE;
+}
 
 OPJ_BOOL OPJ_CALLCONV opj_set_decoded_components(opj_codec_t *p_codec,
         OPJ_UINT32 numcomps,
@@ -590,6 +794,28 @@ OPJ_BOOL OPJ_CALLCONV opj_set_decoded_components(opj_codec_t *p_codec,
     return OPJ_FALSE;
 }
 
+OPJ_BOOL OPJ_CALLCONV opj_set_decoded_planes(opj_codec_t *p_codec,
+        const opj_output_plane_t *planes,
+        OPJ_UINT32 numcomps)
+{
+    if (p_codec) {
+        opj_codec_private_t * l_codec = (opj_codec_private_t *) p_codec;
+
+        if (! l_codec->is_decompressor) {
+            opj_event_msg(&(l_codec->m_event_mgr), EVT_ERROR,
+                          "Codec provided to the opj_set_decoded_planes function is not a decompressor handler.\n");
+            return OPJ_FALSE;
+        }
+
+        return  l_codec->m_codec_data.m_decompression.opj_set_decoded_planes(
+                    l_codec->m_codec,
+                    planes,
+                    numcomps,
+                    &(l_codec->m_event_mgr));
+    }
+    return OPJ_FALSE;
+}
+
 OPJ_BOOL OPJ_CALLCONV opj_decode(opj_codec_t *p_codec,
                                  opj_stream_t *p_stream,
                                  opj_image_t* p_image)
@@ -1173,9 +1399,24 @@ opj_stream_t* OPJ_CALLCONV opj_stream_create_file_stream(
 }
 
 
+static opj_image_data_alloc_fn opj_image_data_alloc_func = 00;
+static opj_image_data_free_fn opj_image_data_free_func = 00;
+
+void OPJ_CALLCONV opj_set_image_data_allocator(opj_image_data_alloc_fn p_alloc,
+        opj_image_data_free_fn p_free)
+{
+    opj_image_data_alloc_func = p_alloc;
+    opj_image_data_free_func = p_free;
+}
+
 void* OPJ_CALLCONV opj_image_data_alloc(OPJ_SIZE_T size)
 {
-    void* ret = opj_aligned_malloc(size);
+    void* ret;
+    if (opj_image_data_alloc_func) {
+        ret = opj_image_data_alloc_func(size);
+    } else {
+        ret = opj_aligned_malloc(size);
+    }
     /* printf("opj_image_data_alloc %p\n", ret); */
     return ret;
 }
@@ -1183,5 +1424,9 @@ void* OPJ_CALLCONV opj_image_data_alloc(OPJ_SIZE_T size)
 void OPJ_CALLCONV opj_image_data_free(void* ptr)
 {
     /* printf("opj_image_data_free %p\n", ptr); */
-    opj_aligned_free(ptr);
+    if (opj_image_data_free_func) {
+        opj_image_data_free_func(ptr);
+    } else {
+        opj_aligned_free(ptr);
+    }
 }
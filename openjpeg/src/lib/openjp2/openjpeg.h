@@ -505,6 +505,9 @@ typedef struct opj_cparameters {
 
 #define OPJ_DPARAMETERS_IGNORE_PCLR_CMAP_CDEF_FLAG  0x0001
 #define OPJ_DPARAMETERS_DUMP_FLAG 0x0002
+/** Decode what is available of a codestream that was cut short (e.g. to a
+    byte budget) instead of failing on the truncated tile-part */
+#define OPJ_DPARAMETERS_ALLOW_TRUNCATION_FLAG 0x0004
 
 /**
  * Decompression parameters
@@ -582,6 +585,16 @@ typedef struct opj_buffer_info {
  * */
 typedef void * opj_codec_t;
 
+/**
+ * Worker threads shared by several codecs
+ * */
+typedef void * opj_shared_thread_pool_t;
+
+/**
+ * Application jobs run on a opj_shared_thread_pool_t
+ * */
+typedef void * opj_job_group_t;
+
 /*
 ==========================================================
    I/O stream typedef definitions
@@ -717,6 +730,26 @@ typedef struct opj_image_comptparm {
     OPJ_UINT32 sgnd;
 } opj_image_cmptparm_t;
 
+/**
+ * Sample layout of a plane given to opj_set_decoded_planes()
+ * */
+typedef enum PLANE_FORMAT {
+    OPJ_PLANE_U16 = 0,      /**< 16 bit, in the low prec bits */
+    OPJ_PLANE_U16_MSB = 1   /**< 16 bit, in the high prec bits */
+} OPJ_PLANE_FORMAT;
+
+/**
+ * Caller allocated output plane of one component, see opj_set_decoded_planes()
+ * */
+typedef struct opj_output_plane {
+    /** first sample of the component, at its x0/y0 in the image returned by opj_read_header() */
+    OPJ_UINT16 *data;
+    /** bytes from one row to the next */
+    OPJ_SIZE_T stride;
+    /** sample layout */
+    OPJ_PLANE_FORMAT format;
+} opj_output_plane_t;
+
 
 /*
 ==========================================================
@@ -1123,6 +1156,28 @@ OPJ_API void* OPJ_CALLCONV opj_image_data_alloc(OPJ_SIZE_T size);
 */
 OPJ_API void OPJ_CALLCONV opj_image_data_free(void* ptr);
 
+/** Allocator for opj_set_image_data_allocator() */
+typedef void* (*opj_image_data_alloc_fn)(OPJ_SIZE_T size);
+/** Destructor for opj_set_image_data_allocator() */
+typedef void (*opj_image_data_free_fn)(void* ptr);
+
+/**
+ * Replaces the allocator behind opj_image_data_alloc and
+ * opj_image_data_free, which the decoder uses for the component planes of
+ * the output image and its tile buffers. Meant for pools that keep these
+ * large buffers between images.
+ *
+ * The setting is process wide. Set it before any image data is allocated
+ * and keep it until all of it is freed. The functions are called from
+ * several threads at once, p_alloc must return memory aligned on at least
+ * 16 bytes.
+ *
+ * @param   p_alloc    allocator, NULL for the default one.
+ * @param   p_free     destructor, NULL for the default one.
+*/
+OPJ_API void OPJ_CALLCONV opj_set_image_data_allocator(
+    opj_image_data_alloc_fn p_alloc, opj_image_data_free_fn p_free);
+
 /*
 ==========================================================
    stream functions definitions
@@ -1227,10 +1282,35 @@ OPJ_API opj_stream_t* OPJ_CALLCONV opj_stream_create_file_stream(
     OPJ_SIZE_T p_buffer_size,
     OPJ_BOOL p_is_read_stream);
 
+/**
+ * Creates a stream on a buffer in memory.
+ *
+ * An input stream reads the codestream in place, from psrc->cur to the end
+ * of the buffer: the tile data is not copied, the decoder points into it.
+ * The buffer must therefore stay valid and unchanged until the codestream
+ * is decoded, and psrc->cur is not advanced.
+ *
+ * @param psrc      the buffer, kept by the stream. An output stream grows it.
+ * @param input     whether the stream is read from (true) or written to.
+ */
 OPJ_API opj_stream_t* OPJ_CALLCONV opj_stream_create_buffer_stream(
     opj_buffer_info_t *psrc,
     OPJ_BOOL input);
 
+/**
+ * Points an input stream from opj_stream_create_buffer_stream() at the next
+ * buffer (e.g. the next frame of a sequence), reading starts at psrc->cur.
+ * Lets the stream be reused instead of creating one per codestream.
+ *
+ * @param p_stream  the stream to reset.
+ * @param psrc      the buffer to read from, kept by the stream.
+ *
+ * @return OPJ_FALSE if p_stream is not an input stream.
+ */
+OPJ_API OPJ_BOOL OPJ_CALLCONV opj_stream_reset_buffer_stream(
+    opj_stream_t *p_stream,
+    opj_buffer_info_t *psrc);
+
 /*
 ==========================================================
    event manager functions definitions
@@ -1336,6 +1416,87 @@ OPJ_API OPJ_BOOL OPJ_CALLCONV opj_setup_decoder(opj_codec_t *p_codec,
 OPJ_API OPJ_BOOL OPJ_CALLCONV opj_codec_set_threads(opj_codec_t *p_codec,
         int num_threads);
 
+/**
+ * Creates worker threads that several codecs can share.
+ *
+ * The jobs of all the codecs attached with opj_codec_set_shared_thread_pool()
+ * and of all the job groups created on the pool go to one queue and are run
+ * in submission order. A codec waiting for its jobs, e.g. at the end of the
+ * code-block decoding of a tile or between DWT passes, runs queued jobs of
+ * the other codecs meanwhile, so that decoding several codestreams at the
+ * same time keeps the threads busy through the barriers of each of them.
+ *
+ * @param num_threads   number of threads, at least 1.
+ *
+ * @return the pool, or NULL if the library is built without thread support.
+ */
+OPJ_API opj_shared_thread_pool_t OPJ_CALLCONV opj_create_shared_thread_pool(
+    int num_threads);
+
+/**
+ * Releases a pool created with opj_create_shared_thread_pool(). Its threads
+ * stop once the codecs and job groups using it are destroyed as well.
+ *
+ * @param p_pool        the pool.
+ */
+OPJ_API void OPJ_CALLCONV opj_destroy_shared_thread_pool(
+    opj_shared_thread_pool_t p_pool);
+
+/**
+ * Runs the jobs of the codec on a shared thread pool instead of threads of
+ * its own. Like opj_codec_set_threads(), it must be called after
+ * opj_setup_decoder() and before opj_read_header(), and only has effect on
+ * the decompressor.
+ *
+ * @param p_codec       decompressor handler
+ * @param p_pool        pool created with opj_create_shared_thread_pool().
+ *
+ * @return OPJ_TRUE     if the decoder is correctly set
+ */
+OPJ_API OPJ_BOOL OPJ_CALLCONV opj_codec_set_shared_thread_pool(
+    opj_codec_t *p_codec,
+    opj_shared_thread_pool_t p_pool);
+
+/**
+ * Creates a group of application jobs that run on a shared thread pool,
+ * queued with the jobs of the codecs using the pool. With a NULL pool the
+ * jobs run in the calling thread.
+ *
+ * @param p_pool        pool created with opj_create_shared_thread_pool(),
+ *                      or NULL.
+ *
+ * @return the group, NULL in case of failure.
+ */
+OPJ_API opj_job_group_t OPJ_CALLCONV opj_create_job_group(
+    opj_shared_thread_pool_t p_pool);
+
+/**
+ * Runs p_function(p_data, i) for i from 0 to p_count - 1 on the threads of
+ * the pool, the calling thread running queued jobs as well, and returns once
+ * all of them returned. The functions must not wait on other jobs of the
+ * group; decoding with codecs on the same pool is fine, their waits run
+ * queued jobs too. A group runs one set of jobs at a time.
+ *
+ * @param p_group       group created with opj_create_job_group().
+ * @param p_function    function to run.
+ * @param p_data        first argument of the function.
+ * @param p_count       number of calls.
+ *
+ * @return OPJ_FALSE if not all the jobs could be queued. The ones queued
+ *         have returned nevertheless.
+ */
+OPJ_API OPJ_BOOL OPJ_CALLCONV opj_job_group_run(opj_job_group_t p_group,
+        void (*p_function)(void *p_data, int p_index),
+        void *p_data,
+        int p_count);
+
+/**
+ * Destroys a group created with opj_create_job_group().
+ *
+ * @param p_group       the group.
+ */
+OPJ_API void OPJ_CALLCONV opj_destroy_job_group(opj_job_group_t p_group);
+
 /**
  * Decodes an image header.
  *
@@ -1349,6 +1510,35 @@ OPJ_API OPJ_BOOL OPJ_CALLCONV opj_read_header(opj_stream_t *p_stream,
         opj_codec_t *p_codec,
         opj_image_t **p_image);
 
+/**
+ * Decodes the image header of the next codestream of a sequence (e.g. the
+ * frames of a track file) with a codec that already decoded a codestream.
+ *
+ * The main header is compared with the one of the previous codestream,
+ * ignoring TLM, PLM and COM markers. If they match, the parsed header, the
+ * tile decoder and the thread pool of the codec are reused, and decoding
+ * goes on as after opj_read_header(). Only supported for J2K codestreams.
+ *
+ * If *p_image is the image of the previous codestream, its component buffers
+ * are handed back to the codec and the image is updated in place, so that a
+ * sequence of codestreams with the same geometry is decoded without
+ * allocating. The component data of the previous image is not valid anymore
+ * after this call.
+ *
+ * @param   p_stream        the jpeg2000 stream of the next codestream.
+ * @param   p_codec         the jpeg2000 codec that decoded the previous codestream.
+ * @param   p_image         the image structure initialized with the characteristics of encoded image,
+ *                          or the image of the previous codestream to recycle.
+ *
+ * @return true             if the main header could be reused. Otherwise the
+ *                          codec and the stream position are in an undefined
+ *                          state, destroy the codec and use opj_read_header()
+ *                          with a new codec and stream.
+ */
+OPJ_API OPJ_BOOL OPJ_CALLCONV opj_read_next_header(opj_stream_t *p_stream,
+        opj_codec_t *p_codec,
+        opj_image_t **p_image);
+
 
 /** Restrict the number of components to decode.
  *
@@ -1380,6 +1570,34 @@ OPJ_API OPJ_BOOL OPJ_CALLCONV opj_set_decoded_components(opj_codec_t *p_codec,
         const OPJ_UINT32* comps_indices,
         OPJ_BOOL apply_color_transforms);
 
+/** Decode into caller allocated 16 bit planes instead of the image.
+ *
+ * This function should be called after opj_read_header() and before
+ * opj_decode(). The final samples are written from the tile buffers straight
+ * to the planes, the components of the image passed to opj_decode() get no
+ * data. Samples are clamped to [0, 2^prec - 1], so negative samples of
+ * signed components come out as 0. Components with a precision above 16 bits
+ * are rejected by opj_decode().
+ *
+ * The planes stay in use for the following codestreams read with
+ * opj_read_next_header() until this function is called again. JP2 palettes
+ * and channel definitions are not applied, and the function cannot be used
+ * together with opj_set_decoded_components(). With
+ * OPJ_DPARAMETERS_ALLOW_TRUNCATION_FLAG the areas a truncated codestream
+ * leaves out are set to 0.
+ *
+ * @param   p_codec         the jpeg2000 codec to read.
+ * @param   planes          Array of numcomps planes, one per component in
+ *                          codestream order. It is copied.
+ * @param   numcomps        Size of the planes array, 0 to decode into the
+ *                          image again.
+ *
+ * @return OPJ_TRUE         in case of success.
+ */
+OPJ_API OPJ_BOOL OPJ_CALLCONV opj_set_decoded_planes(opj_codec_t *p_codec,
+        const opj_output_plane_t *planes,
+        OPJ_UINT32 numcomps);
+
 /**
  * Sets the given area to be decoded. This function should be called right after opj_read_header and before any tile header reading.
  *
@@ -52,6 +52,12 @@ typedef struct opj_codec_private {
                                        opj_image_t **p_image,
                                        struct opj_event_mgr * p_manager);
 
+            /** Main header reading function handler reusing the previous header, NULL if not supported */
+            OPJ_BOOL(*opj_read_next_header)(struct opj_stream_private * cio,
+                                            void * p_codec,
+                                            opj_image_t **p_image,
+                                            struct opj_event_mgr * p_manager);
+
             /** Decoding function */
             OPJ_BOOL(*opj_decode)(void * p_codec,
                                   struct opj_stream_private * p_cio,
@@ -116,6 +122,12 @@ typedef struct opj_codec_private {
                                                   OPJ_UINT32 num_comps,
                                                   const OPJ_UINT32* comps_indices,
                                                   opj_event_mgr_t * p_manager);
+
+            /** Set the caller allocated output planes */
+            OPJ_BOOL(*opj_set_decoded_planes)(void * p_codec,
+                                              const opj_output_plane_t* planes,
+                                              OPJ_UINT32 num_comps,
+                                              opj_event_mgr_t * p_manager);
         } m_decompression;
 
         /**
@@ -163,6 +175,9 @@ typedef struct opj_codec_private {
 
     /** Set number of threads */
     OPJ_BOOL(*opj_set_threads)(void * p_codec, OPJ_UINT32 num_threads);
+
+    /** Run the jobs on the threads of a shared thread pool */
+    OPJ_BOOL(*opj_set_thread_pool)(void * p_codec, opj_thread_pool_t * p_pool);
 }
 opj_codec_private_t;
 
@@ -220,16 +220,49 @@ static OPJ_BOOL opj_pi_check_next_level(OPJ_INT32 pos,
                                         OPJ_UINT32 pino,
                                         const OPJ_CHAR *prog);
 
+/**
+ * Makes sure *p_memory holds at least p_size bytes, growing it with
+ * opj_realloc() otherwise. The content of the memory is kept.
+ *
+ * @param   p_memory        memory block, may point to NULL.
+ * @param   p_memory_size   size of the memory block.
+ * @param   p_size          size needed.
+ */
+static OPJ_BOOL opj_pi_reserve_memory(OPJ_BYTE **p_memory,
+                                      OPJ_SIZE_T *p_memory_size,
+                                      OPJ_SIZE_T p_size);
+
 /*@}*/
 
 /*@}*/
 
+/** Offsets inside the memory of opj_pi_create_decode() */
+#define OPJ_PI_ALIGN(size) (((size) + 15U) & ~(OPJ_SIZE_T)15U)
+
 /*
 ==========================================================
    local functions
 ==========================================================
 */
 
+static OPJ_BOOL opj_pi_reserve_memory(OPJ_BYTE **p_memory,
+                                      OPJ_SIZE_T *p_memory_size,
+                                      OPJ_SIZE_T p_size)
+{
+    OPJ_BYTE * l_new_memory;
+
+    if (p_size <= *p_memory_size) {
+        return OPJ_TRUE;
+    }
+    l_new_memory = (OPJ_BYTE *) opj_realloc(*p_memory, p_size);
+    if (!l_new_memory) {
+        return OPJ_FALSE;
+    }
+    *p_memory = l_new_memory;
+    *p_memory_size = p_size;
+    return OPJ_TRUE;
+}
+
 static void opj_pi_emit_error(opj_pi_iterator_t * pi, const char* msg)
 {
     (void)pi;
@@ -1352,7 +1385,9 @@ static OPJ_BOOL opj_pi_check_next_level(OPJ_INT32 pos,
 */
 opj_pi_iterator_t *opj_pi_create_decode(opj_image_t *p_image,
                                         opj_cp_t *p_cp,
-                                        OPJ_UINT32 p_tile_no)
+                                        OPJ_UINT32 p_tile_no,
+                                        OPJ_BYTE **p_memory,
+                                        OPJ_SIZE_T *p_memory_size)
 {
     OPJ_UINT32 numcomps = p_image->numcomps;
 
@@ -1373,6 +1408,12 @@ opj_pi_iterator_t *opj_pi_create_decode(opj_image_t *p_image,
     OPJ_UINT32 l_step_p, l_step_c, l_step_r, l_step_l ;
     OPJ_UINT32 l_data_stride;
 
+    /* layout of *p_memory */
+    OPJ_UINT32 l_nb_resolutions = 0;
+    OPJ_SIZE_T l_pi_offset, l_comps_offset, l_res_offset, l_include_offset;
+    OPJ_SIZE_T l_include_size;
+    opj_pi_resolution_t * l_resolutions;
+
     /* pointers */
     opj_pi_iterator_t *l_pi = 00;
     opj_tcp_t *l_tcp = 00;
@@ -1386,34 +1427,36 @@ opj_pi_iterator_t *opj_pi_create_decode(opj_image_t *p_image,
     assert(p_cp != 00);
     assert(p_image != 00);
     assert(p_tile_no < p_cp->tw * p_cp->th);
+    assert(p_memory != 00);
+    assert(p_memory_size != 00);
 
     /* initializations */
     l_tcp = &p_cp->tcps[p_tile_no];
     l_bound = l_tcp->numpocs + 1;
 
-    l_data_stride = 4 * OPJ_J2K_MAXRLVLS;
-    l_tmp_data = (OPJ_UINT32*)opj_malloc(
-                     l_data_stride * numcomps * sizeof(OPJ_UINT32));
-    if
-    (! l_tmp_data) {
-        return 00;
-    }
-    l_tmp_ptr = (OPJ_UINT32**)opj_malloc(
-                    numcomps * sizeof(OPJ_UINT32 *));
-    if
-    (! l_tmp_ptr) {
-        opj_free(l_tmp_data);
-        return 00;
+    for (compno = 0; compno < numcomps; ++compno) {
+        l_nb_resolutions += l_tcp->tccps[compno].numresolutions;
     }
 
-    /* memory allocation for pi */
-    l_pi = opj_pi_create(p_image, p_cp, p_tile_no);
-    if (!l_pi) {
-        opj_free(l_tmp_data);
-        opj_free(l_tmp_ptr);
+    /* The encoding parameters of the components come first, then the */
+    /* packet iterators, their components, resolutions and include array. */
+    /* Nothing is allocated when *p_memory is big enough */
+    l_data_stride = 4 * OPJ_J2K_MAXRLVLS;
+    l_pi_offset = OPJ_PI_ALIGN(numcomps * sizeof(OPJ_UINT32 *) +
+                               l_data_stride * numcomps * sizeof(OPJ_UINT32));
+    l_comps_offset = l_pi_offset + OPJ_PI_ALIGN(l_bound * sizeof(
+                         opj_pi_iterator_t));
+    l_res_offset = l_comps_offset + OPJ_PI_ALIGN((OPJ_SIZE_T)l_bound * numcomps *
+                   sizeof(opj_pi_comp_t));
+    l_include_offset = l_res_offset + OPJ_PI_ALIGN((OPJ_SIZE_T)l_bound *
+                       l_nb_resolutions * sizeof(opj_pi_resolution_t));
+    if (!opj_pi_reserve_memory(p_memory, p_memory_size, l_include_offset)) {
         return 00;
     }
 
+    l_tmp_ptr = (OPJ_UINT32**)(*p_memory);
+    l_tmp_data = (OPJ_UINT32*)(*p_memory + numcomps * sizeof(OPJ_UINT32 *));
+
     l_encoding_value_ptr = l_tmp_data;
     /* update pointer array */
     for
@@ -1431,26 +1474,54 @@ opj_pi_iterator_t *opj_pi_create_decode(opj_image_t *p_image,
     l_step_r = numcomps * l_step_c;
     l_step_l = l_max_res * l_step_r;
 
-    /* set values for first packet iterator */
-    l_current_pi = l_pi;
-
-    /* memory allocation for include */
+    /* memory for include */
     /* prevent an integer overflow issue */
     /* 0 < l_tcp->numlayers < 65536 c.f. opj_j2k_read_cod in j2k.c */
-    l_current_pi->include = 00;
-    if (l_step_l <= (UINT_MAX / (l_tcp->numlayers + 1U))) {
-        l_current_pi->include_size = (l_tcp->numlayers + 1U) * l_step_l;
-        l_current_pi->include = (OPJ_INT16*) opj_calloc(
-                                    l_current_pi->include_size, sizeof(OPJ_INT16));
+    if (l_step_l > (UINT_MAX / (l_tcp->numlayers + 1U))) {
+        return 00;
     }
-
-    if (!l_current_pi->include) {
-        opj_free(l_tmp_data);
-        opj_free(l_tmp_ptr);
-        opj_pi_destroy(l_pi, l_bound);
+    l_include_size = (l_tcp->numlayers + 1U) * l_step_l;
+    if (!opj_pi_reserve_memory(p_memory, p_memory_size,
+                               l_include_offset + l_include_size * sizeof(OPJ_INT16))) {
         return 00;
     }
 
+    /* the memory may have moved */
+    l_tmp_ptr = (OPJ_UINT32**)(*p_memory);
+    l_tmp_data = (OPJ_UINT32*)(*p_memory + numcomps * sizeof(OPJ_UINT32 *));
+    for (compno = 0; compno < numcomps; ++compno) {
+        l_tmp_ptr[compno] = l_tmp_data + compno * l_data_stride;
+    }
+
+    /* what opj_calloc() would have given */
+    memset(*p_memory + l_pi_offset, 0,
+           l_include_offset + l_include_size * sizeof(OPJ_INT16) - l_pi_offset);
+
+    l_pi = (opj_pi_iterator_t*)(*p_memory + l_pi_offset);
+    l_resolutions = (opj_pi_resolution_t*)(*p_memory + l_res_offset);
+    l_current_pi = l_pi;
+    for (pino = 0; pino < l_bound; ++pino) {
+        l_current_pi->comps = (opj_pi_comp_t*)(*p_memory + l_comps_offset) +
+                              pino * numcomps;
+        l_current_pi->numcomps = numcomps;
+
+        for (compno = 0; compno < numcomps; ++compno) {
+            opj_pi_comp_t *comp = &l_current_pi->comps[compno];
+
+            l_tccp = &l_tcp->tccps[compno];
+            comp->resolutions = l_resolutions;
+            comp->numresolutions = l_tccp->numresolutions;
+            l_resolutions += l_tccp->numresolutions;
+        }
+        ++l_current_pi;
+    }
+
+    /* set values for first packet iterator */
+    l_current_pi = l_pi;
+
+    l_current_pi->include = (OPJ_INT16*)(*p_memory + l_include_offset);
+    l_current_pi->include_size = (OPJ_UINT32)l_include_size;
+
     /* special treatment for the first packet iterator */
     l_current_comp = l_current_pi->comps;
     l_img_comp = p_image->comps;
@@ -1534,10 +1605,6 @@ opj_pi_iterator_t *opj_pi_create_decode(opj_image_t *p_image,
         l_current_pi->include_size = (l_current_pi - 1)->include_size;
         ++l_current_pi;
     }
-    opj_free(l_tmp_data);
-    l_tmp_data = 00;
-    opj_free(l_tmp_ptr);
-    l_tmp_ptr = 00;
     if
     (l_tcp->POC) {
         opj_pi_update_decode_poc(l_pi, l_tcp, l_max_prec, l_max_res);
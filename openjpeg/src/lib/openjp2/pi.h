@@ -161,12 +161,15 @@ Create a packet iterator for Decoder
 @param image Raw image for which the packets will be listed
 @param cp Coding parameters
 @param tileno Number that identifies the tile for which to list the packets
+@param p_memory Memory the packet iterator is created in, grown with opj_realloc() when too small. Give it again for the next tile and release it with opj_free(), not opj_pi_destroy()
+@param p_memory_size Size of *p_memory
 @return Returns a packet iterator that points to the first packet of the tile
-@see opj_pi_destroy
 */
 opj_pi_iterator_t *opj_pi_create_decode(opj_image_t * image,
                                         opj_cp_t * cp,
-                                        OPJ_UINT32 tileno);
+                                        OPJ_UINT32 tileno,
+                                        OPJ_BYTE ** p_memory,
+                                        OPJ_SIZE_T * p_memory_size);
 /**
  * Destroys a packet iterator array.
  *
@@ -1487,8 +1487,10 @@ static OPJ_BOOL opj_t1_allocate_buffers(
                 /* FIXME event manager error callback */
                 return OPJ_FALSE;
             }
+            /* only the capacity, so that smaller code-blocks don't */
+            /* shrink it and make the next bigger one reallocate */
+            t1->flagssize = flagssize;
         }
-        t1->flagssize = flagssize;
 
         memset(t1->flags, 0, flagssize * sizeof(opj_flag_t));
 
@@ -1630,7 +1632,6 @@ static void opj_t1_clbl_decode_processor(void* user_data, opj_tls_t* tls)
                 opj_mutex_unlock(job->p_manager_mutex);
             }
             *(job->pret) = OPJ_FALSE;
-            opj_free(job);
             return;
         }
         /* Zero-init required */
@@ -1651,7 +1652,6 @@ static void opj_t1_clbl_decode_processor(void* user_data, opj_tls_t* tls)
                           tilec->resolutions[tilec->minimum_num_resolutions - 1].x0);
 
     if (!*(job->pret)) {
-        opj_free(job);
         return;
     }
 
@@ -1672,7 +1672,6 @@ static void opj_t1_clbl_decode_processor(void* user_data, opj_tls_t* tls)
                 job->p_manager_mutex,
                 job->check_pterm)) {
         *(job->pret) = OPJ_FALSE;
-        opj_free(job);
         return;
     }
 
@@ -1786,11 +1785,46 @@ static void opj_t1_clbl_decode_processor(void* user_data, opj_tls_t* tls)
             tiledp += tile_w;
         }
     }
-
-    opj_free(job);
 }
 
 
+OPJ_BOOL opj_t1_allocate_decode_jobs(opj_tcd_t* tcd)
+{
+    opj_tcd_tile_t* tile = tcd->tcd_image->tiles;
+    OPJ_UINT32 compno, resno, bandno, precno;
+    OPJ_UINT32 count = 0;
+
+    for (compno = 0; compno < tile->numcomps; ++compno) {
+        opj_tcd_tilecomp_t* tilec = &tile->comps[compno];
+
+        for (resno = 0; resno < tilec->minimum_num_resolutions; ++resno) {
+            opj_tcd_resolution_t* res = &tilec->resolutions[resno];
+
+            for (bandno = 0; bandno < res->numbands; ++bandno) {
+                opj_tcd_band_t* band = &res->bands[bandno];
+
+                for (precno = 0; precno < res->pw * res->ph; ++precno) {
+                    opj_tcd_precinct_t* precinct = &band->precincts[precno];
+                    count += precinct->cw * precinct->ch;
+                }
+            }
+        }
+    }
+
+    tcd->t1_jobs_count = 0;
+    if (count > tcd->t1_jobs_max) {
+        opj_free(tcd->t1_jobs);
+        tcd->t1_jobs_max = 0;
+        tcd->t1_jobs = opj_malloc(count * sizeof(
+                                      opj_t1_cblk_decode_processing_job_t));
+        if (tcd->t1_jobs == NULL) {
+            return OPJ_FALSE;
+        }
+        tcd->t1_jobs_max = count;
+    }
+    return OPJ_TRUE;
+}
+
 void opj_t1_decode_cblks(opj_tcd_t* tcd,
                          volatile OPJ_BOOL* pret,
                          opj_tcd_tilecomp_t* tilec,
@@ -1881,12 +1915,11 @@ void opj_t1_decode_cblks(opj_tcd_t* tcd,
 #endif
                     }
 
-                    job = (opj_t1_cblk_decode_processing_job_t*) opj_calloc(1,
-                            sizeof(opj_t1_cblk_decode_processing_job_t));
-                    if (!job) {
-                        *pret = OPJ_FALSE;
-                        return;
-                    }
+                    /* jobs stay valid until the tile is decoded */
+                    assert(tcd->t1_jobs_count < tcd->t1_jobs_max);
+                    job = (opj_t1_cblk_decode_processing_job_t*) tcd->t1_jobs +
+                          tcd->t1_jobs_count++;
+                    memset(job, 0, sizeof(opj_t1_cblk_decode_processing_job_t));
                     job->whole_tile_decoding = tcd->whole_tile_decoding;
                     job->resno = resno;
                     job->cblk = cblk;
@@ -1897,7 +1930,8 @@ void opj_t1_decode_cblks(opj_tcd_t* tcd,
                     job->p_manager_mutex = p_manager_mutex;
                     job->p_manager = p_manager;
                     job->check_pterm = check_pterm;
-                    job->mustuse_cblkdatabuffer = opj_thread_pool_get_thread_count(tp) > 1;
+                    job->mustuse_cblkdatabuffer = tcd->src_in_place ||
+                                                  opj_thread_pool_get_thread_count(tp) > 1;
                     opj_thread_pool_submit_job(tp, opj_t1_clbl_decode_processor, job);
 #ifdef DEBUG_VERBOSE
                     codeblocks_decoded ++;
@@ -1968,6 +2002,8 @@ static OPJ_BOOL opj_t1_decode_cblk(opj_t1_t *t1,
     /* Even if we have a single chunk, in multi-threaded decoding */
     /* the insertion of our synthetic marker might potentially override */
     /* valid codestream of other codeblocks decoded in parallel. */
+    /* Tile data read in place from a memory stream is not ours to */
+    /* write to either. */
     if (cblk->numchunks > 1 || t1->mustuse_cblkdatabuffer) {
         OPJ_UINT32 i;
         OPJ_UINT32 cblk_len;
@@ -228,6 +228,14 @@ OPJ_BOOL opj_t1_encode_cblks(opj_t1_t *t1,
                              const OPJ_FLOAT64 * mct_norms,
                              OPJ_UINT32 mct_numcomps);
 
+/**
+Make room in the TCD handle for the decoding jobs of all the code-blocks
+of the current tile, opj_t1_decode_cblks() takes its jobs from there
+@param tcd TCD handle
+@return OPJ_FALSE if out of memory
+*/
+OPJ_BOOL opj_t1_allocate_decode_jobs(opj_tcd_t* tcd);
+
 /**
 Decode the code-blocks of a tile
 @param tcd TCD handle
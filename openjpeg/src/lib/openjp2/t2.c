@@ -387,7 +387,6 @@ OPJ_BOOL opj_t2_decode_packets(opj_tcd_t* tcd,
     opj_cp_t *l_cp = p_t2->cp;
     opj_tcp_t *l_tcp = &(p_t2->cp->tcps[p_tile_no]);
     OPJ_UINT32 l_nb_bytes_read;
-    OPJ_UINT32 l_nb_pocs = l_tcp->numpocs + 1;
     opj_pi_iterator_t *l_current_pi = 00;
 #ifdef TODO_MSD
     OPJ_UINT32 curtp = 0;
@@ -395,6 +394,7 @@ OPJ_BOOL opj_t2_decode_packets(opj_tcd_t* tcd,
 #endif
     opj_packet_info_t *l_pack_info = 00;
     opj_image_comp_t* l_img_comp = 00;
+    OPJ_BOOL l_truncated = OPJ_FALSE;
 
     OPJ_ARG_NOT_USED(p_cstr_index);
 
@@ -404,12 +404,23 @@ OPJ_BOOL opj_t2_decode_packets(opj_tcd_t* tcd,
     }
 #endif
 
-    /* create a packet iterator */
-    l_pi = opj_pi_create_decode(l_image, l_cp, p_tile_no);
+    /* create a packet iterator, in memory kept by the tile decoder */
+    l_pi = opj_pi_create_decode(l_image, l_cp, p_tile_no, &tcd->pi_memory,
+                                &tcd->pi_memory_size);
     if (!l_pi) {
         return OPJ_FALSE;
     }
 
+    if (tcd->first_pass_failed_size < l_image->numcomps) {
+        opj_free(tcd->first_pass_failed);
+        tcd->first_pass_failed_size = 0;
+        tcd->first_pass_failed = (OPJ_BOOL*)opj_malloc(l_image->numcomps * sizeof(
+                                     OPJ_BOOL));
+        if (!tcd->first_pass_failed) {
+            return OPJ_FALSE;
+        }
+        tcd->first_pass_failed_size = l_image->numcomps;
+    }
 
     l_current_pi = l_pi;
 
@@ -424,19 +435,22 @@ OPJ_BOOL opj_t2_decode_packets(opj_tcd_t* tcd,
 
         if (l_current_pi->poc.prg == OPJ_PROG_UNKNOWN) {
             /* TODO ADE : add an error */
-            opj_pi_destroy(l_pi, l_nb_pocs);
             return OPJ_FALSE;
         }
 
-        first_pass_failed = (OPJ_BOOL*)opj_malloc(l_image->numcomps * sizeof(OPJ_BOOL));
-        if (!first_pass_failed) {
-            opj_pi_destroy(l_pi, l_nb_pocs);
-            return OPJ_FALSE;
-        }
+        first_pass_failed = tcd->first_pass_failed;
         memset(first_pass_failed, OPJ_TRUE, l_image->numcomps * sizeof(OPJ_BOOL));
 
         while (opj_pi_next(l_current_pi)) {
             OPJ_BOOL skip_packet = OPJ_FALSE;
+
+            /* A truncated codestream ends here, the remaining packets */
+            /* are missing */
+            if (p_max_len == 0 && l_cp->allow_truncation) {
+                l_truncated = OPJ_TRUE;
+                break;
+            }
+
             JAS_FPRINTF(stderr,
                         "packet offset=00000166 prg=%d cmptno=%02d rlvlno=%02d prcno=%03d lyrno=%02d\n\n",
                         l_current_pi->poc.prg1, l_current_pi->compno, l_current_pi->resno,
@@ -490,8 +504,6 @@ OPJ_BOOL opj_t2_decode_packets(opj_tcd_t* tcd,
 
                 if (! opj_t2_decode_packet(p_t2, p_tile, l_tcp, l_current_pi, l_current_data,
                                            &l_nb_bytes_read, p_max_len, l_pack_info, p_manager)) {
-                    opj_pi_destroy(l_pi, l_nb_pocs);
-                    opj_free(first_pass_failed);
                     return OPJ_FALSE;
                 }
 
@@ -502,8 +514,6 @@ OPJ_BOOL opj_t2_decode_packets(opj_tcd_t* tcd,
                 l_nb_bytes_read = 0;
                 if (! opj_t2_skip_packet(p_t2, p_tile, l_tcp, l_current_pi, l_current_data,
                                          &l_nb_bytes_read, p_max_len, l_pack_info, p_manager)) {
-                    opj_pi_destroy(l_pi, l_nb_pocs);
-                    opj_free(first_pass_failed);
                     return OPJ_FALSE;
                 }
             }
@@ -549,8 +559,6 @@ OPJ_BOOL opj_t2_decode_packets(opj_tcd_t* tcd,
             /* << INDEX */
         }
         ++l_current_pi;
-
-        opj_free(first_pass_failed);
     }
     /* INDEX >> */
 #ifdef TODO_MSD
@@ -562,8 +570,16 @@ OPJ_BOOL opj_t2_decode_packets(opj_tcd_t* tcd,
 #endif
     /* << INDEX */
 
-    /* don't forget to release pi */
-    opj_pi_destroy(l_pi, l_nb_pocs);
+    /* Resolutions that were cut off are still decoded, at full size and */
+    /* without their missing packets */
+    if (l_truncated) {
+        OPJ_UINT32 compno;
+        for (compno = 0; compno < l_image->numcomps; ++compno) {
+            l_image->comps[compno].resno_decoded =
+                p_tile->comps[compno].minimum_num_resolutions - 1;
+        }
+    }
+
     *p_data_read = (OPJ_UINT32)(l_current_data - p_src);
     return OPJ_TRUE;
 }
@@ -1028,6 +1044,7 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
     OPJ_UINT32 * l_modified_length_ptr = 00;
     OPJ_BYTE *l_current_data = p_src_data;
     opj_cp_t *l_cp = p_t2->cp;
+    opj_bio_t l_bio_data;
     opj_bio_t *l_bio = 00;  /* BIO component */
     opj_tcd_band_t *l_band = 00;
     opj_tcd_cblk_dec_t* l_cblk = 00;
@@ -1091,10 +1108,8 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
     step 2: Return to codestream for decoding
     */
 
-    l_bio = opj_bio_create();
-    if (! l_bio) {
-        return OPJ_FALSE;
-    }
+    /* the bit reader only lives for this packet header */
+    l_bio = &l_bio_data;
 
     if (l_cp->ppm == 1) { /* PPM */
         l_header_data_start = &l_cp->ppm_data;
@@ -1120,7 +1135,6 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
         /* TODO MSD: no test to control the output of this function*/
         opj_bio_inalign(l_bio);
         l_header_data += opj_bio_numbytes(l_bio);
-        opj_bio_destroy(l_bio);
 
         /* EPH markers */
         if (p_tcp->csty & J2K_CP_CSTY_EPH) {
@@ -1205,7 +1219,6 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
 
             if (!l_cblk->numsegs) {
                 if (! opj_t2_init_seg(l_cblk, l_segno, p_tcp->tccps[p_pi->compno].cblksty, 1)) {
-                    opj_bio_destroy(l_bio);
                     return OPJ_FALSE;
                 }
             } else {
@@ -1213,7 +1226,6 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
                 if (l_cblk->segs[l_segno].numpasses == l_cblk->segs[l_segno].maxpasses) {
                     ++l_segno;
                     if (! opj_t2_init_seg(l_cblk, l_segno, p_tcp->tccps[p_pi->compno].cblksty, 0)) {
-                        opj_bio_destroy(l_bio);
                         return OPJ_FALSE;
                     }
                 }
@@ -1230,7 +1242,6 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
                     opj_event_msg(p_manager, EVT_ERROR,
                                   "Invalid bit number %d in opj_t2_read_packet_header()\n",
                                   bit_number);
-                    opj_bio_destroy(l_bio);
                     return OPJ_FALSE;
                 }
                 l_cblk->segs[l_segno].newlen = opj_bio_read(l_bio, bit_number);
@@ -1243,7 +1254,6 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
                     ++l_segno;
 
                     if (! opj_t2_init_seg(l_cblk, l_segno, p_tcp->tccps[p_pi->compno].cblksty, 0)) {
-                        opj_bio_destroy(l_bio);
                         return OPJ_FALSE;
                     }
                 }
@@ -1254,12 +1264,10 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
     }
 
     if (!opj_bio_inalign(l_bio)) {
-        opj_bio_destroy(l_bio);
         return OPJ_FALSE;
     }
 
     l_header_data += opj_bio_numbytes(l_bio);
-    opj_bio_destroy(l_bio);
 
     /* EPH markers */
     if (p_tcp->csty & J2K_CP_CSTY_EPH) {
@@ -1275,6 +1283,19 @@ static OPJ_BOOL opj_t2_read_packet_header(opj_t2_t* p_t2,
     }
 
     l_header_length = (OPJ_UINT32)(l_header_data - *l_header_data_start);
+    if (l_header_length > *l_modified_length_ptr) {
+        if (!l_cp->allow_truncation) {
+            opj_event_msg(p_manager, EVT_ERROR,
+                          "read: packet header too long (%d) with max (%d)\n",
+                          l_header_length, *l_modified_length_ptr);
+            return OPJ_FALSE;
+        }
+        /* The codestream ends inside this packet header: drop the packet */
+        /* and report all remaining data as read */
+        * p_is_data_present = OPJ_FALSE;
+        *p_data_read = p_max_length;
+        return OPJ_TRUE;
+    }
     JAS_FPRINTF(stderr, "hdrlen=%d \n", l_header_length);
     JAS_FPRINTF(stderr, "packet body\n");
     *l_modified_length_ptr -= l_header_length;
@@ -1311,7 +1332,6 @@ static OPJ_BOOL opj_t2_read_packet_data(opj_t2_t* p_t2,
     opj_tcd_resolution_t* l_res =
         &p_tile->comps[p_pi->compno].resolutions[p_pi->resno];
 
-    OPJ_ARG_NOT_USED(p_t2);
     OPJ_ARG_NOT_USED(pack_info);
 
     l_band = l_res->bands;
@@ -1352,6 +1372,12 @@ static OPJ_BOOL opj_t2_read_packet_data(opj_t2_t* p_t2,
                 if ((((OPJ_SIZE_T)l_current_data + (OPJ_SIZE_T)l_seg->newlen) <
                         (OPJ_SIZE_T)l_current_data) ||
                         (l_current_data + l_seg->newlen > p_src_data + p_max_length)) {
+                    if (p_t2->cp->allow_truncation) {
+                        /* The codestream ends inside this packet: keep the */
+                        /* code-blocks read so far and drop the rest */
+                        *p_data_read = p_max_length;
+                        return OPJ_TRUE;
+                    }
                     opj_event_msg(p_manager, EVT_ERROR,
                                   "read: segment too long (%d) with max (%d) for codeblock %d (p=%d, b=%d, r=%d, c=%d)\n",
                                   l_seg->newlen, p_max_length, cblkno, p_pi->precno, bandno, p_pi->resno,
@@ -1439,7 +1465,6 @@ static OPJ_BOOL opj_t2_skip_packet_data(opj_t2_t* p_t2,
     opj_tcd_resolution_t* l_res =
         &p_tile->comps[p_pi->compno].resolutions[p_pi->resno];
 
-    OPJ_ARG_NOT_USED(p_t2);
     OPJ_ARG_NOT_USED(pack_info);
 
     *p_data_read = 0;
@@ -1481,6 +1506,10 @@ static OPJ_BOOL opj_t2_skip_packet_data(opj_t2_t* p_t2,
                 /* Check possible overflow then size */
                 if (((*p_data_read + l_seg->newlen) < (*p_data_read)) ||
                         ((*p_data_read + l_seg->newlen) > p_max_length)) {
+                    if (p_t2->cp->allow_truncation) {
+                        *p_data_read = p_max_length;
+                        return OPJ_TRUE;
+                    }
                     opj_event_msg(p_manager, EVT_ERROR,
                                   "skip: segment too long (%d) with max (%d) for codeblock %d (p=%d, b=%d, r=%d, c=%d)\n",
                                   l_seg->newlen, p_max_length, cblkno, p_pi->precno, bandno, p_pi->resno,
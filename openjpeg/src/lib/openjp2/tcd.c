@@ -166,7 +166,20 @@ static OPJ_BOOL opj_tcd_dwt_decode(opj_tcd_t *p_tcd);
 static OPJ_BOOL opj_tcd_mct_decode(opj_tcd_t *p_tcd,
                                    opj_event_mgr_t *p_manager);
 
-static OPJ_BOOL opj_tcd_dc_level_shift_decode(opj_tcd_t *p_tcd);
+static OPJ_BOOL opj_tcd_dc_level_shift_decode(opj_tcd_t *p_tcd,
+        OPJ_UINT32 p_first_compno);
+
+static OPJ_BOOL opj_tcd_mct_dc_level_shift_decode(opj_tcd_t *p_tcd);
+
+static void opj_tcd_write_output_plane(opj_tcd_t *p_tcd,
+                                       OPJ_UINT32 compno,
+                                       const OPJ_INT32 *p_src,
+                                       OPJ_UINT32 p_src_stride,
+                                       OPJ_UINT32 p_x0, OPJ_UINT32 p_y0,
+                                       OPJ_UINT32 p_x1, OPJ_UINT32 p_y1,
+                                       OPJ_BOOL p_real,
+                                       OPJ_INT32 p_dc_level_shift,
+                                       OPJ_INT32 p_min, OPJ_INT32 p_max);
 
 
 static OPJ_BOOL opj_tcd_dc_level_shift_encode(opj_tcd_t *p_tcd);
@@ -682,6 +695,15 @@ void opj_tcd_destroy(opj_tcd_t *tcd)
 
         opj_free(tcd->used_component);
 
+        if (tcd->t1_manager_mutex) {
+            opj_mutex_destroy(tcd->t1_manager_mutex);
+        }
+        opj_free(tcd->t1_jobs);
+        opj_free(tcd->pi_memory);
+        opj_free(tcd->first_pass_failed);
+        opj_aligned_free(tcd->dwt_mem);
+        opj_free(tcd->dwt_jobs);
+
         opj_free(tcd);
     }
 }
@@ -1459,6 +1481,7 @@ OPJ_BOOL opj_tcd_decode_tile(opj_tcd_t *p_tcd,
 {
     OPJ_UINT32 l_data_read;
     OPJ_UINT32 compno;
+    OPJ_UINT32 l_first_compno = 0;
 
     p_tcd->tcd_tileno = p_tile_no;
     p_tcd->tcp = &(p_tcd->cp->tcps[p_tile_no]);
@@ -1679,7 +1702,10 @@ OPJ_BOOL opj_tcd_decode_tile(opj_tcd_t *p_tcd,
 
     /*----------------MCT-------------------*/
     /* FIXME _ProfStart(PGROUP_MCT); */
-    if
+    if (opj_tcd_mct_dc_level_shift_decode(p_tcd)) {
+        /* The first three components are done */
+        l_first_compno = 3;
+    } else if
     (! opj_tcd_mct_decode(p_tcd, p_manager)) {
         return OPJ_FALSE;
     }
@@ -1687,7 +1713,7 @@ OPJ_BOOL opj_tcd_decode_tile(opj_tcd_t *p_tcd,
 
     /* FIXME _ProfStart(PGROUP_DC_SHIFT); */
     if
-    (! opj_tcd_dc_level_shift_decode(p_tcd)) {
+    (! opj_tcd_dc_level_shift_decode(p_tcd, l_first_compno)) {
         return OPJ_FALSE;
     }
     /* FIXME _ProfStop(PGROUP_DC_SHIFT); */
@@ -1915,31 +1941,22 @@ static OPJ_BOOL opj_tcd_t2_decode(opj_tcd_t *p_tcd,
                                   opj_event_mgr_t *p_manager
                                  )
 {
-    opj_t2_t * l_t2;
-
-    l_t2 = opj_t2_create(p_tcd->image, p_tcd->cp);
-    if (l_t2 == 00) {
-        return OPJ_FALSE;
-    }
-
-    if (! opj_t2_decode_packets(
-                p_tcd,
-                l_t2,
-                p_tcd->tcd_tileno,
-                p_tcd->tcd_image->tiles,
-                p_src_data,
-                p_data_read,
-                p_max_src_size,
-                p_cstr_index,
-                p_manager)) {
-        opj_t2_destroy(l_t2);
-        return OPJ_FALSE;
-    }
-
-    opj_t2_destroy(l_t2);
-
-    /*---------------CLEAN-------------------*/
-    return OPJ_TRUE;
+    /* nothing to allocate for decoding, the T2 handle lives on the stack */
+    opj_t2_t l_t2;
+
+    l_t2.image = p_tcd->image;
+    l_t2.cp = p_tcd->cp;
+
+    return opj_t2_decode_packets(
+               p_tcd,
+               &l_t2,
+               p_tcd->tcd_tileno,
+               p_tcd->tcd_image->tiles,
+               p_src_data,
+               p_data_read,
+               p_max_src_size,
+               p_cstr_index,
+               p_manager);
 }
 
 static OPJ_BOOL opj_tcd_t1_decode(opj_tcd_t *p_tcd, opj_event_mgr_t *p_manager)
@@ -1952,7 +1969,16 @@ static OPJ_BOOL opj_tcd_t1_decode(opj_tcd_t *p_tcd, opj_event_mgr_t *p_manager)
     OPJ_BOOL check_pterm = OPJ_FALSE;
     opj_mutex_t* p_manager_mutex = NULL;
 
-    p_manager_mutex = opj_mutex_create();
+    if (p_tcd->t1_manager_mutex == NULL) {
+        p_tcd->t1_manager_mutex = opj_mutex_create();
+    }
+    p_manager_mutex = p_tcd->t1_manager_mutex;
+
+    if (!opj_t1_allocate_decode_jobs(p_tcd)) {
+        opj_event_msg(p_manager, EVT_ERROR,
+                      "Not enough memory for code-block decoding jobs\n");
+        return OPJ_FALSE;
+    }
 
     /* Only enable PTERM check if we decode all layers */
     if (p_tcd->tcp->num_layers_to_decode == p_tcd->tcp->numlayers &&
@@ -1974,9 +2000,6 @@ static OPJ_BOOL opj_tcd_t1_decode(opj_tcd_t *p_tcd, opj_event_mgr_t *p_manager)
     }
 
     opj_thread_pool_wait_completion(p_tcd->thread_pool, 0);
-    if (p_manager_mutex) {
-        opj_mutex_destroy(p_manager_mutex);
-    }
     return ret;
 }
 
@@ -2162,7 +2185,155 @@ static OPJ_BOOL opj_tcd_mct_decode(opj_tcd_t *p_tcd, opj_event_mgr_t *p_manager)
 }
 
 
-static OPJ_BOOL opj_tcd_dc_level_shift_decode(opj_tcd_t *p_tcd)
+/**
+ * Inverse MCT of the first three components fused with their DC level
+ * shift and clamping, for the common case of components of the same size
+ * with nothing to skip.
+ * @return OPJ_FALSE when opj_tcd_mct_decode() and
+ * opj_tcd_dc_level_shift_decode() have to do it instead.
+ */
+static OPJ_BOOL opj_tcd_mct_dc_level_shift_decode(opj_tcd_t *p_tcd)
+{
+    opj_tcd_tile_t * l_tile = p_tcd->tcd_image->tiles;
+    opj_tcp_t * l_tcp = p_tcd->tcp;
+    opj_image_comp_t * l_img_comp = p_tcd->image->comps;
+    OPJ_INT32 * l_data[3];
+    OPJ_INT32 l_shift[3], l_min[3], l_max[3];
+    OPJ_UINT32 l_width = 0, l_height = 0;
+    OPJ_UINT32 compno;
+
+    if (l_tcp->mct != 1 || l_tile->numcomps < 3 ||
+            p_tcd->used_component != NULL) {
+        return OPJ_FALSE;
+    }
+
+    for (compno = 0; compno < 3; ++compno) {
+        opj_tcd_tilecomp_t * l_tile_comp = &l_tile->comps[compno];
+        opj_tccp_t * l_tccp = &l_tcp->tccps[compno];
+        opj_tcd_resolution_t* l_res = l_tile_comp->resolutions +
+                                      l_img_comp[compno].resno_decoded;
+        OPJ_UINT32 l_comp_width, l_comp_height;
+
+        if (l_tccp->qmfbid != l_tcp->tccps[0].qmfbid ||
+                l_img_comp[compno].resno_decoded != l_img_comp[0].resno_decoded) {
+            return OPJ_FALSE;
+        }
+        if (p_tcd->whole_tile_decoding) {
+            /* No stride between the rows */
+            if (l_img_comp[compno].resno_decoded + 1 !=
+                    l_tile_comp->minimum_num_resolutions) {
+                return OPJ_FALSE;
+            }
+            l_comp_width = (OPJ_UINT32)(l_res->x1 - l_res->x0);
+            l_comp_height = (OPJ_UINT32)(l_res->y1 - l_res->y0);
+            l_data[compno] = l_tile_comp->data;
+        } else {
+            l_comp_width = l_res->win_x1 - l_res->win_x0;
+            l_comp_height = l_res->win_y1 - l_res->win_y0;
+            l_data[compno] = l_tile_comp->data_win;
+        }
+        if (compno == 0) {
+            l_width = l_comp_width;
+            l_height = l_comp_height;
+        } else if (l_comp_width != l_width || l_comp_height != l_height) {
+            return OPJ_FALSE;
+        }
+
+        l_shift[compno] = l_tccp->m_dc_level_shift;
+        if (l_img_comp[compno].sgnd) {
+            l_min[compno] = -(1 << (l_img_comp[compno].prec - 1));
+            l_max[compno] = (1 << (l_img_comp[compno].prec - 1)) - 1;
+        } else {
+            l_min[compno] = 0;
+            l_max[compno] = (OPJ_INT32)((1U << l_img_comp[compno].prec) - 1);
+        }
+    }
+
+    if (l_tcp->tccps[0].qmfbid == 1) {
+        return opj_mct_decode_dc_shift(l_data[0], l_data[1], l_data[2],
+                                       (OPJ_SIZE_T)l_width * l_height,
+                                       l_shift, l_min, l_max);
+    }
+    return opj_mct_decode_real_dc_shift((OPJ_FLOAT32*)l_data[0],
+                                        (OPJ_FLOAT32*)l_data[1],
+                                        (OPJ_FLOAT32*)l_data[2],
+                                        (OPJ_SIZE_T)l_width * l_height,
+                                        l_shift, l_min, l_max);
+}
+
+/**
+ * Writes the DC level shifted and clamped samples of the decoded area
+ * p_x0/p_y0/p_x1/p_y1 of a tile component, in resolution coordinates, to the
+ * part of its output plane it covers.
+ * @param p_real  whether p_src holds the floats of the 9-7 wavelet
+ */
+static void opj_tcd_write_output_plane(opj_tcd_t *p_tcd,
+                                       OPJ_UINT32 compno,
+                                       const OPJ_INT32 *p_src,
+                                       OPJ_UINT32 p_src_stride,
+                                       OPJ_UINT32 p_x0, OPJ_UINT32 p_y0,
+                                       OPJ_UINT32 p_x1, OPJ_UINT32 p_y1,
+                                       OPJ_BOOL p_real,
+                                       OPJ_INT32 p_dc_level_shift,
+                                       OPJ_INT32 p_min, OPJ_INT32 p_max)
+{
+    const opj_output_plane_t * l_plane = &(p_tcd->output_planes[compno]);
+    const opj_image_comp_t * l_comp = &(p_tcd->output_image->comps[compno]);
+    OPJ_UINT32 l_x0_dest = opj_uint_ceildivpow2(l_comp->x0, l_comp->factor);
+    OPJ_UINT32 l_y0_dest = opj_uint_ceildivpow2(l_comp->y0, l_comp->factor);
+    OPJ_UINT32 l_x0 = opj_uint_max(p_x0, l_x0_dest);
+    OPJ_UINT32 l_y0 = opj_uint_max(p_y0, l_y0_dest);
+    OPJ_UINT32 l_x1 = opj_uint_min(p_x1, l_x0_dest + l_comp->w);
+    OPJ_UINT32 l_y1 = opj_uint_min(p_y1, l_y0_dest + l_comp->h);
+    OPJ_UINT32 l_shift = (l_plane->format == OPJ_PLANE_U16_MSB) ?
+                         16 - l_comp->prec : 0;
+    OPJ_UINT32 i, j, l_width;
+    OPJ_UINT16 * l_dest;
+
+    if (l_x0 >= l_x1 || l_y0 >= l_y1) {
+        return;
+    }
+    l_width = l_x1 - l_x0;
+    p_src += (OPJ_SIZE_T)(l_y0 - p_y0) * p_src_stride + (l_x0 - p_x0);
+    l_dest = (OPJ_UINT16 *)((OPJ_BYTE *)l_plane->data +
+                            (OPJ_SIZE_T)(l_y0 - l_y0_dest) * l_plane->stride) +
+             (l_x0 - l_x0_dest);
+
+    /* Negative samples of signed components have no place in the plane */
+    p_min = opj_int_max(p_min, 0);
+
+    for (j = l_y0; j < l_y1; ++j) {
+        if (p_real) {
+            const OPJ_FLOAT32 * l_src = (const OPJ_FLOAT32 *) p_src;
+            for (i = 0; i < l_width; ++i) {
+                OPJ_FLOAT32 l_value = l_src[i];
+                OPJ_INT32 l_sample;
+                if (l_value > INT_MAX) {
+                    l_sample = p_max;
+                } else if (l_value < INT_MIN) {
+                    l_sample = p_min;
+                } else {
+                    /* Do addition on int64 to avoid overflows */
+                    OPJ_INT64 l_value_int = (OPJ_INT64)opj_lrintf(l_value);
+                    l_sample = (OPJ_INT32)opj_int64_clamp(
+                                   l_value_int + p_dc_level_shift, p_min, p_max);
+                }
+                l_dest[i] = (OPJ_UINT16)((OPJ_UINT32)l_sample << l_shift);
+            }
+        } else {
+            for (i = 0; i < l_width; ++i) {
+                OPJ_INT32 l_sample = opj_int_clamp(p_src[i] + p_dc_level_shift,
+                                                   p_min, p_max);
+                l_dest[i] = (OPJ_UINT16)((OPJ_UINT32)l_sample << l_shift);
+            }
+        }
+        p_src += p_src_stride;
+        l_dest = (OPJ_UINT16 *)((OPJ_BYTE *)l_dest + l_plane->stride);
+    }
+}
+
+static OPJ_BOOL opj_tcd_dc_level_shift_decode(opj_tcd_t *p_tcd,
+        OPJ_UINT32 p_first_compno)
 {
     OPJ_UINT32 compno;
     opj_tcd_tilecomp_t * l_tile_comp = 00;
@@ -2174,13 +2345,23 @@ static OPJ_BOOL opj_tcd_dc_level_shift_decode(opj_tcd_t *p_tcd)
     OPJ_INT32 * l_current_ptr;
     OPJ_INT32 l_min, l_max;
     OPJ_UINT32 l_stride;
+    OPJ_UINT32 l_x0, l_y0;
+    OPJ_UINT32 l_first_compno;
+
+    /* The components opj_tcd_mct_dc_level_shift_decode() did only have */
+    /* to be written to their output planes */
+    if (p_tcd->output_planes) {
+        l_first_compno = 0;
+    } else {
+        l_first_compno = p_first_compno;
+    }
 
     l_tile = p_tcd->tcd_image->tiles;
-    l_tile_comp = l_tile->comps;
-    l_tccp = p_tcd->tcp->tccps;
-    l_img_comp = p_tcd->image->comps;
+    l_tile_comp = l_tile->comps + l_first_compno;
+    l_tccp = p_tcd->tcp->tccps + l_first_compno;
+    l_img_comp = p_tcd->image->comps + l_first_compno;
 
-    for (compno = 0; compno < l_tile->numcomps;
+    for (compno = l_first_compno; compno < l_tile->numcomps;
             compno++, ++l_img_comp, ++l_tccp, ++l_tile_comp) {
 
         if (p_tcd->used_component != NULL && !p_tcd->used_component[compno]) {
@@ -2194,6 +2375,8 @@ static OPJ_BOOL opj_tcd_dc_level_shift_decode(opj_tcd_t *p_tcd)
             l_height = l_res->win_y1 - l_res->win_y0;
             l_stride = 0;
             l_current_ptr = l_tile_comp->data_win;
+            l_x0 = l_res->win_x0;
+            l_y0 = l_res->win_y0;
         } else {
             l_width = (OPJ_UINT32)(l_res->x1 - l_res->x0);
             l_height = (OPJ_UINT32)(l_res->y1 - l_res->y0);
@@ -2202,6 +2385,8 @@ static OPJ_BOOL opj_tcd_dc_level_shift_decode(opj_tcd_t *p_tcd)
                            l_tile_comp->resolutions[l_tile_comp->minimum_num_resolutions - 1].x0)
                        - l_width;
             l_current_ptr = l_tile_comp->data;
+            l_x0 = (OPJ_UINT32)l_res->x0;
+            l_y0 = (OPJ_UINT32)l_res->y0;
 
             assert(l_height == 0 ||
                    l_width + l_stride <= l_tile_comp->data_size / l_height); /*MUPDF*/
@@ -2215,6 +2400,26 @@ static OPJ_BOOL opj_tcd_dc_level_shift_decode(opj_tcd_t *p_tcd)
             l_max = (OPJ_INT32)((1U << l_img_comp->prec) - 1);
         }
 
+        if (p_tcd->output_planes) {
+            if (l_current_ptr == NULL) {
+                continue;
+            }
+            if (compno < p_first_compno) {
+                /* Already shifted and clamped */
+                opj_tcd_write_output_plane(p_tcd, compno, l_current_ptr,
+                                           l_width + l_stride, l_x0, l_y0,
+                                           l_x0 + l_width, l_y0 + l_height,
+                                           OPJ_FALSE, 0, l_min, l_max);
+            } else {
+                opj_tcd_write_output_plane(p_tcd, compno, l_current_ptr,
+                                           l_width + l_stride, l_x0, l_y0,
+                                           l_x0 + l_width, l_y0 + l_height,
+                                           l_tccp->qmfbid != 1,
+                                           l_tccp->m_dc_level_shift, l_min, l_max);
+            }
+            continue;
+        }
+
 
         if (l_tccp->qmfbid == 1) {
             for (j = 0; j < l_height; ++j) {
@@ -282,6 +282,31 @@ typedef struct opj_tcd {
     OPJ_BOOL   whole_tile_decoding;
     /* Array of size image->numcomps indicating if a component must be decoded. NULL if all components must be decoded */
     OPJ_BOOL* used_component;
+    /** Only valid for decoding. Caller allocated planes, one per component, the final samples go to instead of the tile data. NULL if none */
+    const opj_output_plane_t* output_planes;
+    /** Image whose component x0/y0/w/h/factor place output_planes on the reference grid */
+    const opj_image_t* output_image;
+    /** Only valid for decoding. Whether the src of opj_tcd_decode_tile() is the buffer of a memory stream, which code-block decoding must not write its synthetic markers into */
+    OPJ_BOOL   src_in_place;
+    /* Decoding memory kept from one tile to the next, so that decoding */
+    /* tiles of the same size does not allocate anything */
+    /** Mutex protecting the event manager while decoding code-blocks */
+    opj_mutex_t* t1_manager_mutex;
+    /** Code-block decoding jobs, see opj_t1_allocate_decode_jobs() */
+    void* t1_jobs;
+    OPJ_UINT32 t1_jobs_max;
+    OPJ_UINT32 t1_jobs_count;
+    /** Packet iterators, see opj_pi_create_decode() */
+    OPJ_BYTE* pi_memory;
+    OPJ_SIZE_T pi_memory_size;
+    /** Per component flags of opj_t2_decode_packets() */
+    OPJ_BOOL* first_pass_failed;
+    OPJ_UINT32 first_pass_failed_size;
+    /** Inverse DWT buffers and jobs */
+    void* dwt_mem;
+    OPJ_SIZE_T dwt_mem_size;
+    void* dwt_jobs;
+    OPJ_SIZE_T dwt_jobs_size;
 } opj_tcd_t;
 
 /** @name Exported functions */
@@ -573,12 +573,17 @@ OPJ_BOOL opj_tls_set(opj_tls_t* tls, int key, void* value,
 typedef struct {
     opj_job_fn          job_fn;
     void               *user_data;
+    /* pool the job was submitted to, a client of the pool running it */
+    /* when shared pools are used */
+    opj_thread_pool_t  *owner;
 } opj_worker_thread_job_t;
 
-typedef struct {
+typedef struct opj_worker_thread_t {
     opj_thread_pool_t   *tp;
     opj_thread_t        *thread;
     int                  marked_as_waiting;
+    /* next in the list of waiting worker threads, no allocation needed */
+    struct opj_worker_thread_t *next_waiting;
 
     opj_mutex_t         *mutex;
     opj_cond_t          *cond;
@@ -591,36 +596,41 @@ typedef enum {
 } opj_worker_thread_state;
 
 struct opj_job_list_t {
-    opj_worker_thread_job_t* job;
+    opj_worker_thread_job_t job;
     struct opj_job_list_t* next;
 };
 typedef struct opj_job_list_t opj_job_list_t;
 
-struct opj_worker_thread_list_t {
-    opj_worker_thread_t* worker_thread;
-    struct opj_worker_thread_list_t* next;
-};
-typedef struct opj_worker_thread_list_t opj_worker_thread_list_t;
-
 struct opj_thread_pool_t {
     opj_worker_thread_t*             worker_threads;
     int                              worker_threads_count;
     opj_cond_t*                      cond;
     opj_mutex_t*                     mutex;
     volatile opj_worker_thread_state state;
+    /* jobs run in submission order, so that the jobs of the frame */
+    /* submitted first are done first when several clients share the pool */
     opj_job_list_t*                  job_queue;
+    opj_job_list_t*                  job_queue_tail;
+    /* jobs already run, reused by opj_thread_pool_submit_job() */
+    opj_job_list_t*                  free_job_list;
     volatile int                     pending_jobs_count;
-    opj_worker_thread_list_t*        waiting_worker_thread_list;
+    opj_worker_thread_t*             waiting_worker_thread_list;
     int                              waiting_worker_thread_count;
     opj_tls_t*                       tls;
     int                              signaling_threshold;
+    /* for clients, the pool whose threads run the jobs. A client has */
+    /* no threads, mutex or queue of its own: its pending_jobs_count, */
+    /* cond and signaling_threshold are guarded by the mutex of shared */
+    opj_thread_pool_t*               shared;
+    /* 1 for the creator of the pool plus 1 per client */
+    int                              ref_count;
 };
 
 static OPJ_BOOL opj_thread_pool_setup(opj_thread_pool_t* tp, int num_threads);
-static opj_worker_thread_job_t* opj_thread_pool_get_next_job(
+static opj_job_list_t* opj_thread_pool_get_next_job(
     opj_thread_pool_t* tp,
     opj_worker_thread_t* worker_thread,
-    OPJ_BOOL signal_job_finished);
+    opj_job_list_t* finished_job);
 
 opj_thread_pool_t* opj_thread_pool_create(int num_threads)
 {
@@ -631,6 +641,7 @@ opj_thread_pool_t* opj_thread_pool_create(int num_threads)
         return NULL;
     }
     tp->state = OPJWTS_OK;
+    tp->ref_count = 1;
 
     if (num_threads <= 0) {
         tp->tls = opj_tls_new();
@@ -653,29 +664,94 @@ opj_thread_pool_t* opj_thread_pool_create(int num_threads)
     return tp;
 }
 
+opj_thread_pool_t* opj_thread_pool_create_client(opj_thread_pool_t* shared)
+{
+    opj_thread_pool_t* tp;
+
+    if (shared == NULL || shared->mutex == NULL || shared->shared != NULL) {
+        return NULL;
+    }
+
+    tp = (opj_thread_pool_t*) opj_calloc(1, sizeof(opj_thread_pool_t));
+    if (!tp) {
+        return NULL;
+    }
+    tp->state = OPJWTS_OK;
+    tp->ref_count = 1;
+    tp->shared = shared;
+    tp->tls = opj_tls_new();
+    tp->cond = opj_cond_create();
+    if (!tp->tls || !tp->cond) {
+        opj_tls_destroy(tp->tls);
+        opj_cond_destroy(tp->cond);
+        opj_free(tp);
+        return NULL;
+    }
+
+    opj_mutex_lock(shared->mutex);
+    shared->ref_count ++;
+    opj_mutex_unlock(shared->mutex);
+    return tp;
+}
+
+/* Returns a finished job to the free list and updates the pending job */
+/* counts of tp and of the client it was submitted to. */
+/* The mutex of tp must be held */
+static void opj_thread_pool_job_done(opj_thread_pool_t* tp,
+                                     opj_job_list_t* finished_job)
+{
+    opj_thread_pool_t* owner = finished_job->job.owner;
+
+    finished_job->next = tp->free_job_list;
+    tp->free_job_list = finished_job;
+    if (owner != tp) {
+        owner->pending_jobs_count --;
+        if (owner->pending_jobs_count <= owner->signaling_threshold) {
+            opj_cond_signal(owner->cond);
+        }
+    }
+    tp->pending_jobs_count --;
+    /*printf("tp=%p, remaining jobs: %d\n", tp, tp->pending_jobs_count);*/
+    if (tp->pending_jobs_count <= tp->signaling_threshold) {
+        opj_cond_signal(tp->cond);
+    }
+}
+
+/* Takes the oldest job of the queue, NULL if it is empty. */
+/* The mutex of tp must be held */
+static opj_job_list_t* opj_thread_pool_pop_job(opj_thread_pool_t* tp)
+{
+    opj_job_list_t* job = tp->job_queue;
+
+    if (job) {
+        tp->job_queue = job->next;
+        if (tp->job_queue == NULL) {
+            tp->job_queue_tail = NULL;
+        }
+    }
+    return job;
+}
+
 static void opj_worker_thread_function(void* user_data)
 {
     opj_worker_thread_t* worker_thread;
     opj_thread_pool_t* tp;
     opj_tls_t* tls;
-    OPJ_BOOL job_finished = OPJ_FALSE;
+    opj_job_list_t* job = NULL;
 
     worker_thread = (opj_worker_thread_t*) user_data;
     tp = worker_thread->tp;
     tls = opj_tls_new();
 
     while (OPJ_TRUE) {
-        opj_worker_thread_job_t* job = opj_thread_pool_get_next_job(tp, worker_thread,
-                                       job_finished);
+        job = opj_thread_pool_get_next_job(tp, worker_thread, job);
         if (job == NULL) {
             break;
         }
 
-        if (job->job_fn) {
-            job->job_fn(job->user_data, tls);
+        if (job->job.job_fn) {
+            job->job.job_fn(job->job.user_data, tls);
         }
-        opj_free(job);
-        job_finished = OPJ_TRUE;
     }
 
     opj_tls_destroy(tls);
@@ -693,6 +769,18 @@ static OPJ_BOOL opj_thread_pool_setup(opj_thread_pool_t* tp, int num_threads)
         return OPJ_FALSE;
     }
 
+    /* opj_thread_pool_submit_job() waits while more than */
+    /* 100 * num_threads jobs are pending, so this is all the jobs */
+    /* that can be in the queue or running at the same time */
+    for (i = 0; i < 100 * num_threads + 1; i++) {
+        opj_job_list_t* item = (opj_job_list_t*) opj_malloc(sizeof(opj_job_list_t));
+        if (item == NULL) {
+            return OPJ_FALSE;
+        }
+        item->next = tp->free_job_list;
+        tp->free_job_list = item;
+    }
+
     tp->worker_threads = (opj_worker_thread_t*) opj_calloc((size_t)num_threads,
                          sizeof(opj_worker_thread_t));
     if (tp->worker_threads == NULL) {
@@ -754,60 +842,39 @@ void opj_waiting()
 }
 */
 
-static opj_worker_thread_job_t* opj_thread_pool_get_next_job(
+static opj_job_list_t* opj_thread_pool_get_next_job(
     opj_thread_pool_t* tp,
     opj_worker_thread_t* worker_thread,
-    OPJ_BOOL signal_job_finished)
+    opj_job_list_t* finished_job)
 {
     while (OPJ_TRUE) {
         opj_job_list_t* top_job_iter;
 
         opj_mutex_lock(tp->mutex);
 
-        if (signal_job_finished) {
-            signal_job_finished = OPJ_FALSE;
-            tp->pending_jobs_count --;
-            /*printf("tp=%p, remaining jobs: %d\n", tp, tp->pending_jobs_count);*/
-            if (tp->pending_jobs_count <= tp->signaling_threshold) {
-                opj_cond_signal(tp->cond);
-            }
+        if (finished_job) {
+            opj_thread_pool_job_done(tp, finished_job);
+            finished_job = NULL;
         }
 
         if (tp->state == OPJWTS_STOP) {
             opj_mutex_unlock(tp->mutex);
             return NULL;
         }
-        top_job_iter = tp->job_queue;
+        top_job_iter = opj_thread_pool_pop_job(tp);
         if (top_job_iter) {
-            opj_worker_thread_job_t* job;
-            tp->job_queue = top_job_iter->next;
-
-            job = top_job_iter->job;
             opj_mutex_unlock(tp->mutex);
-            opj_free(top_job_iter);
-            return job;
+            return top_job_iter;
         }
 
         /* opj_waiting(); */
         if (!worker_thread->marked_as_waiting) {
-            opj_worker_thread_list_t* item;
-
             worker_thread->marked_as_waiting = OPJ_TRUE;
             tp->waiting_worker_thread_count ++;
             assert(tp->waiting_worker_thread_count <= tp->worker_threads_count);
 
-            item = (opj_worker_thread_list_t*) opj_malloc(sizeof(opj_worker_thread_list_t));
-            if (item == NULL) {
-                tp->state = OPJWTS_ERROR;
-                opj_cond_signal(tp->cond);
-
-                opj_mutex_unlock(tp->mutex);
-                return NULL;
-            }
-
-            item->worker_thread = worker_thread;
-            item->next = tp->waiting_worker_thread_list;
-            tp->waiting_worker_thread_list = item;
+            worker_thread->next_waiting = tp->waiting_worker_thread_list;
+            tp->waiting_worker_thread_list = worker_thread;
         }
 
         /* printf("signaling that worker thread is ready\n"); */
@@ -828,62 +895,83 @@ OPJ_BOOL opj_thread_pool_submit_job(opj_thread_pool_t* tp,
                                     opj_job_fn job_fn,
                                     void* user_data)
 {
-    opj_worker_thread_job_t* job;
+    opj_thread_pool_t* owner = tp;
     opj_job_list_t* item;
 
+    if (tp->shared) {
+        tp = tp->shared;
+    }
     if (tp->mutex == NULL) {
         job_fn(user_data, tp->tls);
         return OPJ_TRUE;
     }
 
-    job = (opj_worker_thread_job_t*)opj_malloc(sizeof(opj_worker_thread_job_t));
-    if (job == NULL) {
-        return OPJ_FALSE;
-    }
-    job->job_fn = job_fn;
-    job->user_data = user_data;
-
-    item = (opj_job_list_t*) opj_malloc(sizeof(opj_job_list_t));
-    if (item == NULL) {
-        opj_free(job);
-        return OPJ_FALSE;
-    }
-    item->job = job;
-
     opj_mutex_lock(tp->mutex);
 
     tp->signaling_threshold = 100 * tp->worker_threads_count;
     while (tp->pending_jobs_count > tp->signaling_threshold) {
+        /* a client of a shared pool may submit from a thread of the pool, */
+        /* from a job decoding with a codec of its own. it runs queued jobs */
+        /* instead of sleeping, when all the threads are submitting nobody */
+        /* would be left to drain the queue */
+        if (owner != tp) {
+            opj_job_list_t* job = opj_thread_pool_pop_job(tp);
+            if (job) {
+                opj_mutex_unlock(tp->mutex);
+                job->job.job_fn(job->job.user_data, owner->tls);
+                opj_mutex_lock(tp->mutex);
+                opj_thread_pool_job_done(tp, job);
+                continue;
+            }
+        }
         /* printf("%d jobs enqueued. Waiting\n", tp->pending_jobs_count); */
         opj_cond_wait(tp->cond, tp->mutex);
         /* printf("...%d jobs enqueued.\n", tp->pending_jobs_count); */
     }
 
-    item->next = tp->job_queue;
-    tp->job_queue = item;
+    item = tp->free_job_list;
+    if (item) {
+        tp->free_job_list = item->next;
+    } else {
+        /* several clients got past the wait at the same time */
+        item = (opj_job_list_t*) opj_malloc(sizeof(opj_job_list_t));
+        if (item == NULL) {
+            opj_mutex_unlock(tp->mutex);
+            return OPJ_FALSE;
+        }
+    }
+    item->job.job_fn = job_fn;
+    item->job.user_data = user_data;
+    item->job.owner = owner;
+
+    item->next = NULL;
+    if (tp->job_queue_tail) {
+        tp->job_queue_tail->next = item;
+    } else {
+        tp->job_queue = item;
+    }
+    tp->job_queue_tail = item;
     tp->pending_jobs_count ++;
+    if (owner != tp) {
+        owner->pending_jobs_count ++;
+    }
 
     if (tp->waiting_worker_thread_list) {
         opj_worker_thread_t* worker_thread;
-        opj_worker_thread_list_t* next;
-        opj_worker_thread_list_t* to_opj_free;
 
-        worker_thread = tp->waiting_worker_thread_list->worker_thread;
+        worker_thread = tp->waiting_worker_thread_list;
 
         assert(worker_thread->marked_as_waiting);
         worker_thread->marked_as_waiting = OPJ_FALSE;
 
-        next = tp->waiting_worker_thread_list->next;
-        to_opj_free = tp->waiting_worker_thread_list;
-        tp->waiting_worker_thread_list = next;
+        tp->waiting_worker_thread_list = worker_thread->next_waiting;
+        worker_thread->next_waiting = NULL;
         tp->waiting_worker_thread_count --;
 
         opj_mutex_lock(worker_thread->mutex);
         opj_mutex_unlock(tp->mutex);
         opj_cond_signal(worker_thread->cond);
         opj_mutex_unlock(worker_thread->mutex);
-
-        opj_free(to_opj_free);
     } else {
         opj_mutex_unlock(tp->mutex);
     }
@@ -891,16 +979,47 @@ OPJ_BOOL opj_thread_pool_submit_job(opj_thread_pool_t* tp,
     return OPJ_TRUE;
 }
 
+/* A client waiting for its jobs does not sleep while the shared queue has */
+/* work: it runs the oldest queued job, whichever client it belongs to, */
+/* with its own thread local storage. Jobs that wait themselves, job */
+/* groups decoding with codecs on the same pool, wait for jobs queued */
+/* after them, so the nested waits return before the outer ones */
+static void opj_thread_pool_wait_client(opj_thread_pool_t* client,
+                                        int max_remaining_jobs)
+{
+    opj_thread_pool_t* tp = client->shared;
+
+    opj_mutex_lock(tp->mutex);
+    client->signaling_threshold = max_remaining_jobs;
+    while (client->pending_jobs_count > max_remaining_jobs) {
+        opj_job_list_t* job = opj_thread_pool_pop_job(tp);
+
+        if (job == NULL) {
+            opj_cond_wait(client->cond, tp->mutex);
+            continue;
+        }
+        opj_mutex_unlock(tp->mutex);
+        job->job.job_fn(job->job.user_data, client->tls);
+        opj_mutex_lock(tp->mutex);
+        opj_thread_pool_job_done(tp, job);
+    }
+    opj_mutex_unlock(tp->mutex);
+}
+
 void opj_thread_pool_wait_completion(opj_thread_pool_t* tp,
                                      int max_remaining_jobs)
 {
+    if (max_remaining_jobs < 0) {
+        max_remaining_jobs = 0;
+    }
+    if (tp->shared) {
+        opj_thread_pool_wait_client(tp, max_remaining_jobs);
+        return;
+    }
     if (tp->mutex == NULL) {
         return;
     }
 
-    if (max_remaining_jobs < 0) {
-        max_remaining_jobs = 0;
-    }
     opj_mutex_lock(tp->mutex);
     tp->signaling_threshold = max_remaining_jobs;
     while (tp->pending_jobs_count > max_remaining_jobs) {
@@ -913,6 +1032,10 @@ void opj_thread_pool_wait_completion(opj_thread_pool_t* tp,
 
 int opj_thread_pool_get_thread_count(opj_thread_pool_t* tp)
 {
+    if (tp->shared) {
+        /* the thread waiting for the jobs of a client runs them too */
+        return tp->shared->worker_threads_count + 1;
+    }
     return tp->worker_threads_count;
 }
 
@@ -921,6 +1044,27 @@ void opj_thread_pool_destroy(opj_thread_pool_t* tp)
     if (!tp) {
         return;
     }
+    if (tp->shared) {
+        opj_thread_pool_t* shared = tp->shared;
+
+        opj_thread_pool_wait_completion(tp, 0);
+        opj_cond_destroy(tp->cond);
+        opj_tls_destroy(tp->tls);
+        opj_free(tp);
+        opj_thread_pool_destroy(shared);
+        return;
+    }
+    if (tp->mutex) {
+        int ref_count;
+
+        opj_mutex_lock(tp->mutex);
+        ref_count = -- tp->ref_count;
+        opj_mutex_unlock(tp->mutex);
+        if (ref_count > 0) {
+            /* the last client destroys it */
+            return;
+        }
+    }
     if (tp->cond) {
         int i;
         opj_thread_pool_wait_completion(tp, 0);
@@ -939,11 +1083,12 @@ void opj_thread_pool_destroy(opj_thread_pool_t* tp)
         }
 
         opj_free(tp->worker_threads);
+        tp->waiting_worker_thread_list = NULL;
 
-        while (tp->waiting_worker_thread_list != NULL) {
-            opj_worker_thread_list_t* next = tp->waiting_worker_thread_list->next;
-            opj_free(tp->waiting_worker_thread_list);
-            tp->waiting_worker_thread_list = next;
+        while (tp->free_job_list != NULL) {
+            opj_job_list_t* next = tp->free_job_list->next;
+            opj_free(tp->free_job_list);
+            tp->free_job_list = next;
         }
 
         opj_cond_destroy(tp->cond);
@@ -206,6 +206,18 @@ typedef struct opj_thread_pool_t opj_thread_pool_t;
  */
 opj_thread_pool_t* opj_thread_pool_create(int num_threads);
 
+/** Create a client of a thread pool.
+ * Jobs submitted to the client are queued on shared, in submission order
+ * with the jobs of its other clients, and run by its threads.
+ * opj_thread_pool_wait_completion() on the client only waits for the jobs
+ * of the client, and the waiting thread runs queued jobs meanwhile.
+ * shared is kept alive until all its clients are destroyed.
+ *
+ * @param shared a thread pool created with num_threads >= 1.
+ * @return a thread pool handle, or NULL in case of failure.
+ */
+opj_thread_pool_t* opj_thread_pool_create_client(opj_thread_pool_t* shared);
+
 /** User function to execute in a thread
  * @param user_data user data provided with opj_thread_create()
  * @param tls handle to thread local storage
@@ -238,6 +250,8 @@ void opj_thread_pool_wait_completion(opj_thread_pool_t* tp,
                                      int max_remaining_jobs);
 
 /** Return the number of threads associated with the thread pool.
+ * For a client, the threads of the shared pool plus the one waiting for
+ * its jobs.
  *
  * @param tp the thread pool handle.
  * @return number of threads associated with the thread pool.
@@ -245,6 +259,7 @@ void opj_thread_pool_wait_completion(opj_thread_pool_t* tp,
 int opj_thread_pool_get_thread_count(opj_thread_pool_t* tp);
 
 /** Destroy a thread pool.
+ * A pool that still has clients is destroyed with its last client.
  * @param tp the thread pool handle.
  */
 void opj_thread_pool_destroy(opj_thread_pool_t* tp);
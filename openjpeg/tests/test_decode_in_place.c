@@ -0,0 +1,442 @@
+/*
+ * The copyright in this software is being made available under the 2-clauses
+ * BSD License, included below. This software may be subject to other third
+ * party and contributor rights, including patent rights, and no such rights
+ * are granted under this license.
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decodes a J2K codestream in place from a buffer stream and checks the
+ * image against the one decoded through a stream with a read function,
+ * which copies the codestream. The buffer is made read-only, so that any
+ * write of the decoder into it crashes the test. Without an input file the
+ * codestream is encoded with one tile-part per resolution, so that the
+ * tile-parts after the first one have to be copied.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "openjpeg.h"
+
+static void quiet_callback(const char *msg, void *client_data)
+{
+    (void)msg;
+    (void)client_data;
+}
+
+/* Codestream in memory, read or written through stream functions */
+typedef struct {
+    OPJ_BYTE *data;
+    OPJ_SIZE_T len;
+    OPJ_SIZE_T size;
+    OPJ_SIZE_T pos;
+} test_memory_t;
+
+static OPJ_SIZE_T test_read(void *p_buffer, OPJ_SIZE_T p_nb_bytes,
+                            void *p_user_data)
+{
+    test_memory_t *l_mem = (test_memory_t *)p_user_data;
+    OPJ_SIZE_T l_left = l_mem->len - l_mem->pos;
+
+    if (l_left == 0) {
+        return (OPJ_SIZE_T) - 1;
+    }
+    if (p_nb_bytes > l_left) {
+        p_nb_bytes = l_left;
+    }
+    memcpy(p_buffer, l_mem->data + l_mem->pos, p_nb_bytes);
+    l_mem->pos += p_nb_bytes;
+    return p_nb_bytes;
+}
+
+static OPJ_SIZE_T test_write(void *p_buffer, OPJ_SIZE_T p_nb_bytes,
+                             void *p_user_data)
+{
+    test_memory_t *l_mem = (test_memory_t *)p_user_data;
+
+    if (l_mem->pos + p_nb_bytes > l_mem->size) {
+        OPJ_SIZE_T l_size = (l_mem->pos + p_nb_bytes) * 2;
+        OPJ_BYTE *l_data = (OPJ_BYTE *)realloc(l_mem->data, l_size);
+        if (!l_data) {
+            return (OPJ_SIZE_T) - 1;
+        }
+        l_mem->data = l_data;
+        l_mem->size = l_size;
+    }
+    memcpy(l_mem->data + l_mem->pos, p_buffer, p_nb_bytes);
+    l_mem->pos += p_nb_bytes;
+    if (l_mem->pos > l_mem->len) {
+        l_mem->len = l_mem->pos;
+    }
+    return p_nb_bytes;
+}
+
+static OPJ_OFF_T test_skip(OPJ_OFF_T p_nb_bytes, void *p_user_data)
+{
+    test_memory_t *l_mem = (test_memory_t *)p_user_data;
+
+    if (p_nb_bytes < 0 || (OPJ_SIZE_T)p_nb_bytes > l_mem->size - l_mem->pos) {
+        return (OPJ_OFF_T) - 1;
+    }
+    l_mem->pos += (OPJ_SIZE_T)p_nb_bytes;
+    return p_nb_bytes;
+}
+
+static OPJ_BOOL test_seek(OPJ_OFF_T p_nb_bytes, void *p_user_data)
+{
+    test_memory_t *l_mem = (test_memory_t *)p_user_data;
+
+    if (p_nb_bytes < 0 || (OPJ_SIZE_T)p_nb_bytes > l_mem->len) {
+        return OPJ_FALSE;
+    }
+    l_mem->pos = (OPJ_SIZE_T)p_nb_bytes;
+    return OPJ_TRUE;
+}
+
+static opj_stream_t* create_memory_stream(test_memory_t *mem, OPJ_BOOL input)
+{
+    opj_stream_t *l_stream = opj_stream_default_create(input);
+
+    if (!l_stream) {
+        return NULL;
+    }
+    opj_stream_set_user_data(l_stream, mem, NULL);
+    opj_stream_set_user_data_length(l_stream, mem->len);
+    opj_stream_set_read_function(l_stream, test_read);
+    opj_stream_set_write_function(l_stream, test_write);
+    opj_stream_set_skip_function(l_stream, test_skip);
+    opj_stream_set_seek_function(l_stream, test_seek);
+    return l_stream;
+}
+
+/* Encodes a 3 component image with 4 tiles of 4 tile-parts each */
+static int encode_tile_parts(test_memory_t *mem)
+{
+    opj_cparameters_t l_param;
+    opj_image_cmptparm_t l_params[3];
+    opj_image_t *l_image;
+    opj_codec_t *l_codec = NULL;
+    opj_stream_t *l_stream = NULL;
+    OPJ_UINT32 compno, i;
+    int l_ok = 0;
+
+    memset(l_params, 0, sizeof(l_params));
+    for (compno = 0; compno < 3; ++compno) {
+        l_params[compno].dx = 1;
+        l_params[compno].dy = 1;
+        l_params[compno].w = 200;
+        l_params[compno].h = 150;
+        l_params[compno].prec = 10;
+    }
+    l_image = opj_image_create(3, l_params, OPJ_CLRSPC_SRGB);
+    if (!l_image) {
+        return 0;
+    }
+    l_image->x1 = 200;
+    l_image->y1 = 150;
+    for (compno = 0; compno < 3; ++compno) {
+        for (i = 0; i < 200 * 150; ++i) {
+            l_image->comps[compno].data[i] = (OPJ_INT32)(((i % 200) * 5 +
+                                             (i / 200) * 3 + (i * 7919) % 61 +
+                                             compno * 100) & 1023);
+        }
+    }
+
+    opj_set_default_encoder_parameters(&l_param);
+    l_param.tile_size_on = OPJ_TRUE;
+    l_param.cp_tdx = 128;
+    l_param.cp_tdy = 128;
+    l_param.numresolution = 4;
+    l_param.tp_on = 1;
+    l_param.tp_flag = 'R';
+    l_param.tcp_mct = 1;
+
+    l_codec = opj_create_compress(OPJ_CODEC_J2K);
+    l_stream = create_memory_stream(mem, OPJ_FALSE);
+    if (!l_codec || !l_stream) {
+        goto cleanup;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+    l_ok = opj_setup_encoder(l_codec, &l_param, l_image) &&
+           opj_start_compress(l_codec, l_image, l_stream) &&
+           opj_encode(l_codec, l_stream) &&
+           opj_end_compress(l_codec, l_stream);
+
+cleanup:
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    opj_image_destroy(l_image);
+    return l_ok;
+}
+
+static opj_codec_t* create_codec(int num_threads)
+{
+    opj_dparameters_t l_param;
+    opj_codec_t * l_codec;
+
+    opj_set_default_decoder_parameters(&l_param);
+    l_codec = opj_create_decompress(OPJ_CODEC_J2K);
+    if (!l_codec) {
+        return NULL;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+
+    if (!opj_setup_decoder(l_codec, &l_param) ||
+            (num_threads > 1 && !opj_codec_set_threads(l_codec, num_threads))) {
+        opj_destroy_codec(l_codec);
+        return NULL;
+    }
+    return l_codec;
+}
+
+static int same_images(const opj_image_t *a, const opj_image_t *b)
+{
+    OPJ_UINT32 compno;
+
+    if (a->numcomps != b->numcomps) {
+        return 0;
+    }
+    for (compno = 0; compno < a->numcomps; ++compno) {
+        const opj_image_comp_t *l_a = &a->comps[compno];
+        const opj_image_comp_t *l_b = &b->comps[compno];
+
+        if (l_a->w != l_b->w || l_a->h != l_b->h || !l_a->data || !l_b->data ||
+                memcmp(l_a->data, l_b->data,
+                       (size_t)l_a->w * l_a->h * sizeof(OPJ_INT32)) != 0) {
+            fprintf(stderr, "component %u differs\n", compno);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Decodes the codestream twice, with opj_read_next_header() in between, */
+/* checking the second image against the first one. mem is read through */
+/* the stream functions, buffer_info in place. Returns the first image */
+static opj_image_t* decode(test_memory_t *mem, opj_buffer_info_t *buffer_info,
+                           int num_threads)
+{
+    opj_stream_t * l_stream = NULL;
+    opj_codec_t * l_codec = NULL;
+    opj_image_t * l_images[2] = { NULL, NULL };
+    int l_frame;
+    OPJ_BOOL l_ok = OPJ_FALSE;
+
+    l_stream = mem ? create_memory_stream(mem, OPJ_TRUE) :
+               opj_stream_create_buffer_stream(buffer_info, OPJ_TRUE);
+    l_codec = create_codec(num_threads);
+    if (!l_stream || !l_codec) {
+        goto cleanup;
+    }
+
+    for (l_frame = 0; l_frame < 2; ++l_frame) {
+        if (l_frame == 0) {
+            if (!opj_read_header(l_stream, l_codec, &l_images[0])) {
+                goto cleanup;
+            }
+        } else {
+            if (mem) {
+                opj_stream_destroy(l_stream);
+                mem->pos = 0;
+                l_stream = create_memory_stream(mem, OPJ_TRUE);
+            } else if (!opj_stream_reset_buffer_stream(l_stream, buffer_info)) {
+                goto cleanup;
+            }
+            if (!l_stream ||
+                    !opj_read_next_header(l_stream, l_codec, &l_images[1])) {
+                goto cleanup;
+            }
+        }
+        if (!opj_decode(l_codec, l_stream, l_images[l_frame]) ||
+                !opj_end_decompress(l_codec, l_stream)) {
+            goto cleanup;
+        }
+    }
+    l_ok = same_images(l_images[0], l_images[1]);
+
+cleanup:
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    if (l_images[1] && l_images[1] != l_images[0]) {
+        opj_image_destroy(l_images[1]);
+    }
+    if (!l_ok && l_images[0]) {
+        opj_image_destroy(l_images[0]);
+        l_images[0] = NULL;
+    }
+    return l_images[0];
+}
+
+/* Read-only copy of the codestream */
+static OPJ_BYTE* map_read_only(const OPJ_BYTE *data, OPJ_SIZE_T len,
+                               OPJ_SIZE_T *size)
+{
+    OPJ_BYTE *l_data;
+#if !defined(_WIN32)
+    OPJ_SIZE_T l_page = (OPJ_SIZE_T)sysconf(_SC_PAGESIZE);
+
+    /* the buffer ends at the end of a page, the next one is not mapped */
+    *size = (len + l_page - 1) / l_page * l_page + l_page;
+    l_data = (OPJ_BYTE *)mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (l_data == (OPJ_BYTE *)MAP_FAILED) {
+        return NULL;
+    }
+    l_data += *size - l_page - len;
+    memcpy(l_data, data, len);
+    if (mprotect(l_data - (*size - l_page - len), *size, PROT_READ) != 0) {
+        return NULL;
+    }
+#else
+    *size = len;
+    l_data = (OPJ_BYTE *)malloc(len);
+    if (l_data) {
+        memcpy(l_data, data, len);
+    }
+#endif
+    return l_data;
+}
+
+static void unmap_read_only(OPJ_BYTE *data, OPJ_SIZE_T len, OPJ_SIZE_T size)
+{
+#if !defined(_WIN32)
+    OPJ_SIZE_T l_page = (OPJ_SIZE_T)sysconf(_SC_PAGESIZE);
+    munmap(data - (size - l_page - len), size);
+#else
+    (void)len;
+    (void)size;
+    free(data);
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    test_memory_t l_mem;
+    opj_buffer_info_t l_buffer_info;
+    opj_image_t *l_image = NULL;
+    OPJ_BYTE *l_read_only = NULL;
+    OPJ_SIZE_T l_size = 0;
+    int l_num_threads;
+    int l_ret = 1;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: test_decode_in_place [input_file.j2k]\n");
+        return 1;
+    }
+
+    memset(&l_mem, 0, sizeof(l_mem));
+    if (argc == 2) {
+        FILE *f = fopen(argv[1], "rb");
+        long l_len;
+
+        if (!f) {
+            fprintf(stderr, "cannot open %s\n", argv[1]);
+            return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        l_len = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        l_mem.len = l_mem.size = (OPJ_SIZE_T)l_len;
+        l_mem.data = (OPJ_BYTE *)malloc((size_t)l_len);
+        if (!l_mem.data || fread(l_mem.data, 1, (size_t)l_len, f) != (size_t)l_len) {
+            fprintf(stderr, "cannot read %s\n", argv[1]);
+            fclose(f);
+            free(l_mem.data);
+            return 1;
+        }
+        fclose(f);
+    } else if (!encode_tile_parts(&l_mem)) {
+        fprintf(stderr, "encoding failed\n");
+        free(l_mem.data);
+        return 1;
+    }
+    l_mem.pos = 0;
+
+    l_image = decode(&l_mem, NULL, 1);
+    if (!l_image) {
+        fprintf(stderr, "decoding through the read function failed\n");
+        goto cleanup;
+    }
+
+    l_read_only = map_read_only(l_mem.data, l_mem.len, &l_size);
+    if (!l_read_only) {
+        fprintf(stderr, "cannot map the codestream\n");
+        goto cleanup;
+    }
+    l_buffer_info.buf = l_read_only;
+    l_buffer_info.len = l_mem.len;
+
+    for (l_num_threads = 1; l_num_threads <= 4; l_num_threads += 3) {
+        opj_image_t *l_in_place;
+
+        l_buffer_info.cur = l_read_only;
+        l_in_place = decode(NULL, &l_buffer_info, l_num_threads);
+        if (!l_in_place) {
+            fprintf(stderr, "decoding in place with %d threads failed\n",
+                    l_num_threads);
+            goto cleanup;
+        }
+        if (!same_images(l_image, l_in_place)) {
+            fprintf(stderr, "decoding in place with %d threads differs\n",
+                    l_num_threads);
+            opj_image_destroy(l_in_place);
+            goto cleanup;
+        }
+        opj_image_destroy(l_in_place);
+    }
+
+    printf("OK\n");
+    l_ret = 0;
+
+cleanup:
+    if (l_image) {
+        opj_image_destroy(l_image);
+    }
+    if (l_read_only) {
+        unmap_read_only(l_read_only, l_mem.len, l_size);
+    }
+    free(l_mem.data);
+    return l_ret;
+}
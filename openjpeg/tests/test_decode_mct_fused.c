@@ -0,0 +1,298 @@
+/*
+ * The copyright in this software is being made available under the 2-clauses
+ * BSD License, included below. This software may be subject to other third
+ * party and contributor rights, including patent rights, and no such rights
+ * are granted under this license.
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decodes a codestream with the inverse MCT fused with the DC level shift
+ * and clamping (opj_mct_decode_dc_shift(), opj_mct_decode_real_dc_shift()),
+ * then again with the separate passes, and checks that both images are the
+ * same bit for bit. Optionally at a reduced resolution or in a window, where
+ * the fused pass works on the window buffers.
+ *
+ * With -create it writes the codestream to check first: three components
+ * with the MCT, at a rate low enough for the decoded samples to overshoot,
+ * so that the clamping has something to do.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "opj_includes.h"
+
+static void quiet_callback(const char *msg, void *client_data)
+{
+    (void)msg;
+    (void)client_data;
+}
+
+static int create(const char *output_file, int prec, int irreversible,
+                  int width, int height, int tile_size)
+{
+    opj_image_cmptparm_t l_params[3];
+    opj_cparameters_t l_param;
+    opj_image_t *l_image = NULL;
+    opj_codec_t *l_codec = NULL;
+    opj_stream_t *l_stream = NULL;
+    unsigned int l_seed = 12345;
+    OPJ_UINT32 compno;
+    int x, y;
+    int l_ret = 1;
+
+    memset(l_params, 0, sizeof(l_params));
+    for (compno = 0; compno < 3; ++compno) {
+        l_params[compno].dx = 1;
+        l_params[compno].dy = 1;
+        l_params[compno].w = (OPJ_UINT32)width;
+        l_params[compno].h = (OPJ_UINT32)height;
+        l_params[compno].prec = (OPJ_UINT32)prec;
+        l_params[compno].bpp = (OPJ_UINT32)prec;
+    }
+    l_image = opj_image_create(3, l_params, OPJ_CLRSPC_SRGB);
+    if (!l_image) {
+        return 1;
+    }
+    l_image->x1 = (OPJ_UINT32)width;
+    l_image->y1 = (OPJ_UINT32)height;
+
+    /* gradients with hard edges and noise, black and white included */
+    for (compno = 0; compno < 3; ++compno) {
+        OPJ_INT32 l_max = (1 << prec) - 1;
+        for (y = 0; y < height; ++y) {
+            for (x = 0; x < width; ++x) {
+                OPJ_INT32 v;
+                l_seed = l_seed * 1103515245U + 12345U;
+                if (((x / 37) + (y / 29) + (int)compno) % 4 == 0) {
+                    v = ((x / 37) % 2) ? l_max : 0;
+                } else {
+                    v = (OPJ_INT32)(((OPJ_INT64)(x * (int)(compno + 1) + y) *
+                                     l_max) / (width + height) % (l_max + 1));
+                    v += (OPJ_INT32)((l_seed >> 16) % 64) - 32;
+                }
+                l_image->comps[compno].data[y * width + x] =
+                    v < 0 ? 0 : (v > l_max ? l_max : v);
+            }
+        }
+    }
+
+    opj_set_default_encoder_parameters(&l_param);
+    l_param.tcp_numlayers = 1;
+    l_param.tcp_rates[0] = 20;
+    l_param.cp_disto_alloc = 1;
+    l_param.irreversible = irreversible;
+    l_param.tcp_mct = 1;
+    l_param.tile_size_on = OPJ_TRUE;
+    l_param.cp_tdx = tile_size;
+    l_param.cp_tdy = tile_size;
+
+    l_codec = opj_create_compress(OPJ_CODEC_J2K);
+    if (!l_codec) {
+        goto cleanup;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+    l_stream = opj_stream_create_default_file_stream(output_file, OPJ_FALSE);
+    if (!l_stream) {
+        fprintf(stderr, "cannot create %s\n", output_file);
+        goto cleanup;
+    }
+    if (!opj_setup_encoder(l_codec, &l_param, l_image) ||
+            !opj_start_compress(l_codec, l_image, l_stream) ||
+            !opj_encode(l_codec, l_stream) ||
+            !opj_end_compress(l_codec, l_stream)) {
+        fprintf(stderr, "cannot encode %s\n", output_file);
+        goto cleanup;
+    }
+    l_ret = 0;
+
+cleanup:
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    opj_image_destroy(l_image);
+    return l_ret;
+}
+
+static opj_image_t* decode(const char *input_file, OPJ_UINT32 reduce,
+                           const OPJ_INT32 *area, OPJ_BOOL *uses_mct)
+{
+    opj_dparameters_t l_param;
+    opj_codec_t *l_codec = NULL;
+    opj_stream_t *l_stream = NULL;
+    opj_image_t *l_image = NULL;
+    opj_codestream_info_v2_t *l_cstr_info = NULL;
+    OPJ_BOOL l_ok = OPJ_FALSE;
+
+    l_stream = opj_stream_create_default_file_stream(input_file, OPJ_TRUE);
+    if (!l_stream) {
+        fprintf(stderr, "cannot open %s\n", input_file);
+        return NULL;
+    }
+    opj_set_default_decoder_parameters(&l_param);
+    l_param.cp_reduce = reduce;
+    l_codec = opj_create_decompress(OPJ_CODEC_J2K);
+    if (!l_codec) {
+        goto cleanup;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+
+    if (!opj_setup_decoder(l_codec, &l_param) ||
+            !opj_read_header(l_stream, l_codec, &l_image)) {
+        fprintf(stderr, "cannot read the header of %s\n", input_file);
+        goto cleanup;
+    }
+    l_cstr_info = opj_get_cstr_info(l_codec);
+    *uses_mct = l_cstr_info && l_cstr_info->m_default_tile_info.mct == 1;
+    opj_destroy_cstr_info(&l_cstr_info);
+
+    if (area && !opj_set_decode_area(l_codec, l_image,
+                                     area[0], area[1], area[2], area[3])) {
+        fprintf(stderr, "cannot set the decode area\n");
+        goto cleanup;
+    }
+    l_ok = opj_decode(l_codec, l_stream, l_image) &&
+           opj_end_decompress(l_codec, l_stream);
+    if (!l_ok) {
+        fprintf(stderr, "cannot decode %s\n", input_file);
+    }
+
+cleanup:
+    if (!l_ok && l_image) {
+        opj_image_destroy(l_image);
+        l_image = NULL;
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    opj_stream_destroy(l_stream);
+    return l_image;
+}
+
+static OPJ_BOOL same_images(const opj_image_t *a, const opj_image_t *b)
+{
+    OPJ_UINT32 compno;
+
+    if (a->numcomps != b->numcomps) {
+        return OPJ_FALSE;
+    }
+    for (compno = 0; compno < a->numcomps; ++compno) {
+        const opj_image_comp_t *ca = &a->comps[compno];
+        const opj_image_comp_t *cb = &b->comps[compno];
+        OPJ_SIZE_T i;
+
+        if (ca->w != cb->w || ca->h != cb->h) {
+            fprintf(stderr, "component %u has a different size\n", compno);
+            return OPJ_FALSE;
+        }
+        for (i = 0; i < (OPJ_SIZE_T)ca->w * ca->h; ++i) {
+            if (ca->data[i] != cb->data[i]) {
+                fprintf(stderr, "component %u differs at %u: %d instead of %d\n",
+                        compno, (OPJ_UINT32)i, ca->data[i], cb->data[i]);
+                return OPJ_FALSE;
+            }
+        }
+    }
+    return OPJ_TRUE;
+}
+
+int main(int argc, char** argv)
+{
+    OPJ_UINT32 l_reduce = 0;
+    OPJ_INT32 l_area[4];
+    OPJ_INT32 *l_use_area = NULL;
+    opj_image_t *l_fused = NULL;
+    opj_image_t *l_separate = NULL;
+    OPJ_BOOL l_uses_mct = OPJ_FALSE;
+    int l_ret = 1;
+
+    if (argc == 8 && strcmp(argv[1], "-create") == 0) {
+        return create(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]),
+                      atoi(argv[6]), atoi(argv[7]));
+    }
+    if (argc != 2 && argc != 3 && argc != 7) {
+        fprintf(stderr,
+                "Usage: test_decode_mct_fused input_file.j2k [reduce [x0 y0 x1 y1]]\n"
+                "       test_decode_mct_fused -create output_file.j2k prec irreversible\n"
+                "                             width height tile_size\n");
+        return 1;
+    }
+    if (argc >= 3) {
+        l_reduce = (OPJ_UINT32)atoi(argv[2]);
+    }
+    if (argc == 7) {
+        l_area[0] = atoi(argv[3]);
+        l_area[1] = atoi(argv[4]);
+        l_area[2] = atoi(argv[5]);
+        l_area[3] = atoi(argv[6]);
+        l_use_area = l_area;
+    }
+
+    opj_mct_set_dc_shift_fused(OPJ_TRUE);
+    if (!opj_mct_get_dc_shift_fused()) {
+        /* both decodes would take the separate passes */
+        printf("fused pass not available on this CPU, skipped\n");
+        return 0;
+    }
+    l_fused = decode(argv[1], l_reduce, l_use_area, &l_uses_mct);
+    if (!l_fused) {
+        goto cleanup;
+    }
+    if (!l_uses_mct) {
+        fprintf(stderr, "%s does not use the inverse MCT\n", argv[1]);
+        goto cleanup;
+    }
+
+    opj_mct_set_dc_shift_fused(OPJ_FALSE);
+    l_separate = decode(argv[1], l_reduce, l_use_area, &l_uses_mct);
+    opj_mct_set_dc_shift_fused(OPJ_TRUE);
+    if (!l_separate) {
+        goto cleanup;
+    }
+
+    if (!same_images(l_fused, l_separate)) {
+        goto cleanup;
+    }
+    printf("OK\n");
+    l_ret = 0;
+
+cleanup:
+    if (l_fused) {
+        opj_image_destroy(l_fused);
+    }
+    if (l_separate) {
+        opj_image_destroy(l_separate);
+    }
+    return l_ret;
+}
@@ -0,0 +1,560 @@
+/*
+ * The copyright in this software is being made available under the 2-clauses
+ * BSD License, included below. This software may be subject to other third
+ * party and contributor rights, including patent rights, and no such rights
+ * are granted under this license.
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks when opj_read_next_header() reuses the main header of the previous
+ * codestream. A codec decodes a first codestream, then gets a second one
+ * whose main header differs in SIZ (size), COD (progression order) or QCD
+ * (guard bits): opj_read_next_header() has to refuse it, and the second
+ * codestream, decoded from scratch with opj_read_header() as the caller
+ * does then, has to come out lossless. With "same" the second codestream
+ * is the first one again, which has to be reused and decode the same.
+ *
+ * With "ppm" the codestream carries its packet headers in a PPM marker,
+ * moved there from a codestream encoded with SOP and EPH markers. PPM
+ * headers are consumed while decoding, so such a main header is never
+ * reused, even for the same codestream.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "openjpeg.h"
+
+#define WIDTH 200
+#define HEIGHT 150
+#define PREC 10
+
+static void quiet_callback(const char *msg, void *client_data)
+{
+    (void)msg;
+    (void)client_data;
+}
+
+/* Codestream in memory, written through stream functions */
+typedef struct {
+    OPJ_BYTE *data;
+    OPJ_SIZE_T len;
+    OPJ_SIZE_T size;
+    OPJ_SIZE_T pos;
+} test_memory_t;
+
+static OPJ_SIZE_T test_write(void *p_buffer, OPJ_SIZE_T p_nb_bytes,
+                             void *p_user_data)
+{
+    test_memory_t *l_mem = (test_memory_t *)p_user_data;
+
+    if (l_mem->pos + p_nb_bytes > l_mem->size) {
+        OPJ_SIZE_T l_size = (l_mem->pos + p_nb_bytes) * 2;
+        OPJ_BYTE *l_data = (OPJ_BYTE *)realloc(l_mem->data, l_size);
+        if (!l_data) {
+            return (OPJ_SIZE_T) - 1;
+        }
+        l_mem->data = l_data;
+        l_mem->size = l_size;
+    }
+    memcpy(l_mem->data + l_mem->pos, p_buffer, p_nb_bytes);
+    l_mem->pos += p_nb_bytes;
+    if (l_mem->pos > l_mem->len) {
+        l_mem->len = l_mem->pos;
+    }
+    return p_nb_bytes;
+}
+
+static OPJ_OFF_T test_skip(OPJ_OFF_T p_nb_bytes, void *p_user_data)
+{
+    test_memory_t *l_mem = (test_memory_t *)p_user_data;
+
+    if (p_nb_bytes < 0 || (OPJ_SIZE_T)p_nb_bytes > l_mem->size - l_mem->pos) {
+        return (OPJ_OFF_T) - 1;
+    }
+    l_mem->pos += (OPJ_SIZE_T)p_nb_bytes;
+    return p_nb_bytes;
+}
+
+static OPJ_BOOL test_seek(OPJ_OFF_T p_nb_bytes, void *p_user_data)
+{
+    test_memory_t *l_mem = (test_memory_t *)p_user_data;
+
+    if (p_nb_bytes < 0 || (OPJ_SIZE_T)p_nb_bytes > l_mem->len) {
+        return OPJ_FALSE;
+    }
+    l_mem->pos = (OPJ_SIZE_T)p_nb_bytes;
+    return OPJ_TRUE;
+}
+
+static opj_image_t* create_image(OPJ_UINT32 width)
+{
+    opj_image_cmptparm_t l_params[3];
+    opj_image_t *l_image;
+    OPJ_UINT32 compno, x, y;
+
+    memset(l_params, 0, sizeof(l_params));
+    for (compno = 0; compno < 3; ++compno) {
+        l_params[compno].dx = 1;
+        l_params[compno].dy = 1;
+        l_params[compno].w = width;
+        l_params[compno].h = HEIGHT;
+        l_params[compno].prec = PREC;
+    }
+    l_image = opj_image_create(3, l_params, OPJ_CLRSPC_SRGB);
+    if (!l_image) {
+        return NULL;
+    }
+    l_image->x1 = width;
+    l_image->y1 = HEIGHT;
+    for (compno = 0; compno < 3; ++compno) {
+        for (y = 0; y < HEIGHT; ++y) {
+            for (x = 0; x < width; ++x) {
+                l_image->comps[compno].data[y * width + x] = (OPJ_INT32)((x * 5 +
+                        y * 3 + ((y * WIDTH + x) * 7919) % 61 + compno * 100) & 1023);
+            }
+        }
+    }
+    return l_image;
+}
+
+/* Lossless, a single tile. csty as in opj_cparameters_t, SOP and EPH. */
+/* The image of the given width is created here: with a single tile the */
+/* encoder transforms the component data in place */
+static int encode(test_memory_t *mem, OPJ_UINT32 width,
+                  OPJ_PROG_ORDER prog_order, int csty)
+{
+    opj_cparameters_t l_param;
+    opj_image_t *l_image = create_image(width);
+    opj_codec_t *l_codec = NULL;
+    opj_stream_t *l_stream = NULL;
+    int l_ok = 0;
+
+    memset(mem, 0, sizeof(*mem));
+    if (!l_image) {
+        return 0;
+    }
+    opj_set_default_encoder_parameters(&l_param);
+    l_param.numresolution = 4;
+    l_param.prog_order = prog_order;
+    l_param.csty = csty;
+    l_param.tcp_mct = 1;
+
+    l_codec = opj_create_compress(OPJ_CODEC_J2K);
+    l_stream = opj_stream_default_create(OPJ_FALSE);
+    if (!l_codec || !l_stream) {
+        goto cleanup;
+    }
+    opj_stream_set_user_data(l_stream, mem, NULL);
+    opj_stream_set_write_function(l_stream, test_write);
+    opj_stream_set_skip_function(l_stream, test_skip);
+    opj_stream_set_seek_function(l_stream, test_seek);
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+    l_ok = opj_setup_encoder(l_codec, &l_param, l_image) &&
+           opj_start_compress(l_codec, l_image, l_stream) &&
+           opj_encode(l_codec, l_stream) &&
+           opj_end_compress(l_codec, l_stream);
+
+cleanup:
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    opj_image_destroy(l_image);
+    return l_ok;
+}
+
+static OPJ_UINT32 read_uint(const OPJ_BYTE *p, int n)
+{
+    OPJ_UINT32 v = 0;
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static void write_uint(OPJ_BYTE *p, OPJ_UINT32 v, int n)
+{
+    int i;
+
+    for (i = n - 1; i >= 0; --i) {
+        p[i] = (OPJ_BYTE)v;
+        v >>= 8;
+    }
+}
+
+/* Offset of the first marker segment with this id in the main header, */
+/* or of the first SOT */
+static OPJ_SIZE_T find_marker(const test_memory_t *mem, OPJ_UINT32 id)
+{
+    OPJ_SIZE_T l_pos = 2;
+
+    while (l_pos + 4 <= mem->len) {
+        OPJ_UINT32 l_marker = read_uint(mem->data + l_pos, 2);
+        if (l_marker == id || l_marker == 0xff90) {
+            return l_pos;
+        }
+        l_pos += 2 + read_uint(mem->data + l_pos + 2, 2);
+    }
+    return 0;
+}
+
+/* One more guard bit for every sub-band, only the QCD changes */
+static int add_guard_bit(test_memory_t *mem)
+{
+    OPJ_SIZE_T l_qcd = find_marker(mem, 0xff5c);
+
+    if (!l_qcd || read_uint(mem->data + l_qcd, 2) != 0xff5c) {
+        return 0;
+    }
+    mem->data[l_qcd + 4] = (OPJ_BYTE)(mem->data[l_qcd + 4] + 0x20);
+    return 1;
+}
+
+/* Moves the packet headers of a single tile-part codestream with SOP and */
+/* EPH markers into a PPM marker segment. Packet headers, EPH included, */
+/* run from the end of a SOP to its EPH, the body from there to the next */
+/* SOP. Neither of them can contain 0xff91 or 0xff92 */
+static int move_headers_to_ppm(const test_memory_t *mem, test_memory_t *ppm)
+{
+    OPJ_SIZE_T l_sot = find_marker(mem, 0xff90);
+    OPJ_SIZE_T l_sod, l_end, l_pos;
+    OPJ_BYTE *l_headers, *l_body;
+    OPJ_SIZE_T l_headers_len = 0, l_body_len = 0;
+    OPJ_BYTE l_marker[11];
+    int l_ok = 0;
+
+    memset(ppm, 0, sizeof(*ppm));
+    if (!l_sot) {
+        return 0;
+    }
+    l_end = l_sot + read_uint(mem->data + l_sot + 6, 4);
+    for (l_sod = l_sot + 12; l_sod + 2 <= l_end &&
+            read_uint(mem->data + l_sod, 2) != 0xff93;
+            l_sod += 2 + read_uint(mem->data + l_sod + 2, 2)) {
+    }
+    if (l_sod + 2 > l_end || l_end > mem->len) {
+        return 0;
+    }
+
+    l_headers = (OPJ_BYTE *)malloc(l_end - l_sod);
+    l_body = (OPJ_BYTE *)malloc(l_end - l_sod);
+    if (!l_headers || !l_body) {
+        goto cleanup;
+    }
+    l_pos = l_sod + 2;
+    while (l_pos < l_end) {
+        OPJ_SIZE_T l_start;
+
+        if (l_pos + 6 > l_end || read_uint(mem->data + l_pos, 2) != 0xff91) {
+            fprintf(stderr, "no SOP at %lu\n", (unsigned long)l_pos);
+            goto cleanup;
+        }
+        memcpy(l_body + l_body_len, mem->data + l_pos, 6);
+        l_body_len += 6;
+        l_pos += 6;
+
+        l_start = l_pos;
+        while (l_pos + 2 <= l_end && read_uint(mem->data + l_pos, 2) != 0xff92) {
+            ++l_pos;
+        }
+        if (l_pos + 2 > l_end) {
+            fprintf(stderr, "no EPH after %lu\n", (unsigned long)l_start);
+            goto cleanup;
+        }
+        l_pos += 2;
+        memcpy(l_headers + l_headers_len, mem->data + l_start, l_pos - l_start);
+        l_headers_len += l_pos - l_start;
+
+        l_start = l_pos;
+        while (l_pos < l_end && (l_pos + 2 > l_end ||
+                                 read_uint(mem->data + l_pos, 2) != 0xff91)) {
+            ++l_pos;
+        }
+        memcpy(l_body + l_body_len, mem->data + l_start, l_pos - l_start);
+        l_body_len += l_pos - l_start;
+    }
+    if (2 + 1 + 4 + l_headers_len > 0xffff) {
+        fprintf(stderr, "packet headers too long for one PPM marker\n");
+        goto cleanup;
+    }
+
+    /* main header, PPM, tile-part header with the new Psot, body, EOC */
+    write_uint(l_marker, 0xff60, 2);
+    write_uint(l_marker + 2, (OPJ_UINT32)(2 + 1 + 4 + l_headers_len), 2);
+    l_marker[4] = 0;
+    write_uint(l_marker + 5, (OPJ_UINT32)l_headers_len, 4);
+    ppm->pos = 0;
+    if (test_write(mem->data, l_sot, ppm) != l_sot ||
+            test_write(l_marker, 9, ppm) != 9 ||
+            test_write(l_headers, l_headers_len, ppm) != l_headers_len ||
+            test_write(mem->data + l_sot, l_sod + 2 - l_sot, ppm) != l_sod + 2 - l_sot ||
+            test_write(l_body, l_body_len, ppm) != l_body_len ||
+            test_write(mem->data + l_end, mem->len - l_end, ppm) != mem->len - l_end) {
+        goto cleanup;
+    }
+    write_uint(ppm->data + l_sot + 9 + l_headers_len + 6,
+               (OPJ_UINT32)(l_sod + 2 - l_sot + l_body_len), 4);
+    l_ok = 1;
+
+cleanup:
+    if (!l_ok) {
+        free(ppm->data);
+        memset(ppm, 0, sizeof(*ppm));
+    }
+    free(l_headers);
+    free(l_body);
+    return l_ok;
+}
+
+static opj_codec_t* create_codec(void)
+{
+    opj_dparameters_t l_param;
+    opj_codec_t * l_codec;
+
+    opj_set_default_decoder_parameters(&l_param);
+    l_codec = opj_create_decompress(OPJ_CODEC_J2K);
+    if (!l_codec) {
+        return NULL;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+    if (!opj_setup_decoder(l_codec, &l_param)) {
+        opj_destroy_codec(l_codec);
+        return NULL;
+    }
+    return l_codec;
+}
+
+static int same_images(const opj_image_t *a, const opj_image_t *b)
+{
+    OPJ_UINT32 compno;
+
+    if (a->numcomps != b->numcomps) {
+        return 0;
+    }
+    for (compno = 0; compno < a->numcomps; ++compno) {
+        const opj_image_comp_t *l_a = &a->comps[compno];
+        const opj_image_comp_t *l_b = &b->comps[compno];
+
+        if (l_a->w != l_b->w || l_a->h != l_b->h || !l_a->data || !l_b->data ||
+                memcmp(l_a->data, l_b->data,
+                       (size_t)l_a->w * l_a->h * sizeof(OPJ_INT32)) != 0) {
+            fprintf(stderr, "component %u differs\n", compno);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Decodes first, then reads the main header of second with */
+/* opj_read_next_header(). Returns whether it was reused, -1 on errors. */
+/* If it was, second is decoded too and has to be the image expected */
+static int decode_next(const test_memory_t *first, const test_memory_t *second,
+                       const opj_image_t *expected)
+{
+    opj_buffer_info_t l_buffer_info;
+    opj_stream_t *l_stream = NULL;
+    opj_codec_t *l_codec = NULL;
+    opj_image_t *l_image = NULL;
+    int l_ret = -1;
+
+    l_buffer_info.buf = l_buffer_info.cur = first->data;
+    l_buffer_info.len = first->len;
+    l_stream = opj_stream_create_buffer_stream(&l_buffer_info, OPJ_TRUE);
+    l_codec = create_codec();
+    if (!l_stream || !l_codec ||
+            !opj_read_header(l_stream, l_codec, &l_image) ||
+            !opj_decode(l_codec, l_stream, l_image) ||
+            !opj_end_decompress(l_codec, l_stream)) {
+        fprintf(stderr, "decoding the first codestream failed\n");
+        goto cleanup;
+    }
+
+    l_buffer_info.buf = l_buffer_info.cur = second->data;
+    l_buffer_info.len = second->len;
+    if (!opj_stream_reset_buffer_stream(l_stream, &l_buffer_info)) {
+        goto cleanup;
+    }
+    if (!opj_read_next_header(l_stream, l_codec, &l_image)) {
+        l_ret = 0;
+        goto cleanup;
+    }
+    if (!opj_decode(l_codec, l_stream, l_image) ||
+            !opj_end_decompress(l_codec, l_stream)) {
+        fprintf(stderr, "decoding with the reused main header failed\n");
+        goto cleanup;
+    }
+    l_ret = same_images(l_image, expected) ? 1 : -1;
+
+cleanup:
+    if (l_image) {
+        opj_image_destroy(l_image);
+    }
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    return l_ret;
+}
+
+/* With a new codec and stream, as after opj_read_next_header() failed */
+static int decode_fresh(const test_memory_t *mem, const opj_image_t *expected)
+{
+    opj_buffer_info_t l_buffer_info;
+    opj_stream_t *l_stream = NULL;
+    opj_codec_t *l_codec = NULL;
+    opj_image_t *l_image = NULL;
+    int l_ok = 0;
+
+    l_buffer_info.buf = l_buffer_info.cur = mem->data;
+    l_buffer_info.len = mem->len;
+    l_stream = opj_stream_create_buffer_stream(&l_buffer_info, OPJ_TRUE);
+    l_codec = create_codec();
+    if (l_stream && l_codec &&
+            opj_read_header(l_stream, l_codec, &l_image) &&
+            opj_decode(l_codec, l_stream, l_image) &&
+            opj_end_decompress(l_codec, l_stream)) {
+        l_ok = same_images(l_image, expected);
+    }
+
+    if (l_image) {
+        opj_image_destroy(l_image);
+    }
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    return l_ok;
+}
+
+int main(int argc, char** argv)
+{
+    const char *l_mode = argc == 2 ? argv[1] : "";
+    opj_image_t *l_image = NULL;
+    test_memory_t l_first, l_second;
+    int l_expect_reuse = 0;
+    int l_reused;
+    int l_ret = 1;
+
+    if (strcmp(l_mode, "same") && strcmp(l_mode, "siz") &&
+            strcmp(l_mode, "cod") && strcmp(l_mode, "qcd") &&
+            strcmp(l_mode, "ppm")) {
+        fprintf(stderr,
+                "Usage: test_decode_next_header same|siz|cod|qcd|ppm\n");
+        return 1;
+    }
+    memset(&l_first, 0, sizeof(l_first));
+    memset(&l_second, 0, sizeof(l_second));
+
+    /* the second codestream is always lossless of l_image */
+    l_image = create_image(WIDTH);
+    if (!l_image ||
+            !encode(&l_second, WIDTH, OPJ_LRCP, strcmp(l_mode, "ppm") ? 0 : 6)) {
+        fprintf(stderr, "encoding failed\n");
+        goto cleanup;
+    }
+
+    if (!strcmp(l_mode, "same")) {
+        l_expect_reuse = 1;
+        l_first.len = l_second.len;
+        l_first.data = (OPJ_BYTE *)malloc(l_second.len);
+        if (!l_first.data) {
+            goto cleanup;
+        }
+        memcpy(l_first.data, l_second.data, l_second.len);
+    } else if (!strcmp(l_mode, "siz")) {
+        if (!encode(&l_first, WIDTH - 8, OPJ_LRCP, 0)) {
+            fprintf(stderr, "encoding failed\n");
+            goto cleanup;
+        }
+    } else if (!strcmp(l_mode, "cod")) {
+        if (!encode(&l_first, WIDTH, OPJ_RPCL, 0)) {
+            fprintf(stderr, "encoding failed\n");
+            goto cleanup;
+        }
+    } else if (!strcmp(l_mode, "qcd")) {
+        if (!encode(&l_first, WIDTH, OPJ_LRCP, 0) || !add_guard_bit(&l_first)) {
+            fprintf(stderr, "encoding failed\n");
+            goto cleanup;
+        }
+    } else {
+        test_memory_t l_sop_eph = l_second;
+
+        if (!move_headers_to_ppm(&l_sop_eph, &l_second)) {
+            fprintf(stderr, "cannot move the packet headers to PPM\n");
+            l_second = l_sop_eph;
+            goto cleanup;
+        }
+        free(l_sop_eph.data);
+        l_first.len = l_second.len;
+        l_first.data = (OPJ_BYTE *)malloc(l_second.len);
+        if (!l_first.data) {
+            goto cleanup;
+        }
+        memcpy(l_first.data, l_second.data, l_second.len);
+        if (!decode_fresh(&l_first, l_image)) {
+            fprintf(stderr, "decoding the PPM codestream failed\n");
+            goto cleanup;
+        }
+    }
+
+    l_reused = decode_next(&l_first, &l_second, l_image);
+    if (l_reused < 0) {
+        goto cleanup;
+    }
+    if (l_reused != l_expect_reuse) {
+        fprintf(stderr, "main header %s\n", l_reused ? "reused" : "not reused");
+        goto cleanup;
+    }
+    if (!l_reused && !decode_fresh(&l_second, l_image)) {
+        fprintf(stderr, "decoding the second codestream on its own failed\n");
+        goto cleanup;
+    }
+
+    printf("OK\n");
+    l_ret = 0;
+
+cleanup:
+    if (l_image) {
+        opj_image_destroy(l_image);
+    }
+    free(l_first.data);
+    free(l_second.data);
+    return l_ret;
+}
@@ -0,0 +1,245 @@
+/*
+ * The copyright in this software is being made available under the 2-clauses
+ * BSD License, included below. This software may be subject to other third
+ * party and contributor rights, including patent rights, and no such rights
+ * are granted under this license.
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decodes the same J2K codestream as a sequence of frames, the way a frame
+ * server does: one codec, one stream reset per frame, opj_read_next_header()
+ * with the image of the previous frame. Counts heap allocations by wrapping
+ * the glibc allocator and checks that frames after the first ones don't
+ * allocate at all and still decode to the same image.
+ *
+ * Only the allocations of the decoding thread are counted: the scratch
+ * buffers of worker threads grow until each of them has decoded the biggest
+ * code-block, which depends on how jobs were scheduled.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "openjpeg.h"
+
+#define NUM_FRAMES 6
+/* the first frame allocates everything, the second one gives the decoder */
+/* a buffer to swap with the image of the first */
+#define WARMUP_FRAMES 2
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/* only set in the decoding thread */
+static __thread int counting = 0;
+static volatile int allocations = 0;
+
+static void count(void)
+{
+    if (counting) {
+        __sync_fetch_and_add(&allocations, 1);
+    }
+}
+
+void *malloc(size_t size)
+{
+    count();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    count();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+    count();
+    ptr = __libc_memalign(alignment, size);
+    if (!ptr) {
+        return 12; /* ENOMEM */
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+static void quiet_callback(const char *msg, void *client_data)
+{
+    (void)msg;
+    (void)client_data;
+}
+
+static unsigned int checksum(const opj_image_t *image)
+{
+    unsigned int sum = 0;
+    OPJ_UINT32 compno;
+    OPJ_SIZE_T i;
+
+    for (compno = 0; compno < image->numcomps; ++compno) {
+        const opj_image_comp_t *comp = &image->comps[compno];
+        for (i = 0; i < (OPJ_SIZE_T)comp->w * comp->h; ++i) {
+            sum = sum * 31 + (unsigned int)comp->data[i];
+        }
+    }
+    return sum;
+}
+
+int main(int argc, char** argv)
+{
+    FILE *f;
+    long l_len;
+    OPJ_BYTE *l_data;
+    opj_buffer_info_t l_buffer_info;
+    opj_dparameters_t l_param;
+    opj_codec_t *l_codec = NULL;
+    opj_stream_t *l_stream = NULL;
+    opj_image_t *l_image = NULL;
+    unsigned int l_first_sum = 0;
+    int l_num_threads = 0;
+    int l_frame;
+    int l_ret = 1;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: test_decode_no_alloc input_file.j2k [num_threads]\n");
+        return 1;
+    }
+    if (argc == 3) {
+        l_num_threads = atoi(argv[2]);
+    }
+
+    f = fopen(argv[1], "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    l_len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    l_data = (OPJ_BYTE *)malloc((size_t)l_len);
+    if (!l_data || fread(l_data, 1, (size_t)l_len, f) != (size_t)l_len) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        fclose(f);
+        free(l_data);
+        return 1;
+    }
+    fclose(f);
+
+    opj_set_default_decoder_parameters(&l_param);
+    l_codec = opj_create_decompress(OPJ_CODEC_J2K);
+    if (!l_codec) {
+        goto cleanup;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+    if (!opj_setup_decoder(l_codec, &l_param) ||
+            !opj_codec_set_threads(l_codec, l_num_threads)) {
+        fprintf(stderr, "cannot set up the decoder\n");
+        goto cleanup;
+    }
+
+    l_buffer_info.buf = l_data;
+    l_buffer_info.cur = l_data;
+    l_buffer_info.len = (OPJ_SIZE_T)l_len;
+    l_stream = opj_stream_create_buffer_stream(&l_buffer_info, OPJ_TRUE);
+    if (!l_stream) {
+        goto cleanup;
+    }
+
+    for (l_frame = 0; l_frame < NUM_FRAMES; ++l_frame) {
+        OPJ_BOOL l_ok;
+        unsigned int l_sum;
+
+        allocations = 0;
+        counting = l_frame >= WARMUP_FRAMES;
+        if (l_frame == 0) {
+            l_ok = opj_read_header(l_stream, l_codec, &l_image);
+        } else {
+            l_buffer_info.cur = l_data;
+            l_ok = opj_stream_reset_buffer_stream(l_stream, &l_buffer_info) &&
+                   opj_read_next_header(l_stream, l_codec, &l_image);
+        }
+        l_ok = l_ok && opj_decode(l_codec, l_stream, l_image) &&
+               opj_end_decompress(l_codec, l_stream);
+        counting = 0;
+        if (!l_ok) {
+            fprintf(stderr, "decoding frame %d failed\n", l_frame);
+            goto cleanup;
+        }
+
+        l_sum = checksum(l_image);
+        if (l_frame == 0) {
+            l_first_sum = l_sum;
+        } else if (l_sum != l_first_sum) {
+            fprintf(stderr, "frame %d decoded differently\n", l_frame);
+            goto cleanup;
+        }
+        if (allocations) {
+            fprintf(stderr, "frame %d made %d allocations\n", l_frame, allocations);
+            goto cleanup;
+        }
+    }
+
+    printf("OK\n");
+    l_ret = 0;
+
+cleanup:
+    if (l_image) {
+        opj_image_destroy(l_image);
+    }
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    free(l_data);
+    return l_ret;
+}
@@ -0,0 +1,322 @@
+/*
+ * The copyright in this software is being made available under the 2-clauses
+ * BSD License, included below. This software may be subject to other third
+ * party and contributor rights, including patent rights, and no such rights
+ * are granted under this license.
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decodes a J2K codestream into an image and then into caller allocated 16
+ * bit planes with opj_set_decoded_planes(), in both plane formats, for the
+ * whole image and a window of it, and checks that the planes hold the
+ * samples of the image. The planes get a padded stride and a border that
+ * must stay untouched. The codestream is decoded twice into the planes with
+ * opj_read_next_header() in between, the way a frame server does.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "openjpeg.h"
+
+/* samples of padding at the end of the rows and rows of border around */
+#define PADDING 5
+#define BORDER 2
+#define GUARD 0xA5A5
+
+static void quiet_callback(const char *msg, void *client_data)
+{
+    (void)msg;
+    (void)client_data;
+}
+
+static opj_codec_t* create_codec(void)
+{
+    opj_dparameters_t l_param;
+    opj_codec_t * l_codec;
+
+    opj_set_default_decoder_parameters(&l_param);
+    l_codec = opj_create_decompress(OPJ_CODEC_J2K);
+    if (!l_codec) {
+        return NULL;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+
+    if (!opj_setup_decoder(l_codec, &l_param)) {
+        opj_destroy_codec(l_codec);
+        return NULL;
+    }
+    return l_codec;
+}
+
+/* Plane of a component, with BORDER rows above and below */
+typedef struct {
+    OPJ_UINT16 *buffer;
+    OPJ_SIZE_T stride;
+    OPJ_SIZE_T size;
+} test_plane_t;
+
+/* Decodes the area (all zeros for the whole image) into an image, or into */
+/* planes when planes is not NULL. Returns the image, NULL on failure */
+static opj_image_t* decode(OPJ_BYTE *data, OPJ_SIZE_T len,
+                           OPJ_UINT32 reduce, const OPJ_INT32 area[4],
+                           test_plane_t *planes, OPJ_PLANE_FORMAT format)
+{
+    opj_buffer_info_t l_buffer_info;
+    opj_stream_t * l_stream = NULL;
+    opj_codec_t * l_codec = NULL;
+    opj_image_t * l_image = NULL;
+    opj_output_plane_t l_planes[4];
+    OPJ_UINT32 compno;
+    int l_frame;
+    OPJ_BOOL l_ok = OPJ_FALSE;
+
+    l_buffer_info.buf = data;
+    l_buffer_info.cur = data;
+    l_buffer_info.len = len;
+
+    l_stream = opj_stream_create_buffer_stream(&l_buffer_info, OPJ_TRUE);
+    l_codec = create_codec();
+    if (!l_stream || !l_codec) {
+        goto cleanup;
+    }
+
+    for (l_frame = 0; l_frame < (planes ? 2 : 1); ++l_frame) {
+        if (l_frame == 0) {
+            if (!opj_read_header(l_stream, l_codec, &l_image)) {
+                goto cleanup;
+            }
+        } else {
+            l_buffer_info.cur = data;
+            if (!opj_stream_reset_buffer_stream(l_stream, &l_buffer_info) ||
+                    !opj_read_next_header(l_stream, l_codec, &l_image)) {
+                goto cleanup;
+            }
+        }
+        if (!opj_set_decoded_resolution_factor(l_codec, reduce) ||
+                !opj_set_decode_area(l_codec, l_image, area[0], area[1],
+                                     area[2], area[3])) {
+            goto cleanup;
+        }
+
+        if (planes) {
+            if (l_image->numcomps > 4) {
+                goto cleanup;
+            }
+            for (compno = 0; compno < l_image->numcomps; ++compno) {
+                opj_image_comp_t *l_comp = &l_image->comps[compno];
+                test_plane_t *l_plane = &planes[compno];
+                OPJ_SIZE_T i;
+
+                if (l_frame == 0) {
+                    l_plane->stride = (OPJ_SIZE_T)l_comp->w + PADDING;
+                    l_plane->size = l_plane->stride * (l_comp->h + 2 * BORDER);
+                    l_plane->buffer = (OPJ_UINT16 *)malloc(l_plane->size *
+                                                           sizeof(OPJ_UINT16));
+                    if (!l_plane->buffer) {
+                        goto cleanup;
+                    }
+                }
+                for (i = 0; i < l_plane->size; ++i) {
+                    l_plane->buffer[i] = GUARD;
+                }
+                l_planes[compno].data = l_plane->buffer + BORDER * l_plane->stride;
+                l_planes[compno].stride = l_plane->stride * sizeof(OPJ_UINT16);
+                l_planes[compno].format = format;
+            }
+            if (!opj_set_decoded_planes(l_codec, l_planes, l_image->numcomps)) {
+                goto cleanup;
+            }
+        }
+
+        if (!opj_decode(l_codec, l_stream, l_image) ||
+                !opj_end_decompress(l_codec, l_stream)) {
+            goto cleanup;
+        }
+    }
+    l_ok = OPJ_TRUE;
+
+cleanup:
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    if (!l_ok && l_image) {
+        opj_image_destroy(l_image);
+        l_image = NULL;
+    }
+    return l_image;
+}
+
+static int check_planes(const opj_image_t *image, const test_plane_t *planes,
+                        OPJ_PLANE_FORMAT format)
+{
+    OPJ_UINT32 compno, x, y;
+
+    for (compno = 0; compno < image->numcomps; ++compno) {
+        const opj_image_comp_t *l_comp = &image->comps[compno];
+        const test_plane_t *l_plane = &planes[compno];
+        OPJ_INT32 l_max = (OPJ_INT32)((1U << l_comp->prec) - 1);
+        OPJ_UINT32 l_shift = format == OPJ_PLANE_U16_MSB ? 16 - l_comp->prec : 0;
+
+        for (y = 0; y < l_comp->h + 2 * BORDER; ++y) {
+            const OPJ_UINT16 *l_row = l_plane->buffer + y * l_plane->stride;
+            for (x = 0; x < l_plane->stride; ++x) {
+                OPJ_UINT16 l_expected = GUARD;
+                if (y >= BORDER && y < l_comp->h + BORDER && x < l_comp->w) {
+                    OPJ_INT32 v = l_comp->data[(y - BORDER) * l_comp->w + x];
+                    v = v < 0 ? 0 : (v > l_max ? l_max : v);
+                    l_expected = (OPJ_UINT16)((OPJ_UINT32)v << l_shift);
+                }
+                if (l_row[x] != l_expected) {
+                    fprintf(stderr, "component %u: %u instead of %u at %u,%d\n",
+                            compno, l_row[x], l_expected, x, (int)y - BORDER);
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+/* Checks the planes against the image decoded from the same area */
+static int test_area(OPJ_BYTE *data, OPJ_SIZE_T len, OPJ_UINT32 reduce,
+                     const OPJ_INT32 area[4], const opj_image_t *image)
+{
+    int l_format;
+
+    for (l_format = OPJ_PLANE_U16; l_format <= OPJ_PLANE_U16_MSB; ++l_format) {
+        test_plane_t l_planes[4];
+        opj_image_t *l_planes_image;
+        OPJ_UINT32 compno;
+        int l_ok;
+
+        memset(l_planes, 0, sizeof(l_planes));
+        l_planes_image = decode(data, len, reduce, area, l_planes,
+                                (OPJ_PLANE_FORMAT)l_format);
+        l_ok = l_planes_image != NULL &&
+               check_planes(image, l_planes, (OPJ_PLANE_FORMAT)l_format);
+        if (!l_planes_image) {
+            fprintf(stderr, "decoding into planes failed\n");
+        }
+        for (compno = 0; compno < 4; ++compno) {
+            free(l_planes[compno].buffer);
+        }
+        if (l_planes_image) {
+            opj_image_destroy(l_planes_image);
+        }
+        if (!l_ok) {
+            fprintf(stderr, "area %d,%d,%d,%d format %d failed\n",
+                    area[0], area[1], area[2], area[3], l_format);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    FILE *f;
+    long l_len;
+    OPJ_BYTE *l_data;
+    opj_image_t *l_image = NULL, *l_window_image = NULL;
+    OPJ_UINT32 l_reduce = 0;
+    OPJ_INT32 l_whole[4] = { 0, 0, 0, 0 };
+    OPJ_INT32 l_window[4];
+    OPJ_INT32 l_w, l_h;
+    int l_ret = 1;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: test_decode_planes input_file.j2k [reduce]\n");
+        return 1;
+    }
+    if (argc == 3) {
+        l_reduce = (OPJ_UINT32)atoi(argv[2]);
+    }
+
+    f = fopen(argv[1], "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    l_len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    l_data = (OPJ_BYTE *)malloc((size_t)l_len);
+    if (!l_data || fread(l_data, 1, (size_t)l_len, f) != (size_t)l_len) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        fclose(f);
+        free(l_data);
+        return 1;
+    }
+    fclose(f);
+
+    l_image = decode(l_data, (OPJ_SIZE_T)l_len, l_reduce, l_whole, NULL,
+                     OPJ_PLANE_U16);
+    if (!l_image) {
+        fprintf(stderr, "decoding into the image failed\n");
+        goto cleanup;
+    }
+    if (!test_area(l_data, (OPJ_SIZE_T)l_len, l_reduce, l_whole, l_image)) {
+        goto cleanup;
+    }
+
+    /* A window that does not fall on tile borders */
+    l_w = (OPJ_INT32)(l_image->x1 - l_image->x0);
+    l_h = (OPJ_INT32)(l_image->y1 - l_image->y0);
+    l_window[0] = (OPJ_INT32)l_image->x0 + l_w / 5;
+    l_window[1] = (OPJ_INT32)l_image->y0 + l_h / 7;
+    l_window[2] = (OPJ_INT32)l_image->x0 + l_w * 3 / 4;
+    l_window[3] = (OPJ_INT32)l_image->y1 - l_h / 9;
+    l_window_image = decode(l_data, (OPJ_SIZE_T)l_len, l_reduce, l_window,
+                            NULL, OPJ_PLANE_U16);
+    if (!l_window_image) {
+        fprintf(stderr, "decoding the window into the image failed\n");
+        goto cleanup;
+    }
+    if (!test_area(l_data, (OPJ_SIZE_T)l_len, l_reduce, l_window,
+                   l_window_image)) {
+        goto cleanup;
+    }
+
+    printf("OK\n");
+    l_ret = 0;
+
+cleanup:
+    if (l_image) {
+        opj_image_destroy(l_image);
+    }
+    if (l_window_image) {
+        opj_image_destroy(l_window_image);
+    }
+    free(l_data);
+    return l_ret;
+}
@@ -0,0 +1,273 @@
+/*
+ * The copyright in this software is being made available under the 2-clauses
+ * BSD License, included below. This software may be subject to other third
+ * party and contributor rights, including patent rights, and no such rights
+ * are granted under this license.
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decodes a J2K codestream cut at several lengths with
+ * OPJ_DPARAMETERS_ALLOW_TRUNCATION_FLAG, both with opj_decode() and tile by
+ * tile, and checks that the whole image comes out every time. Without the
+ * flag a codestream cut inside tile data must still fail.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "openjpeg.h"
+
+static void quiet_callback(const char *msg, void *client_data)
+{
+    (void)msg;
+    (void)client_data;
+}
+
+static opj_codec_t* create_codec(OPJ_BOOL allow_truncation)
+{
+    opj_dparameters_t l_param;
+    opj_codec_t * l_codec;
+
+    opj_set_default_decoder_parameters(&l_param);
+    if (allow_truncation) {
+        l_param.flags |= OPJ_DPARAMETERS_ALLOW_TRUNCATION_FLAG;
+    }
+
+    l_codec = opj_create_decompress(OPJ_CODEC_J2K);
+    if (!l_codec) {
+        return NULL;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+
+    if (!opj_setup_decoder(l_codec, &l_param)) {
+        opj_destroy_codec(l_codec);
+        return NULL;
+    }
+    return l_codec;
+}
+
+/* Returns the decoded image, NULL if decoding failed */
+static opj_image_t* decode(OPJ_BYTE *data, OPJ_SIZE_T len,
+                           OPJ_BOOL allow_truncation, OPJ_BOOL tile_by_tile)
+{
+    opj_buffer_info_t l_buffer_info;
+    opj_stream_t * l_stream = NULL;
+    opj_codec_t * l_codec = NULL;
+    opj_image_t * l_image = NULL;
+    OPJ_BYTE * l_tile_data = NULL;
+    OPJ_BOOL l_ok = OPJ_FALSE;
+
+    l_buffer_info.buf = data;
+    l_buffer_info.cur = data;
+    l_buffer_info.len = len;
+
+    l_stream = opj_stream_create_buffer_stream(&l_buffer_info, OPJ_TRUE);
+    l_codec = create_codec(allow_truncation);
+    if (!l_stream || !l_codec) {
+        goto cleanup;
+    }
+    if (!opj_read_header(l_stream, l_codec, &l_image)) {
+        goto cleanup;
+    }
+
+    if (tile_by_tile) {
+        OPJ_UINT32 l_tile_index, l_data_size, l_nb_comps;
+        OPJ_INT32 l_tx0, l_ty0, l_tx1, l_ty1;
+        OPJ_BOOL l_go_on = OPJ_TRUE;
+
+        while (l_go_on) {
+            if (!opj_read_tile_header(l_codec, l_stream, &l_tile_index,
+                                      &l_data_size, &l_tx0, &l_ty0, &l_tx1, &l_ty1,
+                                      &l_nb_comps, &l_go_on)) {
+                goto cleanup;
+            }
+            if (!l_go_on) {
+                break;
+            }
+            free(l_tile_data);
+            l_tile_data = (OPJ_BYTE *)malloc(l_data_size);
+            if (!l_tile_data) {
+                goto cleanup;
+            }
+            if (!opj_decode_tile_data(l_codec, l_tile_index, l_tile_data,
+                                      l_data_size, l_stream)) {
+                goto cleanup;
+            }
+        }
+    } else {
+        OPJ_UINT32 compno;
+
+        if (!opj_decode(l_codec, l_stream, l_image)) {
+            goto cleanup;
+        }
+        for (compno = 0; compno < l_image->numcomps; ++compno) {
+            opj_image_comp_t *l_comp = &l_image->comps[compno];
+            if (!l_comp->data ||
+                    l_comp->w != (l_image->x1 - l_image->x0 + l_comp->dx - 1) / l_comp->dx ||
+                    l_comp->h != (l_image->y1 - l_image->y0 + l_comp->dy - 1) / l_comp->dy) {
+                fprintf(stderr, "component %u is %ux%u\n", compno, l_comp->w,
+                        l_comp->h);
+                goto cleanup;
+            }
+        }
+    }
+    l_ok = opj_end_decompress(l_codec, l_stream);
+
+cleanup:
+    free(l_tile_data);
+    if (l_stream) {
+        opj_stream_destroy(l_stream);
+    }
+    if (l_codec) {
+        opj_destroy_codec(l_codec);
+    }
+    if (!l_ok && l_image) {
+        opj_image_destroy(l_image);
+        l_image = NULL;
+    }
+    return l_image;
+}
+
+static int images_equal(const opj_image_t *a, const opj_image_t *b)
+{
+    OPJ_UINT32 compno;
+
+    if (a->numcomps != b->numcomps) {
+        return 0;
+    }
+    for (compno = 0; compno < a->numcomps; ++compno) {
+        const opj_image_comp_t *ca = &a->comps[compno];
+        const opj_image_comp_t *cb = &b->comps[compno];
+        if (ca->w != cb->w || ca->h != cb->h ||
+                memcmp(ca->data, cb->data, (size_t)ca->w * ca->h * sizeof(OPJ_INT32))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    FILE *f;
+    long l_len, l_sot;
+    OPJ_BYTE *l_data;
+    opj_image_t *l_full, *l_full_truncation, *l_image;
+    int l_cut;
+    int l_ret = 1;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: test_decode_truncated input_file.j2k\n");
+        return 1;
+    }
+
+    f = fopen(argv[1], "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    l_len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    l_data = (OPJ_BYTE *)malloc((size_t)l_len);
+    if (!l_data || fread(l_data, 1, (size_t)l_len, f) != (size_t)l_len) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        fclose(f);
+        free(l_data);
+        return 1;
+    }
+    fclose(f);
+
+    /* A complete codestream decodes the same with and without the flag */
+    l_full = decode(l_data, (OPJ_SIZE_T)l_len, OPJ_FALSE, OPJ_FALSE);
+    l_full_truncation = decode(l_data, (OPJ_SIZE_T)l_len, OPJ_TRUE, OPJ_FALSE);
+    if (!l_full || !l_full_truncation || !images_equal(l_full, l_full_truncation)) {
+        fprintf(stderr, "complete codestream decoded differently\n");
+        goto cleanup;
+    }
+
+    /* Without the flag a cut inside tile data is an error */
+    l_image = decode(l_data, (OPJ_SIZE_T)l_len / 2, OPJ_FALSE, OPJ_FALSE);
+    if (l_image) {
+        fprintf(stderr, "codestream cut at %ld decoded without the flag\n", l_len / 2);
+        opj_image_destroy(l_image);
+        goto cleanup;
+    }
+
+    /* Cut anywhere after the main header, which ends with the first SOT */
+    /* marker */
+    for (l_sot = 0; l_sot + 1 < l_len; ++l_sot) {
+        if (l_data[l_sot] == 0xff && l_data[l_sot + 1] == 0x90) {
+            break;
+        }
+    }
+    l_sot += 2;
+    for (l_cut = 1; l_cut < 16; ++l_cut) {
+        OPJ_SIZE_T l_cut_len = (OPJ_SIZE_T)(l_sot + (l_len - l_sot) * l_cut / 16);
+
+        l_image = decode(l_data, l_cut_len, OPJ_TRUE, OPJ_FALSE);
+        if (!l_image) {
+            fprintf(stderr, "opj_decode failed on codestream cut at %lu\n",
+                    (unsigned long)l_cut_len);
+            goto cleanup;
+        }
+        opj_image_destroy(l_image);
+
+        l_image = decode(l_data, l_cut_len, OPJ_TRUE, OPJ_TRUE);
+        if (!l_image) {
+            fprintf(stderr, "tile decoding failed on codestream cut at %lu\n",
+                    (unsigned long)l_cut_len);
+            goto cleanup;
+        }
+        opj_image_destroy(l_image);
+    }
+
+    /* No EOC marker */
+    l_image = decode(l_data, (OPJ_SIZE_T)l_len - 2, OPJ_TRUE, OPJ_FALSE);
+    if (!l_image || !images_equal(l_full, l_image)) {
+        fprintf(stderr, "codestream without EOC decoded differently\n");
+        if (l_image) {
+            opj_image_destroy(l_image);
+        }
+        goto cleanup;
+    }
+    opj_image_destroy(l_image);
+
+    printf("OK\n");
+    l_ret = 0;
+
+cleanup:
+    if (l_full) {
+        opj_image_destroy(l_full);
+    }
+    if (l_full_truncation) {
+        opj_image_destroy(l_full_truncation);
+    }
+    free(l_data);
+    return l_ret;
+}
@@ -0,0 +1,277 @@
+/*
+ * The copyright in this software is being made available under the 2-clauses
+ * BSD License, included below. This software may be subject to other third
+ * party and contributor rights, including patent rights, and no such rights
+ * are granted under this license.
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS `AS IS'
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decodes the same J2K codestream in several threads at the same time, each
+ * with its own codec attached to one shared thread pool, and checks that all
+ * of them get the image of a single-threaded decode. The checksums of the
+ * decoded components are computed with a job group on the same pool.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "openjpeg.h"
+
+#define NUM_ROUNDS 4
+#define MAX_DECODERS 16
+
+typedef struct {
+    const OPJ_BYTE *data;
+    OPJ_SIZE_T len;
+    opj_shared_thread_pool_t pool;
+    unsigned int expected_sum;
+    int failed;
+} decoder_arg_t;
+
+typedef struct {
+    const opj_image_t *image;
+    unsigned int sums[4];
+} checksum_job_t;
+
+static void quiet_callback(const char *msg, void *client_data)
+{
+    (void)msg;
+    (void)client_data;
+}
+
+static unsigned int checksum_comp(const opj_image_comp_t *comp)
+{
+    unsigned int sum = 0;
+    OPJ_SIZE_T i;
+
+    for (i = 0; i < (OPJ_SIZE_T)comp->w * comp->h; ++i) {
+        sum = sum * 31 + (unsigned int)comp->data[i];
+    }
+    return sum;
+}
+
+static unsigned int combine(const unsigned int *sums, OPJ_UINT32 numcomps)
+{
+    unsigned int sum = 0;
+    OPJ_UINT32 compno;
+
+    for (compno = 0; compno < numcomps; ++compno) {
+        sum = sum * 7 + sums[compno];
+    }
+    return sum;
+}
+
+static void checksum_job(void *p_data, int p_index)
+{
+    checksum_job_t *job = (checksum_job_t *)p_data;
+
+    job->sums[p_index] = checksum_comp(&job->image->comps[p_index]);
+}
+
+static opj_image_t *decode(const OPJ_BYTE *data, OPJ_SIZE_T len,
+                           opj_shared_thread_pool_t pool)
+{
+    opj_buffer_info_t l_buffer_info;
+    opj_dparameters_t l_param;
+    opj_codec_t *l_codec;
+    opj_stream_t *l_stream = NULL;
+    opj_image_t *l_image = NULL;
+    OPJ_BOOL l_ok = OPJ_FALSE;
+
+    opj_set_default_decoder_parameters(&l_param);
+    l_codec = opj_create_decompress(OPJ_CODEC_J2K);
+    if (!l_codec) {
+        return NULL;
+    }
+    opj_set_info_handler(l_codec, quiet_callback, 00);
+    opj_set_warning_handler(l_codec, quiet_callback, 00);
+    opj_set_error_handler(l_codec, quiet_callback, 00);
+    if (!opj_setup_decoder(l_codec, &l_param)) {
+        goto cleanup;
+    }
+    if (pool) {
+        if (!opj_codec_set_shared_thread_pool(l_codec, pool)) {
+            goto cleanup;
+        }
+    } else if (!opj_codec_set_threads(l_codec, 0)) {
+        goto cleanup;
+    }
+
+    l_buffer_info.buf = (OPJ_BYTE *)data;
+    l_buffer_info.cur = (OPJ_BYTE *)data;
+    l_buffer_info.len = len;
+    l_stream = opj_stream_create_buffer_stream(&l_buffer_info, OPJ_TRUE);
+    if (!l_stream) {
+        goto cleanup;
+    }
+    l_ok = opj_read_header(l_stream, l_codec, &l_image) &&
+           opj_decode(l_codec, l_stream, l_image) &&
+           opj_end_decompress(l_codec, l_stream);
+
+cleanup:
+    if (!l_ok) {
+        opj_image_destroy(l_image);
+        l_image = NULL;
+    }
+    opj_stream_destroy(l_stream);
+    opj_destroy_codec(l_codec);
+    return l_image;
+}
+
+static void *decoder_thread(void *user_data)
+{
+    decoder_arg_t *arg = (decoder_arg_t *)user_data;
+    opj_job_group_t l_group;
+    int l_round;
+
+    l_group = opj_create_job_group(arg->pool);
+    if (!l_group) {
+        arg->failed = 1;
+        return NULL;
+    }
+    for (l_round = 0; l_round < NUM_ROUNDS && !arg->failed; ++l_round) {
+        checksum_job_t l_job;
+        opj_image_t *l_image = decode(arg->data, arg->len, arg->pool);
+
+        if (!l_image || l_image->numcomps > 4) {
+            arg->failed = 1;
+        } else {
+            l_job.image = l_image;
+            if (!opj_job_group_run(l_group, checksum_job, &l_job,
+                                   (int)l_image->numcomps) ||
+                    combine(l_job.sums, l_image->numcomps) != arg->expected_sum) {
+                arg->failed = 1;
+            }
+        }
+        opj_image_destroy(l_image);
+    }
+    opj_destroy_job_group(l_group);
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    FILE *f;
+    long l_len;
+    OPJ_BYTE *l_data;
+    opj_image_t *l_image;
+    opj_shared_thread_pool_t l_pool;
+    decoder_arg_t l_args[MAX_DECODERS];
+    pthread_t l_threads[MAX_DECODERS];
+    unsigned int l_sums[4];
+    unsigned int l_expected_sum;
+    OPJ_UINT32 compno;
+    int l_num_threads = 3;
+    int l_num_decoders = 3;
+    int i;
+    int l_ret = 0;
+
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr,
+                "Usage: test_shared_thread_pool input_file.j2k [num_threads] [num_decoders]\n");
+        return 1;
+    }
+    if (argc >= 3) {
+        l_num_threads = atoi(argv[2]);
+    }
+    if (argc == 4) {
+        l_num_decoders = atoi(argv[3]);
+    }
+    if (l_num_decoders < 1 || l_num_decoders > MAX_DECODERS) {
+        fprintf(stderr, "num_decoders must be between 1 and %d\n", MAX_DECODERS);
+        return 1;
+    }
+
+    if (!opj_has_thread_support()) {
+        printf("no thread support, nothing to test\n");
+        return 0;
+    }
+
+    f = fopen(argv[1], "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    l_len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    l_data = (OPJ_BYTE *)malloc((size_t)l_len);
+    if (!l_data || fread(l_data, 1, (size_t)l_len, f) != (size_t)l_len) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        fclose(f);
+        free(l_data);
+        return 1;
+    }
+    fclose(f);
+
+    l_image = decode(l_data, (OPJ_SIZE_T)l_len, NULL);
+    if (!l_image || l_image->numcomps > 4) {
+        fprintf(stderr, "single-threaded decode failed\n");
+        opj_image_destroy(l_image);
+        free(l_data);
+        return 1;
+    }
+    for (compno = 0; compno < l_image->numcomps; ++compno) {
+        l_sums[compno] = checksum_comp(&l_image->comps[compno]);
+    }
+    l_expected_sum = combine(l_sums, l_image->numcomps);
+    opj_image_destroy(l_image);
+
+    l_pool = opj_create_shared_thread_pool(l_num_threads);
+    if (!l_pool) {
+        fprintf(stderr, "cannot create a pool of %d threads\n", l_num_threads);
+        free(l_data);
+        return 1;
+    }
+
+    for (i = 0; i < l_num_decoders; ++i) {
+        l_args[i].data = l_data;
+        l_args[i].len = (OPJ_SIZE_T)l_len;
+        l_args[i].pool = l_pool;
+        l_args[i].expected_sum = l_expected_sum;
+        l_args[i].failed = 0;
+        if (pthread_create(&l_threads[i], NULL, decoder_thread, &l_args[i]) != 0) {
+            fprintf(stderr, "cannot create decoder thread %d\n", i);
+            l_num_decoders = i;
+            l_ret = 1;
+            break;
+        }
+    }
+    for (i = 0; i < l_num_decoders; ++i) {
+        pthread_join(l_threads[i], NULL);
+        if (l_args[i].failed) {
+            fprintf(stderr, "decoder %d did not get the expected image\n", i);
+            l_ret = 1;
+        }
+    }
+
+    /* the codecs and job groups are gone, this stops the threads */
+    opj_destroy_shared_thread_pool(l_pool);
+    free(l_data);
+    return l_ret;
+}
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include "pack.h"
+
+// rows [strip * h / num_strips, (strip + 1) * h / num_strips) of a plane h
+// rows high
+static void strip_rows(int h, int strip, int num_strips, int *y0, int *y1) {
+    *y0 = (int)((int64_t)h * strip / num_strips);
+    *y1 = (int)((int64_t)h * (strip + 1) / num_strips);
+}
+
+void pack_image_gbrp16_strip(opj_image_t *image, unsigned char **planes, const int *linesizes, int shift, int strip, int num_strips) {
+    // r->g[1], g->b[2], b->r[0]
+    static const int comp_table[3] = { 1, 2, 0 };
+
+    int w = (int)image->comps[0].w;
+    int y0, y1;
+    int numcomps = image->numcomps < 3 ? image->numcomps : 3;
+
+    strip_rows((int)image->comps[0].h, strip, num_strips, &y0, &y1);
+    for (int i = 0; i < numcomps; i++) {
+        opj_image_comp_t *comp = &image->comps[comp_table[i]];
+        int mask = (1 << (comp->prec - shift)) - 1;
+        const int *src = comp->data + (size_t)y0 * w;
+        for (int y = y0; y < y1; y++) {
+            uint16_t *dst = (uint16_t*)(planes[i] + (size_t)y * linesizes[i]);
+            // plain loop without branches so the compiler can vectorize it
+            for (int x = 0; x < w; x++) {
+                int v = src[x];
+                v = v < 0 ? 0 : v;
+                v = v > 65535 ? 65535 : v;
+                dst[x] = (uint16_t)((v >> shift) & mask);
+            }
+            src += w;
+        }
+    }
+}
+
+void pack_image_gbrp16(opj_image_t *image, unsigned char **planes, const int *linesizes) {
+    pack_image_gbrp16_strip(image, planes, linesizes, 0, 0, 1);
+}
+
+void pack_image_yuv16_strip(opj_image_t *image, unsigned char **planes, const int *linesizes, int shift, int strip, int num_strips) {
+    int numcomps = image->numcomps < 3 ? image->numcomps : 3;
+
+    for (int i = 0; i < numcomps; i++) {
+        opj_image_comp_t *comp = &image->comps[i];
+        int w = (int)comp->w;
+        int y0, y1;
+        int mask = (1 << (comp->prec - shift)) - 1;
+
+        // subsampled planes get the same share of their own rows
+        strip_rows((int)comp->h, strip, num_strips, &y0, &y1);
+        const int *src = comp->data + (size_t)y0 * w;
+        for (int y = y0; y < y1; y++) {
+            uint16_t *dst = (uint16_t*)(planes[i] + (size_t)y * linesizes[i]);
+            for (int x = 0; x < w; x++) {
+                int v = src[x];
+                v = v < 0 ? 0 : v;
+                v = v > 65535 ? 65535 : v;
+                dst[x] = (uint16_t)((v >> shift) & mask);
+            }
+            src += w;
+        }
+    }
+}
+
+void pack_image_yuv16(opj_image_t *image, unsigned char **planes, const int *linesizes) {
+    pack_image_yuv16_strip(image, planes, linesizes, 0, 0, 1);
+}
+
+void pack_pcm24le_to_s32(const unsigned char *src, unsigned char *dst, unsigned int num_samples) {
+    // av frame buffers are aligned
+    uint32_t *out = (uint32_t*)dst;
+    for (unsigned int i = 0; i < num_samples; ++i) {
+        out[i] = ((uint32_t)src[0] << 8) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 24);
+        src += 3;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <openjpeg-2.3/openjpeg.h>
+
+// copies the R, G, B components of image into 16 bit G, B, R planes
+// (AV_PIX_FMT_GBRP10 order), values clamped and masked to the component precision
+extern void pack_image_gbrp16(opj_image_t *image, unsigned char **planes, const int *linesizes);
+
+// pack_image_gbrp16 of one of num_strips horizontal strips, strips of the
+// same image can be packed at the same time. shift drops low bits of
+// components deeper than the planes, 0 to keep them
+extern void pack_image_gbrp16_strip(opj_image_t *image, unsigned char **planes, const int *linesizes, int shift, int strip, int num_strips);
+
+// copies the Y, Cb, Cr components of image into 16 bit planes of the same
+// order and subsampling (AV_PIX_FMT_YUV422P10 / YUV444P10), values clamped
+// and masked to the component precision
+extern void pack_image_yuv16(opj_image_t *image, unsigned char **planes, const int *linesizes);
+
+// pack_image_yuv16 of one of num_strips horizontal strips, shift as for
+// pack_image_gbrp16_strip
+extern void pack_image_yuv16_strip(opj_image_t *image, unsigned char **planes, const int *linesizes, int shift, int strip, int num_strips);
+
+// widens num_samples 24 bit little endian samples to 32 bit (AV_SAMPLE_FMT_S32)
+extern void pack_pcm24le_to_s32(const unsigned char *src, unsigned char *dst, unsigned int num_samples);
+
+#endif
@@ -13,6 +13,10 @@ export LD_LIBRARY_PATH=${CUR_PATH}/third_party/openssl/lib
 #valgrind --tool=callgrind ${CUR_PATH}/imf_fs ${CPL} ${ASSETMAP} > /dev/null
 #exit 1
 
+# per frame timeline, open in chrome://tracing or ui.perfetto.dev
+#${CUR_PATH}/imf_fs -T /tmp/imf_fs_trace.json ${CPL} ${ASSETMAP} > /dev/null
+#exit 1
+
 # write to file test
 #${CUR_PATH}/imf_fs ${CPL} ${ASSETMAP} > ~/x.nut
 #ffmpeg -i ~/x.nut -f mp4 -y ~/winhome/Downloads/x.mp4
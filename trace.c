@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "trace.h"
+
+// queue depth counters every SAMPLE_MS
+#define SAMPLE_MS 10
+
+static const char *queue_names[METRICS_QUEUE_COUNT] = {
+    "decoding", "decrypt", "video_packets", "audio_packets"
+};
+
+volatile int trace_enabled = 0;
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t sampler_thread_id;
+static volatile int sampler_running = 0;
+
+static FILE *trace_file_s = NULL;
+static metrics_sample_queues_func sample_queues_s = NULL;
+static uint64_t start_ns_s = 0;
+static int next_tid_s = 1;
+static __thread int tid_s = 0;
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// chrome wants microseconds
+static double to_us(uint64_t ns) {
+    return (ns - start_ns_s) / 1000.0;
+}
+
+// needs trace_mutex
+static int current_tid() {
+    if (!tid_s) {
+        tid_s = next_tid_s++;
+    }
+    return tid_s;
+}
+
+uint64_t trace_now() {
+    if (!trace_enabled) {
+        return 0;
+    }
+    return monotonic_ns();
+}
+
+void trace_thread_name(const char *name) {
+    if (!trace_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&trace_mutex);
+    if (!trace_file_s) {
+        // trace_stop came first
+        pthread_mutex_unlock(&trace_mutex);
+        return;
+    }
+    fprintf(trace_file_s, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            current_tid(), name);
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+void trace_span(const char *name, unsigned int frame, uint64_t start_ns) {
+    if (!trace_enabled) {
+        return;
+    }
+    uint64_t end_ns = monotonic_ns();
+    pthread_mutex_lock(&trace_mutex);
+    if (!trace_file_s) {
+        pthread_mutex_unlock(&trace_mutex);
+        return;
+    }
+    fprintf(trace_file_s, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+            name, current_tid(), to_us(start_ns), (end_ns - start_ns) / 1000.0, frame);
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static void sample_queues() {
+    unsigned int depths[METRICS_QUEUE_COUNT];
+    memset(depths, 0, sizeof(depths));
+    sample_queues_s(depths);
+
+    uint64_t now = monotonic_ns();
+    pthread_mutex_lock(&trace_mutex);
+    for (int i = 0; i < METRICS_QUEUE_COUNT; ++i) {
+        fprintf(trace_file_s, ",\n{\"name\":\"queue %s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"depth\":%u}}",
+                queue_names[i], to_us(now), depths[i]);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static void *trace_sampler_thread(void *data) {
+    while (sampler_running) {
+        usleep(SAMPLE_MS * 1000);
+        sample_queues();
+    }
+    return NULL;
+}
+
+int trace_start(const char *path, metrics_sample_queues_func sample_queues) {
+    if (!path) {
+        return 0;
+    }
+
+    trace_file_s = fopen(path, "w");
+    if (!trace_file_s) {
+        fprintf(stderr, "error opening trace file %s\n", path);
+        return 1;
+    }
+    // every event gets written with a leading comma, so start with the process name
+    fprintf(trace_file_s, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"imf_fs\"}}");
+
+    sample_queues_s = sample_queues;
+    start_ns_s = monotonic_ns();
+    trace_enabled = 1;
+
+    if (sample_queues_s) {
+        sampler_running = 1;
+        if (pthread_create(&sampler_thread_id, NULL, trace_sampler_thread, NULL)) {
+            fprintf(stderr, "error starting trace sampler thread\n");
+            sampler_running = 0;
+        }
+    }
+    return 0;
+}
+
+void trace_stop() {
+    if (!trace_enabled) {
+        return;
+    }
+    if (sampler_running) {
+        sampler_running = 0;
+        pthread_join(sampler_thread_id, NULL);
+    }
+
+    pthread_mutex_lock(&trace_mutex);
+    trace_enabled = 0;
+    fprintf(trace_file_s, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(trace_file_s);
+    trace_file_s = NULL;
+    pthread_mutex_unlock(&trace_mutex);
+}
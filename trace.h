@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "metrics.h"
+
+// 0 unless trace_start was called. all functions below return
+// immediately if it is 0
+extern volatile int trace_enabled;
+
+// writes chrome trace event JSON (chrome://tracing, ui.perfetto.dev) to path.
+// sample_queues is polled for queue depth counters, may be NULL
+extern int trace_start(const char *path, metrics_sample_queues_func sample_queues);
+// terminates and closes the trace file
+extern void trace_stop();
+
+// names the calling thread in the trace
+extern void trace_thread_name(const char *name);
+// monotonic ns, 0 if disabled
+extern uint64_t trace_now();
+// span from start_ns until now on the calling thread. name must be a literal
+extern void trace_span(const char *name, unsigned int frame, uint64_t start_ns);
+
+#endif